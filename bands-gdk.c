@@ -0,0 +1,202 @@
+/*
+ * bands-gdk.c: gdk_pixbuf_scale_simple() on all cores.
+ *
+ * That scales on one core, so while the window is being resized the others
+ * sit idle. Here the destination is cut into a horizontal band per thread
+ * and gdk_pixbuf_scale() renders each band straight into its rows of the
+ * one destination pixbuf. Which source pixels go into a destination pixel
+ * only depends on where that pixel is, so the result is the same as doing
+ * it in one go.
+ *
+ * The threads are a GThreadPool that is made the first time and kept, so
+ * a resize storm doesn't make and join threads for every frame, and the
+ * calling thread does the last band itself rather than wait idle.
+ *
+ * In linear light, each band is scaled by scale.c instead, which can do it,
+ * on the same threads, unless the pixbuf has alpha, which mustn't be turned
+ * into linear light as well. The setting is ours, not scale.c's, so only
+ * what the viewers show is scaled that way, not thumbnails and the like.
+ *
+ * With black point, white point or gamma set (see levels.c), each band is
+ * scaled in strips of a few rows, each looked up in the tables as soon as
+ * it's made, while it's still in the cache, so it's not another pass over
+ * the window's pixels. scale.c does the same a row at a time.
+ */
+
+#include <unistd.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "levels.h"
+#include "bands-gdk.h"
+#include "scale.h"
+
+#define STRIP	16	/* Rows scaled at a time, then looked up */
+
+int bandThreads = 0;
+static gboolean linear = FALSE;
+static gboolean levelled = FALSE;	/* Are the tables anything but 1:1? */
+static unsigned char lut[4][256];	/* For R, G, B and A */
+
+/* Set on the pixbufs that bandsPixbufScale() makes, so that it only ever
+ * writes over one of its own, not something like a mapping from imgserver
+ * that happens to be the same size. */
+#define OURS	"bands-gdk"
+
+typedef struct {
+    GdkPixbuf *src, *dest;
+    double scaleX, scaleY;
+    GdkInterpType interp;
+    gboolean linear;		/* Scale it with scale.c in linear light */
+    int bands;			/* How many the destination is cut into */
+    int pending;		/* How many the pool has still to do */
+    GMutex lock;
+    GCond done;
+} job_t;
+
+typedef struct {
+    job_t *job;
+    int i;			/* Which band */
+} band_t;
+
+static GThreadPool *pool = NULL;
+
+static void
+scaleBand(job_t *job, int i)
+{
+    int width = gdk_pixbuf_get_width(job->dest);
+    int height = gdk_pixbuf_get_height(job->dest);
+    int y0 = (long) height * i / job->bands;
+    int y1 = (long) height * (i + 1) / job->bands;
+    int stride = gdk_pixbuf_get_rowstride(job->dest);
+    guchar *pixels = gdk_pixbuf_get_pixels(job->dest);
+    int y, n;
+
+    /* If scale.c runs out of memory, GDK does the band */
+    if (job->linear &&
+	scale_band(gdk_pixbuf_get_pixels(job->src),
+		   gdk_pixbuf_get_width(job->src),
+		   gdk_pixbuf_get_height(job->src),
+		   gdk_pixbuf_get_rowstride(job->src), pixels, width, height,
+		   stride, 3, levelled ? lut : NULL, y0, y1, TRUE) == 0)
+	return;
+    if (!levelled) {
+	gdk_pixbuf_scale(job->src, job->dest, 0, y0, width, y1 - y0,
+			 0.0, 0.0, job->scaleX, job->scaleY, job->interp);
+	return;
+    }
+    for (y = y0; y < y1; y += n) {
+	n = MIN(STRIP, y1 - y);
+	gdk_pixbuf_scale(job->src, job->dest, 0, y, width, n,
+			 0.0, 0.0, job->scaleX, job->scaleY, job->interp);
+	levels_map(pixels + (gsize) y * stride, stride,
+		   pixels + (gsize) y * stride, stride, width, n,
+		   gdk_pixbuf_get_n_channels(job->dest), lut);
+    }
+}
+
+/* In one of the pool's threads */
+static void
+runBand(gpointer data, gpointer unused)
+{
+    band_t *band = data;
+    job_t *job = band->job;
+
+    scaleBand(job, band->i);
+    g_mutex_lock(&job->lock);
+    if (--job->pending == 0) g_cond_signal(&job->done);
+    g_mutex_unlock(&job->lock);
+}
+
+void
+bandsSetLinear(gboolean on)
+{
+    linear = on;
+}
+
+void
+bandsSetLevels(const levels_t *levels)
+{
+    static const int order[4] = { 0, 1, 2, -1 };
+
+    levelled = levels != NULL && !levels_identity(levels);
+    if (levelled) levels_tables(levels, order, 4, lut);
+}
+
+gboolean
+bandsLevelled(void)
+{
+    return levelled;
+}
+
+GdkPixbuf *
+bandsPixbufScale(GdkPixbuf *src, GdkPixbuf *reuse, int width, int height,
+		 GdkInterpType interp)
+{
+    gboolean alpha = gdk_pixbuf_get_has_alpha(src);
+    int threads = bandThreads > 0 ? bandThreads
+				  : sysconf(_SC_NPROCESSORS_ONLN);
+    GdkPixbuf *dest;
+    band_t *bands;
+    job_t job;
+    int i;
+
+    if (reuse != NULL && reuse != src &&
+	g_object_get_data(G_OBJECT(reuse), OURS) != NULL &&
+	gdk_pixbuf_get_width(reuse) == width &&
+	gdk_pixbuf_get_height(reuse) == height &&
+	gdk_pixbuf_get_has_alpha(reuse) == alpha &&
+	gdk_pixbuf_get_n_channels(reuse) == gdk_pixbuf_get_n_channels(src) &&
+	gdk_pixbuf_get_bits_per_sample(reuse) == 8) {
+	dest = g_object_ref(reuse);
+    } else if ((dest = gdk_pixbuf_new(GDK_COLORSPACE_RGB, alpha, 8,
+				      width, height)) == NULL) {
+	return NULL;
+    } else {
+	g_object_set_data(G_OBJECT(dest), OURS, GINT_TO_POINTER(1));
+    }
+
+    job.src = src;
+    job.dest = dest;
+    job.scaleX = (double) width / gdk_pixbuf_get_width(src);
+    job.scaleY = (double) height / gdk_pixbuf_get_height(src);
+    job.interp = interp;
+    job.linear = linear && !alpha;
+    /* No band less than a row */
+    job.bands = MAX(1, MIN(threads, height));
+
+    if (job.bands == 1) {
+	scaleBand(&job, 0);
+	return dest;
+    }
+
+    if (pool == NULL) {
+	pool = g_thread_pool_new(runBand, NULL, job.bands - 1, TRUE, NULL);
+	if (pool == NULL) {
+	    job.bands = 1;
+	    scaleBand(&job, 0);
+	    return dest;
+	}
+    } else if (g_thread_pool_get_max_threads(pool) < job.bands - 1) {
+	g_thread_pool_set_max_threads(pool, job.bands - 1, NULL);
+    }
+
+    g_mutex_init(&job.lock);
+    g_cond_init(&job.done);
+    job.pending = job.bands - 1;
+    bands = g_new(band_t, job.bands - 1);
+    for (i = 0; i < job.bands - 1; i++) {
+	bands[i].job = &job;
+	bands[i].i = i;
+	g_thread_pool_push(pool, &bands[i], NULL);
+    }
+    scaleBand(&job, job.bands - 1);
+
+    g_mutex_lock(&job.lock);
+    while (job.pending > 0) g_cond_wait(&job.done, &job.lock);
+    g_mutex_unlock(&job.lock);
+
+    g_mutex_clear(&job.lock);
+    g_cond_clear(&job.done);
+    g_free(bands);
+    return dest;
+}
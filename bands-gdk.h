@@ -0,0 +1,33 @@
+/*
+ * bands-gdk.h: Interface to bands-gdk.c, which scales the GTK viewers'
+ * pixbufs on all cores.
+ */
+
+/* How many threads to scale with. 0, the default, means one per core. */
+extern int bandThreads;
+
+/* Scale in linear light from now on, if on is set (see scale.c). It only
+ * changes what bandsPixbufScale() does, not scale.c's other callers.
+ * Call it between scalings, not during one. */
+extern void bandsSetLinear(gboolean on);
+
+/* Look the results up in the tables for these black points, white points and
+ * gammas (see levels.h) from now on, or not if NULL or they do nothing.
+ * Call it between scalings, not during one. */
+extern void bandsSetLevels(const levels_t *levels);
+
+/* Whether it's doing that, so the result of scaling to the same size isn't
+ * the source */
+extern gboolean bandsLevelled(void);
+
+/* Like gdk_pixbuf_scale_simple() but with the destination cut into bands
+ * that are scaled at the same time on a pool of threads. The result is the
+ * same as gdk_pixbuf_scale_simple()'s, apart from the levels, except that
+ * in linear light, pixbufs without alpha are scaled by scale.c instead,
+ * in the same bands on the same threads.
+ * If reuse is a pixbuf that an earlier call made, of the right size and
+ * format and other than src, the result is put in that and a new reference
+ * to it is returned, otherwise a new pixbuf is made. Returns NULL if there isn't the memory. */
+extern GdkPixbuf *bandsPixbufScale(GdkPixbuf *src, GdkPixbuf *reuse,
+				   int width, int height,
+				   GdkInterpType interp);
@@ -0,0 +1,148 @@
+/*
+ * bench-bands.c: Time scaling a photo to the sizes of a window being
+ * resized, with gdk_pixbuf_scale_simple() and with bands-gdk.c on 1, 2, 4
+ * and 8 threads, and check that they all give the same pixels.
+ *
+ * Usage: bench-bands [-f frames] [-t maxthreads] [-g widthxheight]
+ *
+ * The source is a noisy -g image (default 4000x3000) and the window goes
+ * from 800x600 to 1920x1080 in -f steps (default 40). For each way of
+ * scaling it prints a tab-separated line with
+ *	threads	0 for gdk_pixbuf_scale_simple(), otherwise how many bands
+ *	frames	how many sizes it was scaled to
+ *	ms	how long they took
+ *	mpix_s	megapixels of output per second
+ *	speedup	how many times faster than gdk_pixbuf_scale_simple()
+ *	same	1 if every frame was the same as gdk_pixbuf_scale_simple()'s
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "levels.h"
+#include "bands-gdk.h"
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static GdkPixbuf *
+makeSource(int w, int h)
+{
+    GdkPixbuf *pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, w, h);
+    int stride = gdk_pixbuf_get_rowstride(pixbuf);
+    guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+    unsigned seed = 1;
+    int x, y;
+
+    for (y = 0; y < h; y++) {
+	guchar *p = pixels + (gsize) y * stride;
+
+	for (x = 0; x < w; x++, p += 3) {
+	    int noise;
+
+	    seed = seed * 1103515245 + 12345;
+	    noise = (seed >> 16) % 64 - 32;
+	    p[0] = (x * 191 / w + noise + 32) & 0xFF;
+	    p[1] = (y * 191 / h + noise + 32) & 0xFF;
+	    p[2] = (128 + noise) & 0xFF;
+	}
+    }
+    return pixbuf;
+}
+
+static gboolean
+samePixels(GdkPixbuf *a, GdkPixbuf *b)
+{
+    int w = gdk_pixbuf_get_width(a), h = gdk_pixbuf_get_height(a);
+    int rowBytes = w * gdk_pixbuf_get_n_channels(a);
+    int y;
+
+    if (w != gdk_pixbuf_get_width(b) || h != gdk_pixbuf_get_height(b))
+	return FALSE;
+    for (y = 0; y < h; y++)
+	if (memcmp(gdk_pixbuf_get_pixels(a) +
+			(gsize) y * gdk_pixbuf_get_rowstride(a),
+		   gdk_pixbuf_get_pixels(b) +
+			(gsize) y * gdk_pixbuf_get_rowstride(b), rowBytes) != 0)
+	    return FALSE;
+    return TRUE;
+}
+
+static void
+usage(void)
+{
+    fputs("Usage: bench-bands [-f frames] [-t maxthreads] [-g widthxheight]\n",
+	  stderr);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt, frames = 40, maxThreads = 8, sw = 4000, sh = 3000;
+    int threads, f;
+    GdkPixbuf *src;
+    double baseMs = 0;
+
+    while ((opt = getopt(argc, argv, "f:t:g:")) != -1) {
+	switch (opt) {
+	case 'f': frames = atoi(optarg); break;
+	case 't': maxThreads = atoi(optarg); break;
+	case 'g':
+	    if (sscanf(optarg, "%dx%d", &sw, &sh) == 2) break;
+	    /* Fall through */
+	default: usage();
+	}
+    }
+    if (optind != argc || frames < 1 || maxThreads < 1 || sw < 1 || sh < 1)
+	usage();
+
+    src = makeSource(sw, sh);
+    printf("threads\tframes\tms\tmpix_s\tspeedup\tsame\n");
+
+    /* 0 is gdk_pixbuf_scale_simple() itself */
+    for (threads = 0; threads <= maxThreads;
+	 threads = threads == 0 ? 1 : threads * 2) {
+	double ms = 0;
+	long pixels = 0;
+	gboolean same = TRUE;
+
+	bandThreads = threads;
+	for (f = 0; f < frames; f++) {
+	    int w = 800 + (1920 - 800) * f / frames;
+	    int h = 600 + (1080 - 600) * f / frames;
+	    GdkPixbuf *ref = NULL, *scaled;
+	    double start;
+
+	    if (threads > 0)
+		ref = gdk_pixbuf_scale_simple(src, w, h, GDK_INTERP_BILINEAR);
+	    start = now();
+	    scaled = threads == 0
+		   ? gdk_pixbuf_scale_simple(src, w, h, GDK_INTERP_BILINEAR)
+		   : bandsPixbufScale(src, NULL, w, h, GDK_INTERP_BILINEAR);
+	    ms += now() - start;
+	    pixels += (long) w * h;
+	    if (ref != NULL) {
+		if (!samePixels(ref, scaled)) same = FALSE;
+		g_object_unref(ref);
+	    }
+	    g_object_unref(scaled);
+	}
+	if (threads == 0) baseMs = ms;
+	printf("%d\t%d\t%.0f\t%.1f\t%.2f\t%d\n", threads, frames, ms,
+	       pixels / ms / 1000.0, baseMs / ms, same);
+    }
+
+    g_object_unref(src);
+    exit(0);
+}
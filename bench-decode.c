@@ -0,0 +1,186 @@
+/*
+ * bench-decode.c: Measure how much faster loadjpeg.c decodes a JPEG with
+ * restart markers on more cores.
+ *
+ * Usage: bench-decode -g widthxheight file.jpg
+ *	  bench-decode [-t threads] file.jpg
+ *
+ * The first form makes a test image with a restart marker at the end of
+ * every row of MCUs, as our scanners do. It's a gradient with noise added
+ * so that there is a realistic amount of entropy-coded data to decode.
+ *
+ * The second form decodes the file at full size with 1, 2, 4... threads up
+ * to the number of cores, or -t, taking the best of three runs each, and
+ * prints a tab-separated line for each with
+ *	threads	how many
+ *	ms	how long the decode took
+ *	speedup	how many times faster than with one thread
+ *	maxdiff	the most any byte differs from decoding it on one thread,
+ *		which should be 0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <jpeglib.h>
+
+#include "loadjpeg.h"
+
+#define RUNS	3	/* Take the best of this many */
+
+/* Write a noisy gradient JPEG of w x h pixels with restart markers */
+static void
+makeImage(int w, int h, char *filename)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    JSAMPROW row;
+    FILE *fp;
+    unsigned seed = 1;
+    int x;
+
+    if ((fp = fopen(filename, "wb")) == NULL) {
+	perror(filename);
+	exit(1);
+    }
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, fp);
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    cinfo.restart_in_rows = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+
+    row = malloc(w * 3);
+    while (cinfo.next_scanline < cinfo.image_height) {
+	int y = cinfo.next_scanline;
+
+	for (x = 0; x < w; x++) {
+	    int noise;
+
+	    seed = seed * 1103515245 + 12345;
+	    noise = (seed >> 16) % 64 - 32;
+	    row[x * 3] = (x * 191 / w + noise + 32) & 0xFF;
+	    row[x * 3 + 1] = (y * 191 / h + noise + 32) & 0xFF;
+	    row[x * 3 + 2] = (128 + noise) & 0xFF;
+	}
+	jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    fclose(fp);
+    free(row);
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* How long it takes to decode the file with "threads" threads, in ms.
+ * Sets *result to the pixels and *size to how many bytes they are. */
+static double
+decodeTime(char *filename, int threads, unsigned char **result, size_t *size)
+{
+    double best = -1;
+    int run;
+
+    *result = NULL;
+
+    loadjpeg_threads = threads;
+    for (run = 0; run < RUNS; run++) {
+	double start = now(), t;
+	unsigned char *pixels;
+	int w, h, denom;
+
+	/* Ask for something huge to get it at full size */
+	if ((pixels = loadjpeg(filename, 1 << 30, 1 << 30, &w, &h, &denom))
+	    == NULL) {
+	    fprintf(stderr, "Cannot decode %s\n", filename);
+	    exit(1);
+	}
+	t = now() - start;
+	free(*result);
+	*result = pixels;
+	*size = (size_t) w * h * 3;
+	if (best < 0 || t < best) best = t;
+    }
+
+    return best;
+}
+
+/* The most any byte of "a" differs from the same one of "b" */
+static int
+maxDiff(const unsigned char *a, const unsigned char *b, size_t size)
+{
+    int most = 0;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+	int d = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+
+	if (d > most) most = d;
+    }
+    return most;
+}
+
+int
+main(int argc, char **argv)
+{
+    int cores = 0, threads;
+    double one;
+    unsigned char *ref, *pixels;
+    size_t refSize, size;
+
+    if (argc == 4 && strcmp(argv[1], "-g") == 0) {
+	int w, h;
+
+	if (sscanf(argv[2], "%dx%d", &w, &h) != 2 || w < 1 || h < 1) {
+	    fprintf(stderr, "Bad size \"%s\"\n", argv[2]);
+	    exit(1);
+	}
+	makeImage(w, h, argv[3]);
+	exit(0);
+    }
+    if (argc == 4 && strcmp(argv[1], "-t") == 0) {
+	cores = atoi(argv[2]);
+	argc -= 2;
+	argv += 2;
+    }
+    if (argc != 2) {
+	fputs("Usage: bench-decode -g widthxheight file.jpg\n", stderr);
+	fputs("       bench-decode [-t threads] file.jpg\n", stderr);
+	exit(1);
+    }
+
+    if (cores < 1) cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+
+    one = decodeTime(argv[1], 1, &ref, &refSize);
+    printf("1\t%.1f\t1.00\t0\n", one);
+    for (threads = 2; ; threads *= 2) {
+	double t;
+
+	if (threads > cores) threads = cores;
+	if (threads == 1) break;
+	t = decodeTime(argv[1], threads, &pixels, &size);
+	printf("%d\t%.1f\t%.2f\t%d\n", threads, t, one / t,
+	       size == refSize ? maxDiff(ref, pixels, size) : 256);
+	free(pixels);
+	fflush(stdout);
+	if (threads == cores) break;
+    }
+
+    exit(0);
+}
@@ -0,0 +1,247 @@
+/*
+ * bench-firstpixel.c: Measure how long a viewer takes from exec to showing
+ * the image.
+ *
+ * Usage: bench-firstpixel -g widthxheight file.jpg
+ *	  bench-firstpixel program file.jpg
+ *
+ * The first form makes a test image: a smooth gradient with red going from
+ * 0 to 255 left to right, green from 0 to 255 top to bottom and blue 128,
+ * so that we know what color any part of it should be at any scale.
+ *
+ * The second form runs the program on one of those images with IMAGE_STAMPS
+ * set in its environment, finds its window and reads a few pixels from it
+ * with XGetImage until they are all the right color. It then prints
+ * a tab-separated line with the times in milliseconds from the exec to
+ *	total	the window showing the right pixels
+ *	init	the toolkit having been initialised
+ *	decode	the image having been read from the file
+ *	scale	the first scaling of the image
+ *	present	the first frame having been drawn or presented
+ * The last four come from the program's stamp() calls (see stamp.h) and are
+ * "-" if it doesn't do that step or we can't see when it does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <jpeglib.h>
+
+#include "benchx.h"
+
+#define FIND_TIMEOUT	60000	/* Huge images take a while to decode */
+#define PIXEL_TIMEOUT	120000	/* How long to wait for the right pixels */
+#define TOLERANCE	32	/* How far off each channel may be. Menu bars
+				 * above the image offset green a bit. */
+
+static char *stamps[] = { "init", "decode", "scale", "present" };
+#define NSTAMPS (int)(sizeof(stamps) / sizeof(stamps[0]))
+
+/* Write a gradient JPEG of w x h pixels */
+static void
+makeImage(int w, int h, char *filename)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    JSAMPROW row;
+    FILE *fp;
+    int x;
+
+    if ((fp = fopen(filename, "wb")) == NULL) {
+	perror(filename);
+	exit(1);
+    }
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, fp);
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    row = malloc(w * 3);
+    for (x = 0; x < w; x++) {
+	row[x * 3] = (w > 1) ? x * 255 / (w - 1) : 0;
+	row[x * 3 + 2] = 128;
+    }
+    while (cinfo.next_scanline < cinfo.image_height) {
+	int y = cinfo.next_scanline;
+
+	for (x = 0; x < w; x++)
+	    row[x * 3 + 1] = (h > 1) ? y * 255 / (h - 1) : 0;
+	jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    fclose(fp);
+    free(row);
+}
+
+/* Is this channel of a pixel within TOLERANCE of what it should be? */
+static int
+nearly(unsigned long pixel, unsigned long mask, int expected)
+{
+    int shift = 0, value;
+
+    if (mask == 0) return 0;
+    while (!(mask & 1)) { mask >>= 1; shift++; }
+    value = ((pixel >> shift) & mask) * 255 / mask;
+
+    return abs(value - expected) <= TOLERANCE;
+}
+
+/* Is the window showing the gradient yet?
+ * We look at five points, skipping any that are off the screen because
+ * XGetImage fails on those. */
+static int
+showingImage(Display *dpy, Window window)
+{
+    static double points[][2] = {
+	{ 0.5, 0.5 }, { 0.25, 0.25 }, { 0.75, 0.25 }, { 0.25, 0.75 }, { 0.75, 0.75 }
+    };
+    XWindowAttributes attr;
+    int sw = DisplayWidth(dpy, DefaultScreen(dpy));
+    int sh = DisplayHeight(dpy, DefaultScreen(dpy));
+    int i, seen = 0;
+
+    if (!XGetWindowAttributes(dpy, window, &attr) ||
+	attr.map_state != IsViewable)
+	return 0;
+
+    for (i = 0; i < 5; i++) {
+	int x = points[i][0] * attr.width;
+	int y = points[i][1] * attr.height;
+	XImage *image;
+	unsigned long pixel;
+	int ok;
+
+	if (attr.x + x >= sw || attr.y + y >= sh) continue;
+	image = XGetImage(dpy, window, x, y, 1, 1, AllPlanes, ZPixmap);
+	if (image == NULL) return 0;
+	pixel = XGetPixel(image, 0, 0);
+	ok = nearly(pixel, image->red_mask, 255 * points[i][0]) &&
+	     nearly(pixel, image->green_mask, 255 * points[i][1]) &&
+	     nearly(pixel, image->blue_mask, 128);
+	XDestroyImage(image);
+	if (!ok) return 0;
+	seen++;
+    }
+
+    return seen > 0;
+}
+
+/* Never mind X errors from windows being resized under our feet */
+static int
+ignoreErrors(Display *dpy, XErrorEvent *ev)
+{
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    Display *dpy;
+    Window window;
+    char *program, *name;
+    char logname[] = "/tmp/firstpixelXXXXXX";
+    int log;
+    struct timeval tv;
+    double start, total = -1;	/* in ms since the epoch */
+    double when[NSTAMPS];
+    char line[256];
+    FILE *fp;
+    pid_t pid;
+    int i;
+
+    if (argc == 4 && strcmp(argv[1], "-g") == 0) {
+	int w, h;
+
+	if (sscanf(argv[2], "%dx%d", &w, &h) != 2 || w < 1 || h < 1) {
+	    fprintf(stderr, "Bad size \"%s\"\n", argv[2]);
+	    exit(1);
+	}
+	makeImage(w, h, argv[3]);
+	exit(0);
+    }
+    if (argc != 3) {
+	fputs("Usage: bench-firstpixel -g widthxheight file.jpg\n", stderr);
+	fputs("       bench-firstpixel program file.jpg\n", stderr);
+	exit(1);
+    }
+    program = argv[1];
+    name = (name = strrchr(program, '/')) ? name + 1 : program;
+
+    if ((dpy = XOpenDisplay(NULL)) == NULL) {
+	fputs("Cannot open display\n", stderr);
+	exit(1);
+    }
+    XSetErrorHandler(ignoreErrors);
+
+    /* Its stamps go to a temporary file that we read afterwards */
+    if ((log = mkstemp(logname)) < 0) {
+	perror(logname);
+	exit(1);
+    }
+    unlink(logname);
+
+    gettimeofday(&tv, NULL);
+    start = tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+    switch (pid = fork()) {
+    case -1:
+	perror("fork");
+	exit(1);
+    case 0:
+	setenv("IMAGE_STAMPS", "1", 1);
+	dup2(log, 2);
+	execl(program, program, argv[2], (char *)NULL);
+	perror(program);
+	_exit(1);
+    }
+
+    if ((window = findWindow(dpy, pid, name, FIND_TIMEOUT)) != None) {
+	long give_up = now() + PIXEL_TIMEOUT;
+
+	while (!showingImage(dpy, window) && now() < give_up &&
+	       kill(pid, 0) == 0)
+	    usleep(1000);
+	if (now() < give_up && kill(pid, 0) == 0) {
+	    gettimeofday(&tv, NULL);
+	    total = tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0 - start;
+	}
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    for (i = 0; i < NSTAMPS; i++) when[i] = -1;
+    lseek(log, 0, SEEK_SET);
+    if ((fp = fdopen(log, "r")) != NULL) {
+	while (fgets(line, sizeof(line), fp)) {
+	    char what[32];
+	    double usecs;
+
+	    if (sscanf(line, "stamp %31s %lf", what, &usecs) != 2) continue;
+	    for (i = 0; i < NSTAMPS; i++)
+		if (strcmp(what, stamps[i]) == 0)
+		    when[i] = usecs / 1000.0 - start;
+	}
+	fclose(fp);
+    }
+
+    if (total < 0) printf("-"); else printf("%.1f", total);
+    for (i = 0; i < NSTAMPS; i++)
+	if (when[i] < 0) printf("\t-"); else printf("\t%.1f", when[i]);
+    putchar('\n');
+
+    exit(total < 0);
+}
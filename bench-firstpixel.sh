@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# bench-firstpixel.sh: Time-to-first-pixel benchmark for the viewers.
+#
+# Usage: bench-firstpixel.sh program...
+#
+# Makes small, medium and huge test images in bench-corpus/ if they aren't
+# there already, starts a headless X server and runs each program on each
+# image with bench-firstpixel, printing a tab-separated table on stdout.
+# See bench-firstpixel.c for what the columns mean.
+# Each one is run with an empty pixel cache ("cold") and again with the
+# cache that that run left behind ("warm").
+#
+# Set BENCH_DISPLAY to use a display other than :99.
+
+display=${BENCH_DISPLAY:-:99}
+corpus=bench-corpus
+sizes="320x240 3000x2000 8000x6000"
+
+mkdir -p $corpus
+for size in $sizes
+do
+    [ -f $corpus/$size.jpg ] || ./bench-firstpixel -g $size $corpus/$size.jpg ||
+	exit 1
+done
+
+cache=`mktemp -d` || exit 1
+Xvfb $display -screen 0 5120x2880x24 -nolisten tcp 2>/dev/null &
+xvfb=$!
+trap 'kill $xvfb 2>/dev/null; rm -rf $cache' 0
+DISPLAY=$display; export DISPLAY
+
+# Wait for the server to come up
+tries=50
+until xdpyinfo >/dev/null 2>&1; do
+    tries=`expr $tries - 1`
+    if [ $tries = 0 ]; then
+	echo "Xvfb didn't start on $display" 1>&2
+	exit 1
+    fi
+    sleep 0.1
+done
+
+printf 'program\timage\tcache\ttotal_ms\tinit_ms\tdecode_ms\tscale_ms\tpresent_ms\n'
+for size in $sizes
+do
+    for program
+    do
+	rm -rf $cache/*
+	for run in cold warm
+	do
+	    row=`XDG_CACHE_HOME=$cache ./bench-firstpixel ./$program \
+		 $corpus/$size.jpg`
+	    printf '%s\t%s\t%s\t%s\n' `basename $program` $size $run "$row"
+	done
+    done
+done
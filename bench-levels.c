@@ -0,0 +1,233 @@
+/*
+ * bench-levels.c: Measure what the levels' lookup tables (see levels.c)
+ * cost, on their own and fused into scaling, and counting the histogram,
+ * and check that they come out the same as doing it a byte at a time.
+ *
+ * Usage: bench-levels [-g widthxheight] [-s widthxheight] [-t threads]
+ *
+ * It makes a random image of -g pixels (default 3840x2160, a 4K screen)
+ * and prints a tab-separated line for each test with
+ *	test	map: levels_map() on its own
+ *		scale: scale_pixels() to -s (default 2560x1440)
+ *		fused: scale_levels() to the same size
+ *		separate: scale_pixels() then levels_map() on the result
+ *		histogram: levels_histogram()
+ *	bpp	bytes per pixel
+ *	threads	how many threads it was allowed, 1 to -t (default one
+ *		per core) in powers of two
+ *	ms	how long it took, the best of three
+ *	Mpix/s	megapixels a second, of the source
+ *	base_ms	how long the same done the simple way took: a byte at a time
+ *		for map and histogram, scale_pixels() for fused and separate
+ *	ratio	ms over base_ms
+ *	same	whether they made the same result
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "levels.h"
+#include "scale.h"
+
+#define RUNS	3	/* Take the best of this many */
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void *
+xmalloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (p == NULL) {
+	fputs("Out of memory\n", stderr);
+	exit(1);
+    }
+    return p;
+}
+
+static void
+usage(void)
+{
+    fputs("Usage: bench-levels [-g widthxheight] [-s widthxheight] "
+	  "[-t threads]\n", stderr);
+    exit(1);
+}
+
+static void
+size(const char *arg, int *w, int *h)
+{
+    if (sscanf(arg, "%dx%d", w, h) == 2 && *w > 0 && *h > 0) return;
+    fprintf(stderr, "Bad size \"%s\"\n", arg);
+    exit(1);
+}
+
+static void
+report(const char *test, int bpp, int threads, double ms, double pixels,
+       double baseMs, int same)
+{
+    printf("%s\t%d\t%d\t%.1f\t%.0f\t%.1f\t%.2f\t%s\n", test, bpp, threads,
+	   ms, pixels / ms / 1000, baseMs, ms / baseMs, same ? "yes" : "no");
+}
+
+/* The tables a byte at a time */
+static void
+naiveMap(const unsigned char *src, unsigned char *dst, size_t pixels, int bpp,
+	 unsigned char lut[][256])
+{
+    size_t i;
+    int b;
+
+    for (i = 0; i < pixels; i++)
+	for (b = 0; b < bpp; b++)
+	    dst[i * bpp + b] = lut[b][src[i * bpp + b]];
+}
+
+static void
+naiveHistogram(const unsigned char *src, size_t pixels, int bpp,
+	       unsigned long hist[][256])
+{
+    size_t i;
+    int b;
+
+    memset(hist, 0, sizeof(hist[0]) * bpp);
+    for (i = 0; i < pixels; i++)
+	for (b = 0; b < bpp; b++)
+	    hist[b][src[i * bpp + b]]++;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int order[4] = { 0, 1, 2, -1 };
+    int opt, w = 3840, h = 2160, dw = 2560, dh = 1440, maxThreads = 0;
+    int bpp, threads, run;
+    size_t bytes, dbytes, i;
+    unsigned char *src, *dst, *ref;
+    unsigned char lut[4][256];
+    unsigned long hist[4][256], refHist[4][256];
+    levels_t levels;
+    unsigned seed = 1;
+    double start, t, ms, baseMs, scaleMs;
+
+    while ((opt = getopt(argc, argv, "g:s:t:")) != -1) {
+	switch (opt) {
+	case 'g':
+	    size(optarg, &w, &h);
+	    break;
+	case 's':
+	    size(optarg, &dw, &dh);
+	    break;
+	case 't':
+	    maxThreads = atoi(optarg);
+	    if (maxThreads >= 1) break;
+	    /* Fall through */
+	default:
+	    usage();
+	}
+    }
+    if (maxThreads == 0) maxThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* Something like what someone would set: lift the shadows, clip the
+     * highlights and brighten the middle, more in blue. */
+    levels_reset(&levels);
+    for (i = 0; i < 3; i++) {
+	levels.black[i] = 16;
+	levels.white[i] = 235;
+	levels.gamma[i] = i == 2 ? 1.4 : 1.2;
+    }
+
+    bytes = (size_t) w * h * 4;
+    dbytes = (size_t) dw * dh * 4;
+    src = xmalloc(bytes);
+    dst = xmalloc(bytes > dbytes ? bytes : dbytes);
+    ref = xmalloc(bytes > dbytes ? bytes : dbytes);
+    for (i = 0; i < bytes; i++) {
+	seed = seed * 1103515245 + 12345;
+	src[i] = seed >> 16;
+    }
+
+    printf("test\tbpp\tthreads\tms\tMpix/s\tbase_ms\tratio\tsame\n");
+    for (bpp = 4; bpp >= 3; bpp--) {
+	levels_tables(&levels, order, bpp, lut);
+
+	start = now();
+	naiveMap(src, ref, (size_t) w * h, bpp, lut);
+	baseMs = now() - start;
+	for (threads = 1; ; threads *= 2) {
+	    if (threads > maxThreads) threads = maxThreads;
+	    levels_threads = threads;
+	    ms = -1;
+	    for (run = 0; run < RUNS; run++) {
+		start = now();
+		levels_map(src, w * bpp, dst, w * bpp, w, h, bpp, lut);
+		t = now() - start;
+		if (ms < 0 || t < ms) ms = t;
+	    }
+	    report("map", bpp, threads, ms, (double) w * h, baseMs,
+		   memcmp(dst, ref, (size_t) w * h * bpp) == 0);
+	    if (threads == maxThreads) break;
+	}
+
+	/* Scaling is on one core, so the separate pass is too */
+	levels_threads = 1;
+	scaleMs = -1;
+	for (run = 0; run < RUNS; run++) {
+	    start = now();
+	    scale_pixels(src, w, h, w * bpp, ref, dw, dh, dw * bpp, bpp);
+	    t = now() - start;
+	    if (scaleMs < 0 || t < scaleMs) scaleMs = t;
+	}
+	report("scale", bpp, 1, scaleMs, (double) w * h, scaleMs, 1);
+	levels_map(ref, dw * bpp, ref, dw * bpp, dw, dh, bpp, lut);
+
+	ms = -1;
+	for (run = 0; run < RUNS; run++) {
+	    start = now();
+	    scale_levels(src, w, h, w * bpp, dst, dw, dh, dw * bpp, bpp, lut);
+	    t = now() - start;
+	    if (ms < 0 || t < ms) ms = t;
+	}
+	report("fused", bpp, 1, ms, (double) w * h, scaleMs,
+	       memcmp(dst, ref, (size_t) dw * dh * bpp) == 0);
+
+	ms = -1;
+	for (run = 0; run < RUNS; run++) {
+	    start = now();
+	    scale_pixels(src, w, h, w * bpp, dst, dw, dh, dw * bpp, bpp);
+	    levels_map(dst, dw * bpp, dst, dw * bpp, dw, dh, bpp, lut);
+	    t = now() - start;
+	    if (ms < 0 || t < ms) ms = t;
+	}
+	report("separate", bpp, 1, ms, (double) w * h, scaleMs,
+	       memcmp(dst, ref, (size_t) dw * dh * bpp) == 0);
+
+	start = now();
+	naiveHistogram(src, (size_t) w * h, bpp, refHist);
+	baseMs = now() - start;
+	for (threads = 1; ; threads *= 2) {
+	    if (threads > maxThreads) threads = maxThreads;
+	    levels_threads = threads;
+	    ms = -1;
+	    for (run = 0; run < RUNS; run++) {
+		start = now();
+		levels_histogram(src, w, h, w * bpp, bpp, hist);
+		t = now() - start;
+		if (ms < 0 || t < ms) ms = t;
+	    }
+	    report("histogram", bpp, threads, ms, (double) w * h, baseMs,
+		   memcmp(hist, refHist, sizeof(hist[0]) * bpp) == 0);
+	    if (threads == maxThreads) break;
+	}
+    }
+    exit(0);
+}
@@ -0,0 +1,237 @@
+/*
+ * bench-linear.c: Measure what scaling in linear light costs over scaling
+ * the sRGB values themselves (see scale.c), and show what it's for.
+ *
+ * Usage: bench-linear [-s widthxheight] [-d widthxheight] [-t threads]
+ *	  bench-linear -p pattern.ppm
+ *
+ * The first form scales a source image of -s pixels (default 8000x6000) to
+ * -d pixels (default 1920x1080) with 4 and 3 bytes per pixel, each both
+ * ways. Like the GTK viewers (see bands-gdk.c), it cuts the destination into
+ * a band per thread, -t of them (default one per core), and scales them at
+ * once with scale_band(). It prints a tab-separated line for each with
+ *	format	rgb or rgb24, as in bench-scale
+ *	light	gamma, for the sRGB values, or linear
+ *	threads	how many bands it was scaled in at once
+ *	ms	how long one scale took, the best of three
+ *	Mpix/s	source megapixels scaled per second
+ *	cost	how many times longer it took than gamma
+ *	lines	what black and white lines a pixel apart shrink to, which
+ *		should be 188, the gray with the same light as half white
+ *
+ * The second form writes a test pattern to show in the viewers: black and
+ * white lines and checks one pixel apart, beside squares of gray 188 and
+ * 128, and a fine black and white zone plate. Shrunk in linear light, the
+ * lines match the 188 square and the zone plate stays an even gray; in
+ * sRGB values they match the 128 one and the zone plate's middle darkens.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "scale.h"
+
+#define RUNS	3	/* Take the best of this many */
+
+/* What to scale, and which band of it */
+typedef struct {
+    const unsigned char *src;
+    int sw, sh;
+    unsigned char *dst;
+    int dw, dh, bpp, linear;
+    int y0, y1;
+    int result;
+} band_t;
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* What lines of 0 and 255 a pixel apart come out as when shrunk */
+static int
+lines(int linear)
+{
+    unsigned char src[64 * 64], dst[16 * 16];
+    int x, y;
+
+    for (y = 0; y < 64; y++)
+	for (x = 0; x < 64; x++)
+	    src[y * 64 + x] = (y & 1) ? 255 : 0;
+    if (scale_band(src, 64, 64, 64, dst, 16, 16, 16, 1, NULL, 0, 16,
+		   linear) < 0)
+	return -1;
+    return dst[8 * 16 + 8];
+}
+
+static void *
+scaleBand(void *arg)
+{
+    band_t *b = arg;
+
+    b->result = scale_band(b->src, b->sw, b->sh, b->sw * b->bpp, b->dst,
+			   b->dw, b->dh, b->dw * b->bpp, b->bpp, NULL,
+			   b->y0, b->y1, b->linear);
+    return NULL;
+}
+
+/* Time scaling an image of bpp bytes per pixel in "threads" bands at once,
+ * the best of RUNS */
+static double
+bench(const unsigned char *src, int sw, int sh, unsigned char *dst,
+      int dw, int dh, int bpp, int linear, int threads)
+{
+    band_t bands[threads];
+    pthread_t tids[threads];
+    double best = 0;
+    int i, b;
+
+    for (b = 0; b < threads; b++) {
+	bands[b].src = src;
+	bands[b].sw = sw;
+	bands[b].sh = sh;
+	bands[b].dst = dst;
+	bands[b].dw = dw;
+	bands[b].dh = dh;
+	bands[b].bpp = bpp;
+	bands[b].linear = linear;
+	bands[b].y0 = (long) dh * b / threads;
+	bands[b].y1 = (long) dh * (b + 1) / threads;
+    }
+    for (i = 0; i < RUNS; i++) {
+	double start = now(), t;
+
+	/* The calling thread does the last band, as bands-gdk.c does */
+	for (b = 0; b < threads - 1; b++)
+	    if (pthread_create(&tids[b], NULL, scaleBand, &bands[b]) != 0) {
+		fputs("Can't start a thread\n", stderr);
+		exit(1);
+	    }
+	scaleBand(&bands[threads - 1]);
+	for (b = 0; b < threads - 1; b++)
+	    pthread_join(tids[b], NULL);
+	t = now() - start;
+	for (b = 0; b < threads; b++)
+	    if (bands[b].result < 0) {
+		fputs("Scaling failed\n", stderr);
+		exit(1);
+	    }
+	if (i == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+/* Write the test pattern, 1024x768, as a binary PPM */
+static void
+pattern(const char *filename)
+{
+    FILE *fp;
+    int x, y;
+
+    if ((fp = fopen(filename, "wb")) == NULL) {
+	perror(filename);
+	exit(1);
+    }
+    fprintf(fp, "P6\n1024 768\n255\n");
+    for (y = 0; y < 768; y++) {
+	for (x = 0; x < 1024; x++) {
+	    int v;
+
+	    if (x < 512 && y < 384) {
+		/* Lines, top left */
+		v = (y & 1) ? 255 : 0;
+	    } else if (x < 512) {
+		/* Checks, bottom left */
+		v = ((x ^ y) & 1) ? 255 : 0;
+	    } else if (y < 384) {
+		/* Squares of the gray the lines should become and of the
+		 * one that averaging the sRGB values makes them */
+		v = x < 768 ? 188 : 128;
+	    } else {
+		/* A zone plate: rings getting finer towards the edge */
+		long dx = x - 768, dy = y - 576;
+
+		v = (((dx * dx + dy * dy) / 96) & 1) ? 255 : 0;
+	    }
+	    putc(v, fp); putc(v, fp); putc(v, fp);
+	}
+    }
+    if (fclose(fp) != 0) {
+	perror(filename);
+	exit(1);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    int sw = 8000, sh = 6000, dw = 1920, dh = 1080, threads = 0;
+    int opt, bpp;
+    size_t i;
+    unsigned char *src, *dst;
+
+    while ((opt = getopt(argc, argv, "s:d:p:t:")) != -1) {
+	switch (opt) {
+	case 'p':
+	    pattern(optarg);
+	    exit(0);
+	case 't':
+	    if ((threads = atoi(optarg)) >= 1) break;
+	    goto usage;
+	case 's':
+	    if (sscanf(optarg, "%dx%d", &sw, &sh) == 2 && sw > 0 && sh > 0)
+		break;
+	    /* Fall through */
+	case 'd':
+	    if (opt == 'd' &&
+		sscanf(optarg, "%dx%d", &dw, &dh) == 2 && dw > 0 && dh > 0)
+		break;
+	    /* Fall through */
+	default:
+	usage:
+	    fputs("Usage: bench-linear [-s widthxheight] [-d widthxheight] "
+		  "[-t threads]\n", stderr);
+	    fputs("       bench-linear -p pattern.ppm\n", stderr);
+	    exit(1);
+	}
+    }
+
+    if (threads == 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > dh) threads = dh;
+    if (threads < 1) threads = 1;
+
+    src = malloc((size_t) sw * sh * 4);
+    dst = malloc((size_t) dw * dh * 4);
+    if (src == NULL || dst == NULL) {
+	fputs("Out of memory\n", stderr);
+	exit(1);
+    }
+    /* Noise, so that the tables are looked up all over */
+    for (i = 0; i < (size_t) sw * sh * 4; i++)
+	src[i] = (i * 2654435761u) >> 24;
+
+    printf("format\tlight\tthreads\tms\tMpix/s\tcost\tlines\n");
+    for (bpp = 4; bpp >= 3; bpp--) {
+	double gamma, t;
+	int on;
+
+	for (on = 0; on <= 1; on++) {
+	    t = bench(src, sw, sh, dst, dw, dh, bpp, on, threads);
+	    if (!on) gamma = t;
+	    printf("%s\t%s\t%d\t%.1f\t%.1f\t%.2f\t%d\n",
+		   bpp == 4 ? "rgb" : "rgb24", on ? "linear" : "gamma",
+		   threads, t, (double) sw * sh / t / 1000, t / gamma,
+		   lines(on));
+	}
+    }
+
+    return 0;
+}
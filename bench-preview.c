@@ -0,0 +1,212 @@
+/*
+ * bench-preview.c: Measure how much sooner a viewer can show something when
+ * it starts with the preview in a JPEG's EXIF data (see exifthumb.c).
+ *
+ * Usage: bench-preview -g widthxheight [-o orientation] file.jpg
+ *	  bench-preview file.jpg
+ *
+ * The first form makes a test image like a camera's: a noisy gradient with
+ * a 160x120 preview in its EXIF data and the orientation -o (default 1).
+ *
+ * The second form times getting the preview and decoding the image at full
+ * size on one core, taking the best of three runs each, and prints a
+ * tab-separated line with
+ *	width, height	of the image
+ *	preview	the size of the preview, turned the right way up
+ *	orientation	what the file says
+ *	preview_ms	how long the preview took
+ *	full_ms	how long the full-size decode took
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <jpeglib.h>
+
+#include "exifthumb.h"
+#include "loadjpeg.h"
+
+#define RUNS	3	/* Take the best of this many */
+#define PREVIEW_W 160
+#define PREVIEW_H 120
+
+/* Compress a noisy gradient of w x h pixels, into a file if fp isn't NULL
+ * or to memory otherwise. The same gradient at any size looks the same. */
+static void
+compress(FILE *fp, unsigned char **mem, unsigned long *len, int w, int h,
+	 unsigned char *exif, unsigned exifLen)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    JSAMPROW row;
+    unsigned seed = 1;
+    int x;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    if (fp != NULL) jpeg_stdio_dest(&cinfo, fp);
+    else jpeg_mem_dest(&cinfo, mem, len);
+    cinfo.image_width = w;
+    cinfo.image_height = h;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    /* The EXIF segment replaces the JFIF one */
+    cinfo.write_JFIF_header = exif == NULL;
+    jpeg_start_compress(&cinfo, TRUE);
+    if (exif != NULL) jpeg_write_marker(&cinfo, JPEG_APP0 + 1, exif, exifLen);
+
+    row = malloc(w * 3);
+    while (cinfo.next_scanline < cinfo.image_height) {
+	int y = cinfo.next_scanline;
+
+	for (x = 0; x < w; x++) {
+	    int noise;
+
+	    seed = seed * 1103515245 + 12345;
+	    noise = (seed >> 16) % 64 - 32;
+	    row[x * 3] = (x * 191 / w + noise + 32) & 0xFF;
+	    row[x * 3 + 1] = (y * 191 / h + noise + 32) & 0xFF;
+	    row[x * 3 + 2] = (128 + noise) & 0xFF;
+	}
+	jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+}
+
+static unsigned char *
+put16(unsigned char *p, unsigned n)
+{
+    p[0] = n; p[1] = n >> 8;
+    return p + 2;
+}
+
+static unsigned char *
+put32(unsigned char *p, unsigned long n)
+{
+    return put16(put16(p, n), n >> 16);
+}
+
+/* An IFD entry with one SHORT or LONG */
+static unsigned char *
+putTag(unsigned char *p, unsigned tag, unsigned type, unsigned long value)
+{
+    p = put32(put16(put16(p, tag), type), 1);
+    return type == 3 ? put16(put16(p, value), 0) : put32(p, value);
+}
+
+/* Make an image w x h with a preview and an orientation in its EXIF data,
+ * as a camera would, in little-endian TIFF order. */
+static void
+makeImage(int w, int h, int orientation, char *filename)
+{
+    unsigned char *thumb = NULL, *exif, *p;
+    unsigned long thumbLen = 0;
+    FILE *fp;
+
+    compress(NULL, &thumb, &thumbLen, PREVIEW_W, PREVIEW_H, NULL, 0);
+    if ((exif = malloc(6 + 68 + thumbLen)) == NULL ||
+	6 + 68 + thumbLen > 65533) {
+	fputs("Preview too big\n", stderr);
+	exit(1);
+    }
+    memcpy(exif, "Exif\0\0II*\0", 10);
+    p = put32(exif + 10, 8);			/* IFD0 is at 8 */
+    p = put16(p, 1);
+    p = putTag(p, 0x0112, 3, orientation);
+    p = put32(p, 26);				/* IFD1 is at 26 */
+    p = put16(p, 3);
+    p = putTag(p, 0x0103, 3, 6);		/* JPEG compression */
+    p = putTag(p, 0x0201, 4, 68);		/* The preview is at 68 */
+    p = putTag(p, 0x0202, 4, thumbLen);
+    p = put32(p, 0);				/* There's no IFD2 */
+    memcpy(p, thumb, thumbLen);
+
+    if ((fp = fopen(filename, "wb")) == NULL) {
+	perror(filename);
+	exit(1);
+    }
+    compress(fp, NULL, NULL, w, h, exif, 6 + 68 + thumbLen);
+    fclose(fp);
+    free(thumb);
+    free(exif);
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt, w = 0, h = 0, orientation = 1, run;
+    int pw, ph, iw, ih, denom;
+    double previewMs = -1, fullMs = -1;
+    unsigned char *pixels;
+
+    while ((opt = getopt(argc, argv, "g:o:")) != -1) {
+	switch (opt) {
+	case 'g':
+	    if (sscanf(optarg, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) break;
+	    fprintf(stderr, "Bad size \"%s\"\n", optarg);
+	    exit(1);
+	case 'o':
+	    orientation = atoi(optarg);
+	    if (orientation >= 1 && orientation <= 8) break;
+	    /* Fall through */
+	default:
+	    optind = argc;
+	    break;
+	}
+    }
+    if (optind != argc - 1) {
+	fputs("Usage: bench-preview -g widthxheight [-o orientation] "
+	      "file.jpg\n", stderr);
+	fputs("       bench-preview file.jpg\n", stderr);
+	exit(1);
+    }
+    if (w > 0) {
+	makeImage(w, h, orientation, argv[optind]);
+	exit(0);
+    }
+
+    loadjpeg_threads = 1;
+    for (run = 0; run < RUNS; run++) {
+	double start = now(), t;
+
+	if ((pixels = exifthumb_load(argv[optind], &pw, &ph,
+				     &orientation)) == NULL) {
+	    fprintf(stderr, "%s has no preview\n", argv[optind]);
+	    exit(1);
+	}
+	t = now() - start;
+	free(pixels);
+	if (previewMs < 0 || t < previewMs) previewMs = t;
+
+	start = now();
+	if ((pixels = loadjpeg(argv[optind], 1 << 30, 1 << 30,
+			       &iw, &ih, &denom)) == NULL) {
+	    fprintf(stderr, "Cannot decode %s\n", argv[optind]);
+	    exit(1);
+	}
+	t = now() - start;
+	free(pixels);
+	if (fullMs < 0 || t < fullMs) fullMs = t;
+    }
+
+    printf("width\theight\tpreview\torientation\tpreview_ms\tfull_ms\n");
+    printf("%d\t%d\t%dx%d\t%d\t%.1f\t%.1f\n", iw, ih, pw, ph, orientation,
+	   previewMs, fullMs);
+    exit(0);
+}
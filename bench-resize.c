@@ -0,0 +1,191 @@
+/*
+ * bench-resize.c: Replay a window-resizing trajectory on one of the viewers
+ * and measure how well it keeps up.
+ *
+ * Usage: bench-resize pid name trajectory
+ *
+ * "pid" is the process ID of a viewer that has just been started and "name"
+ * its window title. We find its window, wait for it to paint its first frame
+ * and then settle down, and then play the window manager, resizing it
+ * according to the trajectory file. Each line of that is
+ *	width height milliseconds
+ * meaning resize the window to width x height then wait that long before
+ * the next one. Blank lines and lines starting with # are ignored.
+ *
+ * A frame is counted every time the X server reports that the window's
+ * contents have changed (with the DAMAGE extension), which is about once per
+ * repaint however the toolkit does its drawing.
+ *
+ * When the trajectory is over we wait until it has stopped repainting for
+ * a second, then print a tab-separated line with:
+ *	frames		frames it presented during the trajectory
+ *	settle_ms	time from the last resize to its last repaint
+ *	total_ms	time from the first resize to its last repaint
+ *	cpu_ms		user+system CPU time used by the viewer since it started
+ *	peak_rss_kb	the viewer's peak resident memory since it started
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+
+#include "benchx.h"
+
+#define FIND_TIMEOUT	10000	/* How long to wait for its window to appear */
+#define QUIET		1000	/* No repaints for this long means it's settled */
+#define SETTLE_TIMEOUT	300000	/* Give up on it ever settling after this */
+
+static Display *dpy;
+static int damageEvent;		/* Event base of the DAMAGE extension */
+static Damage damage;
+static long frames;		/* Frames seen since the last reset */
+static long lastFrame;		/* Time of the last frame in ms, or -1 */
+
+/* Process X events until time "until", counting frames. */
+static void
+pumpEvents(long until)
+{
+    struct pollfd pfd;
+
+    pfd.fd = ConnectionNumber(dpy);
+    pfd.events = POLLIN;
+
+    for (;;) {
+	long t;
+
+	while (XPending(dpy)) {
+	    XEvent ev;
+
+	    XNextEvent(dpy, &ev);
+	    if (ev.type == damageEvent + XDamageNotify) {
+		frames++;
+		lastFrame = now();
+		/* Re-arm it so that we hear about the next frame */
+		XDamageSubtract(dpy, damage, None, None);
+	    }
+	}
+	if ((t = now()) >= until) break;
+	poll(&pfd, 1, until - t);
+    }
+}
+
+/* Wait until it hasn't repainted for QUIET ms since time "since". */
+static void
+waitToSettle(long since)
+{
+    long give_up = since + SETTLE_TIMEOUT;
+
+    for (;;) {
+	long last = (lastFrame > since) ? lastFrame : since;
+
+	if (now() >= last + QUIET || now() >= give_up) break;
+	pumpEvents(last + QUIET);
+    }
+}
+
+/* Get the viewer's CPU time in ms and peak RSS in kB from /proc */
+static void
+procStats(pid_t pid, long *cpu_ms, long *peak_rss_kb)
+{
+    char path[64], line[256];
+    FILE *fp;
+
+    *cpu_ms = *peak_rss_kb = -1;
+
+    sprintf(path, "/proc/%d/stat", (int)pid);
+    if ((fp = fopen(path, "r")) != NULL) {
+	unsigned long utime, stime;
+	/* Skip "pid (comm) state" then 10 fields to get to utime, stime.
+	 * comm can contain spaces, so start after the last ')'. */
+	if (fgets(line, sizeof(line), fp) && strrchr(line, ')') &&
+	    sscanf(strrchr(line, ')') + 2,
+		   "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+		   &utime, &stime) == 2)
+	    *cpu_ms = (utime + stime) * 1000 / sysconf(_SC_CLK_TCK);
+	fclose(fp);
+    }
+
+    sprintf(path, "/proc/%d/status", (int)pid);
+    if ((fp = fopen(path, "r")) != NULL) {
+	while (fgets(line, sizeof(line), fp))
+	    if (sscanf(line, "VmHWM: %ld", peak_rss_kb) == 1) break;
+	fclose(fp);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    pid_t pid;
+    Window window;
+    FILE *trajectory;
+    char line[256];
+    int damageError;
+    long start = -1, lastResize = -1;
+    long cpu_ms, peak_rss_kb;
+
+    if (argc != 4) {
+	fputs("Usage: bench-resize pid name trajectory\n", stderr);
+	exit(1);
+    }
+    pid = atoi(argv[1]);
+
+    if ((trajectory = fopen(argv[3], "r")) == NULL) {
+	perror(argv[3]);
+	exit(1);
+    }
+
+    if ((dpy = XOpenDisplay(NULL)) == NULL) {
+	fputs("Cannot open display\n", stderr);
+	exit(1);
+    }
+    if (!XDamageQueryExtension(dpy, &damageEvent, &damageError)) {
+	fputs("The X server doesn't have the DAMAGE extension\n", stderr);
+	exit(1);
+    }
+
+    if ((window = findWindow(dpy, pid, argv[2], FIND_TIMEOUT)) == None) {
+	fprintf(stderr, "Can't find %s's window\n", argv[2]);
+	exit(1);
+    }
+    damage = XDamageCreate(dpy, window, XDamageReportNonEmpty);
+
+    /* Let it paint its first frame and calm down */
+    lastFrame = -1;
+    waitToSettle(now());
+
+    frames = 0;
+    while (fgets(line, sizeof(line), trajectory)) {
+	int w, h, ms;
+
+	if (line[0] == '#' || sscanf(line, "%d %d %d", &w, &h, &ms) != 3)
+	    continue;
+	lastResize = now();
+	if (start < 0) start = lastResize;
+	XResizeWindow(dpy, window, w, h);
+	XFlush(dpy);
+	pumpEvents(lastResize + ms);
+	if (kill(pid, 0) != 0) {
+	    fprintf(stderr, "%s died during the trajectory\n", argv[2]);
+	    exit(1);
+	}
+    }
+    if (start < 0) {
+	fprintf(stderr, "%s has no steps in it\n", argv[3]);
+	exit(1);
+    }
+    waitToSettle(lastResize);
+
+    procStats(pid, &cpu_ms, &peak_rss_kb);
+    printf("%ld\t%ld\t%ld\t%ld\t%ld\n", frames,
+	   (lastFrame > lastResize) ? lastFrame - lastResize : 0,
+	   (lastFrame > start) ? lastFrame - start : 0,
+	   cpu_ms, peak_rss_kb);
+
+    exit(0);
+}
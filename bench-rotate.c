@@ -0,0 +1,176 @@
+/*
+ * bench-rotate.c: Measure how long turning and flipping a camera-sized image
+ * takes (see rotate.c) against doing it a pixel at a time, and check that
+ * they come out the same.
+ *
+ * Usage: bench-rotate [-g widthxheight] [-b bytes-per-pixel] [-t threads]
+ *
+ * It makes a random image of -g pixels (default 8192x6144, 50 megapixels)
+ * of -b bytes per pixel (default 4) and does each of the eight EXIF
+ * orientations to it on -t threads (default one per core), printing a
+ * tab-separated line for each with
+ *	bpp	bytes per pixel
+ *	threads	how many threads it was allowed
+ *	orientation	1 to 8, as in exifthumb.h
+ *	ms	how long rotate_pixels() took, the best of three
+ *	Mpix/s	megapixels turned per second
+ *	naive_ms	how long a pixel at a time in source order took
+ *	speedup	how many times faster rotate_pixels() was than that
+ *	same	whether they made the same image
+ *
+ * First it checks that doing one orientation then another gives the same
+ * as doing what rotate_then() says they add up to, for all 64 pairs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "rotate.h"
+
+#define RUNS	3	/* Take the best of this many */
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void *
+xmalloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (p == NULL) {
+	fputs("Out of memory\n", stderr);
+	exit(1);
+    }
+    return p;
+}
+
+static void
+usage(void)
+{
+    fputs("Usage: bench-rotate [-g widthxheight] [-b bytes-per-pixel] "
+	  "[-t threads]\n", stderr);
+    exit(1);
+}
+
+/* Where each pixel goes, worked out for each one, as exifthumb.c does */
+static void
+naive(const unsigned char *src, int w, int h, unsigned char *dst, int bpp,
+      int orientation)
+{
+    int dw = ROTATE_SWAPS(orientation) ? h : w;
+    int x, y, dx, dy;
+
+    for (y = 0; y < h; y++) {
+	for (x = 0; x < w; x++) {
+	    switch (orientation) {
+	    case 1: dx = x; dy = y; break;
+	    case 2: dx = w - 1 - x; dy = y; break;
+	    case 3: dx = w - 1 - x; dy = h - 1 - y; break;
+	    case 4: dx = x; dy = h - 1 - y; break;
+	    case 5: dx = y; dy = x; break;
+	    case 6: dx = h - 1 - y; dy = x; break;
+	    case 7: dx = h - 1 - y; dy = w - 1 - x; break;
+	    default: dx = y; dy = w - 1 - x; break;	/* 8 */
+	    }
+	    memcpy(dst + ((size_t) dy * dw + dx) * bpp,
+		   src + ((size_t) y * w + x) * bpp, bpp);
+	}
+    }
+}
+
+/* Is doing "a" then "b" the same as doing rotate_then(a, b)? */
+static int
+composes(int a, int b)
+{
+    enum { W = 7, H = 5 };
+    unsigned char src[W * H], once[W * H], twice[W * H], both[W * H];
+    int aw = ROTATE_SWAPS(a) ? H : W, ah = ROTATE_SWAPS(a) ? W : H;
+    int o = rotate_then(a, b);
+    int i;
+
+    for (i = 0; i < W * H; i++) src[i] = i;
+    rotate_pixels(src, W, H, W, once, aw, 1, a);
+    rotate_pixels(once, aw, ah, aw, twice, ROTATE_SWAPS(b) ? ah : aw, 1, b);
+    rotate_pixels(src, W, H, W, both, ROTATE_SWAPS(o) ? H : W, 1, o);
+    return memcmp(twice, both, sizeof(both)) == 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int opt, w = 8192, h = 6144, bpp = 4;
+    int a, b, o, run;
+    size_t size, i;
+    unsigned char *src, *dst, *ref;
+    unsigned seed = 1;
+
+    while ((opt = getopt(argc, argv, "g:b:t:")) != -1) {
+	switch (opt) {
+	case 'g':
+	    if (sscanf(optarg, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) break;
+	    fprintf(stderr, "Bad size \"%s\"\n", optarg);
+	    exit(1);
+	case 'b':
+	    bpp = atoi(optarg);
+	    if (bpp >= 1 && bpp <= 4) break;
+	    usage();
+	case 't':
+	    rotate_threads = atoi(optarg);
+	    if (rotate_threads >= 1) break;
+	    /* Fall through */
+	default:
+	    usage();
+	}
+    }
+
+    if (rotate_threads == 0) rotate_threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (a = 1; a <= 8; a++) {
+	for (b = 1; b <= 8; b++) {
+	    if (!composes(a, b)) {
+		fprintf(stderr, "%d then %d isn't %d\n", a, b, rotate_then(a, b));
+		exit(1);
+	    }
+	}
+    }
+
+    size = (size_t) w * h * bpp;
+    src = xmalloc(size);
+    dst = xmalloc(size);
+    ref = xmalloc(size);
+    for (i = 0; i < size; i++) {
+	seed = seed * 1103515245 + 12345;
+	src[i] = seed >> 16;
+    }
+
+    printf("bpp\tthreads\torientation\tms\tMpix/s\tnaive_ms\tspeedup\tsame\n");
+    for (o = 1; o <= 8; o++) {
+	int dpitch = (ROTATE_SWAPS(o) ? h : w) * bpp;
+	double ms = -1, naiveMs, start, t;
+
+	for (run = 0; run < RUNS; run++) {
+	    start = now();
+	    rotate_pixels(src, w, h, w * bpp, dst, dpitch, bpp, o);
+	    t = now() - start;
+	    if (ms < 0 || t < ms) ms = t;
+	}
+	start = now();
+	naive(src, w, h, ref, bpp, o);
+	naiveMs = now() - start;
+
+	printf("%d\t%d\t%d\t%.1f\t%.0f\t%.1f\t%.1f\t%s\n", bpp,
+	       rotate_threads, o, ms,
+	       (double) w * h / ms / 1000, naiveMs, naiveMs / ms,
+	       memcmp(dst, ref, size) == 0 ? "yes" : "no");
+    }
+    exit(0);
+}
@@ -0,0 +1,163 @@
+/*
+ * bench-scale.c: Measure what keeping gray, palette and bitmap images in
+ * their own formats saves over expanding them to RGB before scaling them.
+ *
+ * Usage: bench-scale [-s widthxheight] [-d widthxheight]
+ *
+ * It makes a source image of -s pixels (default 8000x6000) in each of these
+ * forms and scales it to -d pixels (default 1920x1080) with scale.c:
+ *	rgb	expanded to 4 bytes per pixel, as SDL_DisplayFormat() or
+ *		converting to IM_RGB would, and scaled as that
+ *	rgb24	3 bytes per pixel, as on a 24-bit screen
+ *	rgb16	2 bytes per pixel, 565 with ordered dither, as on a 16-bit one
+ *	gray	1 byte per pixel, scaled to 1 byte per pixel
+ *	palette	1 byte per pixel, scaled through the palette to 4 bytes
+ *	bitmap	1 bit per pixel, scaled to 1 byte per pixel
+ * Built with -DNO_SIMD (bench-scale-c) it shows what SSE2 saves.
+ * Each one runs in a process of its own so that its peak memory use is its
+ * own, and prints a tab-separated line with
+ *	format	which of the above
+ *	src_MB	the size of the source image
+ *	rss_MB	the process's peak resident set size
+ *	ms	how long one scale took, the best of three
+ *	Mpix/s	source megapixels scaled per second
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "scale.h"
+
+#define RUNS	3	/* Take the best of this many */
+
+enum { RGB, RGB24, RGB16, GRAY, PALETTE, BITMAP };
+static const char *names[] = {
+    "rgb", "rgb24", "rgb16", "gray", "palette", "bitmap"
+};
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* Make the source image in one of the formats and time scaling it */
+static void
+bench(int format, int sw, int sh, int dw, int dh)
+{
+    unsigned char *src, *dst, lut[256 * 4];
+    int spitch, dbpp, x, y, i, result = 0;
+    double best = 0;
+    struct rusage ru;
+
+    switch (format) {
+    case RGB:	  spitch = sw * 4; dbpp = 4; break;
+    case RGB24:	  spitch = sw * 3; dbpp = 3; break;
+    case RGB16:	  spitch = sw * 2; dbpp = 2; break;
+    case BITMAP:  spitch = (sw + 7) / 8; dbpp = 1; break;
+    case PALETTE: spitch = sw; dbpp = 4; break;
+    default:	  spitch = sw; dbpp = 1; break;
+    }
+    src = malloc((size_t) spitch * sh);
+    dst = malloc((size_t) dw * dbpp * dh);
+    if (src == NULL || dst == NULL) {
+	fputs("Out of memory\n", stderr);
+	exit(1);
+    }
+
+    /* A gradient, so that every page of it is really there */
+    for (y = 0; y < sh; y++) {
+	unsigned char *row = src + (size_t) y * spitch;
+
+	for (x = 0; x < spitch; x++)
+	    row[x] = (x + y) * 255 / (spitch + sh);
+    }
+    for (i = 0; i < 256; i++) {
+	lut[i * 4] = i;
+	lut[i * 4 + 1] = 255 - i;
+	lut[i * 4 + 2] = i / 2;
+	lut[i * 4 + 3] = 0;
+    }
+
+    for (i = 0; i < RUNS; i++) {
+	double start = now(), t;
+	static const unsigned char levels[2] = { 255, 0 };
+
+	switch (format) {
+	case BITMAP:
+	    result = scale_bits(src, sw, sh, spitch, dst, dw, dh, dw, levels,
+				0);
+	    break;
+	case RGB16:
+	    result = scale_pixels16(src, sw, sh, spitch, dst, dw, dh, dw * 2,
+				    0xF800, 0x07E0, 0x001F, 1, 0);
+	    break;
+	case PALETTE:
+	    result = scale_lut(src, sw, sh, spitch, dst, dw, dh, dw * 4,
+			       lut, 4, 0);
+	    break;
+	default:
+	    result = scale_pixels(src, sw, sh, spitch, dst, dw, dh, dw * dbpp,
+				  dbpp);
+	    break;
+	}
+	if (result < 0) {
+	    fputs("Scaling failed\n", stderr);
+	    exit(1);
+	}
+	t = now() - start;
+	if (i == 0 || t < best) best = t;
+    }
+
+    getrusage(RUSAGE_SELF, &ru);
+    printf("%s\t%.1f\t%.1f\t%.1f\t%.1f\n", names[format],
+	   (double) spitch * sh / 1048576, ru.ru_maxrss / 1024.0, best,
+	   (double) sw * sh / best / 1000);
+}
+
+int
+main(int argc, char **argv)
+{
+    int sw = 8000, sh = 6000, dw = 1920, dh = 1080;
+    int opt, format;
+
+    while ((opt = getopt(argc, argv, "s:d:")) != -1) {
+	switch (opt) {
+	case 's':
+	    if (sscanf(optarg, "%dx%d", &sw, &sh) == 2 && sw > 0 && sh > 0)
+		break;
+	    /* Fall through */
+	case 'd':
+	    if (opt == 'd' &&
+		sscanf(optarg, "%dx%d", &dw, &dh) == 2 && dw > 0 && dh > 0)
+		break;
+	    /* Fall through */
+	default:
+	    fputs("Usage: bench-scale [-s widthxheight] [-d widthxheight]\n",
+		  stderr);
+	    exit(1);
+	}
+    }
+
+    printf("format\tsrc_MB\trss_MB\tms\tMpix/s\n");
+    fflush(stdout);
+    for (format = RGB; format <= BITMAP; format++) {
+	pid_t pid = fork();
+
+	if (pid == 0) {
+	    bench(format, sw, sh, dw, dh);
+	    exit(0);
+	}
+	if (pid > 0) waitpid(pid, NULL, 0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * bench-server.c: Check that imgserver decodes an image once for any number
+ * of viewers and time how long they take to get it.
+ *
+ * Usage: IMAGE_SERVER=socket bench-server [-n clients] [-s widthxheight] file
+ *
+ * With imgserver running on the socket, it starts that many clients
+ * (default 8) at once, each of which gets the JPEG at the size -s asks for
+ * (default: full size) as a viewer would (see imgclient.c) and sums its pixels.
+ * Then it asks the server how it did and prints a tab-separated line with
+ *	clients	how many there were
+ *	ms	how long it took for all of them to have the image
+ *	decodes	how many times the server decoded a file
+ *	MB	how big the decoded image is
+ *	same	"yes" if they all got the same pixels
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "imgclient.h"
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* Get the image and write its size and the sum of its pixels to fd */
+static void
+client(const char *filename, int w, int h, int fd)
+{
+    imgclient_t *img = imgclient_get(filename, w, h);
+    unsigned long long sum = 0;
+    char line[128];
+    int x, y;
+
+    if (img == NULL) {
+	write(fd, "failed\n", 7);
+	exit(1);
+    }
+    for (y = 0; y < img->height; y++) {
+	const unsigned char *row = img->pixels + (size_t) y * img->stride;
+
+	for (x = 0; x < img->width * img->bpp; x++)
+	    sum = sum * 31 + row[x];
+    }
+    snprintf(line, sizeof(line), "%d %d %d %llu\n",
+	     img->width, img->height, img->bpp, sum);
+    write(fd, line, strlen(line));
+    imgclient_release(img);
+}
+
+/* Ask the server for its STATS line and find the number after "name" */
+static long
+serverStat(const char *name)
+{
+    const char *path = getenv("IMAGE_SERVER");
+    struct sockaddr_un addr;
+    char line[256], *p;
+    int fd, n;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	write(fd, "STATS\n", 6) != 6 ||
+	(n = read(fd, line, sizeof(line) - 1)) <= 0) {
+	perror(path);
+	exit(1);
+    }
+    close(fd);
+    line[n] = '\0';
+    if ((p = strstr(line, name)) == NULL) return -1;
+    return atol(p + strlen(name));
+}
+
+int
+main(int argc, char **argv)
+{
+    int nclients = 8, w = INT_MAX, h = INT_MAX;
+    int opt, i, same = 1, fds[2];
+    long decodes;
+    double start;
+    char first[128] = "", line[128];
+    int iw, ih, bpp;
+    FILE *results;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+	switch (opt) {
+	case 'n':
+	    if ((nclients = atoi(optarg)) > 0) break;
+	    /* Fall through */
+	case 's':
+	    if (opt == 's' && sscanf(optarg, "%dx%d", &w, &h) == 2) break;
+	    /* Fall through */
+	default:
+	    goto usage;
+	}
+    }
+    if (optind != argc - 1 || getenv("IMAGE_SERVER") == NULL) {
+usage:
+	fputs("Usage: IMAGE_SERVER=socket bench-server [-n clients] "
+	      "[-s widthxheight] file\n", stderr);
+	exit(1);
+    }
+
+    decodes = serverStat("decodes ");
+    if (pipe(fds) < 0) {
+	perror("pipe");
+	exit(1);
+    }
+    start = now();
+    for (i = 0; i < nclients; i++) {
+	if (fork() == 0) {
+	    close(fds[0]);
+	    client(argv[optind], w, h, fds[1]);
+	    exit(0);
+	}
+    }
+    close(fds[1]);
+    while (wait(NULL) > 0)
+	;
+
+    /* Did they all get the same? */
+    results = fdopen(fds[0], "r");
+    for (i = 0; fgets(line, sizeof(line), results) != NULL; i++) {
+	if (i == 0) strcpy(first, line);
+	else if (strcmp(line, first) != 0) same = 0;
+    }
+    if (i != nclients || strcmp(first, "failed\n") == 0) same = 0;
+    if (sscanf(first, "%d %d %d", &iw, &ih, &bpp) != 3) iw = ih = bpp = 0;
+
+    printf("clients\tms\tdecodes\tMB\tsame\n");
+    printf("%d\t%.1f\t%ld\t%.1f\t%s\n", nclients, now() - start,
+	   serverStat("decodes ") - decodes, (double) iw * ih * bpp / 1048576,
+	   same ? "yes" : "no");
+
+    return same ? 0 : 1;
+}
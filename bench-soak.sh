@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# bench-soak.sh: Check that a viewer doesn't leak as it opens image after
+# image.
+#
+# Usage: bench-soak.sh program
+#
+# Makes $SOAK_IMAGES test photos (default 24), each of a different size
+# from 2000x1500 up, in bench-corpus/ if they aren't there already, so that
+# no cache or memory budget can hold them all. It then starts a headless
+# X server and has the program go through them all $SOAK_PASSES times
+# (default 10) through its own File-Open path (see IMAGE_SOAK in
+# image2-agar.c), printing a tab-separated table of
+#	opens	how many it has opened so far
+#	rss_kb	its resident memory then
+# on stdout, one line per pass. By the end of the second pass the allocator
+# and any cache have seen every image, so from then on the memory should
+# stay where it is. It fails if it grew by more than $SOAK_SLACK_KB
+# (default 1024) between the end of the second pass and the end of the
+# last, which even a small leak per open would do over this many opens.
+#
+# Set BENCH_DISPLAY to use a display other than :99.
+
+display=${BENCH_DISPLAY:-:99}
+corpus=bench-corpus
+images=${SOAK_IMAGES:-24}
+passes=${SOAK_PASSES:-10}
+slack=${SOAK_SLACK_KB:-1024}
+
+program=$1
+if [ -z "$program" ]; then
+    echo "Usage: bench-soak.sh program" 1>&2
+    exit 1
+fi
+if [ $passes -lt 3 ]; then
+    echo "SOAK_PASSES must be at least 3" 1>&2
+    exit 1
+fi
+
+mkdir -p $corpus
+files=
+i=0
+while [ $i -lt $images ]
+do
+    size=`expr 2000 + $i \* 40`x`expr 1500 + $i \* 30`
+    [ -f $corpus/soak-$size.jpg ] ||
+	./bench-firstpixel -g $size $corpus/soak-$size.jpg || exit 1
+    files="$files $corpus/soak-$size.jpg"
+    i=`expr $i + 1`
+done
+
+Xvfb $display -screen 0 5120x2880x24 -nolisten tcp 2>/dev/null &
+xvfb=$!
+out=`mktemp` || exit 1
+trap 'kill $xvfb 2>/dev/null; rm -f $out' 0
+DISPLAY=$display; export DISPLAY
+
+# Wait for the server to come up
+tries=50
+until xdpyinfo >/dev/null 2>&1; do
+    tries=`expr $tries - 1`
+    if [ $tries = 0 ]; then
+	echo "Xvfb didn't start on $display" 1>&2
+	exit 1
+    fi
+    sleep 0.1
+done
+
+IMAGE_SOAK=$passes $program $files > $out || exit 1
+cat $out
+
+# Line 1 is the heading, 2 before it opened anything and 4 after pass two
+awk -v slack=$slack -v passes=$passes '
+    NR == 4 { second = $2; from = $1 }
+    NR > 4 { last = $2; to = $1 }
+    END {
+	if (NR != passes + 2) {
+	    print "Only " NR - 2 " of " passes " passes finished" > "/dev/stderr"
+	    exit 1
+	}
+	grew = last - second
+	printf "rss grew %d kB from %d opens to %d (slack %d kB)\n",
+	       grew, from, to, slack > "/dev/stderr"
+	exit grew > slack
+    }' $out
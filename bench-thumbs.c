@@ -0,0 +1,118 @@
+/*
+ * bench-thumbs.c: Time opening a directory as a grid of thumbnails
+ * (see thumbs.c), cold, when they all have to be made, or warm, when they
+ * are in the thumbnail cache.
+ *
+ * Usage: bench-thumbs [-r run] [-t threads] [-v visible] [-c ms] directory
+ *
+ * It asks for -v thumbnails (default 40) from the middle of the directory,
+ * as a viewer scrolled there would for the ones on its screen, waits for
+ * them all or, with -c, closes it after that many ms, as a viewer does when
+ * one is double-clicked, and prints a tab-separated line with
+ *	run	what -r said, like "cold" or "warm"
+ *	files	how many images there are
+ *	threads	how many threads made them (-t, default one per core)
+ *	first_ms	how long until the visible ones were all there, or -1
+ *	all_ms	how long until they all were, or until it closed with -c
+ *	failed	how many couldn't be made
+ *	made	how many were made before it closed
+ *	close_ms	how long closing took, which should be at most one
+ *		thumbnail's worth however many are left
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "thumbs.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static int first, visible;	/* The ones on the "screen" */
+static int done = 0, visibleDone = 0;
+static double start, firstMs = -1;
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+ready(void *arg, int i)
+{
+    pthread_mutex_lock(&lock);
+    done++;
+    if (i >= first && i < first + visible && ++visibleDone == visible)
+	firstMs = now() - start;
+    pthread_cond_signal(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+int
+main(int argc, char **argv)
+{
+    thumbs_t *t;
+    const char *run = "-";
+    int opt, i, n, failed = 0, closeAfter = -1, made;
+    double allMs, closeMs;
+
+    visible = 40;
+    while ((opt = getopt(argc, argv, "r:t:v:c:")) != -1) {
+	switch (opt) {
+	case 'c': closeAfter = atoi(optarg); break;
+	case 'r': run = optarg; break;
+	case 't': thumbs_threads = atoi(optarg); break;
+	case 'v': visible = atoi(optarg); break;
+	default: optind = argc; break;
+	}
+    }
+    if (optind != argc - 1) {
+	fputs("Usage: bench-thumbs [-r run] [-t threads] [-v visible] "
+	      "[-c ms] directory\n", stderr);
+	exit(1);
+    }
+
+    start = now();
+    if ((t = thumbs_open(argv[optind], ready, NULL)) == NULL) {
+	perror(argv[optind]);
+	exit(1);
+    }
+    n = thumbs_count(t);
+    if (visible > n) visible = n;
+    first = (n - visible) / 2;
+
+    /* What a viewer does when it draws the screen. ready() says when
+     * they're there, whether they were already or not. */
+    for (i = first; i < first + visible; i++)
+	thumbs_get(t, i);
+    if (closeAfter >= 0) {
+	usleep(closeAfter * 1000);
+    } else {
+	pthread_mutex_lock(&lock);
+	while (done < n)
+	    pthread_cond_wait(&changed, &lock);
+	pthread_mutex_unlock(&lock);
+    }
+    allMs = now() - start;
+
+    for (i = 0; i < n; i++)
+	if (thumbs_failed(t, i)) failed++;
+    closeMs = now();
+    thumbs_close(t);
+    closeMs = now() - closeMs;
+    pthread_mutex_lock(&lock);
+    made = done;
+    pthread_mutex_unlock(&lock);
+
+    printf("run\tfiles\tthreads\tfirst_ms\tall_ms\tfailed\tmade\tclose_ms\n");
+    printf("%s\t%d\t%d\t%.1f\t%.1f\t%d\t%d\t%.1f\n", run, n,
+	   thumbs_threads ? thumbs_threads : (int) sysconf(_SC_NPROCESSORS_ONLN),
+	   firstMs, allMs, failed, made, closeMs);
+    return 0;
+}
@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# bench.sh: Resize-storm benchmark for the viewers.
+#
+# Usage: bench.sh image program...
+#
+# Starts a headless X server, then runs each program on the image in turn
+# while bench-resize plays the window manager, resizing its window along the
+# trajectory in bench.traj, and prints a tab-separated table of the results
+# on stdout. See bench-resize.c for what the columns mean.
+#
+# Set BENCH_DISPLAY to use a display other than :99, BENCH_TRAJ to use
+# a different trajectory and BENCH_DEPTH to give the screen 16 bits per pixel
+# (565) or some other depth than 24.
+
+image="$1"; shift
+display=${BENCH_DISPLAY:-:99}
+traj=${BENCH_TRAJ:-bench.traj}
+depth=${BENCH_DEPTH:-24}
+
+# Big enough for the 4728x864 step in the trajectory
+Xvfb $display -screen 0 5120x2880x$depth -nolisten tcp 2>/dev/null &
+xvfb=$!
+trap 'kill $xvfb 2>/dev/null' 0
+DISPLAY=$display; export DISPLAY
+
+# Wait for the server to come up
+tries=50
+until xdpyinfo >/dev/null 2>&1; do
+    tries=`expr $tries - 1`
+    if [ $tries = 0 ]; then
+	echo "Xvfb didn't start on $display" 1>&2
+	exit 1
+    fi
+    sleep 0.1
+done
+
+printf 'program\tframes\tsettle_ms\ttotal_ms\tcpu_ms\tpeak_rss_kb\n'
+for program
+do
+    name=`basename $program`
+    ./$program "$image" >/dev/null 2>&1 &
+    pid=$!
+    row=`./bench-resize $pid $name "$traj"` || row='-	-	-	-	-'
+    kill $pid 2>/dev/null
+    wait $pid 2>/dev/null
+    printf '%s\t%s\n' $name "$row"
+done
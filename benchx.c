@@ -0,0 +1,76 @@
+/*
+ * benchx.c: X11 functions shared by bench-resize and bench-firstpixel.
+ */
+
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+
+#include "benchx.h"
+
+long
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+/* Does window w belong to process pid or have the title "name"? */
+static int
+isViewer(Display *dpy, Window w, pid_t pid, char *name)
+{
+    static Atom netWmPid = None;
+    XWindowAttributes attr;
+    Atom type;
+    int format;
+    unsigned long n, after;
+    unsigned char *prop = NULL;
+    char *title = NULL;
+    int found = 0;
+
+    if (!XGetWindowAttributes(dpy, w, &attr) || attr.map_state != IsViewable)
+	return 0;
+
+    if (netWmPid == None) netWmPid = XInternAtom(dpy, "_NET_WM_PID", False);
+    if (XGetWindowProperty(dpy, w, netWmPid, 0, 1, False, XA_CARDINAL,
+			   &type, &format, &n, &after, &prop) == Success &&
+	prop != NULL && n == 1)
+	found = (*(unsigned long *)prop == (unsigned long)pid);
+    if (prop) XFree(prop);
+
+    if (!found && XFetchName(dpy, w, &title) && title != NULL) {
+	found = (strcmp(title, name) == 0);
+	XFree(title);
+    }
+
+    return found;
+}
+
+/* With no window manager, its window is a child of the root window. */
+Window
+findWindow(Display *dpy, pid_t pid, char *name, long timeout)
+{
+    long give_up = now() + timeout;
+
+    do {
+	Window root, parent, *children;
+	unsigned int n, i;
+	Window found = None;
+
+	if (XQueryTree(dpy, DefaultRootWindow(dpy),
+		       &root, &parent, &children, &n)) {
+	    for (i = 0; i < n && found == None; i++)
+		if (isViewer(dpy, children[i], pid, name)) found = children[i];
+	    if (children) XFree(children);
+	}
+	if (found != None) return found;
+	usleep(10000);
+    } while (now() < give_up && kill(pid, 0) == 0);
+
+    return None;
+}
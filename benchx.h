@@ -0,0 +1,11 @@
+/*
+ * benchx.h: Interface to benchx.c, the X11 bits shared by the benchmarks.
+ */
+
+/* Milliseconds since some time in the past */
+extern long now(void);
+
+/* Wait up to "timeout" ms for process "pid" to map a top-level window,
+ * recognised by its _NET_WM_PID or its title being "name".
+ * Returns the window or None if it didn't appear or the process died. */
+extern Window findWindow(Display *dpy, pid_t pid, char *name, long timeout);
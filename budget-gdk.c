@@ -0,0 +1,76 @@
+/*
+ * budget-gdk.c: A memory budget for the GTK viewers' pixel buffers.
+ *
+ * --max-memory=SIZE (in bytes, or with a K, M or G suffix) limits how big
+ * the pixel buffers can get. Half of it is for the image as read from the
+ * file, which is decoded at a reduced size if it would be bigger than that,
+ * and the rest is for the copy scaled to the window.
+ *
+ * Every pixbuf the viewer keeps is passed through budgetTrack(), which adds
+ * its size to the stats' pixel_bytes_live and takes it off again when the
+ * pixbuf is finalized, so the stats say how much there is and what the peak
+ * was, budget or no budget.
+ */
+
+#include <gtk/gtk.h>
+
+#include "budget-gdk.h"
+#include "stats.h"
+
+static gsize maxMemory = 0;	/* 0 means no limit */
+
+static gboolean
+parseMaxMemory(const gchar *name, const gchar *value, gpointer data,
+	       GError **error)
+{
+    char *end;
+    double n = g_ascii_strtod(value, &end);
+
+    switch (g_ascii_toupper(*end)) {
+    case 'G': n *= 1024;	/* and fall through */
+    case 'M': n *= 1024;
+    case 'K': n *= 1024; end++;
+    }
+    if (end == value || *end != '\0' || n < 1) {
+	g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+		    "%s wants a size like 200M, not \"%s\"", name, value);
+	return FALSE;
+    }
+    maxMemory = n;
+    return TRUE;
+}
+
+GOptionEntry budgetOptions[] = {
+    { "max-memory", 0, 0, G_OPTION_ARG_CALLBACK, parseMaxMemory,
+      "Keep the pixel buffers within SIZE bytes (K, M or G)", "SIZE" },
+    { NULL }
+};
+
+gsize
+budgetSourceBytes(void)
+{
+    return maxMemory / 2;
+}
+
+static void
+untrack(gpointer data, GObject *pixbuf)
+{
+    stats_add(STAT_LIVE_BYTES, -(long) GPOINTER_TO_SIZE(data));
+}
+
+GdkPixbuf *
+budgetTrack(GdkPixbuf *pixbuf)
+{
+    gsize bytes;
+
+    if (pixbuf == NULL) return NULL;
+    /* The last row isn't padded out to the rowstride */
+    bytes = (gsize) gdk_pixbuf_get_rowstride(pixbuf) *
+		    (gdk_pixbuf_get_height(pixbuf) - 1) +
+	    (gsize) gdk_pixbuf_get_width(pixbuf) *
+		    ((gdk_pixbuf_get_n_channels(pixbuf) *
+		      gdk_pixbuf_get_bits_per_sample(pixbuf) + 7) / 8);
+    stats_add(STAT_LIVE_BYTES, bytes);
+    g_object_weak_ref(G_OBJECT(pixbuf), untrack, GSIZE_TO_POINTER(bytes));
+    return pixbuf;
+}
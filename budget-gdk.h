@@ -0,0 +1,15 @@
+/*
+ * budget-gdk.h: Interface to budget-gdk.c, which keeps the GTK viewers'
+ * pixel buffers within a memory budget given by --max-memory.
+ */
+
+/* The --max-memory option, for gtk_init_with_args() */
+extern GOptionEntry budgetOptions[];
+
+/* How many bytes of pixels the image as read from the file may have,
+ * or 0 if there's no limit. */
+extern gsize budgetSourceBytes(void);
+
+/* Count a pixbuf's pixels in the stats' live bytes until it is freed.
+ * Returns the same pixbuf, so you can wrap it round whatever made it. */
+extern GdkPixbuf *budgetTrack(GdkPixbuf *pixbuf);
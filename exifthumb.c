@@ -0,0 +1,222 @@
+/*
+ * exifthumb.c: Get the preview image from a JPEG's EXIF data.
+ *
+ * Cameras put a small JPEG, usually 160x120, in the APP1 segment at the start
+ * of the file, which decodes in a millisecond or two while the real image
+ * can take a second, so a viewer can show that scaled up to fill the window
+ * and swap it for the real one when that's ready.
+ *
+ * The EXIF data is a little TIFF file: a header saying which way round the
+ * numbers are, then a list of tags for the image (IFD0), which is where the
+ * orientation is, then one for the preview (IFD1), which says where its JPEG
+ * is. Offsets are from the TIFF header and the APP1 segment can't be longer
+ * than 64K, so we read the whole segment and never look outside it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#include "exifthumb.h"
+#include "rotate.h"
+
+#define MAX_SEGMENT 65536
+
+typedef struct {
+    unsigned char *tiff;	/* The TIFF header, which offsets are from */
+    size_t len;			/* From there to the end of the segment */
+    int bigEndian;		/* "MM" rather than "II" */
+} exif_t;
+
+static unsigned
+get16(exif_t *e, size_t off)
+{
+    const unsigned char *p = e->tiff + off;
+
+    return e->bigEndian ? p[0] << 8 | p[1] : p[1] << 8 | p[0];
+}
+
+static unsigned long
+get32(exif_t *e, size_t off)
+{
+    return e->bigEndian ? (unsigned long) get16(e, off) << 16 | get16(e, off + 2)
+			: (unsigned long) get16(e, off + 2) << 16 | get16(e, off);
+}
+
+/* Find the EXIF APP1 segment among the ones before the image data and read
+ * it into buf. Returns 0 on success or -1 if there isn't one. */
+static int
+readExif(const char *filename, unsigned char *buf, exif_t *e)
+{
+    FILE *fp;
+    int c, marker;
+    size_t len;
+
+    if ((fp = fopen(filename, "rb")) == NULL) return -1;
+    if (getc(fp) != 0xFF || getc(fp) != 0xD8) goto fail;
+    for (;;) {
+	if (getc(fp) != 0xFF) goto fail;
+	while ((marker = getc(fp)) == 0xFF)
+	    ;
+	/* The image data starts at SOS, so it's not coming after that */
+	if (marker == EOF || marker == 0xDA || marker == 0xD9) goto fail;
+	if ((c = getc(fp)) == EOF) goto fail;
+	len = c << 8;
+	if ((c = getc(fp)) == EOF || (len |= c) < 2) goto fail;
+	len -= 2;
+	if (marker == 0xE1 && len > 6 + 8) {
+	    if (fread(buf, 1, len, fp) != len) goto fail;
+	    if (memcmp(buf, "Exif\0\0", 6) == 0) break;
+	} else if (fseek(fp, len, SEEK_CUR) != 0) {
+	    goto fail;
+	}
+    }
+    fclose(fp);
+
+    e->tiff = buf + 6;
+    e->len = len - 6;
+    if (memcmp(e->tiff, "II*\0", 4) == 0) e->bigEndian = 0;
+    else if (memcmp(e->tiff, "MM\0*", 4) == 0) e->bigEndian = 1;
+    else return -1;
+    return 0;
+
+fail:
+    fclose(fp);
+    return -1;
+}
+
+/* Find the orientation in IFD0 and where the preview is from IFD1 */
+static void
+readTags(exif_t *e, int *orientation, size_t *thumbOff, size_t *thumbLen)
+{
+    unsigned long ifd = get32(e, 4);
+    int pass, n, i;
+
+    *orientation = 1;
+    *thumbOff = *thumbLen = 0;
+    for (pass = 0; pass < 2 && ifd != 0; pass++) {
+	if (ifd + 2 > e->len) return;
+	n = get16(e, ifd);
+	if (ifd + 2 + n * 12 + 4 > e->len) return;
+	for (i = 0; i < n; i++) {
+	    size_t entry = ifd + 2 + i * 12;
+	    unsigned tag = get16(e, entry);
+	    /* A SHORT is in the first half of the value field */
+	    unsigned long value = get16(e, entry + 2) == 3 ? get16(e, entry + 8)
+							  : get32(e, entry + 8);
+
+	    if (pass == 0 && tag == 0x0112 && value >= 1 && value <= 8)
+		*orientation = value;
+	    if (pass == 1 && tag == 0x0201) *thumbOff = value;
+	    if (pass == 1 && tag == 0x0202) *thumbLen = value;
+	}
+	ifd = get32(e, ifd + 2 + n * 12);
+    }
+}
+
+int
+exifthumb_orientation(const char *filename)
+{
+    unsigned char *buf = malloc(MAX_SEGMENT);
+    exif_t e;
+    int orientation = 1;
+    size_t off, len;
+
+    if (buf != NULL && readExif(filename, buf, &e) == 0)
+	readTags(&e, &orientation, &off, &len);
+    free(buf);
+    return orientation;
+}
+
+/* libjpeg's default error handler calls exit(), so we jump back instead */
+struct error_mgr {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+};
+
+static void
+errorExit(j_common_ptr cinfo)
+{
+    longjmp(((struct error_mgr *) cinfo->err)->jmp, 1);
+}
+
+static void
+outputMessage(j_common_ptr cinfo)
+{
+}
+
+static unsigned char *
+decode(unsigned char *data, size_t len, int *w, int *h)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct error_mgr jerr;
+    unsigned char * volatile pixels = NULL;
+    JSAMPROW row;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = errorExit;
+    jerr.pub.output_message = outputMessage;
+    jpeg_create_decompress(&cinfo);
+    if (setjmp(jerr.jmp)) {
+	jpeg_destroy_decompress(&cinfo);
+	free(pixels);
+	return NULL;
+    }
+    jpeg_mem_src(&cinfo, data, len);
+    jpeg_read_header(&cinfo, TRUE);
+    if (cinfo.jpeg_color_space != JCS_YCbCr &&
+	cinfo.jpeg_color_space != JCS_RGB) {
+	jpeg_destroy_decompress(&cinfo);
+	return NULL;
+    }
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    *w = cinfo.output_width;
+    *h = cinfo.output_height;
+    if ((pixels = malloc((size_t) *w * *h * 3)) == NULL) {
+	jpeg_destroy_decompress(&cinfo);
+	return NULL;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+	row = pixels + (size_t) cinfo.output_scanline * *w * 3;
+	jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return pixels;
+}
+
+unsigned char *
+exifthumb_load(const char *filename, int *w, int *h, int *orientation)
+{
+    unsigned char *buf = malloc(MAX_SEGMENT);
+    unsigned char *pixels = NULL, *turned;
+    exif_t e;
+    size_t off, len;
+    int tw, th;
+
+    *orientation = 1;
+    if (buf == NULL || readExif(filename, buf, &e) < 0) {
+	free(buf);
+	return NULL;
+    }
+    readTags(&e, orientation, &off, &len);
+    if (len > 2 && off + len <= e.len &&
+	e.tiff[off] == 0xFF && e.tiff[off + 1] == 0xD8 &&
+	(pixels = decode(e.tiff + off, len, &tw, &th)) != NULL) {
+	*w = ROTATE_SWAPS(*orientation) ? th : tw;
+	*h = ROTATE_SWAPS(*orientation) ? tw : th;
+	/* Turn it the way the image is (see rotate.c) */
+	if (*orientation != 1) {
+	    if ((turned = malloc((size_t) tw * th * 3)) != NULL)
+		rotate_pixels(pixels, tw, th, tw * 3, turned, *w * 3, 3,
+			      *orientation);
+	    free(pixels);
+	    pixels = turned;
+	}
+    }
+    free(buf);
+    return pixels;
+}
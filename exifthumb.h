@@ -0,0 +1,22 @@
+/*
+ * exifthumb.h: Interface to exifthumb.c, which gets the preview image that
+ * cameras put in a JPEG's EXIF data, to show while the real one is decoded.
+ */
+
+/* Which way up the image should be shown, from its EXIF data:
+ *	1 as it is		2 flipped left to right
+ *	3 turned 180 degrees	4 flipped top to bottom
+ *	5 flipped about the top-left to bottom-right diagonal
+ *	6 turned 90 degrees clockwise
+ *	7 flipped about the other diagonal
+ *	8 turned 90 degrees anticlockwise
+ * Returns 1 if it doesn't say or isn't a JPEG file. */
+extern int exifthumb_orientation(const char *filename);
+
+/* Decode the preview in the file, if it has one, turned the right way up.
+ * Returns a malloc()ed buffer of *w x *h pixels of 3 bytes, R, G and B,
+ * with no gaps between the rows, and sets *orientation to what the file
+ * says, which is how the full-size image needs turning to match it.
+ * Returns NULL if there's no preview we can read. */
+extern unsigned char *exifthumb_load(const char *filename, int *w, int *h,
+				     int *orientation);
@@ -27,22 +27,50 @@
  * Features:
  *    - THe menus don't close when you move off them or press Escape.
  *    - The minimum window size is 32x32 instead of 1x1.
- *    - The scaling is done to the nearest pixel, giving a shimmering effect
- *	to the image during window resizing.
+ *    - AG_PIXMAP_RESCALE's scaling is done to the nearest pixel, giving a
+ *	shimmering effect to the image during window resizing, so we do the
+ *	scaling ourselves in scale-agar.c.
+ *
+ * JPEGs are turned the way their EXIF orientation says, and the r and l keys
+ * turn the image a quarter turn clockwise and anticlockwise and h and v flip
+ * it left to right and top to bottom. The source image is turned once for
+ * each (see scale-agar.c) and the frames are scaled from that.
  */
 
 #include <agar/core.h>
 #include <agar/gui.h>
 
+#include "scale-agar.h"
+#include "exifthumb.h"
+#include "rotate.h"
+#include "stamp.h"
+#include "trace.h"
+
 /* Called when they hit the [X] in the title bar to make the application quit */
 static void QuitGUI_handler(AG_Event *event) { AG_QuitGUI(); }
 
+static AG_Window	*window;
+static AG_Pixmap	*pixmap;
+
+/* Turn or flip the image on the r, l, h and v keys, turning the window with
+ * it if it changes shape. Global keys are bound to functions of no
+ * arguments, hence one for each. */
+static void
+turnImage(int key)
+{
+    if (scaledPixmapTurn(pixmap, key) == 0 && ROTATE_SWAPS(key))
+	AG_WindowSetGeometry(window, AGWIDGET(window)->x, AGWIDGET(window)->y,
+			     HEIGHT(window), WIDTH(window));
+}
+static void turnClockwise(void) { turnImage(ROTATE_CLOCKWISE); }
+static void turnAnticlockwise(void) { turnImage(ROTATE_ANTICLOCKWISE); }
+static void flipLeftRight(void) { turnImage(ROTATE_FLIP_LEFT_RIGHT); }
+static void flipTopBottom(void) { turnImage(ROTATE_FLIP_TOP_BOTTOM); }
+
 int
 main(int argc, char **argv)
 {
-    AG_Window	*window;
     AG_Surface	*surface;
-    AG_Pixmap	*pixmap;
     char *imageFilename = (argc > 1) ? argv[1] : "image.jpg";
 
     if (AG_InitCore(NULL, 0) == -1 ||
@@ -51,13 +79,17 @@ main(int argc, char **argv)
 		    AG_GetError());
 	    exit(1);
     }
+    stamp("init");
 
+    trace_begin("decode");
     surface = AG_SurfaceFromFile(imageFilename);
+    trace_end("decode");
     if (!surface) {
 	fprintf(stderr, "Cannot make surface from file %s: %s.\n",
 		imageFilename, AG_GetError());
 	exit(1);
     }
+    stamp("decode");
 
     window = AG_WindowNew(0);
     if (!window) {
@@ -69,18 +101,22 @@ main(int argc, char **argv)
     AG_WindowSetCaption(window, "image1-agar");
 
     AG_BindGlobalKey(AG_KEY_Q, AG_KEYMOD_CTRL, AG_QuitGUI);
+    AG_BindGlobalKey(AG_KEY_R, AG_KEYMOD_NONE, turnClockwise);
+    AG_BindGlobalKey(AG_KEY_L, AG_KEYMOD_NONE, turnAnticlockwise);
+    AG_BindGlobalKey(AG_KEY_H, AG_KEYMOD_NONE, flipLeftRight);
+    AG_BindGlobalKey(AG_KEY_V, AG_KEYMOD_NONE, flipTopBottom);
     AG_SetEvent(window, "window-close", QuitGUI_handler, "");
 
     /* Without EXPAND, the image is never made bigger than its original size.
      * The window can be made smaller, in which case the image is scaled in
      * the horizontal direction but truncated in the vertical. */
-    pixmap = AG_PixmapFromSurface(
-	window, AG_PIXMAP_RESCALE|AG_PIXMAP_EXPAND, surface);
+    pixmap = scaledPixmapNew(window, AG_PIXMAP_EXPAND, surface);
     if (!pixmap) {
 	fprintf(stderr, "Cannot make pixmap from surface: %s.\n",
 		AG_GetError());
 	exit(1);
     }
+    scaledPixmapTurn(pixmap, exifthumb_orientation(imageFilename));
 
     AG_WindowShow(window);
 
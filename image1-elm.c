@@ -8,13 +8,26 @@
  * If they hit Control-Q or poke the [X] icon in the window's titlebar,
  * the application should quit.
  *
+ * JPEGs are turned the way their EXIF orientation says, and the r and l keys
+ * turn the image a quarter turn clockwise and anticlockwise and h and v flip
+ * it left to right and top to bottom. It's the image's pixels that are
+ * turned, once (see rotate-evas.c), and Evas scales those as before.
+ *
  * Bugs: None.
  *
  *     Martin Guy <martinwguy@gmail.com>, October 2016.
  */
 #include <Elementary.h>
+#include "stamp.h"
+#include "trace.h"
+#include "stats.h"
+#include "exifthumb.h"
+#include "rotate.h"
+#include "rotate-evas.h"
 
 static void keyDown(void *data, Evas *e, Evas_Object *obj, void *event_info);
+static void imageResized(void *data, Evas *e, Evas_Object *obj, void *event_info);
+static Eina_Bool serviceStats(void *data, Ecore_Fd_Handler *handler);
  
 EAPI_MAIN int
 elm_main(int argc, char **argv)
@@ -23,23 +36,34 @@ elm_main(int argc, char **argv)
    Evas_Object *image;
    char *filename = (argc > 1) ? argv[1] : "image.jpg";
 
+   stamp("init");	/* ELM_MAIN() has initialised it before calling us */
    elm_policy_set(ELM_POLICY_QUIT, ELM_POLICY_QUIT_LAST_WINDOW_CLOSED);
+
+   /* Report the stats on SIGUSR1 or to the stats socket */
+   stats_init("image1-elm");
+   ecore_main_fd_handler_add(stats_fd(), ECORE_FD_READ, serviceStats,
+			     NULL, NULL, NULL);
  
    win = elm_win_util_standard_add("Image", "image1-elm");
    elm_win_title_set(win, "image1-elm");
    elm_win_autodel_set(win, EINA_TRUE);
-   evas_object_event_callback_add(win, EVAS_CALLBACK_KEY_DOWN, keyDown, NULL);
 
    image = elm_image_add(win);
    elm_image_resizable_set(image, EINA_TRUE, EINA_TRUE);
    elm_image_aspect_fixed_set(image, EINA_FALSE);
+   evas_object_event_callback_add(win, EVAS_CALLBACK_KEY_DOWN, keyDown, image);
+   trace_begin("decode");
    elm_image_file_set(image, filename, NULL);
+   trace_end("decode");
+   stamp("decode");
+   evasImageTurn(elm_image_object_get(image), exifthumb_orientation(filename));
    {
       int w, h;
       elm_image_object_size_get(image, &w, &h);
       evas_object_resize(win, w, h);
    }
    elm_win_resize_object_add(win, image);
+   evas_object_event_callback_add(image, EVAS_CALLBACK_RESIZE, imageResized, NULL);
    evas_object_show(image);
    evas_object_show(win);
 
@@ -50,16 +74,44 @@ elm_main(int argc, char **argv)
 
 ELM_MAIN()
 
-/* Quit on Control-Q */
+/* Quit on Control-Q. Turn or flip the image, which is "data", for the keys
+ * that do that, turning the window with it. */
 static void
 keyDown(void *data, Evas *evas, Evas_Object *obj, void *einfo)
 {
     const Evas_Modifier *mods;
     Evas_Event_Key_Down *ev = einfo;
+    int key;
 
     mods = evas_key_modifier_get(evas);
     if (evas_key_modifier_is_set(mods, "Control") &&
 	strcmp(ev->key, "q") == 0) {
 	exit(0);	/* There has to be a more graceful way! */
     }
+    if (!evas_key_modifier_is_set(mods, "Control") &&
+	!evas_key_modifier_is_set(mods, "Alt") &&
+	ev->key[0] != '\0' && ev->key[1] == '\0' &&
+	(key = rotate_key(ev->key[0])) != 0 &&
+	evasImageTurn(elm_image_object_get(data), key) == 0 &&
+	ROTATE_SWAPS(key)) {
+	int w, h;
+
+	evas_object_geometry_get(obj, NULL, NULL, &w, &h);
+	evas_object_resize(obj, h, w);
+    }
+}
+
+/* Count the resizes. Evas does the scaling itself when it renders. */
+static void
+imageResized(void *data, Evas *evas, Evas_Object *obj, void *einfo)
+{
+    stats_add(STAT_RESIZES, 1);
+}
+
+/* Print the stats or send them to whoever connected to the stats socket */
+static Eina_Bool
+serviceStats(void *data, Ecore_Fd_Handler *handler)
+{
+    stats_service();
+    return ECORE_CALLBACK_RENEW;
 }
@@ -8,6 +8,11 @@
  * If they hit Control-Q or poke the [X] icon in the window's titlebar,
  * the application should quit.
  *
+ * JPEGs are turned the way their EXIF orientation says, and the r and l keys
+ * turn the image a quarter turn clockwise and anticlockwise and h and v flip
+ * it left to right and top to bottom. It's the image's pixels that are
+ * turned, once (see rotate-evas.c), and Evas scales those as before.
+ *
  * See http://docs.enlightenment.org/auto/Ecore_Evas_Window_Sizes_Example_c.html
  *
  * Bugs: None.
@@ -16,9 +21,17 @@
  */
 #include <Ecore.h>
 #include <Ecore_Evas.h>
+#include "stamp.h"
+#include "trace.h"
+#include "stats.h"
+#include "exifthumb.h"
+#include "rotate.h"
+#include "rotate-evas.h"
 
 static void keyDown(void *data, Evas *e, Evas_Object *obj, void *event_info);
 static void quitGUI(Ecore_Evas *ee);
+static void imageResized(void *data, Evas *e, Evas_Object *obj, void *event_info);
+static Eina_Bool serviceStats(void *data, Ecore_Fd_Handler *handler);
  
 int
 main(int argc, char **argv)
@@ -39,6 +52,13 @@ main(int argc, char **argv)
 	fputs("Can't initialise graphics system.\n", stderr);
 	exit(1);
     }
+    stamp("init");
+
+    /* Report the stats on SIGUSR1 or to the stats socket */
+    stats_init("image1-evas");
+    ecore_main_fd_handler_add(stats_fd(), ECORE_FD_READ, serviceStats,
+			      NULL, NULL, NULL);
+
     ecore_evas_callback_delete_request_set(ee, quitGUI);
     ecore_evas_title_set(ee, "image1-evas");
     ecore_evas_show(ee);
@@ -52,7 +72,9 @@ main(int argc, char **argv)
 #endif
 
     /* Load the image file */
+    trace_begin("decode");
     evas_object_image_file_set(image, filename, NULL);
+    trace_end("decode");
     {
 	int err = evas_object_image_load_error_get(image);
 	if (err != EVAS_LOAD_ERROR_NONE) {
@@ -60,6 +82,8 @@ main(int argc, char **argv)
 	    exit(1);
 	}
     }
+    stamp("decode");
+    evasImageTurn(image, exifthumb_orientation(filename));
     evas_object_show(image);
 
     /* Set the window size to fit the image */
@@ -70,7 +94,8 @@ main(int argc, char **argv)
     ecore_evas_object_associate(ee, image, 0);
 
     evas_object_focus_set(image, EINA_TRUE); // Without this, no keydown events
-    evas_object_event_callback_add(image, EVAS_CALLBACK_KEY_DOWN, keyDown, NULL);
+    evas_object_event_callback_add(image, EVAS_CALLBACK_KEY_DOWN, keyDown, ee);
+    evas_object_event_callback_add(image, EVAS_CALLBACK_RESIZE, imageResized, NULL);
 
     ecore_main_loop_begin();
 
@@ -80,15 +105,29 @@ main(int argc, char **argv)
     return 0;
 }
 
+/* Quit on Control-Q. Turn or flip the image for the keys that do that,
+ * turning the window, which is "data", with it. */
 static void
 keyDown(void *data, Evas *evas, Evas_Object *obj, void *einfo)
 {
     Evas_Event_Key_Down *ev = einfo;
     const Evas_Modifier *mods = evas_key_modifier_get(evas);
+    int key;
 
     if (evas_key_modifier_is_set(mods, "Control") &&
 	strcmp(ev->key, "q") == 0)
 	ecore_main_loop_quit();
+    if (!evas_key_modifier_is_set(mods, "Control") &&
+	!evas_key_modifier_is_set(mods, "Alt") &&
+	ev->key[0] != '\0' && ev->key[1] == '\0' &&
+	(key = rotate_key(ev->key[0])) != 0 &&
+	evasImageTurn(obj, key) == 0 &&
+	ROTATE_SWAPS(key)) {
+	int w, h;
+
+	ecore_evas_geometry_get(data, NULL, NULL, &w, &h);
+	ecore_evas_resize(data, h, w);
+    }
 }
 
 /* Quit on Control-Q */
@@ -97,3 +136,18 @@ quitGUI(Ecore_Evas *ee EINA_UNUSED)
 {
     ecore_main_loop_quit();
 }
+
+/* Count the resizes. Evas does the scaling itself when it renders. */
+static void
+imageResized(void *data, Evas *evas, Evas_Object *obj, void *einfo)
+{
+    stats_add(STAT_RESIZES, 1);
+}
+
+/* Print the stats or send them to whoever connected to the stats socket */
+static Eina_Bool
+serviceStats(void *data, Ecore_Fd_Handler *handler)
+{
+    stats_service();
+    return ECORE_CALLBACK_RENEW;
+}
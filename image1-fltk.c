@@ -1,11 +1,273 @@
+/*
+ * image1-fltk.c: GUI toolkit test piece to display an image file.
+ *
+ * The image file is given as a command-line argument (default: image.jpg).
+ * The window should open to exactly fit the image at one-pixel-per-pixel size.
+ * The user can then resize the window in which case the image scales to fit
+ * the window without keeping its aspect ratio.
+ * If they hit Control-Q or poke the [X] icon in the window's titlebar,
+ * the application should quit.
+ *
+ * Despite the name, FLTK is C++ so this is too.
+ *
+ * FLTK's image scaler, Fl_Image::copy(w,h), only looks at the nearest source
+ * pixels so when reducing by more than 2x it aliases, like IUP's does.
+ * So we keep a pyramid of copies of the image halved in width and height
+ * with scale.c's area-averaging scaler and copy() from the one that is
+ * less than twice the window size.
+ * The results of copy() are kept for the last few window sizes so that
+ * repeated exposures don't rescale.
+ *
+ * JPEGs are turned the way their EXIF orientation says, and the r and l keys
+ * turn the image a quarter turn clockwise and anticlockwise and h and v flip
+ * it left to right and top to bottom. The source image is turned once for
+ * each (see rotate.c) and the pyramid is made again from that.
+ *
+ * Bugs:
+ *    - None known.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
 #include <FL/Fl.H>
-#include <FL/Fl_Window.H>
-#include <FL/Fl_Button.H>
-
-int main(int argc, char *argv[]) {
-   Fl_Window* w = new Fl_Window(330, 190, "image1-fltk");
-   new Fl_Button(110, 130, 100, 35, "Okay");
-   w->end();
-   w->show(argc, argv);
-   return Fl::run();
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Widget.H>
+#include <FL/Fl_Shared_Image.H>
+#include <FL/Fl_RGB_Image.H>
+#include <FL/Fl_Pixmap.H>
+#include <FL/fl_draw.H>
+#include <FL/x.H>
+
+#include "stamp.h"
+
+extern "C" {
+#include "scale.h"
+#include "trace.h"
+#include "exifthumb.h"
+#include "rotate.h"
+}
+
+#define MAXLEVELS 32	/* Max number of halvings in each direction */
+#define NCACHED 8	/* How many scaled copies to keep */
+
+class ImageBox : public Fl_Widget {
+public:
+    ImageBox(int X, int Y, Fl_RGB_Image *image);
+    void draw();
+    int handle(int event);
+    void turn(int orientation);
+
+private:
+    Fl_RGB_Image *level(int kx, int ky);
+    Fl_Image *scaledCopy(int W, int H);
+
+    /* levels[kx][ky] is the source image with its width halved kx times
+     * and its height halved ky times. levels[0][0] is the source itself. */
+    Fl_RGB_Image *levels[MAXLEVELS][MAXLEVELS];
+
+    /* The most recent scaled copies */
+    struct {
+	int w, h;
+	Fl_Image *image;
+    } cache[NCACHED];
+    int nextCached;	/* Which cache entry to replace next */
+};
+
+ImageBox::ImageBox(int X, int Y, Fl_RGB_Image *image)
+    : Fl_Widget(X, Y, image->w(), image->h())
+{
+    int i, j;
+
+    for (i = 0; i < MAXLEVELS; i++)
+	for (j = 0; j < MAXLEVELS; j++)
+	    levels[i][j] = NULL;
+    levels[0][0] = image;
+    for (i = 0; i < NCACHED; i++) cache[i].image = NULL;
+    nextCached = 0;
+}
+
+void
+ImageBox::draw()
+{
+    Fl_Image *image = scaledCopy(w(), h());
+
+    trace_begin("present");
+    if (image) image->draw(x(), y());
+    else fl_rectf(x(), y(), w(), h(), FL_BLACK);
+    trace_end("present");
+    stamp("present");
+}
+
+/* Quit on Control-Q. Turn or flip the image for the keys that do that,
+ * turning the window with it. */
+int
+ImageBox::handle(int event)
+{
+    int key;
+
+    if (event == FL_SHORTCUT && Fl::event_key() == 'q' &&
+	(Fl::event_state() & FL_CTRL))
+	exit(0);
+    if (event == FL_SHORTCUT && !(Fl::event_state() & (FL_CTRL | FL_ALT)) &&
+	(key = rotate_key(Fl::event_key())) != 0) {
+	turn(key);
+	if (ROTATE_SWAPS(key)) window()->size(window()->h(), window()->w());
+	redraw();
+	return 1;
+    }
+    return Fl_Widget::handle(event);
+}
+
+/* Turn the source image the way an EXIF orientation says and forget the
+ * pyramid and the scaled copies made from it the old way up. */
+void
+ImageBox::turn(int orientation)
+{
+    Fl_RGB_Image *from = levels[0][0];
+    uchar *pixels;
+    int W, H, d, pitch, i, j;
+
+    if (orientation == 1) return;
+    W = ROTATE_SWAPS(orientation) ? from->h() : from->w();
+    H = ROTATE_SWAPS(orientation) ? from->w() : from->h();
+    d = from->d();
+    pitch = from->ld() ? from->ld() : from->w() * d;
+
+    pixels = new uchar[W * H * d];
+    trace_begin("rotate");
+    rotate_pixels((const unsigned char *) from->data()[0],
+		  from->w(), from->h(), pitch, pixels, W * d, d, orientation);
+    trace_end("rotate");
+
+    for (i = 0; i < MAXLEVELS; i++) {
+	for (j = 0; j < MAXLEVELS; j++) {
+	    delete levels[i][j];
+	    levels[i][j] = NULL;
+	}
+    }
+    levels[0][0] = new Fl_RGB_Image(pixels, W, H, d);
+    levels[0][0]->alloc_array = 1;	/* Delete pixels with the image */
+    for (i = 0; i < NCACHED; i++) {
+	delete cache[i].image;
+	cache[i].image = NULL;
+    }
+}
+
+/* Return the pyramid level halved kx times in width and ky in height,
+ * making it (and the ones above it) if we haven't already. */
+Fl_RGB_Image *
+ImageBox::level(int kx, int ky)
+{
+    Fl_RGB_Image *from;
+    uchar *pixels;
+    int W, H, d, pitch;
+
+    if (levels[kx][ky]) return levels[kx][ky];
+
+    from = (kx > 0) ? level(kx - 1, ky) : level(kx, ky - 1);
+    if (from == NULL) return NULL;
+
+    W = (kx > 0) ? (from->w() + 1) / 2 : from->w();
+    H = (kx > 0) ? from->h() : (from->h() + 1) / 2;
+    d = from->d();
+    pitch = from->ld() ? from->ld() : from->w() * d;
+
+    pixels = new uchar[W * H * d];
+    trace_scale(from->w(), from->h(), W, H, "area");
+    if (scale_pixels((const unsigned char *) from->data()[0],
+		     from->w(), from->h(), pitch,
+		     pixels, W, H, W * d, d) == -1) {
+	trace_end("scale");
+	delete[] pixels;
+	return NULL;
+    }
+    trace_end("scale");
+    levels[kx][ky] = new Fl_RGB_Image(pixels, W, H, d);
+    levels[kx][ky]->alloc_array = 1;	/* Delete pixels with the image */
+
+    return levels[kx][ky];
+}
+
+/* Return the image scaled to W x H from the cache or make it and cache it */
+Fl_Image *
+ImageBox::scaledCopy(int W, int H)
+{
+    Fl_RGB_Image *from;
+    int i, kx, ky, lw, lh;
+
+    for (i = 0; i < NCACHED; i++)
+	if (cache[i].image && cache[i].w == W && cache[i].h == H)
+	    return cache[i].image;
+
+    /* Find the pyramid level that is less than twice the target size */
+    for (kx = 0, lw = levels[0][0]->w(); lw > 2 * W && kx < MAXLEVELS - 1; kx++)
+	lw = (lw + 1) / 2;
+    for (ky = 0, lh = levels[0][0]->h(); lh > 2 * H && ky < MAXLEVELS - 1; ky++)
+	lh = (lh + 1) / 2;
+    from = level(kx, ky);
+    if (from == NULL) from = levels[0][0];	/* Out of memory. Alias. */
+
+    delete cache[nextCached].image;
+    cache[nextCached].w = W;
+    cache[nextCached].h = H;
+    trace_scale(from->w(), from->h(), W, H, "bilinear");
+    cache[nextCached].image = from->copy(W, H);
+    trace_end("scale");
+    stamp("scale");
+    i = nextCached;
+    nextCached = (nextCached + 1) % NCACHED;
+
+    return cache[i].image;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *filename = (argc > 1) ? argv[1] : "image.jpg";
+    Fl_Shared_Image *shared;
+    Fl_RGB_Image *image;	/* As read from the file */
+    Fl_Double_Window *window;
+    ImageBox *box;
+    int orientation, W, H;
+
+    fl_open_display();
+    fl_register_images();
+    stamp("init");
+    trace_begin("decode");
+    shared = Fl_Shared_Image::get(filename);
+    trace_end("decode");
+    if (shared == NULL || shared->w() == 0 || shared->h() == 0) {
+	fprintf(stderr, "Cannot read image from %s.\n", filename);
+	exit(1);
+    }
+    stamp("decode");
+
+    /* Get the pixels as RGB, or as RGBA if it has transparency.
+     * GIF and XPM are pixmaps with a color table, so convert those. */
+    if (shared->count() == 1) {
+	image = new Fl_RGB_Image((const uchar *) shared->data()[0],
+				 shared->w(), shared->h(), shared->d(),
+				 shared->ld());
+    } else {
+	Fl_Pixmap pixmap(shared->data());
+	image = new Fl_RGB_Image(&pixmap);
+    }
+    /* Bilinear for the last step from the pyramid level to the window */
+    Fl_Image::RGB_scaling(FL_RGB_SCALING_BILINEAR);
+
+    /* Turning it deletes "image" */
+    orientation = exifthumb_orientation(filename);
+    W = ROTATE_SWAPS(orientation) ? image->h() : image->w();
+    H = ROTATE_SWAPS(orientation) ? image->w() : image->h();
+    window = new Fl_Double_Window(W, H, "image1-fltk");
+    box = new ImageBox(0, 0, image);
+    box->turn(orientation);
+    box->size(W, H);
+    window->end();
+    window->resizable(box);
+    window->size_range(1, 1);
+    /* show(argc, argv) would reject the filename as a bad option */
+    window->show();
+
+    return Fl::run();
 }
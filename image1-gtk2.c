@@ -8,6 +8,17 @@
  * If they hit Control-Q or poke the [X] icon in the window's titlebar,
  * the application should quit.
  *
+ * If it's a photo with a preview in its EXIF data, that is shown scaled up
+ * while the image is read in another thread (see preview-gdk.c).
+ * With IMAGE_LINEAR=1 it's scaled in linear light (see bands-gdk.c).
+ * Photos are turned the way their EXIF orientation says, and the r and l
+ * keys turn the image a quarter turn clockwise and anticlockwise and h and v
+ * flip it left to right and top to bottom. It's the source pixbuf that is
+ * turned, once (see rotate.c), and the frames are scaled from that.
+ * Control-L shows the levels window, whose black point, white point and
+ * gamma sliders, for all channels or for one, are applied as the image is
+ * scaled to the window, over the image's histogram (see levels-gtk.c).
+ *
  * Bugs:
  *    - If its window is covered by another window and the obsuring window
  *	is moved, the image1-gtk2 window doesn't repaint, and exposed regions
@@ -18,34 +29,85 @@
 
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
+#include <stdlib.h>	/* for exit() */
+#include "stamp.h"
+#include "trace.h"
+#include "stats.h"
+#include "pixcache-gdk.h"
+#include "budget-gdk.h"
+#include "preview-gdk.h"
+#include "levels.h"
+#include "bands-gdk.h"
+#include "levels-gtk.h"
+#include "rotate.h"
 
 /* Event callbacks */
 static gboolean keyPress(GtkWidget *widget, gpointer data);
 static gboolean exposeImage(GtkWidget *widget, GdkEventExpose *event, gpointer data);
+static gboolean serviceStats(GIOChannel *source, GIOCondition condition, gpointer data);
+static void imageRead(GdkPixbuf *pixbuf, GError *error, gpointer data);
+static void levelsMoved(gpointer data);
+
+static GdkPixbuf *sourcePixbuf = NULL;	/* As read from a file, or the preview */
+static GtkWidget *image;		/* As displayed on the screen */
+static gboolean sourceChanged = FALSE;	/* Scale it even if the size hasn't */
+static gboolean sizeUndone = FALSE;	/* Has the first expose freed its size? */
+static int turn = 1;			/* How the keys have turned it */
 
 int
 main(int argc, char **argv)
 {
     GtkWidget *window;
-    GdkPixbuf *sourcePixbuf = NULL;	/* As read from a file */
-    GtkWidget *image;		/* As displayed on the screen */
-    char *filename =  (argc > 1) ? argv[1] : "image.jpg";
-    gtk_init(&argc, &argv);
+    char *filename;
+    GError *error = NULL;
+    gint width, height;		/* The size of the image */
 
-    /* Make pixbuf, then make image from pixbuf because
-     * gtk_image_new_from_file() doesn't flag errors */
-    {
-	GError *error = NULL;
-	sourcePixbuf = gdk_pixbuf_new_from_file(filename, &error);
+    if (!gtk_init_with_args(&argc, &argv, "[FILE]", budgetOptions, NULL,
+			    &error)) {
+	g_message("%s", error->message);
+	return 1;
+    }
+    filename = (argc > 1) ? argv[1] : "image.jpg";
+    stamp("init");
+
+    /* Report the stats on SIGUSR1 or to the stats socket */
+    stats_init("image1-gtk2");
+    g_io_add_watch(g_io_channel_unix_new(stats_fd()), G_IO_IN,
+		   serviceStats, NULL);
+
+    if (getenv("IMAGE_LINEAR") && atoi(getenv("IMAGE_LINEAR")))
+	bandsSetLinear(TRUE);
+
+    /* Show the preview while the image is read, if it has one */
+    trace_begin("preview");
+    sourcePixbuf = previewPixbufNewFromFile(filename, budgetSourceBytes(),
+					    &width, &height, imageRead, NULL);
+    trace_end("preview");
+    if (sourcePixbuf != NULL) {
+	budgetTrack(sourcePixbuf);
+	stamp("preview");
+    } else {
+	/* Make pixbuf, then make image from pixbuf because
+	 * gtk_image_new_from_file() doesn't flag errors */
+	trace_begin("decode");
+	sourcePixbuf = budgetTrack(orientedPixbufNewFromFile(filename,
+					budgetSourceBytes(), &error));
+	trace_end("decode");
 	if (sourcePixbuf == NULL) {
 	    g_message("%s", error->message);
 	    return 1; /* exit() */
 	}
+	stamp("decode");
+	width = gdk_pixbuf_get_width(sourcePixbuf);
+	height = gdk_pixbuf_get_height(sourcePixbuf);
     }
 
-    /* On expose/resize, the image's pixbuf will be overwritten
-     * but we will still need the original image so take a copy of it */
-    image = gtk_image_new_from_pixbuf(gdk_pixbuf_copy(sourcePixbuf));
+    /* It starts by showing the source pixbuf itself. On expose/resize,
+     * the image is given a scaled copy, which it owns.
+     * A preview is smaller than the image, so we ask for the image's size
+     * until the first expose has scaled it up to that. */
+    image = gtk_image_new_from_pixbuf(sourcePixbuf);
+    gtk_widget_set_size_request(image, width, height);
 
     window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_window_set_title(GTK_WINDOW(window), "image1-gtk2");
@@ -57,7 +119,7 @@ main(int argc, char **argv)
     g_signal_connect(window, "key-press-event", G_CALLBACK(keyPress), NULL);
 
     /* When the window is resized, scale the image to fit */
-    g_signal_connect(image, "expose-event", G_CALLBACK(exposeImage), sourcePixbuf);
+    g_signal_connect(image, "expose-event", G_CALLBACK(exposeImage), NULL);
 
     gtk_container_add(GTK_CONTAINER(window), image);
     gtk_widget_show_all(window);
@@ -76,31 +138,100 @@ main(int argc, char **argv)
 
 /* Callback functions */
 
-/* Check for Control-Q and quit if it was pressed */
+/* Check for Control-Q and quit if it was pressed, and Control-L for the
+ * levels. Turn or flip the image for the keys that do that, turning the
+ * window with it. */
 static gboolean
 keyPress(GtkWidget *widget, gpointer data)
 {
     GdkEventKey *event = (GdkEventKey *) data;
+    int key;
 
     if (event->keyval == GDK_q && (event->state & GDK_CONTROL_MASK)) {
 	gtk_main_quit();
 	return FALSE;
-    } else
+    }
+    if (event->keyval == GDK_l && (event->state & GDK_CONTROL_MASK)) {
+	levelsToggle(GTK_WINDOW(widget), sourcePixbuf, levelsMoved, NULL);
 	return TRUE;
+    }
+    if (!(event->state & (GDK_CONTROL_MASK | GDK_MOD1_MASK)) &&
+	(key = rotate_key(event->keyval)) != 0) {
+	GdkPixbuf *turned;
+
+	trace_begin("rotate");
+	/* It takes a reference, so we keep ours if it can't */
+	turned = orientPixbuf(g_object_ref(sourcePixbuf), key);
+	trace_end("rotate");
+	if (turned == NULL) return TRUE;
+	g_object_unref(sourcePixbuf);
+	sourcePixbuf = budgetTrack(turned);
+	turn = rotate_then(turn, key);
+	sourceChanged = TRUE;
+	if (ROTATE_SWAPS(key))
+	    gtk_window_resize(GTK_WINDOW(widget), image->allocation.height,
+			      image->allocation.width);
+	gtk_widget_queue_draw(image);
+    }
+    return TRUE;
+}
+
+/* The image has been read in the background. Show it instead of the preview. */
+static void
+imageRead(GdkPixbuf *pixbuf, GError *error, gpointer data)
+{
+    if (pixbuf == NULL) {
+	g_message("%s", error->message);
+	exit(1);
+    }
+    stamp("decode");
+    /* Turned the way they've turned the preview */
+    if ((pixbuf = orientPixbuf(pixbuf, turn)) == NULL) {
+	g_message("Can't turn the image");
+	exit(1);
+    }
+    g_object_unref(sourcePixbuf);	/* The image may still have it */
+    sourcePixbuf = budgetTrack(pixbuf);
+    sourceChanged = TRUE;
+    levelsSetSource(sourcePixbuf);
+    gtk_widget_queue_draw(image);
+}
+
+/* A levels slider has moved. Scale it again through the new tables. */
+static void
+levelsMoved(gpointer data)
+{
+    sourceChanged = TRUE;
+    gtk_widget_queue_draw(image);
+}
+
+/* Print the stats or send them to whoever connected to the stats socket */
+static gboolean
+serviceStats(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    stats_service();
+    return TRUE;
 }
 
-static int int_sqrt(int n);
+static guint32 int_sqrt(guint64 n);
 
 /* If the window has been resized, resize the image to it. */
 static gboolean
 exposeImage(GtkWidget *widget, GdkEventExpose *event, gpointer data)
 {
-    GdkPixbuf *sourcePixbuf = data;	/* As read from a file */
     GdkPixbuf *imagePixbuf;	/* pixbuf of the on-screen image */
     GdkPixbuf *readFrom;	/* the image we need to compress */
+    GdkPixbuf *scaled;		/* readFrom scaled to the window */
+    long long start;		/* When we started scaling, for the stats */
     guint32 from_width, from_height;	/* Size of readFrom */
     guint32 to_width, to_height;	/* Target size */
 
+    /* Stop asking for the size it started at, so they can shrink it */
+    if (!sizeUndone) {
+	gtk_widget_set_size_request(widget, -1, -1);
+	sizeUndone = TRUE;
+    }
+
     imagePixbuf = gtk_image_get_pixbuf(GTK_IMAGE(widget));
     if (imagePixbuf == NULL) {
 	g_message("Can't get on-screen pixbuf");
@@ -115,8 +246,27 @@ exposeImage(GtkWidget *widget, GdkEventExpose *event, gpointer data)
     /* Recreate the displayed image if the image size has changed. */
 
     /* Eliminate repeated calls to the same size */
-    if (to_width == from_width && to_height == from_height)
+    if (!sourceChanged &&
+	to_width == gdk_pixbuf_get_width(imagePixbuf) &&
+	to_height == gdk_pixbuf_get_height(imagePixbuf)) {
+	    stats_add(STAT_CACHE_HITS, 1);
+	    stamp("present");	/* GTK draws it when we return */
 	    return FALSE;
+    }
+    /* Back to the original size: show the original, unless it has to go
+     * through the levels */
+    if (to_width == from_width && to_height == from_height &&
+	!bandsLevelled()) {
+	    if (!sourceChanged) stats_add(STAT_RESIZES, 1);
+	    sourceChanged = FALSE;
+	    stats_add(STAT_CACHE_HITS, 1);
+	    gtk_image_set_from_pixbuf(GTK_IMAGE(widget), sourcePixbuf);
+	    stamp("present");	/* GTK draws it when we return */
+	    return FALSE;
+    }
+    if (!sourceChanged) stats_add(STAT_RESIZES, 1);
+    sourceChanged = FALSE;
+    stats_add(STAT_CACHE_MISSES, 1);
 
 #if 0
     /*
@@ -128,51 +278,59 @@ exposeImage(GtkWidget *widget, GdkEventExpose *event, gpointer data)
      * in two steps.
      */
     {
-	int area_ratio = (from_width * from_height) / (to_width  * to_height);
+	/* 64-bit because a big image's width times another width overflows */
+	guint64 area_ratio = ((guint64) from_width * from_height) /
+			     ((guint64) to_width * to_height);
 	int x_ratio = from_width / to_width;
 	int y_ratio = from_height / to_height;
 	int temp_width, temp_height;
 
         if (area_ratio >= 1600) {
 	    /* Do two downscales, each of the same ratio */
-	    temp_width = int_sqrt(from_width * to_width);
-	    temp_height = int_sqrt(from_height * to_height);
+	    temp_width = int_sqrt((guint64) from_width * to_width);
+	    temp_height = int_sqrt((guint64) from_height * to_height);
 	} else if (x_ratio >= 256) {
-	    temp_width = int_sqrt(from_width * to_width);
+	    temp_width = int_sqrt((guint64) from_width * to_width);
 	    temp_height = from_height;
 	} else if (y_ratio >= 256) {
 	    temp_width = from_width;
-	    temp_height = int_sqrt(from_height * to_height);
+	    temp_height = int_sqrt((guint64) from_height * to_height);
 	 } else
 	    goto one_step;
 
-	gtk_image_set_from_pixbuf(
-	    GTK_IMAGE(widget),
-	    gdk_pixbuf_scale_simple(readFrom, temp_width, temp_height,
-				    GDK_INTERP_BILINEAR)
-	);
-	g_object_unref(imagePixbuf); /* Free the old one */
-	readFrom = imagePixbuf = gtk_image_get_pixbuf(GTK_IMAGE(widget));
+	scaled = budgetTrack(gdk_pixbuf_scale_simple(readFrom,
+				temp_width, temp_height, GDK_INTERP_BILINEAR));
+	gtk_image_set_from_pixbuf(GTK_IMAGE(widget), scaled);
+	g_object_unref(scaled);	/* The image has it now */
+	readFrom = scaled;
 	from_width = temp_width; from_height = temp_height;
     }
 #endif
 
 one_step:
     /* Now the real thing */
-    gtk_image_set_from_pixbuf(
-        GTK_IMAGE(widget),
-        gdk_pixbuf_scale_simple(readFrom, to_width, to_height,
-				GDK_INTERP_BILINEAR)
-    );
-    g_object_unref(imagePixbuf); /* Free the old one */
+    start = stats_now();
+    trace_scale(from_width, from_height, to_width, to_height, "bilinear");
+    /* On all cores, into the on-screen one if it's still the right size */
+    scaled = bandsPixbufScale(readFrom, imagePixbuf,
+			      to_width, to_height, GDK_INTERP_BILINEAR);
+    if (scaled != imagePixbuf) budgetTrack(scaled);
+    trace_end("scale");
+    stats_scaled(start, (long) to_width * to_height *
+			gdk_pixbuf_get_n_channels(readFrom));
+    /* The image drops the old one, freeing it unless it's the source */
+    gtk_image_set_from_pixbuf(GTK_IMAGE(widget), scaled);
+    if (scaled != NULL) g_object_unref(scaled);
+    stamp("scale");
+    stamp("present");	/* GTK draws it when we return */
 
     return FALSE;
 }
 
-static int
-int_sqrt (int n)
+static guint32
+int_sqrt (guint64 n)
 {
-    int a;
+    guint64 a;
     for (a=0; n >= (2*a)+1; n -= (2*a++)+1);
     return a;
 }
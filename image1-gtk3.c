@@ -15,6 +15,17 @@
  * We get round this by displaying a cairo drawing area inside a 1x1 grid
  * container, suggested by Eric Cecashon on the gtk-list mailing list.
  *
+ * If it's a photo with a preview in its EXIF data, that is drawn scaled up
+ * while the image is read in another thread (see preview-gdk.c).
+ * With IMAGE_LINEAR=1 it's scaled in linear light (see bands-gdk.c).
+ * Photos are turned the way their EXIF orientation says, and the r and l
+ * keys turn the image a quarter turn clockwise and anticlockwise and h and v
+ * flip it left to right and top to bottom. It's the source pixbuf that is
+ * turned, once (see rotate.c), and the frames are scaled from that.
+ * Control-L shows the levels window, whose black point, white point and
+ * gamma sliders, for all channels or for one, are applied as the image is
+ * scaled to the window, over the image's histogram (see levels-gtk.c).
+ *
  * Bugs:
  *    -	If you resize the window to 1x1, it goes into a 100% CPU loop. If
  *	you then enlarge the window again you are left with a white area
@@ -35,10 +46,27 @@ Aborted (core dumped)
 
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
+#include <stdlib.h>	/* for exit() */
+#include "stamp.h"
+#include "trace.h"
+#include "stats.h"
+#include "pixcache-gdk.h"
+#include "budget-gdk.h"
+#include "preview-gdk.h"
+#include "levels.h"
+#include "bands-gdk.h"
+#include "levels-gtk.h"
+#include "rotate.h"
 
 /* Event callbacks */
 static gboolean keyPress(GtkWidget *widget, gpointer data);
 static gboolean draw_picture(GtkWidget *widget, cairo_t *cr, gpointer data);
+static gboolean serviceStats(GIOChannel *source, GIOCondition condition, gpointer data);
+static void imageRead(GdkPixbuf *pixbuf, GError *error, gpointer data);
+static void levelsMoved(gpointer data);
+
+static GdkPixbuf *pixbuf = NULL;	/* As read from a file, or the preview */
+static int turn = 1;			/* How the keys have turned it */
 
 int
 main(int argc, char **argv)
@@ -46,22 +74,52 @@ main(int argc, char **argv)
     GtkWidget *window;
     GtkWidget *grid;
     GtkWidget *drawing_area;
-    GdkPixbuf *pixbuf = NULL;	/* As read from a file */
-    char *filename =  (argc > 1) ? argv[1] : "image.jpg";
+    char *filename;
+    GError *error = NULL;
+    gint width, height;		/* The size of the image */
+
+    if (!gtk_init_with_args(&argc, &argv, "[FILE]", budgetOptions, NULL,
+			    &error)) {
+	g_message("%s", error->message);
+	return 1;
+    }
+    filename = (argc > 1) ? argv[1] : "image.jpg";
+    stamp("init");
 
-    gtk_init(&argc, &argv);
+    /* Report the stats on SIGUSR1 or to the stats socket */
+    stats_init("image1-gtk3");
+    g_io_add_watch(g_io_channel_unix_new(stats_fd()), G_IO_IN,
+		   serviceStats, NULL);
 
-    /* Read source image from file */
-    {
-	GError *error = NULL;
-	pixbuf = gdk_pixbuf_new_from_file(filename, &error);
+    if (getenv("IMAGE_LINEAR") && atoi(getenv("IMAGE_LINEAR")))
+	bandsSetLinear(TRUE);
+
+    drawing_area = gtk_drawing_area_new();
+
+    /* Show the preview while the image is read, if it has one */
+    trace_begin("preview");
+    pixbuf = previewPixbufNewFromFile(filename, budgetSourceBytes(),
+				      &width, &height, imageRead, drawing_area);
+    trace_end("preview");
+    if (pixbuf != NULL) {
+	budgetTrack(pixbuf);
+	stamp("preview");
+    } else {
+	/* Read source image from file, at a reduced size if it would take
+	 * more than its share of --max-memory */
+	trace_begin("decode");
+	pixbuf = budgetTrack(orientedPixbufNewFromFile(filename,
+					budgetSourceBytes(), &error));
+	trace_end("decode");
 	if (pixbuf == NULL) {
 	    g_message("%s", error->message);
 	    return 1; /* exit() */
 	}
+	stamp("decode");
+	width = gdk_pixbuf_get_width(pixbuf);
+	height = gdk_pixbuf_get_height(pixbuf);
     }
 
-    drawing_area = gtk_drawing_area_new();
     gtk_widget_set_hexpand(drawing_area, TRUE);
     gtk_widget_set_vexpand(drawing_area, TRUE);
 
@@ -75,7 +133,7 @@ main(int argc, char **argv)
     g_signal_connect(window, "key-press-event", G_CALLBACK(keyPress), NULL);
 
     /* When the window is resized, scale the image to fit */
-    g_signal_connect(drawing_area, "draw", G_CALLBACK(draw_picture), pixbuf);
+    g_signal_connect(drawing_area, "draw", G_CALLBACK(draw_picture), NULL);
 
     grid = gtk_grid_new();
     gtk_grid_attach(GTK_GRID(grid), drawing_area, 0, 0, 1, 1);
@@ -83,9 +141,7 @@ main(int argc, char **argv)
     gtk_container_add(GTK_CONTAINER(window), grid);
 
     /* Open the window the same size as the image */
-    gtk_window_set_default_size(GTK_WINDOW(window),
-	gdk_pixbuf_get_width(pixbuf),
-	gdk_pixbuf_get_height(pixbuf));
+    gtk_window_set_default_size(GTK_WINDOW(window), width, height);
 
     gtk_widget_show_all(window);
 
@@ -96,17 +152,80 @@ main(int argc, char **argv)
 
 /* Callback functions */
 
-/* Check for Control-Q and quit if it was pressed */
+/* Check for Control-Q and quit if it was pressed, and Control-L for the
+ * levels. Turn or flip the image for the keys that do that, turning the
+ * window with it. */
 static gboolean
 keyPress(GtkWidget *widget, gpointer data)
 {
     GdkEventKey *event = (GdkEventKey *) data;
+    int key;
 
     if (event->keyval == GDK_KEY_q && (event->state & GDK_CONTROL_MASK)) {
 	gtk_main_quit();
 	return FALSE;
-    } else
+    }
+    if (event->keyval == GDK_KEY_l && (event->state & GDK_CONTROL_MASK)) {
+	levelsToggle(GTK_WINDOW(widget), pixbuf, levelsMoved, widget);
 	return TRUE;
+    }
+    if (!(event->state & (GDK_CONTROL_MASK | GDK_MOD1_MASK)) &&
+	(key = rotate_key(event->keyval)) != 0) {
+	GdkPixbuf *turned;
+	gint width, height;
+
+	trace_begin("rotate");
+	/* It takes a reference, so we keep ours if it can't */
+	turned = orientPixbuf(g_object_ref(pixbuf), key);
+	trace_end("rotate");
+	if (turned == NULL) return TRUE;
+	g_object_unref(pixbuf);
+	pixbuf = budgetTrack(turned);
+	turn = rotate_then(turn, key);
+	if (ROTATE_SWAPS(key)) {
+	    gtk_window_get_size(GTK_WINDOW(widget), &width, &height);
+	    gtk_window_resize(GTK_WINDOW(widget), height, width);
+	}
+	gtk_widget_queue_draw(widget);
+    }
+    return TRUE;
+}
+
+/* The image has been read in the background. Draw it instead of the preview. */
+static void
+imageRead(GdkPixbuf *newPixbuf, GError *error, gpointer data)
+{
+    GtkWidget *drawing_area = data;
+
+    if (newPixbuf == NULL) {
+	g_message("%s", error->message);
+	exit(1);
+    }
+    stamp("decode");
+    /* Turned the way they've turned the preview */
+    if ((newPixbuf = orientPixbuf(newPixbuf, turn)) == NULL) {
+	g_message("Can't turn the image");
+	exit(1);
+    }
+    g_object_unref(pixbuf);
+    pixbuf = budgetTrack(newPixbuf);
+    levelsSetSource(pixbuf);
+    gtk_widget_queue_draw(drawing_area);
+}
+
+/* A levels slider has moved. Draw it again through the new tables. */
+static void
+levelsMoved(gpointer data)
+{
+    gtk_widget_queue_draw(GTK_WIDGET(data));
+}
+
+/* Print the stats or send them to whoever connected to the stats socket */
+static gboolean
+serviceStats(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    stats_service();
+    return TRUE;
 }
 
 /* When the window is resized, that resizes the drawing area
@@ -115,13 +234,22 @@ keyPress(GtkWidget *widget, gpointer data)
 static gboolean
 draw_picture(GtkWidget *drawing_area, cairo_t *cr, gpointer data)
 {
-    GdkPixbuf *source = data;	/* As read from a file */
+    GdkPixbuf *source = pixbuf;	/* As read from a file */
     GdkPixbuf *image;		/* Scaled to the window */
     gint width = gtk_widget_get_allocated_width(drawing_area);
     gint height = gtk_widget_get_allocated_height(drawing_area);
     GdkPixbuf *readFrom;	/* the image that needs scaling */
+    GdkPixbuf *scaled;
+    static gint oldWidth = -1, oldHeight = -1;	/* Size at the last draw */
 
-    readFrom = source;
+    /* At the source's size we paint the source itself, so "image" always
+     * holds a reference that we drop when we've painted it. */
+    readFrom = image = g_object_ref(source);
+
+    if (width != oldWidth || height != oldHeight) {
+	stats_add(STAT_RESIZES, 1);
+	oldWidth = width; oldHeight = height;
+    }
 
     /* Recreate the displayed image if the image size has changed. */
 
@@ -137,32 +265,49 @@ draw_picture(GtkWidget *drawing_area, cairo_t *cr, gpointer data)
      */
     /* For reduction to a width of 1 */
     if (width != gdk_pixbuf_get_width(readFrom) && width == 1) {
-	image = gdk_pixbuf_scale_simple(readFrom,
+	scaled = budgetTrack(gdk_pixbuf_scale_simple(readFrom,
 				    width,
 				    gdk_pixbuf_get_height(readFrom),
-				    GDK_INTERP_BILINEAR);
-	readFrom = image;
+				    GDK_INTERP_BILINEAR));
+	g_object_unref(image);
+	readFrom = image = scaled;
     }
     /* and for reduction to a height of 1 */
     if (height != gdk_pixbuf_get_height(readFrom) &&
 	height == 1) {
-	image = gdk_pixbuf_scale_simple(readFrom,
+	scaled = budgetTrack(gdk_pixbuf_scale_simple(readFrom,
 				    gdk_pixbuf_get_width(readFrom),
 				    height,
-				    GDK_INTERP_BILINEAR);
-	readFrom = image;
+				    GDK_INTERP_BILINEAR));
+	g_object_unref(image);
+	readFrom = image = scaled;
     }
 
-    /* Now the real thing */
+    /* Now the real thing, which at the same size still goes through the
+     * levels if they're set */
     if (width != gdk_pixbuf_get_width(readFrom) ||
-        height != gdk_pixbuf_get_height(readFrom)) {
-	image = gdk_pixbuf_scale_simple(readFrom,
-				    width, height,
-				    GDK_INTERP_BILINEAR);
+        height != gdk_pixbuf_get_height(readFrom) || bandsLevelled()) {
+	long long start = stats_now();
+
+	stats_add(STAT_CACHE_MISSES, 1);
+	trace_scale(gdk_pixbuf_get_width(readFrom),
+		    gdk_pixbuf_get_height(readFrom),
+		    width, height, "bilinear");
+	scaled = budgetTrack(bandsPixbufScale(readFrom, NULL, width, height,
+					      GDK_INTERP_BILINEAR));
+	trace_end("scale");
+	stats_scaled(start, (long) width * height *
+			    gdk_pixbuf_get_n_channels(readFrom));
+	g_object_unref(image);
+	image = scaled;
+	stamp("scale");
     }
 
+    trace_begin("present");
     gdk_cairo_set_source_pixbuf(cr, image, 0, 0);
     cairo_paint(cr);
+    trace_end("present");
+    stamp("present");
     g_object_unref(image);
 
     return FALSE;
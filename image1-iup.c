@@ -26,19 +26,45 @@
  *    - The image resizer is slow and can only do 3 or 4 resizes per second.
  *	Not only does this make the display laggy but it makes it get behind,
  *	which provokes the above-mentioned bug.
+ *    - Gray, palette and bitmap images are scaled by scale.c instead, which
+ *	averages the area, as one channel of bytes: a palette image is only
+ *	expanded to RGB one source row at a time, through the palette, as it
+ *	is scaled, and a gray one never is.
+ *
+ * JPEGs are turned the way their EXIF orientation says, and the r and l keys
+ * turn the image a quarter turn clockwise and anticlockwise and h and v flip
+ * it left to right and top to bottom. The image as read from the file is
+ * turned once for each, a plane at a time (see rotate.c), and the frames are
+ * scaled from that.
  *
  *	Martin Guy <martinwguy@gmail.com>, November 2016.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iup.h>
 #include <im/im.h>
 #include <im/im_image.h>
+#include <im/im_util.h>
 #include <iupim.h>
+#include "stamp.h"
+#include "trace.h"
+#include "stats.h"
+#include "scale.h"
+#include "exifthumb.h"
+#include "rotate.h"
+
+#include <poll.h>
 
 static int resizeImage(Ihandle *data);
 static int quitGUI(Ihandle *self);
+static int pollStats(Ihandle *self);
+static int turnClockwise(Ihandle *self);
+static int turnAnticlockwise(Ihandle *self);
+static int flipLeftRight(Ihandle *self);
+static int flipTopBottom(Ihandle *self);
+static imImage *turnImImage(imImage *src, int orientation);
 
 static Ihandle *window;
 static Ihandle *box;
@@ -51,34 +77,40 @@ main(argc, argv)
 int argc;
 char **argv;
 {
+    Ihandle *statsTimer;
+
     IupOpen(&argc, &argv);
+    stamp("init");
+
+    /* Report the stats on SIGUSR1 or to the stats socket.
+     * IUP can't watch a file descriptor so look at it now and then. */
+    stats_init("image1-iup");
+    statsTimer = IupTimer();
+    IupSetAttribute(statsTimer, "TIME", "250");
+    IupSetCallback(statsTimer, "ACTION_CB", (Icallback) pollStats);
+    IupSetAttribute(statsTimer, "RUN", "YES");
 
     /* Read image from file */
     {
         char *filename = (argc > 1) ? argv[1] : "image.jpg";
 	int error;
 
+	trace_begin("decode");
 	imimage = imFileImageLoad(filename, 0, &error);
+	trace_end("decode");
 	if (error != IM_ERR_NONE) {
 	    fputs("Cannot read ", stderr);
 	    perror(filename);
 	    exit(1);
 	}
+	stamp("decode");
+	imimage = turnImImage(imimage, exifthumb_orientation(filename));
 	image = IupImageFromImImage(imimage);
 	/* The image rescaler doesn't do bilinear on images with color_space
-	 * MAP (palette) and BINARY (bitmap) and falls back to "nearest"
-	 * so convert those to RGB.
+	 * MAP (palette) and BINARY (bitmap) and falls back to "nearest",
+	 * but instead of converting those to RGB, which takes three or four
+	 * times the memory, we scale them ourselves (see resizeImage()).
 	 */
-	switch (imimage->color_space) {
-	case IM_MAP:
-	case IM_BINARY:
-	    {
-	    imImage *new = imImageCreateBased(imimage, -1, -1, IM_RGB, -1);
-	    imConvertColorSpace(imimage, new);
-	    imImageDestroy(imimage);
-	    imimage = new;
-	    }
-	}
     }
 
     /* Make the user interface: Just a label displaying the image */
@@ -93,6 +125,11 @@ char **argv;
     IupSetAttribute(window, "SHRINK", "YES");
     /* Quit on Control-Q */
     IupSetCallback(window, "K_cQ", (Icallback) quitGUI);
+    /* Turn and flip it on r, l, h and v */
+    IupSetCallback(window, "K_r", (Icallback) turnClockwise);
+    IupSetCallback(window, "K_l", (Icallback) turnAnticlockwise);
+    IupSetCallback(window, "K_h", (Icallback) flipLeftRight);
+    IupSetCallback(window, "K_v", (Icallback) flipTopBottom);
     /* Scale the image when the window is resized */
     IupSetCallback(window, "RESIZE_CB", (Icallback) resizeImage);
 
@@ -107,6 +144,123 @@ static int quitGUI(Ihandle *self)
     return IUP_CLOSE;
 }
 
+static int
+pollStats(Ihandle *self)
+{
+    struct pollfd pfd;
+
+    pfd.fd = stats_fd();
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) > 0) stats_service();
+    return IUP_DEFAULT;
+}
+
+/* Turn an image the way an EXIF orientation says, a plane at a time.
+ * Returns the turned one and destroys "src", or returns "src" as it is if it
+ * can't. IM keeps the bottom row first, so what the orientation does to the
+ * rows is done the other way round. */
+static imImage *
+turnImImage(imImage *src, int orientation)
+{
+    int planes = src->depth + (src->has_alpha ? 1 : 0);
+    int bpp = imDataTypeSize(src->data_type);
+    int upsideDown = rotate_then(ROTATE_FLIP_TOP_BOTTOM,
+			rotate_then(orientation, ROTATE_FLIP_TOP_BOTTOM));
+    int w = ROTATE_SWAPS(orientation) ? src->height : src->width;
+    int h = ROTATE_SWAPS(orientation) ? src->width : src->height;
+    imImage *new;
+    int c;
+
+    if (orientation == 1 || bpp > 4 || (src->color_space & IM_PACKED) ||
+	(new = imImageCreateBased(src, w, h, -1, -1)) == NULL)
+	return src;
+    trace_begin("rotate");
+    for (c = 0; c < planes; c++)
+	rotate_pixels(src->data[c], src->width, src->height, src->width * bpp,
+		      new->data[c], w * bpp, bpp, upsideDown);
+    trace_end("rotate");
+    imImageDestroy(src);
+    return new;
+}
+
+/* Turn the image for a key, turning the window with it if it changes shape,
+ * which rescales it, or rescaling it if not. */
+static int
+turnKey(int key)
+{
+    int w, h;
+
+    imimage = turnImImage(imimage, key);
+    if (ROTATE_SWAPS(key) &&
+	IupGetIntInt(window, "CLIENTSIZE", &w, &h) == 2) {
+	IupSetfAttribute(window, "CLIENTSIZE", "%dx%d", h, w);
+	IupRefresh(window);
+    } else {
+	resizeImage(window);
+    }
+    return IUP_DEFAULT;
+}
+
+static int turnClockwise(Ihandle *self) { return turnKey(ROTATE_CLOCKWISE); }
+static int turnAnticlockwise(Ihandle *self) { return turnKey(ROTATE_ANTICLOCKWISE); }
+static int flipLeftRight(Ihandle *self) { return turnKey(ROTATE_FLIP_LEFT_RIGHT); }
+static int flipTopBottom(Ihandle *self) { return turnKey(ROTATE_FLIP_TOP_BOTTOM); }
+
+/* Is it a gray, palette or bitmap image that scaleCompact() can do? */
+static int
+isCompact(imImage *src)
+{
+    return src->data_type == IM_BYTE &&
+	   (src->color_space == IM_GRAY || src->color_space == IM_MAP ||
+	    src->color_space == IM_BINARY);
+}
+
+/* Scale a gray, palette or bitmap image to w x h without converting it to
+ * RGB first. Gray levels and bitmaps become gray levels; a palette image
+ * becomes RGB, each plane scaled from the indices through its channel of
+ * the palette. Returns NULL if there isn't the memory. */
+static imImage *
+scaleCompact(imImage *src, int w, int h)
+{
+    const unsigned char *pixels = src->data[0];
+    unsigned char lut[3][256];	/* For each channel */
+    imImage *new;
+    int i, c, planes, result = 0;
+
+    memset(lut, 0, sizeof(lut));
+    switch (src->color_space) {
+    case IM_MAP:
+	for (i = 0; i < src->palette_count; i++)
+	    imColorDecode(&lut[0][i], &lut[1][i], &lut[2][i], src->palette[i]);
+	planes = 3;
+	break;
+    case IM_BINARY:
+	/* Its pixels are bytes of 0 or 1 */
+	lut[0][1] = 255;
+	planes = 1;
+	break;
+    default:
+	planes = 1;
+	break;
+    }
+
+    new = imImageCreate(w, h, planes == 3 ? IM_RGB : IM_GRAY, IM_BYTE);
+    if (new == NULL) return NULL;
+    for (c = 0; c < planes && result == 0; c++) {
+	if (src->color_space == IM_GRAY)
+	    result = scale_pixels(pixels, src->width, src->height, src->width,
+				  new->data[c], w, h, w, 1);
+	else
+	    result = scale_lut(pixels, src->width, src->height, src->width,
+			       new->data[c], w, h, w, lut[c], 1, 0);
+    }
+    if (result < 0) {
+	imImageDestroy(new);
+	return NULL;
+    }
+    return new;
+}
+
 static int
 resizeImage(Ihandle *data)
 {
@@ -121,9 +275,25 @@ resizeImage(Ihandle *data)
     {
 	imImage *new;
 	Ihandle *oldimage = image;
+	long long start = stats_now();
 
-	new = imImageCreateBased(imimage, w, h, -1, -1);
-	imProcessResize(imimage, new, 1);
+	stats_add(STAT_RESIZES, 1);
+	stats_add(STAT_CACHE_MISSES, 1);
+	if (isCompact(imimage)) {
+	    trace_scale(imimage->width, imimage->height, w, h, "area");
+	    new = scaleCompact(imimage, w, h);
+	} else {
+	    new = imImageCreateBased(imimage, w, h, -1, -1);
+	    trace_scale(imimage->width, imimage->height, w, h, "bilinear");
+	    imProcessResize(imimage, new, 1);
+	}
+	trace_end("scale");
+	if (new == NULL) {
+	    fprintf(stderr, "Cannot scale image to %dx%d\n", w, h);
+	    return(IUP_DEFAULT);
+	}
+	stats_scaled(start, new->size);
+	stamp("scale");
         image = IupImageFromImImage(new);
 	imImageDestroy(new);
 	IupSetAttributeHandle(label, "IMAGE", image);
@@ -8,25 +8,243 @@
  * If they hit Control-Q or poke the [X] icon in the window's titlebar,
  * the application should quit.
  *
+ * Qt's smooth scaler is good but too slow to run at every resize event,
+ * so while the window is being resized we show a quick nearest-pixel
+ * scaling and do the smooth one in a QtConcurrent worker thread, swapping
+ * it in when it's done. Smooth results are kept in the QPixmapCache by size,
+ * so going back to a size we've already been is instant.
+ * The UI thread never does a smooth scale itself.
+ *
+ * JPEGs are turned the way their EXIF orientation says, and the r and l keys
+ * turn the image a quarter turn clockwise and anticlockwise and h and v flip
+ * it left to right and top to bottom. The source image is turned once for
+ * each (see rotate.c) and the scalings are done from that.
+ *
  * Bugs:
- *    - The image is not scaled to the window: it is centered or has scrollbars.
- *    - Seems to have an extra 1-pixel white border around the image.
+ *    - None known.
  *
  *	Martin Guy <martinwguy@gmail.com>, November 2016.
  */
 
+#include <cstdio>
 #include <QApplication>
-#include <QGraphicsScene>
-#include <QGraphicsView>
-#include <QGraphicsPixmapItem>
+#include <QWidget>
+#include <QImage>
+#include <QPixmap>
+#include <QPixmapCache>
+#include <QPainter>
+#include <QKeyEvent>
+#include <QShortcut>
+#include <QFutureWatcher>
+#include <QtConcurrentRun>
+
+#include "../stamp.h"
+
+extern "C" {
+#include "../exifthumb.h"
+#include "../rotate.h"
+}
+
+class ImageWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    ImageWidget(const QImage &image);
+    void turn(int orientation);
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void resizeEvent(QResizeEvent *event);
+    void keyPressEvent(QKeyEvent *event);
+
+private slots:
+    void smoothScaleDone();
+
+private:
+    void startSmoothScale(const QSize &size);
+    static QString cacheKey(const QSize &size);
+
+    QImage source;		// As read from the file
+    QPixmap scaled;		// As displayed, scaled to the window
+    QFutureWatcher<QImage> watcher; // The smooth scaler in the background
+    QSize scaling;		// The size the worker is scaling to
+    QSize pending;		// Size to do next, if resized while it runs
+    int turns;			// How many times it has been turned
+    int scalingTurns;		// and how many when the worker started
+};
+
+/* Runs in the worker thread. QImage, unlike QPixmap, is safe to use there. */
+static QImage
+smoothScale(QImage image, QSize size)
+{
+    return image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+}
+
+ImageWidget::ImageWidget(const QImage &image)
+{
+    // RGB32 and premultiplied ARGB32 are the formats Qt scales fastest
+    source = image.convertToFormat(image.hasAlphaChannel()
+				   ? QImage::Format_ARGB32_Premultiplied
+				   : QImage::Format_RGB32);
+    scaled = QPixmap::fromImage(source);
+    turns = scalingTurns = 0;
+
+    // We paint every pixel so don't clear the background first (it flickers)
+    setAttribute(Qt::WA_OpaquePaintEvent);
+    setWindowTitle("image1-qt4");
+    resize(source.size());
+
+    connect(&watcher, SIGNAL(finished()), this, SLOT(smoothScaleDone()));
+}
+
+void
+ImageWidget::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.drawPixmap(0, 0, scaled);
+    stamp("present");
+}
+
+/* When the window is resized, show a smooth scaling if we have one
+ * and otherwise a fast one while the smooth one is being made. */
+void
+ImageWidget::resizeEvent(QResizeEvent *)
+{
+    QSize size = this->size();
+
+    if (size.isEmpty() || scaled.size() == size) return;
+
+    if (size == source.size()) {
+	scaled = QPixmap::fromImage(source);
+    } else if (!QPixmapCache::find(cacheKey(size), &scaled)) {
+	scaled = QPixmap::fromImage(source.scaled(size, Qt::IgnoreAspectRatio,
+						  Qt::FastTransformation));
+	stamp("scale");
+	startSmoothScale(size);
+    }
+    update();
+}
+
+/* Turn the source image the way an EXIF orientation says. The smooth
+ * scalings we have are of the old way up, so forget them. */
+void
+ImageWidget::turn(int orientation)
+{
+    int w = ROTATE_SWAPS(orientation) ? source.height() : source.width();
+    int h = ROTATE_SWAPS(orientation) ? source.width() : source.height();
+
+    if (orientation == 1) return;
+    QImage turned(w, h, source.format());
+    if (turned.isNull()) return;
+    rotate_pixels(source.constBits(), source.width(), source.height(),
+		  source.bytesPerLine(), turned.bits(), turned.bytesPerLine(),
+		  4, orientation);
+    source = turned;
+    turns++;
+    QPixmapCache::clear();
+    scaled = QPixmap();		// so that resizeEvent() doesn't think it's done
+    pending = QSize();
+}
+
+/* Turn or flip the image for the keys that do that, turning the window with
+ * it. Without Control or Alt, as Control-Q is a shortcut. */
+void
+ImageWidget::keyPressEvent(QKeyEvent *event)
+{
+    int key;
+
+    if ((event->modifiers() & (Qt::ControlModifier | Qt::AltModifier)) ||
+	event->text().length() != 1 ||
+	(key = rotate_key(event->text()[0].toLatin1())) == 0) {
+	QWidget::keyPressEvent(event);
+	return;
+    }
+    turn(key);
+    if (ROTATE_SWAPS(key)) resize(height(), width());
+    resizeEvent(NULL);	// if it's the same size, or was already
+}
+
+/* Only one worker runs at a time. If the window is resized while it's busy,
+ * remember the latest size and do that one when it has finished. */
+void
+ImageWidget::startSmoothScale(const QSize &size)
+{
+    if (watcher.isRunning()) {
+	pending = size;
+	return;
+    }
+    scaling = size;
+    scalingTurns = turns;
+    pending = QSize();
+    watcher.setFuture(QtConcurrent::run(smoothScale, source, size));
+}
+
+void
+ImageWidget::smoothScaleDone()
+{
+    QPixmap smooth;
+
+    if (scalingTurns != turns) {
+	// It scaled the image the old way up. Do the size we're at now.
+	if (!pending.isValid()) pending = size();
+	scaling = QSize();
+    } else {
+	smooth = QPixmap::fromImage(watcher.result());
+	QPixmapCache::insert(cacheKey(scaling), smooth);
+	if (size() == scaling) {
+	    scaled = smooth;
+	    update();
+	}
+    }
+
+    if (pending.isValid() && pending != scaling) {
+	if (QPixmapCache::find(cacheKey(pending), &smooth)) {
+	    if (size() == pending) {
+		scaled = smooth;
+		update();
+	    }
+	    pending = QSize();
+	} else {
+	    startSmoothScale(pending);
+	}
+    }
+}
+
+QString
+ImageWidget::cacheKey(const QSize &size)
+{
+    return QString("image1-qt4:%1x%2").arg(size.width()).arg(size.height());
+}
 
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
-    QGraphicsScene scene;
-    QGraphicsView view(&scene);
-    QGraphicsPixmapItem item(QPixmap ((argc > 1) ? argv[1] : "image.jpg"));
-    scene.addItem(&item);
-    view.show();
-    return a.exec();
+    QApplication app(argc, argv);
+    const char *filename = (argc > 1) ? argv[1] : "image.jpg";
+
+    stamp("init");
+    QImage image(filename);
+    if (image.isNull()) {
+	fprintf(stderr, "Cannot read image from %s.\n", filename);
+	return 1;
+    }
+    stamp("decode");
+
+    // The default cache of 10MB doesn't hold even one full-screen pixmap.
+    // Make room for a few of them.
+    QPixmapCache::setCacheLimit(4 * 4 * 1920 * 1200 / 1024);
+
+    ImageWidget widget(image);
+    int orientation = exifthumb_orientation(filename);
+    widget.turn(orientation);
+    if (ROTATE_SWAPS(orientation))
+	widget.resize(widget.height(), widget.width());
+    QShortcut quit(QKeySequence(Qt::CTRL + Qt::Key_Q), &widget);
+    QObject::connect(&quit, SIGNAL(activated()), &app, SLOT(quit()));
+    widget.show();
+
+    return app.exec();
 }
+
+// qmake runs moc on this file because of the Q_OBJECT in ImageWidget
+#include "image1-qt4.moc"
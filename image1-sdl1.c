@@ -8,8 +8,32 @@
  * If they hit Control-Q or poke the [X] icon in the window's titlebar,
  * the application should quit.
  *
+ * JPEGs are decoded at 1/2, 1/4 or 1/8 size if that is still at least as big
+ * as the screen, so the window opens at that size, and if the window is then
+ * made bigger than the decoded image, it is decoded again at a larger size.
+ * Ones with restart markers are decoded on all cores (see loadjpeg.c).
+ * What it decodes is kept in the pixel cache (see pixcache.c) so that it
+ * doesn't have to decode them again next time.
+ * If $IMAGE_SERVER is set, JPEGs come from imgserver instead, which decodes
+ * each one once for all the viewers showing it (see imgclient.c), and are
+ * used from its shared memory.
+ * Uncompressed PPM, PGM, PAM, BMP, TGA and farbfeld files are mapped into
+ * memory and converted to the screen's format from there (see rawimg.c).
+ * Gray, palette and bitmap (PBM) images aren't converted at all: they are
+ * scaled as one channel of bytes or bits and only become the screen's format
+ * when the scaled image is drawn (see scale.c).
+ * Other images are converted to the screen's format and scaled in that:
+ * 24- and 32-bit pixels a byte at a time, 16-bit ones unpacked, scaled and
+ * packed again with an ordered dither, unless IMAGE_DITHER=0.
+ * With IMAGE_LINEAR=1, they're all scaled in linear light, so fine detail
+ * keeps its brightness.
+ * JPEGs are turned the way their EXIF orientation says, and the r and l keys
+ * turn the image a quarter turn clockwise and anticlockwise and h and v flip
+ * it left to right and top to bottom. It's the source image that is turned,
+ * once (see rotate.c), so resizing after that costs what it did before.
+ * Screens in other formats get 32-bit pixels that SDL converts as it draws.
+ *
  * Bugs:
- *    - swscale can't rescale to smaller than 9x7.
  *    - While resizing, the image flickers black.
  *
  * Features:
@@ -23,7 +47,487 @@
 
 #include <SDL/SDL.h>
 #include <SDL/SDL_image.h>
-#include <libswscale/swscale.h>
+#include "stamp.h"
+#include "trace.h"
+#include "stats.h"
+#include "loadjpeg.h"
+#include "pixcache.h"
+#include "imgclient.h"
+#include "rawimg.h"
+#include "scale.h"
+#include "exifthumb.h"
+#include "rotate.h"
+
+#include <poll.h>
+
+/* SDL has no way to watch a file descriptor, so a timer looks at the stats
+ * one now and then and, if there's anything to do, wakes the main loop. */
+#define STATS_POLL 250		/* ms */
+
+static volatile int statsPending = 0;	/* We've sent an SDL_USEREVENT */
+
+static int linear = 0;		/* Scale what we show in linear light */
+
+static Uint32
+pollStats(Uint32 interval, void *param)
+{
+    struct pollfd pfd;
+
+    pfd.fd = stats_fd();
+    pfd.events = POLLIN;
+    if (!statsPending && poll(&pfd, 1, 0) > 0) {
+	SDL_Event event;
+
+	event.type = SDL_USEREVENT;
+	statsPending = 1;
+	SDL_PushEvent(&event);
+    }
+    return interval;
+}
+
+/* The cache entry, uncompressed file or image server's image whose pixels
+ * the image from loadImage() is using, if any. They're let go when
+ * displayFormat() has converted them. */
+static pixcache_t *mapped = NULL;
+static rawimg_t *raw = NULL;
+static imgclient_t *served = NULL;
+
+/* The same, for a gray, palette or bitmap image that displayFormat() left as
+ * it was, which are let go when freeSource() frees the image. */
+static pixcache_t *keptMapped = NULL;
+static rawimg_t *keptRaw = NULL;
+static imgclient_t *keptServed = NULL;
+
+/* Give an 8-bit surface a palette of gray levels */
+static void
+setGrays(SDL_Surface *image)
+{
+    SDL_Color grays[256];
+    int i;
+
+    for (i = 0; i < 256; i++)
+	grays[i].r = grays[i].g = grays[i].b = i;
+    SDL_SetColors(image, grays, 0, 256);
+}
+
+/* Is it an image that we scale without converting it to the screen's format?
+ * Those are bitmaps and 8-bit images with a palette, gray or otherwise. */
+static int
+isCompact(SDL_Surface *image)
+{
+    return image->format->BitsPerPixel == 1 ||
+	   (image->format->BitsPerPixel == 8 && image->format->palette != NULL);
+}
+
+/* Is the palette the one setGrays() gives, so that an 8-bit image's pixels
+ * are gray levels? */
+static int
+isGrayRamp(SDL_Palette *palette)
+{
+    int i;
+
+    if (palette->ncolors != 256) return 0;
+    for (i = 0; i < 256; i++)
+	if (palette->colors[i].r != i || palette->colors[i].g != i ||
+	    palette->colors[i].b != i)
+	    return 0;
+    return 1;
+}
+
+/* Turn an image upside down */
+static void
+flipRows(SDL_Surface *image)
+{
+    Uint8 *top = image->pixels;
+    Uint8 *bottom = top + (image->h - 1) * image->pitch;
+    Uint8 *row = malloc(image->pitch);
+
+    if (row == NULL) return;
+    for (; top < bottom; top += image->pitch, bottom -= image->pitch) {
+	memcpy(row, top, image->pitch);
+	memcpy(top, bottom, image->pitch);
+	memcpy(bottom, row, image->pitch);
+    }
+    free(row);
+}
+
+/* What loadjpeg() will reduce a JPEG by for a w x h window, which goes in the
+ * pixel cache's key, or 1 if it isn't a JPEG. */
+static int
+jpegDenom(char *filename, int w, int h)
+{
+    int iw, ih, d;
+
+    if (loadjpeg_size(filename, &iw, &ih) != 0) return 1;
+    for (d = 8; d > 1; d /= 2)
+	if ((iw + d - 1) / d >= w && (ih + d - 1) / d >= h) break;
+    return d;
+}
+
+/* Read the image, at a reduced resolution if it's a JPEG that is bigger than
+ * w x h, from the pixel cache if it's there. Sets *denom to how much it was
+ * reduced by. */
+static SDL_Surface *
+loadImage(char *filename, int w, int h, int *denom)
+{
+    SDL_Surface *image;
+    unsigned char *pixels;
+    int iw, ih, bpp, d = jpegDenom(filename, w, h);
+    char variant[16];
+
+    /* Uncompressed files are used where they are */
+    if ((raw = rawimg_open(filename)) != NULL) {
+	image = SDL_CreateRGBSurfaceFrom(raw->pixels, raw->width, raw->height,
+					 raw->mono ? 1 : raw->bpp * 8,
+					 raw->pitch, raw->rmask, raw->gmask,
+					 raw->bmask, raw->amask);
+	if (image != NULL) {
+	    if (raw->gray) setGrays(image);
+	    if (raw->mono) {
+		/* In a PBM, 0 is white */
+		SDL_Color bw[2] = { { 255, 255, 255 }, { 0, 0, 0 } };
+
+		SDL_SetColors(image, bw, 0, 2);
+	    }
+	    *denom = 1;
+	    return image;
+	}
+	rawimg_close(raw);
+	raw = NULL;
+    }
+
+    /* Another viewer may have had the server decode it already */
+    if ((served = imgclient_get(filename, w, h)) != NULL) {
+	image = SDL_CreateRGBSurfaceFrom(served->pixels,
+					 served->width, served->height,
+					 served->bpp * 8, served->stride,
+					 served->rmask, served->gmask,
+					 served->bmask, 0);
+	if (image != NULL) {
+	    if (served->bpp == 1) setGrays(image);
+	    *denom = served->denom;
+	    return image;
+	}
+	imgclient_release(served);
+	served = NULL;
+    }
+
+    sprintf(variant, "sdl/%d", d);
+    if ((mapped = pixcache_get(filename, variant)) != NULL) {
+	image = SDL_CreateRGBSurfaceFrom(mapped->pixels,
+					 mapped->width, mapped->height,
+					 mapped->bpp * 8, mapped->stride,
+					 mapped->rmask, mapped->gmask,
+					 mapped->bmask, mapped->amask);
+	if (image != NULL) {
+	    if (mapped->bpp == 1) setGrays(image);
+	    *denom = d;
+	    return image;
+	}
+	pixcache_release(mapped);
+	mapped = NULL;
+    }
+
+    /* Gray JPEGs stay gray */
+    pixels = loadjpeg_native(filename, w, h, &iw, &ih, denom, &bpp);
+    if (pixels == NULL) {
+	*denom = 1;
+	image = IMG_Load(filename);
+	/* Palette images would need the palette too, so don't cache them */
+	if (image != NULL && image->format->BytesPerPixel >= 3 &&
+	    image->format->palette == NULL && SDL_LockSurface(image) == 0) {
+	    pixcache_put(filename, variant, image->pixels, image->w, image->h,
+			 image->pitch, image->format->BytesPerPixel,
+			 image->format->Rmask, image->format->Gmask,
+			 image->format->Bmask, image->format->Amask);
+	    SDL_UnlockSurface(image);
+	}
+	return image;
+    }
+    if (bpp == 1)
+	image = SDL_CreateRGBSurfaceFrom(pixels, iw, ih, 8, iw, 0, 0, 0, 0);
+    else
+	image = SDL_CreateRGBSurfaceFrom(pixels, iw, ih, 24, iw * 3,
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+					 0x0000FF, 0x00FF00, 0xFF0000,
+#else
+					 0xFF0000, 0x00FF00, 0x0000FF,
+#endif
+					 0);
+    if (image == NULL) {
+	free(pixels);
+	return NULL;
+    }
+    if (bpp == 1) setGrays(image);
+    /* Make SDL_FreeSurface() free the pixels too */
+    image->flags &= ~SDL_PREALLOC;
+    pixcache_put(filename, variant, pixels, iw, ih, iw * bpp, bpp,
+		 image->format->Rmask, image->format->Gmask,
+		 image->format->Bmask, 0);
+
+    return image;
+}
+
+/* Can scale.c scale pixels of this format as they are? It needs 8-bit
+ * channels each in a byte of their own, or 16-bit pixels. */
+static int
+isScalable(SDL_PixelFormat *fmt)
+{
+    Uint32 masks[3];
+    int i;
+
+    masks[0] = fmt->Rmask; masks[1] = fmt->Gmask; masks[2] = fmt->Bmask;
+    switch (fmt->BytesPerPixel) {
+    case 2:
+	return 1;
+    case 3:
+    case 4:
+	for (i = 0; i < 3; i++)
+	    if (masks[i] != 0xFF && masks[i] != 0xFF00 &&
+		masks[i] != 0xFF0000 && masks[i] != 0xFF000000)
+		return 0;
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+/* Convert an image to the screen's native format, or to 32-bit pixels if
+ * we can't scale that, and free the original. Gray, palette and bitmap images
+ * are left as they are. */
+static SDL_Surface *
+displayFormat(SDL_Surface *image)
+{
+    SDL_Surface *temp;
+
+    if (isCompact(image)) {
+	if (raw == NULL || !raw->bottomUp) {
+	    /* It goes on using the file or cache entry's pixels */
+	    keptMapped = mapped;
+	    keptRaw = raw;
+	    keptServed = served;
+	    mapped = NULL;
+	    raw = NULL;
+	    served = NULL;
+	    return image;
+	}
+	/* A bottom-up gray TGA: a copy the right way up is only a byte
+	 * per pixel */
+	temp = SDL_ConvertSurface(image, image->format, SDL_SWSURFACE);
+	if (!temp) {
+	    fputs("Couldn't copy image", stderr);
+	    exit(1);
+	}
+	flipRows(temp);
+	SDL_FreeSurface(image);
+	rawimg_close(raw);
+	raw = NULL;
+	return temp;
+    }
+
+    if (isScalable(SDL_GetVideoSurface()->format)) {
+	temp = SDL_DisplayFormat(image);
+    } else {
+	temp = SDL_CreateRGBSurface(SDL_SWSURFACE, image->w, image->h, 32,
+				    0xFF0000, 0x00FF00, 0x0000FF, 0);
+	if (temp) {
+	    SDL_SetAlpha(image, 0, 0);	/* Copy, don't blend */
+	    SDL_BlitSurface(image, NULL, temp, NULL);
+	}
+    }
+    if (!temp) {
+	fputs("Couldn't convert image to display format", stderr);
+	exit(1);
+    }
+    SDL_FreeSurface(image);
+    pixcache_release(mapped);
+    mapped = NULL;
+    imgclient_release(served);
+    served = NULL;
+    if (raw != NULL) {
+	/* BMPs and TGAs are usually stored bottom row first */
+	if (raw->bottomUp) flipRows(temp);
+	rawimg_close(raw);
+	raw = NULL;
+    }
+
+    return temp;
+}
+
+/* Free an image from displayFormat() and what it was using */
+static void
+freeSource(SDL_Surface *image)
+{
+    SDL_FreeSurface(image);
+    pixcache_release(keptMapped);
+    keptMapped = NULL;
+    rawimg_close(keptRaw);
+    keptRaw = NULL;
+    imgclient_release(keptServed);
+    keptServed = NULL;
+}
+
+/* Turn an image from displayFormat() the way an EXIF orientation says and
+ * free the original. A bitmap becomes a byte per pixel with the same two
+ * colors, as its rows of bits aren't worth turning themselves. */
+static SDL_Surface *
+turnImage(SDL_Surface *image, int orientation)
+{
+    SDL_PixelFormat *fmt = image->format;
+    SDL_Surface *bytes = NULL, *turned;
+    int x, y;
+
+    if (orientation == 1) return image;
+    if (fmt->BitsPerPixel == 1) {
+	bytes = SDL_CreateRGBSurface(SDL_SWSURFACE, image->w, image->h, 8,
+				     0, 0, 0, 0);
+	if (bytes == NULL) {
+	    fputs("Couldn't turn image", stderr);
+	    exit(1);
+	}
+	SDL_SetColors(bytes, fmt->palette->colors, 0, fmt->palette->ncolors);
+	for (y = 0; y < image->h; y++) {
+	    Uint8 *bits = (Uint8 *) image->pixels + y * image->pitch;
+	    Uint8 *row = (Uint8 *) bytes->pixels + y * bytes->pitch;
+
+	    for (x = 0; x < image->w; x++)
+		row[x] = bits[x >> 3] >> (7 - (x & 7)) & 1;
+	}
+	freeSource(image);
+	image = bytes;
+	fmt = image->format;
+    }
+
+    turned = SDL_CreateRGBSurface(SDL_SWSURFACE,
+				  ROTATE_SWAPS(orientation) ? image->h : image->w,
+				  ROTATE_SWAPS(orientation) ? image->w : image->h,
+				  fmt->BitsPerPixel, fmt->Rmask, fmt->Gmask,
+				  fmt->Bmask, fmt->Amask);
+    if (turned == NULL) {
+	fputs("Couldn't turn image", stderr);
+	exit(1);
+    }
+    if (fmt->palette != NULL)
+	SDL_SetColors(turned, fmt->palette->colors, 0, fmt->palette->ncolors);
+    trace_begin("rotate");
+    rotate_pixels(image->pixels, image->w, image->h, image->pitch,
+		  turned->pixels, turned->pitch, fmt->BytesPerPixel,
+		  orientation);
+    trace_end("rotate");
+    if (bytes != NULL) SDL_FreeSurface(bytes);
+    else freeSource(image);
+    return turned;
+}
+
+/* Scale a gray, palette or bitmap image to w x h. Gray levels and bits become
+ * an image of gray levels, which SDL expands to the screen's format when it
+ * is drawn. A palette image becomes pixels in the screen's format straight
+ * from its indices, each byte of them scaled through the palette on its own,
+ * or 24-bit RGB for screens with less than 3 bytes per pixel.
+ * Returns NULL if there isn't the memory. */
+static SDL_Surface *
+scaleCompact(SDL_Surface *source, SDL_Surface *screen, int w, int h)
+{
+    SDL_Palette *palette = source->format->palette;
+    SDL_PixelFormat *fmt = screen->format;
+    SDL_Surface *image;
+    int i, b, bpp, result;
+
+    if (source->format->BitsPerPixel == 1 || isGrayRamp(palette)) {
+	image = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, 8, 0, 0, 0, 0);
+	if (image == NULL) return NULL;
+	setGrays(image);
+	if (source->format->BitsPerPixel == 1) {
+	    unsigned char levels[2];
+
+	    for (i = 0; i < 2; i++)
+		levels[i] = (palette->colors[i].r * 299 +
+			     palette->colors[i].g * 587 +
+			     palette->colors[i].b * 114 + 500) / 1000;
+	    result = scale_bits(source->pixels, source->w, source->h,
+				source->pitch, image->pixels, w, h,
+				image->pitch, levels, linear);
+	} else {
+	    result = scale_band(source->pixels, source->w, source->h,
+				source->pitch, image->pixels, w, h,
+				image->pitch, 1, NULL, 0, h, linear);
+	}
+    } else {
+	unsigned char lut[256 * 4];
+
+	if (fmt->BytesPerPixel >= 3)
+	    image = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h,
+					 fmt->BitsPerPixel, fmt->Rmask,
+					 fmt->Gmask, fmt->Bmask, fmt->Amask);
+	else
+	    image = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, 24,
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+					 0x0000FF, 0x00FF00, 0xFF0000,
+#else
+					 0xFF0000, 0x00FF00, 0x0000FF,
+#endif
+					 0);
+	if (image == NULL) return NULL;
+
+	/* Each color in the palette as the bytes of one of its pixels */
+	bpp = image->format->BytesPerPixel;
+	memset(lut, 0, sizeof(lut));
+	for (i = 0; i < palette->ncolors; i++) {
+	    Uint32 pixel = SDL_MapRGB(image->format, palette->colors[i].r,
+				      palette->colors[i].g,
+				      palette->colors[i].b);
+
+	    for (b = 0; b < bpp; b++)
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+		lut[i * bpp + b] = pixel >> 8 * b;
+#else
+		lut[i * bpp + b] = pixel >> 8 * (bpp - 1 - b);
+#endif
+	}
+	result = scale_lut(source->pixels, source->w, source->h,
+			   source->pitch, image->pixels, w, h, image->pitch,
+			   lut, bpp, linear);
+    }
+    if (result < 0) {
+	SDL_FreeSurface(image);
+	return NULL;
+    }
+    return image;
+}
+
+/* Scale an image from displayFormat() to w x h in the same format.
+ * Returns NULL if there isn't the memory. */
+static SDL_Surface *
+scaleNative(SDL_Surface *source, int w, int h)
+{
+    SDL_PixelFormat *fmt = source->format;
+    SDL_Surface *image;
+    static int dither = -1;
+    int result;
+
+    if (dither < 0)
+	dither = !getenv("IMAGE_DITHER") || atoi(getenv("IMAGE_DITHER"));
+
+    image = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, fmt->BitsPerPixel,
+				 fmt->Rmask, fmt->Gmask, fmt->Bmask,
+				 fmt->Amask);
+    if (image == NULL) return NULL;
+    if (fmt->BytesPerPixel == 2)
+	result = scale_pixels16(source->pixels, source->w, source->h,
+				source->pitch, image->pixels, w, h,
+				image->pitch, fmt->Rmask, fmt->Gmask,
+				fmt->Bmask, dither, linear);
+    else
+	result = scale_band(source->pixels, source->w, source->h,
+			    source->pitch, image->pixels, w, h,
+			    image->pitch, fmt->BytesPerPixel, NULL, 0, h,
+			    linear);
+    if (result < 0) {
+	SDL_FreeSurface(image);
+	return NULL;
+    }
+    return image;
+}
 
 int
 main(argc, argv)
@@ -32,20 +536,48 @@ char **argv;
 {
     SDL_Surface *screen;
     SDL_Surface *sourceImage;	/* As read from file */
+    int denom;			/* and reduced by this factor */
+    int turn;			/* and turned this way since */
+    int key;
     SDL_Event	event;
     char *filename = (argc > 1) ? argv[1] : "image.jpg";
+    const SDL_VideoInfo *info;
 
-    SDL_Init(SDL_INIT_VIDEO|SDL_DOUBLEBUF);
+    SDL_Init(SDL_INIT_VIDEO|SDL_INIT_TIMER|SDL_DOUBLEBUF);
     atexit(SDL_Quit);
+    stamp("init");
+
+    /* Report the stats on SIGUSR1 or to the stats socket */
+    stats_init("image1-sdl1");
+    SDL_AddTimer(STATS_POLL, pollStats, NULL);
 
-    sourceImage = IMG_Load(filename);
+    linear = getenv("IMAGE_LINEAR") && atoi(getenv("IMAGE_LINEAR"));
+
+    /* Don't decode more than will fit on the screen. Turned on its side,
+     * the screen's width limits the image's height. */
+    info = SDL_GetVideoInfo();
+    turn = exifthumb_orientation(filename);
+    trace_begin("decode");
+    if (ROTATE_SWAPS(turn))
+	sourceImage = loadImage(filename, info->current_h, info->current_w,
+				&denom);
+    else
+	sourceImage = loadImage(filename, info->current_w, info->current_h,
+				&denom);
+    trace_end("decode");
     if (!sourceImage) {
 	fputs("Couldn't read ", stderr);
 	perror(argv[1]);
 	exit(1);
     }
+    stamp("decode");
 
-    screen = SDL_SetVideoMode(sourceImage->w, sourceImage->h, 0, SDL_RESIZABLE);
+    if (ROTATE_SWAPS(turn))
+	screen = SDL_SetVideoMode(sourceImage->h, sourceImage->w, 0,
+				  SDL_RESIZABLE);
+    else
+	screen = SDL_SetVideoMode(sourceImage->w, sourceImage->h, 0,
+				  SDL_RESIZABLE);
     if (screen == NULL) {
 	printf("Couldn't create window: %s\n", SDL_GetError());
 	exit(1);
@@ -53,25 +585,14 @@ char **argv;
 
     SDL_WM_SetCaption("image1-sdl1", NULL);
 
-    /* Convert source image to screen's native format */
-    {
-        SDL_Surface *temp;
-        temp = SDL_DisplayFormat(sourceImage);
-        if (!temp) {
-	    fputs("Couldn't convert image to display format", stderr);
-	    exit(1);
-	}
-	SDL_FreeSurface(sourceImage);
-	sourceImage = temp;
-    }
-
-    /* sws_scale reads the N+1'th line of the source image so allocate
-     * an extra row */
-    sourceImage->pixels = realloc(sourceImage->pixels,
-				  sourceImage->pitch * (sourceImage->h + 1));
+    /* Convert source image to screen's native format and turn it */
+    sourceImage = turnImage(displayFormat(sourceImage), turn);
 
+    trace_begin("present");
     SDL_BlitSurface(sourceImage, NULL, screen, NULL);
     SDL_Flip(screen);
+    trace_end("present");
+    stamp("present");
 
     while (SDL_WaitEvent(&event)) switch (event.type) {
     /* Closing the window or pressing Ctrl-Q will exit the program */
@@ -81,58 +602,83 @@ char **argv;
 	if (event.key.keysym.sym == SDLK_q &&
 	    event.key.keysym.mod & KMOD_CTRL)
 		exit(0);
+	if (event.key.keysym.mod & (KMOD_CTRL | KMOD_ALT) ||
+	    (key = rotate_key(event.key.keysym.sym)) == 0)
+	    break;
+	/* Turn the source and draw it again, turning the window with it */
+	sourceImage = turnImage(sourceImage, key);
+	turn = rotate_then(turn, key);
+	event.type = SDL_VIDEORESIZE;
+	event.resize.w = ROTATE_SWAPS(key) ? screen->h : screen->w;
+	event.resize.h = ROTATE_SWAPS(key) ? screen->w : screen->h;
+	SDL_PushEvent(&event);
+	break;
+    case SDL_USEREVENT:
+	statsPending = 0;
+	stats_service();
 	break;
     case SDL_VIDEORESIZE:
 	{
 	    SDL_Surface *image = NULL;	/* Scaled to window size */
-	    struct SwsContext *sws_ctx;
-	    static int srcStride[4], destStride[4];
 	    int w = event.resize.w;
 	    int h = event.resize.h;
+	    SDL_Event next;
+	    long long start;
 
-	    /* sws_scale() can't resize to less than 9 wide or 7 deep,
-	     * determined experimentally.
-	     * Error is "Can't create 898x6 scale context."
-	     */
-	    if (w < 9) w = 9;
-	    if (h < 7) h = 7;
+	    stats_add(STAT_RESIZES, 1);
+
+	    /* If there's another resize in the queue, don't scale to this
+	     * size just to throw it away; skip to that one. */
+	    if (SDL_PeepEvents(&next, 1, SDL_PEEKEVENT,
+			       SDL_VIDEORESIZEMASK) > 0) {
+		stats_add(STAT_COALESCED, 1);
+		break;
+	    }
+
+	    if (w < 1) w = 1;
+	    if (h < 1) h = 1;
 
 	    /* Resize display surface to new window size */
 	    screen = SDL_SetVideoMode(w, h, 0, SDL_RESIZABLE);
 
-	    image = SDL_CreateRGBSurface(0, w, h,
-		    sourceImage->format->BitsPerPixel,
-		    sourceImage->format->Rmask,
-		    sourceImage->format->Gmask,
-		    sourceImage->format->Bmask,
-		    sourceImage->format->Amask);
-	    /* Add an extra row because sws_scale writes past the end
-	     * of the image */
-	    image->pixels = realloc(image->pixels,
-				    image->pitch * (image->h + 1));
-
-	    sws_ctx = sws_getContext(
-			sourceImage->w, sourceImage->h, PIX_FMT_RGB32,
-			w, h, PIX_FMT_RGB32,
-			SWS_BILINEAR, NULL, NULL, NULL);
-	    if (!sws_ctx) {
-		fprintf(stderr, "Can't create %dx%d scale context.\n", w, h);
-		exit(1);
-	    }
-
-	    srcStride[0] = sourceImage->pitch;
-	    destStride[0] = image->pitch;
+	    /* If they've made it bigger than a reduced JPEG, decode more
+	     * and turn that the way this one is. */
+	    if (denom > 1 && (w > sourceImage->w || h > sourceImage->h)) {
+		SDL_Surface *bigger;
+		int newDenom;
 
-	    sws_scale(sws_ctx,
-		      (const uint8_t * const*) &(sourceImage->pixels),
-		      srcStride, 0, sourceImage->h,
-		      (uint8_t * const*) &(image->pixels),
-		      destStride);
+		trace_begin("decode");
+		if (ROTATE_SWAPS(turn))
+		    bigger = loadImage(filename, h, w, &newDenom);
+		else
+		    bigger = loadImage(filename, w, h, &newDenom);
+		trace_end("decode");
+		if (bigger != NULL) {
+		    freeSource(sourceImage);
+		    sourceImage = turnImage(displayFormat(bigger), turn);
+		    denom = newDenom;
+		}
+	    }
 
-	    sws_freeContext(sws_ctx);
+	    start = stats_now();
+	    trace_scale(sourceImage->w, sourceImage->h, w, h, "area");
+	    if (isCompact(sourceImage))
+		image = scaleCompact(sourceImage, screen, w, h);
+	    else
+		image = scaleNative(sourceImage, w, h);
+	    trace_end("scale");
+	    if (image == NULL) {
+		fprintf(stderr, "Can't scale to %dx%d.\n", w, h);
+		exit(1);
+	    }
+	    stats_scaled(start, (long) image->pitch * image->h);
+	    stats_add(STAT_CACHE_MISSES, 1);
+	    stamp("scale");
 
+	    trace_begin("present");
 	    SDL_BlitSurface(image, NULL, screen, NULL);
 	    SDL_Flip(screen);
+	    trace_end("present");
 
 	    SDL_FreeSurface(image);
 	}
@@ -13,6 +13,37 @@
  * http://lazyfoo.net/tutorials/SDL/35_window_events
  * https://web.archive.org/web/20140306003549/http://www.programmersranch.com/2013/11/sdl2-displaying-image-in-window.html
  *
+ * JPEG, PNG and TIFF images are read with imgsrc.c, which scales them down to
+ * the size of the screen as it decodes them, a few rows at a time, so the
+ * memory it takes depends on the size of the screen, not of the image.
+ * JPEGs are decoded at 1/2, 1/4 or 1/8 size and pyramidal TIFFs from their
+ * smallest level that is still bigger than the screen, and JPEGs with
+ * restart markers on all cores (see loadjpeg.c).
+ * The window opens at that size and, if the window is then made bigger than
+ * a reduced image, it is read again at the new size.
+ * What it reads is kept in the pixel cache (see pixcache.c), so opening the
+ * same image again at the same size just maps the pixels from there.
+ * Uncompressed PPM, PGM, PAM, BMP, TGA and farbfeld files are mapped into
+ * memory and their pixels made into a texture from there (see rawimg.c),
+ * or scaled to the screen from there if they're bigger.
+ * If $IMAGE_SERVER is set, JPEGs come from imgserver instead, which decodes
+ * each one once for all the viewers showing it (see imgclient.c), and are
+ * used or scaled from its shared memory in the same way.
+ * If a JPEG has a preview in its EXIF data, as photos from cameras do, that
+ * is shown scaled up to the size of the image while the image is decoded in
+ * another thread (see exifthumb.c), then replaced by the image when it's
+ * ready. Both are turned the way the EXIF orientation says, the image by the
+ * renderer as it copies the texture to the window.
+ * The r and l keys turn it a quarter turn clockwise and anticlockwise and
+ * h and v flip it left to right and top to bottom. The renderer does those
+ * too, as it turns and scales the texture in the same copy, so the pixels
+ * are never turned themselves and a turn costs the same as a resize.
+ * b and w lower the black and white points and g the gamma, and with shift
+ * raise them; c picks which of red, green, blue or all of them they change,
+ * 0 puts them back and i shows the histogram. While they're set, the image
+ * is scaled to the window by scale.c instead, looking each row up in a table
+ * per channel as it's made (see levels.c), and the renderer only turns that.
+ *
  * Bugs:
  *    - None.
  * Features:
@@ -21,8 +52,564 @@
  *	Martin Guy <martinwguy@gmail.com>, October-November 2016.
  */
 
+#include <limits.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
+#include "stamp.h"
+#include "trace.h"
+#include "stats.h"
+#include "imgsrc.h"
+#include "imgclient.h"
+#include "pixcache.h"
+#include "rawimg.h"
+#include "scale.h"
+#include "exifthumb.h"
+#include "loadjpeg.h"
+#include "rotate.h"
+#include "levels.h"
+
+#include <poll.h>
+
+/* SDL has no way to watch a file descriptor, so a timer looks at the stats
+ * one now and then and, if there's anything to do, wakes the main loop. */
+#define STATS_POLL 250		/* ms */
+
+static SDL_atomic_t statsPending;	/* We've sent an SDL_USEREVENT */
+
+/* What the SDL_USEREVENTs are for, in event.user.code */
+enum { STATS_EVENT, LOADED_EVENT };
+
+static Uint32
+pollStats(Uint32 interval, void *param)
+{
+    struct pollfd pfd;
+
+    pfd.fd = stats_fd();
+    pfd.events = POLLIN;
+    if (SDL_AtomicGet(&statsPending) == 0 && poll(&pfd, 1, 0) > 0) {
+	SDL_Event event;
+
+	SDL_zero(event);
+	event.type = SDL_USEREVENT;
+	event.user.code = STATS_EVENT;
+	SDL_AtomicSet(&statsPending, 1);
+	SDL_PushEvent(&event);
+    }
+    return interval;
+}
+
+/* Is there another window resize in the event queue? */
+static int
+moreResizes(void)
+{
+    SDL_Event queued[16];
+    int i, n;
+
+    n = SDL_PeepEvents(queued, 16, SDL_PEEKEVENT,
+		       SDL_WINDOWEVENT, SDL_WINDOWEVENT);
+    for (i = 0; i < n; i++)
+	if (queued[i].window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+	    return 1;
+    return 0;
+}
+
+/* What a surface's pixels are borrowed from, in its userdata, when they
+ * aren't its own. They stay mapped until freeImage(). */
+typedef struct {
+    pixcache_t *pc;
+    rawimg_t *raw;
+    imgclient_t *served;
+} borrowed_t;
+
+static SDL_Surface *
+borrowedImage(unsigned char *pixels, int w, int h, int bpp, int pitch,
+	      Uint32 rmask, Uint32 gmask, Uint32 bmask, Uint32 amask,
+	      pixcache_t *pc, rawimg_t *raw, imgclient_t *served)
+{
+    SDL_Surface *image;
+    borrowed_t *b;
+
+    image = SDL_CreateRGBSurfaceFrom(pixels, w, h, bpp * 8, pitch,
+				     rmask, gmask, bmask, amask);
+    if (image == NULL || (b = malloc(sizeof(*b))) == NULL) {
+	if (image != NULL) SDL_FreeSurface(image);
+	pixcache_release(pc);
+	rawimg_close(raw);
+	imgclient_release(served);
+	return NULL;
+    }
+    b->pc = pc;
+    b->raw = raw;
+    b->served = served;
+    image->userdata = b;
+    return image;
+}
+
+static void
+freeImage(SDL_Surface *image)
+{
+    borrowed_t *b = image->userdata;
+
+    SDL_FreeSurface(image);
+    if (b != NULL) {
+	pixcache_release(b->pc);
+	rawimg_close(b->raw);
+	imgclient_release(b->served);
+	free(b);
+    }
+}
+
+/* How to turn the texture made from "image" to show it turned "turn".
+ * BMPs and TGAs are usually stored bottom row first, and when we use their
+ * pixels where they are, the renderer turns them the right way up first. */
+static int
+imageTurn(SDL_Surface *image, int turn)
+{
+    borrowed_t *b = image != NULL ? image->userdata : NULL;
+
+    return (b && b->raw && b->raw->bottomUp)
+	   ? rotate_then(ROTATE_FLIP_TOP_BOTTOM, turn) : turn;
+}
+
+/* Give an 8-bit surface a palette of gray levels */
+static void
+setGrays(SDL_Surface *image)
+{
+    SDL_Color grays[256];
+    int i;
+
+    for (i = 0; i < 256; i++) {
+	grays[i].r = grays[i].g = grays[i].b = i;
+	grays[i].a = 255;
+    }
+    SDL_SetPaletteColors(image->format->palette, grays, 0, 256);
+}
+
+/* Turn an image upside down */
+static void
+flipRows(SDL_Surface *image)
+{
+    Uint8 *top = image->pixels;
+    Uint8 *bottom = top + (image->h - 1) * image->pitch;
+    Uint8 *row = malloc(image->pitch);
+
+    if (row == NULL) return;
+    for (; top < bottom; top += image->pitch, bottom -= image->pitch) {
+	memcpy(row, top, image->pitch);
+	memcpy(top, bottom, image->pitch);
+	memcpy(bottom, row, image->pitch);
+    }
+    free(row);
+}
+
+/* An uncompressed image file, in place if it fits in w x h, otherwise
+ * scaled down to fit from where it is. */
+static SDL_Surface *
+rawImage(rawimg_t *raw, int w, int h, int *reduced)
+{
+    SDL_Surface *image;
+
+    if (raw->width <= w && raw->height <= h) {
+	*reduced = 0;
+	image = borrowedImage(raw->pixels, raw->width, raw->height,
+			      raw->bpp, raw->pitch, raw->rmask, raw->gmask,
+			      raw->bmask, raw->amask, NULL, raw, NULL);
+	if (image != NULL && raw->gray) setGrays(image);
+	return image;
+    }
+
+    *reduced = 1;
+    if (w > raw->width) w = raw->width;
+    if (h > raw->height) h = raw->height;
+    image = SDL_CreateRGBSurface(0, w, h, raw->bpp * 8, raw->rmask,
+				 raw->gmask, raw->bmask, raw->amask);
+    if (image != NULL) {
+	trace_scale(raw->width, raw->height, w, h, "area");
+	if (scale_pixels(raw->pixels, raw->width, raw->height, raw->pitch,
+			 image->pixels, w, h, image->pitch, raw->bpp) < 0) {
+	    SDL_SetError("Out of memory scaling image to %dx%d", w, h);
+	    SDL_FreeSurface(image);
+	    image = NULL;
+	}
+	trace_end("scale");
+    }
+    if (image != NULL) {
+	if (raw->gray) setGrays(image);
+	if (raw->bottomUp) flipRows(image);
+    }
+    rawimg_close(raw);
+    return image;
+}
+
+/* A JPEG from the image server, in place if it fits in w x h, otherwise
+ * scaled down to fit from its shared memory. */
+static SDL_Surface *
+servedImage(imgclient_t *served, int w, int h, int *reduced)
+{
+    SDL_Surface *image;
+
+    if (served->width <= w && served->height <= h) {
+	*reduced = served->denom > 1;
+	image = borrowedImage(served->pixels, served->width, served->height,
+			      served->bpp, served->stride, served->rmask,
+			      served->gmask, served->bmask, 0,
+			      NULL, NULL, served);
+	if (image != NULL && served->bpp == 1) setGrays(image);
+	return image;
+    }
+
+    *reduced = 1;
+    if (w > served->width) w = served->width;
+    if (h > served->height) h = served->height;
+    image = SDL_CreateRGBSurface(0, w, h, served->bpp * 8, served->rmask,
+				 served->gmask, served->bmask, 0);
+    if (image != NULL) {
+	trace_scale(served->width, served->height, w, h, "area");
+	if (scale_pixels(served->pixels, served->width, served->height,
+			 served->stride, image->pixels, w, h, image->pitch,
+			 served->bpp) < 0) {
+	    SDL_SetError("Out of memory scaling image to %dx%d", w, h);
+	    SDL_FreeSurface(image);
+	    image = NULL;
+	}
+	trace_end("scale");
+    }
+    if (image != NULL && served->bpp == 1) setGrays(image);
+    imgclient_release(served);
+    return image;
+}
+
+/* Read the image, scaled down to w x h in either direction that it's bigger,
+ * and set *reduced to whether it was. What we read is kept in the pixel
+ * cache (see pixcache.c) and comes from there if it's the same size. */
+static SDL_Surface *
+loadImage(char *filename, int w, int h, int *reduced)
+{
+    SDL_Surface *image;
+    imgsrc_t *src;
+    int64_t fullw, fullh;
+    pixcache_t *pc;
+    rawimg_t *raw;
+    imgclient_t *served;
+    char variant[32];
+
+    /* Uncompressed files are used where they are. Bitmaps go to IMG_Load. */
+    if ((raw = rawimg_open(filename)) != NULL) {
+	if (!raw->mono) return rawImage(raw, w, h, reduced);
+	rawimg_close(raw);
+    }
+
+    /* Another viewer may have had the server decode it already */
+    if ((served = imgclient_get(filename, w, h)) != NULL)
+	return servedImage(served, w, h, reduced);
+
+    if ((src = imgsrc_open(filename)) == NULL) {
+	*reduced = 0;
+	if ((pc = pixcache_get(filename, "sdl")) != NULL)
+	    return borrowedImage(pc->pixels, pc->width, pc->height, pc->bpp,
+				 pc->stride, pc->rmask, pc->gmask, pc->bmask,
+				 pc->amask, pc, NULL, NULL);
+	image = IMG_Load(filename);
+	/* Palette images would need the palette too, so don't cache them */
+	if (image != NULL && image->format->BytesPerPixel >= 3 &&
+	    image->format->palette == NULL && SDL_LockSurface(image) == 0) {
+	    pixcache_put(filename, "sdl", image->pixels, image->w, image->h,
+			 image->pitch, image->format->BytesPerPixel,
+			 image->format->Rmask, image->format->Gmask,
+			 image->format->Bmask, image->format->Amask);
+	    SDL_UnlockSurface(image);
+	}
+	return image;
+    }
+    fullw = imgsrc_width(src);
+    fullh = imgsrc_height(src);
+    if (fullw < w) w = fullw;
+    if (fullh < h) h = fullh;
+    *reduced = (w < fullw || h < fullh);
+
+    sprintf(variant, "sdl/%dx%d", w, h);
+    if ((pc = pixcache_get(filename, variant)) != NULL) {
+	imgsrc_close(src);
+	return borrowedImage(pc->pixels, pc->width, pc->height, pc->bpp,
+			     pc->stride, pc->rmask, pc->gmask, pc->bmask,
+			     pc->amask, pc, NULL, NULL);
+    }
+
+    image = SDL_CreateRGBSurface(0, w, h, 24,
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+				 0x0000FF, 0x00FF00, 0xFF0000,
+#else
+				 0xFF0000, 0x00FF00, 0x0000FF,
+#endif
+				 0);
+    if (image != NULL &&
+	imgsrc_read(src, 0, 0, fullw, fullh, image->pixels, w, h,
+		    image->pitch) < 0) {
+	SDL_SetError("Cannot decode %s", filename);
+	SDL_FreeSurface(image);
+	image = NULL;
+    }
+    imgsrc_close(src);
+    if (image != NULL)
+	pixcache_put(filename, variant, image->pixels, w, h, image->pitch, 3,
+		     image->format->Rmask, image->format->Gmask,
+		     image->format->Bmask, 0);
+
+    return image;
+}
+
+/* Reading the image in the background while the preview is showing */
+typedef struct {
+    char *filename;
+    int w, h;			/* The size to scale it down to */
+    SDL_Surface *image;		/* What it read, or NULL if it couldn't */
+    int reduced;
+} load_t;
+
+static int
+loadInBackground(void *data)
+{
+    load_t *load = data;
+    SDL_Event event;
+
+    trace_begin("decode");
+    load->image = loadImage(load->filename, load->w, load->h, &load->reduced);
+    trace_end("decode");
+    SDL_zero(event);
+    event.type = SDL_USEREVENT;
+    event.user.code = LOADED_EVENT;
+    event.user.data1 = load;
+    SDL_PushEvent(&event);
+    return 0;
+}
+
+/* The levels keys (see levels.c). While they change the image, it's scaled
+ * to the window with their tables looked up in the same pass (see
+ * scale_levels()), into a streaming texture the size of the window, which
+ * the renderer then turns like the plain one. So the lookup is never a pass
+ * over the whole image, only over the window's pixels as they're made. */
+#define BLACK_STEP	4	/* How far b and w move the points */
+#define GAMMA_STEP	1.05	/* and g the gamma */
+#define HIST_W		256	/* The size of the histogram */
+#define HIST_H		100
+#define HIST_MARGIN	8	/* and its distance from the corner */
+
+static levels_t levels;
+static int channel = -1;	/* Which the keys change, 0-2, or -1 for all */
+static int showHistogram;	/* Toggled by i */
+static SDL_Surface *levelsFor;	/* The image the rest are of */
+static SDL_Surface *levelSource; /* That as ARGB8888 */
+static SDL_Texture *levelled;	/* and scaled and looked up, or NULL */
+static int levelledW, levelledH; /* The size it's scaled to */
+static int levelledStale;	/* The levels have changed since */
+static unsigned char lut[4][256];
+static unsigned long histogram[4][256];	/* Of levelSource, byte by byte */
+
+/* Which channel each byte of an ARGB8888 pixel is */
+static const int argbOrder[4] =
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+    { 2, 1, 0, -1 };
+#else
+    { -1, 0, 1, 2 };
+#endif
+
+/* Do what a key says to the levels and say whether the image needs drawing
+ * again. Shift raises what the letters lower. */
+static int
+levelsKey(SDL_Keycode sym, int up)
+{
+    int c;
+
+    switch (sym) {
+    case SDLK_c:
+	channel = channel == 2 ? -1 : channel + 1;
+	return 0;
+    case SDLK_0:
+	levels_reset(&levels);
+	return 1;
+    case SDLK_i:
+	showHistogram = !showHistogram;
+	return 1;
+    case SDLK_b: case SDLK_w: case SDLK_g:
+	break;
+    default:
+	return 0;
+    }
+    for (c = 0; c < 3; c++) {
+	if (channel >= 0 && c != channel) continue;
+	switch (sym) {
+	case SDLK_b:
+	    levels.black[c] += up ? BLACK_STEP : -BLACK_STEP;
+	    if (levels.black[c] < 0) levels.black[c] = 0;
+	    if (levels.black[c] >= levels.white[c])
+		levels.black[c] = levels.white[c] - 1;
+	    break;
+	case SDLK_w:
+	    levels.white[c] += up ? BLACK_STEP : -BLACK_STEP;
+	    if (levels.white[c] > 255) levels.white[c] = 255;
+	    if (levels.white[c] <= levels.black[c])
+		levels.white[c] = levels.black[c] + 1;
+	    break;
+	default:	/* g */
+	    levels.gamma[c] *= up ? GAMMA_STEP : 1 / GAMMA_STEP;
+	    if (levels.gamma[c] < 0.1) levels.gamma[c] = 0.1;
+	    if (levels.gamma[c] > 10) levels.gamma[c] = 10;
+	    break;
+	}
+    }
+    return 1;
+}
+
+/* Make "image" into ARGB8888 to look up from and count its histogram,
+ * once per image. */
+static int
+levelsSource(SDL_Surface *image)
+{
+    if (levelsFor != image) {
+	if (levelSource != NULL) SDL_FreeSurface(levelSource);
+	if (levelled != NULL) SDL_DestroyTexture(levelled);
+	levelSource = NULL;
+	levelled = NULL;
+	levelsFor = image;
+    }
+    if (levelSource == NULL && image != NULL) {
+	trace_begin("histogram");
+	levelSource = SDL_ConvertSurfaceFormat(image, SDL_PIXELFORMAT_ARGB8888, 0);
+	if (levelSource != NULL)
+	    levels_histogram(levelSource->pixels, levelSource->w,
+			     levelSource->h, levelSource->pitch, 4, histogram);
+	trace_end("histogram");
+    }
+    return levelSource != NULL;
+}
+
+static void
+dropLevelled(void)
+{
+    if (levelled != NULL) SDL_DestroyTexture(levelled);
+    levelled = NULL;
+}
+
+/* Make the tables for the levels and, if they do anything, get the image
+ * ready to be scaled through them the next time it's drawn. */
+static void
+applyLevels(SDL_Surface *image)
+{
+    levels_tables(&levels, argbOrder, 4, lut);
+    levelledStale = 1;
+    if (image == NULL || (levels_identity(&levels) && !showHistogram)) {
+	levelsSource(NULL);
+	return;
+    }
+    if (!levelsSource(image) || levels_identity(&levels)) dropLevelled();
+}
+
+/* The image scaled to w x h through the tables, made again if the size or
+ * the levels have changed, or NULL to show the plain texture. */
+static SDL_Texture *
+levelledTexture(SDL_Renderer *renderer, int w, int h)
+{
+    void *pixels;
+    int pitch, result;
+
+    if (levelSource == NULL || levels_identity(&levels) || w < 1 || h < 1)
+	return NULL;
+    if (levelled != NULL && (w != levelledW || h != levelledH))
+	dropLevelled();
+    if (levelled == NULL) {
+	levelled = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+				     SDL_TEXTUREACCESS_STREAMING, w, h);
+	if (levelled == NULL) return NULL;
+	levelledW = w;
+	levelledH = h;
+	levelledStale = 1;
+    }
+    if (!levelledStale) return levelled;
+
+    if (SDL_LockTexture(levelled, NULL, &pixels, &pitch) != 0) {
+	dropLevelled();
+	return NULL;
+    }
+    trace_begin("levels");
+    result = scale_levels(levelSource->pixels, levelSource->w,
+			  levelSource->h, levelSource->pitch, pixels, w, h,
+			  pitch, 4, lut);
+    trace_end("levels");
+    SDL_UnlockTexture(levelled);
+    if (result < 0) {
+	dropLevelled();
+	return NULL;
+    }
+    levelledStale = 0;
+    return levelled;
+}
+
+/* The histogram of what's showing, in the bottom left corner, the three
+ * channels added together so where they coincide it's white. */
+static void
+drawHistogram(SDL_Renderer *renderer, int wh)
+{
+    unsigned long shown[4][256], max = 1;
+    SDL_Rect box;
+    int b, v, x0 = HIST_MARGIN, y0 = wh - HIST_MARGIN;
+
+    levels_remap(histogram, 4, lut, shown);
+    /* Not counting 0 and 255, which clipping piles up */
+    for (b = 0; b < 4; b++) {
+	if (argbOrder[b] < 0) continue;
+	for (v = 1; v < 255; v++)
+	    if (shown[b][v] > max) max = shown[b][v];
+    }
+
+    box.x = x0; box.y = y0 - HIST_H; box.w = HIST_W; box.h = HIST_H;
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+    SDL_RenderFillRect(renderer, &box);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_ADD);
+    for (b = 0; b < 4; b++) {
+	int c = argbOrder[b];
+
+	if (c < 0) continue;
+	SDL_SetRenderDrawColor(renderer, c == 0 ? 255 : 0, c == 1 ? 255 : 0,
+			       c == 2 ? 255 : 0, 255);
+	for (v = 0; v < 256; v++) {
+	    unsigned long n = shown[b][v] > max ? max : shown[b][v];
+	    int y = (int) ((double) n * HIST_H / max);
+
+	    if (y > 0)
+		SDL_RenderDrawLine(renderer, x0 + v, y0 - 1, x0 + v, y0 - y);
+	}
+    }
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+}
+
+/* Copy the texture to fill the window, turned the way an EXIF orientation
+ * says. The renderer flips it first, then turns it clockwise about the
+ * middle, so one that ends up on its side starts the other way round.
+ * If the levels are set, it's the levelled one instead, already the size
+ * it's drawn at. */
+static void
+renderImage(SDL_Renderer *renderer, SDL_Texture *texture, int ww, int wh,
+	    int orientation)
+{
+    static const double angle[9] = { 0, 0, 0, 180, 180, 270, 90, 90, 270 };
+    static const int mirror[9] =   { 0, 0, 1, 0,   1,   1,   0,  1,  0 };
+    SDL_Texture *levelledTex;
+    SDL_Rect dst;
+
+    if (orientation >= 5) {
+	dst.w = wh; dst.h = ww;
+	dst.x = (ww - wh) / 2; dst.y = (wh - ww) / 2;
+    } else {
+	dst.w = ww; dst.h = wh;
+	dst.x = dst.y = 0;
+    }
+    if ((levelledTex = levelledTexture(renderer, dst.w, dst.h)) != NULL)
+	texture = levelledTex;
+    SDL_RenderCopyEx(renderer, texture, NULL, &dst, angle[orientation], NULL,
+		     mirror[orientation] ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE);
+    if (showHistogram && levelSource != NULL) drawHistogram(renderer, wh);
+}
 
 int
 main(argc, argv)
@@ -32,24 +619,76 @@ char **argv;
     SDL_Window	*window;
     SDL_Renderer *renderer;
     SDL_Surface *image;	    /* image as read from file */
+    int		reduced;    /* Is it smaller than in the file? */
+    SDL_DisplayMode screen;
     SDL_Texture	*texture;   /* image converted to a texture of the same size */
     SDL_Rect	rect;	    /* */
     SDL_Event	event;
     char *filename = (argc > 1) ? argv[1] : "image.jpg";
+    unsigned char *thumb;   /* The preview from its EXIF data */
+    int		tw, th;	    /* and its size */
+    int		orientation;	/* How to turn the image when it's there */
+    int		user = 1;   /* How the keys have turned it since */
+    int		turn;	    /* How to turn what's in the texture now */
+    int		key;
+    int		maxw, maxh; /* Image pixels that fit on the screen */
+    int		ww, wh;	    /* The size of the window */
+    int		iw, ih;	    /* and that in image pixels */
+    load_t	load;	    /* Reading it in the background */
 
-    SDL_Init(SDL_INIT_VIDEO);
+    levels_reset(&levels);
+    SDL_Init(SDL_INIT_VIDEO|SDL_INIT_TIMER);
     atexit(SDL_Quit);
+    stamp("init");
 
-    image = IMG_Load(filename);
-    if (!image) {
-	fprintf(stderr, "Failed to read image file: %s\n", SDL_GetError());
-	perror(argv[1]);
-	exit(1);
+    /* Report the stats on SIGUSR1 or to the stats socket */
+    stats_init("image1-sdl2");
+    SDL_AddTimer(STATS_POLL, pollStats, NULL);
+
+    /* Don't decode more than will fit on the screen */
+    if (SDL_GetDesktopDisplayMode(0, &screen) != 0)
+	screen.w = screen.h = INT_MAX;	/* Don't know. Decode it all. */
+
+    /* If it has a preview, show that at the size the image will be and read
+     * the image in the background. Turned on its side, the screen's width
+     * limits the image's height. */
+    trace_begin("preview");
+    thumb = exifthumb_load(filename, &tw, &th, &orientation);
+    trace_end("preview");
+    maxw = orientation >= 5 ? screen.h : screen.w;
+    maxh = orientation >= 5 ? screen.w : screen.h;
+    if (thumb != NULL && loadjpeg_size(filename, &ww, &wh) == 0) {
+	image = NULL;
+	reduced = 0;
+	if (ww > maxw) ww = maxw;
+	if (wh > maxh) wh = maxh;
+	load.filename = filename;
+	load.w = ww;
+	load.h = wh;
+	turn = 1;	/* The preview is already the right way up */
+    } else {
+	free(thumb);
+	thumb = NULL;
+	trace_begin("decode");
+	image = loadImage(filename, maxw, maxh, &reduced);
+	trace_end("decode");
+	if (!image) {
+	    fprintf(stderr, "Failed to read image file: %s\n", SDL_GetError());
+	    perror(argv[1]);
+	    exit(1);
+	}
+	stamp("decode");
+	ww = image->w;
+	wh = image->h;
+	turn = orientation;
+    }
+    if (orientation >= 5) {
+	int t = ww; ww = wh; wh = t;
     }
 
     window = SDL_CreateWindow("image1-sdl2",
 	SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-	image->w, image->h, SDL_WINDOW_RESIZABLE);
+	ww, wh, SDL_WINDOW_RESIZABLE);
     if (!window) {
 	printf("Failed to create window: %s\n", SDL_GetError());
 	exit(1);
@@ -61,14 +700,38 @@ char **argv;
 	exit(1);
     }
 
-    texture = SDL_CreateTextureFromSurface(renderer, image);
+    if (thumb != NULL) {
+	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGB24,
+				    SDL_TEXTUREACCESS_STATIC, tw, th);
+	if (texture != NULL) SDL_UpdateTexture(texture, NULL, thumb, tw * 3);
+	free(thumb);
+    } else {
+	texture = SDL_CreateTextureFromSurface(renderer, image);
+    }
     if (!texture) {
 	fprintf(stderr, "Failed to create texture: %s\n", SDL_GetError());
 	exit(1);
     }
 
-    SDL_RenderCopy(renderer, texture, NULL, NULL);
-    SDL_RenderPresent(renderer);
+    /* The renderer does the scaling as it copies the texture */
+    if (image != NULL) {
+	trace_scale(image->w, image->h, image->w, image->h, "renderer");
+	renderImage(renderer, texture, ww, wh, imageTurn(image, turn));
+	trace_end("scale");
+	stamp("scale");
+	trace_begin("present");
+	SDL_RenderPresent(renderer);
+	trace_end("present");
+	stamp("present");
+    } else {
+	renderImage(renderer, texture, ww, wh, turn);
+	SDL_RenderPresent(renderer);
+	stamp("preview");
+	if (SDL_CreateThread(loadInBackground, "decode", &load) == NULL) {
+	    fprintf(stderr, "Failed to create thread: %s\n", SDL_GetError());
+	    exit(1);
+	}
+    }
 
     while (SDL_WaitEvent(&event)) switch (event.type) {
     case SDL_QUIT:
@@ -78,23 +741,132 @@ char **argv;
 	if (event.key.keysym.sym == SDLK_q &&
 	    event.key.keysym.mod & KMOD_CTRL)
 		exit(0);
+	if (event.key.keysym.mod & (KMOD_CTRL | KMOD_ALT))
+	    break;
+	if ((key = rotate_key(event.key.keysym.sym)) == 0) {
+	    if (levelsKey(event.key.keysym.sym,
+			  event.key.keysym.mod & KMOD_SHIFT)) {
+		applyLevels(image);
+		SDL_GetWindowSize(window, &ww, &wh);
+		renderImage(renderer, texture, ww, wh, imageTurn(image, turn));
+		SDL_RenderPresent(renderer);
+	    }
+	    break;
+	}
+	/* Turn the window with the image so it keeps its shape. The resize
+	 * draws it, or we do if the window manager won't have it. */
+	user = rotate_then(user, key);
+	turn = rotate_then(turn, key);
+	SDL_GetWindowSize(window, &ww, &wh);
+	if (ROTATE_SWAPS(key)) {
+	    int t = ww; ww = wh; wh = t;
+	    SDL_SetWindowSize(window, ww, wh);
+	    SDL_GetWindowSize(window, &ww, &wh);
+	}
+	renderImage(renderer, texture, ww, wh, imageTurn(image, turn));
+	SDL_RenderPresent(renderer);
+	break;
+
+    case SDL_USEREVENT:
+	if (event.user.code == STATS_EVENT) {
+	    SDL_AtomicSet(&statsPending, 0);
+	    stats_service();
+	    break;
+	}
+	/* The image is here. Swap it for the preview. */
+	image = load.image;
+	if (image == NULL) {
+	    fprintf(stderr, "Failed to read image file: %s\n", SDL_GetError());
+	    exit(1);
+	}
+	stamp("decode");
+	{
+	    SDL_Texture *newTexture = SDL_CreateTextureFromSurface(renderer,
+								  image);
+	    if (newTexture == NULL) {
+		fprintf(stderr, "Failed to create texture: %s\n",
+			SDL_GetError());
+		exit(1);
+	    }
+	    SDL_DestroyTexture(texture);
+	    texture = newTexture;
+	}
+	reduced = load.reduced;
+	applyLevels(image);
+	turn = rotate_then(orientation, user);
+	SDL_GetWindowSize(window, &ww, &wh);
+	trace_scale(image->w, image->h, ww, wh, "renderer");
+	renderImage(renderer, texture, ww, wh, imageTurn(image, turn));
+	trace_end("scale");
+	stamp("scale");
+	trace_begin("present");
+	SDL_RenderPresent(renderer);
+	trace_end("present");
+	stamp("present");
 	break;
 
     case SDL_WINDOWEVENT:
 	switch (event.window.event) {
 	case SDL_WINDOWEVENT_SIZE_CHANGED:
+	    stats_add(STAT_RESIZES, 1);
+	    /* Don't draw a frame at this size if there's a newer one */
+	    if (moreResizes()) {
+		stats_add(STAT_COALESCED, 1);
+		break;
+	    }
+	    /* If they've made it bigger than a reduced image, read more.
+	     * Turned on its side, the window's width is the image's height. */
+	    iw = ROTATE_SWAPS(turn) ? event.window.data2 : event.window.data1;
+	    ih = ROTATE_SWAPS(turn) ? event.window.data1 : event.window.data2;
+	    if (image != NULL && reduced && (iw > image->w || ih > image->h)) {
+		SDL_Surface *bigger;
+		SDL_Texture *newTexture = NULL;
+		int stillReduced;
+
+		trace_begin("decode");
+		bigger = loadImage(filename, iw, ih, &stillReduced);
+		trace_end("decode");
+		if (bigger != NULL)
+		    newTexture = SDL_CreateTextureFromSurface(renderer, bigger);
+		if (newTexture != NULL) {
+		    SDL_DestroyTexture(texture);
+		    texture = newTexture;
+		    freeImage(image);
+		    image = bigger;
+		    reduced = stillReduced;
+		    applyLevels(image);
+		} else if (bigger != NULL) {
+		    freeImage(bigger);
+		}
+	    }
 #if 0
 	    rect.x = rect.y = 0;
 	    rect.w = event.window.data1;
 	    rect.h = event.window.data2;
 	    SDL_RenderCopy(renderer, texture, NULL, &rect);
 #else
-	    SDL_RenderCopy(renderer, texture, NULL, NULL);
+	    {
+		long long start = stats_now();
+
+		ww = event.window.data1;
+		wh = event.window.data2;
+		/* While it's still reading the image, show the preview */
+		if (image != NULL)
+		    trace_scale(image->w, image->h, ww, wh, "renderer");
+		renderImage(renderer, texture, ww, wh, imageTurn(image, turn));
+		if (image != NULL) trace_end("scale");
+		/* The renderer scales on the fly into its own buffers */
+		stats_scaled(start, 0);
+	    }
 #endif
+	    trace_begin("present");
 	    SDL_RenderPresent(renderer);
+	    trace_end("present");
 	    break;
 	case SDL_WINDOWEVENT_EXPOSED:
+	    trace_begin("present");
 	    SDL_RenderPresent(renderer);
+	    trace_end("present");
 	    break;
 	}
 	break;
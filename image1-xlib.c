@@ -0,0 +1,699 @@
+/*
+ * image1-xlib.c: Plain Xlib test piece to display an image file, as the
+ * baseline that the toolkits can be compared against.
+ *
+ * The image file is given as a command-line argument (default: image.jpg).
+ * The window should open to exactly fit the image at one-pixel-per-pixel size.
+ * The user can then resize the window in which case the image scales to fit
+ * the window without keeping its aspect ratio.
+ * If they hit Control-Q or poke the [X] icon in the window's titlebar,
+ * the application should quit.
+ *
+ * There is nothing between our pixels and the X server: the image is
+ * converted to the visual's pixel format once when it is read, and each
+ * frame is scaled (see scale.c) straight into a MIT-SHM shared memory
+ * XImage, which the server copies to the window without it going down the
+ * socket. There are two of them, so the next frame is scaled into one while
+ * the server is still copying the other, and we only wait for a ShmCompletion
+ * event if it's still copying the one we want next. If the server can't do
+ * MIT-SHM, for example over the network, it uses XPutImage instead.
+ *
+ * JPEGs are decoded at a reduced size if they're bigger than the screen,
+ * and again at a bigger one if the window is made bigger than that
+ * (see loadjpeg.c), and uncompressed PPM, PGM, PAM, PBM, BMP, TGA and
+ * farbfeld files are mapped into memory (see rawimg.c). What we convert
+ * is kept in the pixel cache (see pixcache.c).
+ *
+ * It does 16-, 24- and 32-bit TrueColor visuals. On 16-bit ones the frames
+ * are dithered, unless IMAGE_DITHER=0.
+ *
+ * JPEGs are turned the way their EXIF orientation says, and the r and l keys
+ * turn the image a quarter turn clockwise and anticlockwise and h and v flip
+ * it left to right and top to bottom. The source image is what is turned,
+ * once for each (see rotate.c), so the frames are scaled from it as before.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XShm.h>
+
+#include "stamp.h"
+#include "trace.h"
+#include "stats.h"
+#include "loadjpeg.h"
+#include "pixcache.h"
+#include "rawimg.h"
+#include "scale.h"
+#include "exifthumb.h"
+#include "rotate.h"
+
+static Display *dpy;
+static Window window;
+static GC gc;
+static Visual *visual;
+static int depth;
+static int bpp;			/* Bytes per pixel of an XImage */
+static int useShm;		/* Use MIT-SHM for the XImages */
+static int shmCompletion;	/* The ShmCompletion event's type */
+static int dither;		/* Dither on 16-bit visuals */
+
+/* The image in the visual's pixel format, which the frames are scaled from */
+static struct {
+    unsigned char *pixels;
+    int w, h, pitch;
+    int denom;			/* How much a JPEG was reduced by */
+    int turn;			/* How it's turned from the file's way up */
+    pixcache_t *pc;		/* The cache entry it's in, or NULL if it was
+				 * malloc()ed */
+} source;
+
+/* What each 8-bit value of R, G and B becomes in a pixel of the visual */
+static unsigned long rTab[256], gTab[256], bTab[256];
+
+/* An XImage to draw frames in */
+typedef struct {
+    XImage *image;
+    XShmSegmentInfo shm;
+    int busy;			/* The server is still copying it */
+} buffer_t;
+
+static buffer_t buffers[2];
+static int shown = -1;		/* The buffer we presented last */
+
+/*
+ * The visual
+ */
+
+static void
+makeTable(unsigned long *tab, unsigned long mask)
+{
+    int shift, bits, max, v;
+
+    for (shift = 0; !(mask >> shift & 1); shift++)
+	;
+    for (bits = 0; mask >> (shift + bits) & 1; bits++)
+	;
+    max = (1 << bits) - 1;
+    for (v = 0; v < 256; v++)
+	tab[v] = (unsigned long) ((v * max + 127) / 255) << shift;
+}
+
+/* Find the bytes per pixel of images of our depth. Returns 0 if it's not
+ * 2, 3 or 4. */
+static int
+bytesPerPixel(void)
+{
+    XPixmapFormatValues *formats;
+    int n, i, result = 0;
+
+    if ((formats = XListPixmapFormats(dpy, &n)) == NULL) return 0;
+    for (i = 0; i < n; i++)
+	if (formats[i].depth == depth &&
+	    formats[i].bits_per_pixel >= 16 && formats[i].bits_per_pixel <= 32)
+	    result = formats[i].bits_per_pixel / 8;
+    XFree(formats);
+    return result;
+}
+
+/* Put a pixel value into memory in our byte order, which is what we tell
+ * Xlib the XImages are in. */
+static void
+putPixel(unsigned char *p, unsigned long v)
+{
+    uint16_t v16 = v;
+    uint32_t v32 = v;
+
+    switch (bpp) {
+    case 2: memcpy(p, &v16, 2); break;
+    case 4: memcpy(p, &v32, 4); break;
+    default:
+#ifdef WORDS_BIGENDIAN
+	p[0] = v >> 16; p[1] = v >> 8; p[2] = v;
+#else
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16;
+#endif
+	break;
+    }
+}
+
+/*
+ * Reading the image
+ */
+
+/* Which byte of a native-endian pixel of n bytes a channel's mask is in */
+static int
+maskByte(uint32_t mask, int n)
+{
+    int shift = 0;
+    static const union { uint16_t s; unsigned char c[2]; } one = { 1 };
+
+    while (shift < 24 && !(mask >> shift & 1)) shift += 8;
+    return one.c[0] ? shift / 8 : n - 1 - shift / 8;
+}
+
+/* Convert rows of pixels of "sbpp" bytes, with R, G and B in bytes r, g and b
+ * of each (all 0 for gray, and sbpp 0 for a PBM bitmap), to the visual's
+ * format in a malloc()ed buffer that becomes the source image. */
+static int
+convert(const unsigned char *src, int w, int h, int spitch, int sbpp,
+	int r, int g, int b)
+{
+    unsigned char *dst;
+    int x, y;
+
+    if ((dst = malloc((size_t) w * bpp * h)) == NULL) return -1;
+    for (y = 0; y < h; y++) {
+	const unsigned char *s = src + (size_t) y * spitch;
+	unsigned char *d = dst + (size_t) y * w * bpp;
+
+	for (x = 0; x < w; x++, s += sbpp, d += bpp) {
+	    if (sbpp == 0) {
+		/* In a PBM, 1 is black */
+		int v = (s[x / 8] >> (7 - x % 8) & 1) ? 0 : 255;
+
+		putPixel(d, rTab[v] | gTab[v] | bTab[v]);
+	    } else {
+		putPixel(d, rTab[s[r]] | gTab[s[g]] | bTab[s[b]]);
+	    }
+	}
+    }
+    source.pixels = dst;
+    source.w = w;
+    source.h = h;
+    source.pitch = w * bpp;
+    source.pc = NULL;
+    return 0;
+}
+
+/* Read the image, at a reduced size if it's a JPEG bigger than w x h, into
+ * "source". Returns 0 or -1 if we can't read it. */
+static int
+loadImage(char *filename, int w, int h)
+{
+    rawimg_t *raw;
+    pixcache_t *pc;
+    unsigned char *pixels;
+    char variant[32];
+    int iw, ih, d, i;
+
+    /* Is it in the cache already, in this visual's format? */
+    d = 1;
+    if (loadjpeg_size(filename, &iw, &ih) == 0)
+	for (d = 8; d > 1; d /= 2)
+	    if ((iw + d - 1) / d >= w && (ih + d - 1) / d >= h) break;
+    sprintf(variant, "xlib/%d/%lx/%lx/%lx", d, visual->red_mask,
+	    visual->green_mask, visual->blue_mask);
+    if ((pc = pixcache_get(filename, variant)) != NULL) {
+	if (pc->bpp == bpp) {
+	    source.pixels = pc->pixels;
+	    source.w = pc->width;
+	    source.h = pc->height;
+	    source.pitch = pc->stride;
+	    source.denom = d;
+	    source.pc = pc;
+	    return 0;
+	}
+	pixcache_release(pc);
+    }
+
+    if ((raw = rawimg_open(filename)) != NULL) {
+	int failed;
+
+	if (raw->mono || raw->gray)
+	    failed = convert(raw->pixels, raw->width, raw->height, raw->pitch,
+			     raw->bpp, 0, 0, 0);
+	else
+	    failed = convert(raw->pixels, raw->width, raw->height, raw->pitch,
+			     raw->bpp, maskByte(raw->rmask, raw->bpp),
+			     maskByte(raw->gmask, raw->bpp),
+			     maskByte(raw->bmask, raw->bpp));
+	if (!failed && raw->bottomUp) {
+	    /* Turn it the right way up */
+	    unsigned char *row = malloc(source.pitch);
+
+	    for (i = 0; row && i < source.h / 2; i++) {
+		unsigned char *top = source.pixels + (size_t) i * source.pitch;
+		unsigned char *bottom = source.pixels +
+				    (size_t) (source.h - 1 - i) * source.pitch;
+
+		memcpy(row, top, source.pitch);
+		memcpy(top, bottom, source.pitch);
+		memcpy(bottom, row, source.pitch);
+	    }
+	    free(row);
+	}
+	rawimg_close(raw);
+	if (failed) return -1;
+	source.denom = 1;
+    } else {
+	int jbpp;
+
+	/* Gray JPEGs stay gray until they're converted */
+	pixels = loadjpeg_native(filename, w, h, &iw, &ih, &source.denom,
+				 &jbpp);
+	if (pixels == NULL) return -1;
+	if (jbpp == 1)
+	    i = convert(pixels, iw, ih, iw, 1, 0, 0, 0);
+	else
+	    i = convert(pixels, iw, ih, iw * 3, 3, 0, 1, 2);
+	free(pixels);
+	if (i < 0) return -1;
+    }
+
+    pixcache_put(filename, variant, source.pixels, source.w, source.h,
+		 source.pitch, bpp, visual->red_mask, visual->green_mask,
+		 visual->blue_mask, 0);
+    return 0;
+}
+
+static void
+freeImage(void)
+{
+    if (source.pc) pixcache_release(source.pc);
+    else free(source.pixels);
+    source.pixels = NULL;
+    source.pc = NULL;
+}
+
+/* Turn the source image the way an EXIF orientation says. The cache keeps
+ * it the way the file has it, so a turned one is always malloc()ed. */
+static void
+turnImage(int orientation)
+{
+    int w = ROTATE_SWAPS(orientation) ? source.h : source.w;
+    int h = ROTATE_SWAPS(orientation) ? source.w : source.h;
+    unsigned char *turned;
+
+    if (orientation == 1) return;
+    if ((turned = malloc((size_t) w * bpp * h)) == NULL) {
+	fputs("Can't turn the image\n", stderr);
+	exit(1);
+    }
+    trace_begin("rotate");
+    rotate_pixels(source.pixels, source.w, source.h, source.pitch, turned,
+		  w * bpp, bpp, orientation);
+    trace_end("rotate");
+    freeImage();
+    source.pixels = turned;
+    source.w = w;
+    source.h = h;
+    source.pitch = w * bpp;
+    source.turn = rotate_then(source.turn, orientation);
+}
+
+/* Read the image as loadImage() does, for a window of w x h, and turn it
+ * the way "turn" says. */
+static int
+loadTurned(char *filename, int w, int h, int turn)
+{
+    if ((ROTATE_SWAPS(turn) ? loadImage(filename, h, w)
+			    : loadImage(filename, w, h)) < 0)
+	return -1;
+    source.turn = 1;
+    turnImage(turn);
+    return 0;
+}
+
+/*
+ * The XImages
+ */
+
+/* Set if XShmAttach() fails, which it only says asynchronously */
+static int shmFailed;
+
+static int
+shmError(Display *d, XErrorEvent *e)
+{
+    shmFailed = 1;
+    return 0;
+}
+
+/* Make an XImage of w x h in a shared memory segment, or NULL if we can't */
+static XImage *
+createShmImage(XShmSegmentInfo *shm, int w, int h)
+{
+    XImage *image;
+    int (*oldHandler)(Display *, XErrorEvent *);
+
+    image = XShmCreateImage(dpy, visual, depth, ZPixmap, NULL, shm, w, h);
+    if (image == NULL) return NULL;
+    shm->shmid = shmget(IPC_PRIVATE, (size_t) image->bytes_per_line * h,
+			IPC_CREAT | 0600);
+    if (shm->shmid < 0) {
+	XDestroyImage(image);
+	return NULL;
+    }
+    shm->shmaddr = image->data = shmat(shm->shmid, NULL, 0);
+    shm->readOnly = True;
+    shmFailed = 0;
+    oldHandler = XSetErrorHandler(shmError);
+    if (shm->shmaddr == (void *) -1 || !XShmAttach(dpy, shm))
+	shmFailed = 1;
+    XSync(dpy, False);
+    XSetErrorHandler(oldHandler);
+    /* It goes when both of us have detached it */
+    shmctl(shm->shmid, IPC_RMID, NULL);
+    if (shmFailed) {
+	if (shm->shmaddr != (void *) -1) shmdt(shm->shmaddr);
+	image->data = NULL;
+	XDestroyImage(image);
+	return NULL;
+    }
+    return image;
+}
+
+static XImage *
+createImage(int w, int h)
+{
+    XImage *image;
+
+    image = XCreateImage(dpy, visual, depth, ZPixmap, 0, NULL, w, h, 32, 0);
+    if (image == NULL) return NULL;
+    if ((image->data = malloc((size_t) image->bytes_per_line * h)) == NULL) {
+	XDestroyImage(image);
+	return NULL;
+    }
+    return image;
+}
+
+static void
+destroyBuffer(buffer_t *buf)
+{
+    if (buf->image == NULL) return;
+    stats_add(STAT_LIVE_BYTES,
+	      -(long) buf->image->bytes_per_line * buf->image->height);
+    if (useShm) {
+	XShmDetach(dpy, &buf->shm);
+	buf->image->data = NULL;
+	XDestroyImage(buf->image);
+	shmdt(buf->shm.shmaddr);
+    } else {
+	XDestroyImage(buf->image);	/* and its data */
+    }
+    buf->image = NULL;
+}
+
+/* Wait for the server to finish copying a buffer */
+static Bool
+isCompletion(Display *d, XEvent *ev, XPointer arg)
+{
+    return ev->type == shmCompletion &&
+	   ((XShmCompletionEvent *) ev)->shmseg == ((buffer_t *) arg)->shm.shmseg;
+}
+
+static void
+waitFor(buffer_t *buf)
+{
+    XEvent ev;
+
+    if (!buf->busy) return;
+    XIfEvent(dpy, &ev, isCompletion, (XPointer) buf);
+    buf->busy = 0;
+}
+
+/* Get a buffer of w x h that the server isn't copying. With MIT-SHM it's
+ * the one that isn't on the screen; without, XPutImage() has copied it by
+ * the time it returns, so one is enough. Returns its index or -1. */
+static int
+getBuffer(int w, int h)
+{
+    int b = useShm ? (shown + 1) % 2 : 0;
+    buffer_t *buf = &buffers[b];
+
+    waitFor(buf);
+    if (buf->image &&
+	(buf->image->width != w || buf->image->height != h))
+	destroyBuffer(buf);
+    if (buf->image == NULL) {
+	if (useShm && (buf->image = createShmImage(&buf->shm, w, h)) == NULL) {
+	    /* Do without, from now on */
+	    fputs("image1-xlib: Can't use MIT-SHM, using XPutImage\n", stderr);
+	    destroyBuffer(&buffers[1 - b]);
+	    shown = -1;
+	    useShm = 0;
+	}
+	if (!useShm) buf->image = createImage(w, h);
+	if (buf->image == NULL) return -1;
+	/* Our pixels are in our byte order and Xlib swaps them if it must */
+#ifdef WORDS_BIGENDIAN
+	buf->image->byte_order = MSBFirst;
+#else
+	buf->image->byte_order = LSBFirst;
+#endif
+	stats_add(STAT_PIXEL_BYTES, (long) buf->image->bytes_per_line * h);
+	stats_add(STAT_LIVE_BYTES, (long) buf->image->bytes_per_line * h);
+    }
+    return b;
+}
+
+static void
+present(int b)
+{
+    buffer_t *buf = &buffers[b];
+
+    trace_begin("present");
+    if (useShm) {
+	XShmPutImage(dpy, window, gc, buf->image, 0, 0, 0, 0,
+		     buf->image->width, buf->image->height, True);
+	buf->busy = 1;
+    } else {
+	XPutImage(dpy, window, gc, buf->image, 0, 0, 0, 0,
+		  buf->image->width, buf->image->height);
+    }
+    XFlush(dpy);
+    trace_end("present");
+    shown = b;
+}
+
+/* Scale the image to w x h and show it */
+static void
+draw(int w, int h)
+{
+    XImage *image;
+    long long start;
+    int b, y, result = 0;
+
+    if ((b = getBuffer(w, h)) < 0) {
+	fprintf(stderr, "Can't make a %dx%d image\n", w, h);
+	exit(1);
+    }
+    image = buffers[b].image;
+
+    start = stats_now();
+    if (w == source.w && h == source.h) {
+	trace_begin("copy");
+	for (y = 0; y < h; y++)
+	    memcpy(image->data + (size_t) y * image->bytes_per_line,
+		   source.pixels + (size_t) y * source.pitch, w * bpp);
+	trace_end("copy");
+    } else {
+	trace_scale(source.w, source.h, w, h, "area");
+	if (bpp == 2)
+	    result = scale_pixels16(source.pixels, source.w, source.h,
+				    source.pitch, (unsigned char *) image->data,
+				    w, h, image->bytes_per_line,
+				    visual->red_mask, visual->green_mask,
+				    visual->blue_mask, dither, 0);
+	else
+	    result = scale_pixels(source.pixels, source.w, source.h,
+				  source.pitch, (unsigned char *) image->data,
+				  w, h, image->bytes_per_line, bpp);
+	trace_end("scale");
+	if (result < 0) {
+	    fprintf(stderr, "Can't scale to %dx%d\n", w, h);
+	    exit(1);
+	}
+	stats_scaled(start, (long) image->bytes_per_line * h);
+	stats_add(STAT_CACHE_MISSES, 1);
+	stamp("scale");
+    }
+    present(b);
+}
+
+int
+main(argc, argv)
+int argc;
+char **argv;
+{
+    char *filename = (argc > 1) ? argv[1] : "image.jpg";
+    XVisualInfo vinfo;
+    XSizeHints hints;
+    Atom wmDelete, netWmPid;
+    long pid = getpid();
+    int screen, major, minor;
+    int width, height;		/* Of the window */
+    int resized = 0;		/* There's a new size to draw at */
+    Bool pixmaps;
+
+    if ((dpy = XOpenDisplay(NULL)) == NULL) {
+	fputs("Can't open the display\n", stderr);
+	exit(1);
+    }
+    screen = DefaultScreen(dpy);
+    stamp("init");
+
+    stats_init("image1-xlib");
+
+    /* The default visual if it's TrueColor, otherwise any that is */
+    if (!XMatchVisualInfo(dpy, screen, DefaultDepth(dpy, screen),
+			  TrueColor, &vinfo) &&
+	!XMatchVisualInfo(dpy, screen, 24, TrueColor, &vinfo) &&
+	!XMatchVisualInfo(dpy, screen, 16, TrueColor, &vinfo)) {
+	fputs("image1-xlib needs a TrueColor visual\n", stderr);
+	exit(1);
+    }
+    visual = vinfo.visual;
+    depth = vinfo.depth;
+    if ((bpp = bytesPerPixel()) == 0) {
+	fprintf(stderr, "image1-xlib can't do %d-bit visuals\n", depth);
+	exit(1);
+    }
+    makeTable(rTab, visual->red_mask);
+    makeTable(gTab, visual->green_mask);
+    makeTable(bTab, visual->blue_mask);
+    dither = !getenv("IMAGE_DITHER") || atoi(getenv("IMAGE_DITHER"));
+
+    useShm = XShmQueryVersion(dpy, &major, &minor, &pixmaps);
+    shmCompletion = XShmGetEventBase(dpy) + ShmCompletion;
+
+    /* Don't decode more than will fit on the screen */
+    trace_begin("decode");
+    if (loadTurned(filename, DisplayWidth(dpy, screen),
+		   DisplayHeight(dpy, screen),
+		   exifthumb_orientation(filename)) < 0) {
+	trace_end("decode");
+	fputs("Couldn't read ", stderr);
+	perror(filename);
+	exit(1);
+    }
+    trace_end("decode");
+    stamp("decode");
+
+    width = source.w;
+    height = source.h;
+    {
+	XSetWindowAttributes attr;
+
+	attr.colormap = XCreateColormap(dpy, RootWindow(dpy, screen), visual,
+					AllocNone);
+	attr.background_pixel = 0;
+	attr.border_pixel = 0;
+	/* We draw every pixel, so don't have the server clear it first */
+	attr.bit_gravity = NorthWestGravity;
+	attr.event_mask = ExposureMask | StructureNotifyMask | KeyPressMask;
+	window = XCreateWindow(dpy, RootWindow(dpy, screen), 0, 0,
+			       width, height, 0, depth, InputOutput, visual,
+			       CWColormap | CWBackPixel | CWBorderPixel |
+			       CWBitGravity | CWEventMask, &attr);
+    }
+    XStoreName(dpy, window, "image1-xlib");
+    hints.flags = PMinSize;
+    hints.min_width = hints.min_height = 1;
+    XSetWMNormalHints(dpy, window, &hints);
+    wmDelete = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
+    XSetWMProtocols(dpy, window, &wmDelete, 1);
+    netWmPid = XInternAtom(dpy, "_NET_WM_PID", False);
+    XChangeProperty(dpy, window, netWmPid, XA_CARDINAL, 32, PropModeReplace,
+		    (unsigned char *) &pid, 1);
+    gc = XCreateGC(dpy, window, 0, NULL);
+    XMapWindow(dpy, window);
+
+    for (;;) {
+	struct pollfd pfd[2];
+
+	while (XPending(dpy)) {
+	    XEvent ev;
+	    int b;
+
+	    XNextEvent(dpy, &ev);
+	    switch (ev.type) {
+	    case Expose:
+		if (ev.xexpose.count > 0) break;
+		/* Show the last frame again if it's the right size */
+		if (shown >= 0 && !resized && buffers[shown].image &&
+		    buffers[shown].image->width == width &&
+		    buffers[shown].image->height == height) {
+		    waitFor(&buffers[shown]);
+		    present(shown);
+		} else {
+		    resized = 1;
+		}
+		break;
+	    case ConfigureNotify:
+		if (ev.xconfigure.width == width &&
+		    ev.xconfigure.height == height)
+		    break;	/* Just moved */
+		stats_add(STAT_RESIZES, 1);
+		/* We only draw once the queue is empty, so any earlier
+		 * size is skipped */
+		if (resized && shown >= 0) stats_add(STAT_COALESCED, 1);
+		width = ev.xconfigure.width;
+		height = ev.xconfigure.height;
+		resized = 1;
+		break;
+	    case KeyPress:
+		if (XLookupKeysym(&ev.xkey, 0) == XK_q &&
+		    (ev.xkey.state & ControlMask))
+		    exit(0);
+		if (ev.xkey.state & (ControlMask | Mod1Mask) ||
+		    (b = rotate_key(XLookupKeysym(&ev.xkey, 0))) == 0)
+		    break;
+		/* Turn the window with it. The frame at the old size is
+		 * drawn now and the new size comes as a ConfigureNotify. */
+		turnImage(b);
+		if (ROTATE_SWAPS(b)) XResizeWindow(dpy, window, height, width);
+		resized = 1;
+		break;
+	    case ClientMessage:
+		if ((Atom) ev.xclient.data.l[0] == wmDelete) exit(0);
+		break;
+	    default:
+		if (ev.type == shmCompletion) {
+		    for (b = 0; b < 2; b++)
+			if (buffers[b].image &&
+			    isCompletion(dpy, &ev, (XPointer) &buffers[b]))
+			    buffers[b].busy = 0;
+		}
+		break;
+	    }
+	}
+
+	if (resized) {
+	    /* If they've made it bigger than a reduced JPEG, decode more */
+	    if (source.denom > 1 && (width > source.w || height > source.h)) {
+		int turn = source.turn;
+
+		trace_begin("decode");
+		freeImage();
+		if (loadTurned(filename, width, height, turn) < 0) {
+		    fputs("Couldn't read ", stderr);
+		    perror(filename);
+		    exit(1);
+		}
+		trace_end("decode");
+	    }
+	    draw(width, height);
+	    stamp("present");
+	    resized = 0;
+	    continue;
+	}
+
+	/* Wait for the X server or a stats reader */
+	pfd[0].fd = ConnectionNumber(dpy);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = stats_fd();
+	pfd[1].events = POLLIN;
+	if (poll(pfd, pfd[1].fd >= 0 ? 2 : 1, -1) > 0 &&
+	    pfd[1].fd >= 0 && (pfd[1].revents & POLLIN))
+	    stats_service();
+    }
+}
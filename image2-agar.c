@@ -11,6 +11,16 @@
  * if successful, resize the the window to fit the image at 1:1 zoom,
  * and "Quit".
  *
+ * JPEGs are turned the way their EXIF orientation says, and the r and l keys
+ * turn the image a quarter turn clockwise and anticlockwise and h and v flip
+ * it left to right and top to bottom. The source image is turned once for
+ * each (see scale-agar.c) and the frames are scaled from that.
+ *
+ * With $IMAGE_SOAK set to a number, it goes through the files on its
+ * command line that many times, opening each the same way as File-Open
+ * does, printing its resident memory after each pass, then quits (see
+ * bench-soak.sh).
+ *
  *	 Martin Guy <martinwguy@gmail.com>, November 2016.
  *
  * Bugs:
@@ -39,8 +49,9 @@
  *	This happens when AG_BoxSetPadding(vbox, n) is less than 2.
  *	Define WORKAROUND_BUG to get around this.
  * Features:
- *    - The scaling is done to the nearest pixel, giving a shimmering effect
- *	to the image during window resizing.
+ *    - AG_PIXMAP_RESCALE's scaling is done to the nearest pixel, giving a
+ *	shimmering effect to the image during window resizing, so we do the
+ *	scaling ourselves in scale-agar.c.
  *    - You can't action a menu item by clicking on "File", moving down and
  *	releasing on "Open". You have to click-release on "File" and again on
  *	"Open".
@@ -53,12 +64,21 @@
  *    - "pixmap" shouldn't be global. How to get it to openFile otherwise?
  */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <agar/core.h>
 #include <agar/gui.h>
 
+#include "scale-agar.h"
+#include "exifthumb.h"
+#include "rotate.h"
+#include "stamp.h"
+#include "trace.h"
+
 #define WORKAROUND_BUG
 
 /* Event-handling routines */
+static void loadFile(const char *filename);
 static void do_OpenFile(AG_Event *event);
 static void do_QuitGUI(AG_Event *event);
 
@@ -69,13 +89,68 @@ static    AG_Pixmap	*pixmap;
 /* And this needs to be global for WORKAROUND_BUG */
 static    AG_Box	*vbox;
 
+/* and this for turning it with the image */
+static    AG_Window	*window;
+
+/* Turn or flip the image on the r, l, h and v keys, turning the image area
+ * with it if it changes shape. Global keys are bound to functions of no
+ * arguments, hence one for each. */
+static void
+turnImage(int key)
+{
+    if (scaledPixmapTurn(pixmap, key) == 0 && ROTATE_SWAPS(key))
+	AG_WindowSetGeometry(window, AGWIDGET(window)->x, AGWIDGET(window)->y,
+			     WIDTH(window) - WIDTH(pixmap) + HEIGHT(pixmap),
+			     HEIGHT(window) - HEIGHT(pixmap) + WIDTH(pixmap));
+}
+/* The soak test */
+#define SOAK_MS		20	/* Open one this often */
+
+static AG_Timer soak;
+static char	**soakNames;	/* The files to open */
+static int	soakFiles;	/* How many there are */
+static int	soakTotal;	/* How many opens to do */
+static int	soakDone;	/* and how many it has done */
+
+/* Our resident memory in kB, or -1 if we can't tell */
+static long
+residentKB(void)
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[128];
+    long kb = -1;
+
+    if (f == NULL) return -1;
+    while (fgets(line, sizeof(line), f) != NULL)
+	if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+    fclose(f);
+    return kb;
+}
+
+static Uint32
+soakNext(AG_Timer *timer, AG_Event *event)
+{
+    loadFile(soakNames[soakDone % soakFiles]);
+    if (++soakDone % soakFiles == 0 || soakDone == soakTotal) {
+	printf("%d\t%ld\n", soakDone, residentKB());
+	fflush(stdout);
+    }
+    if (soakDone < soakTotal) return SOAK_MS;
+    AG_QuitGUI();
+    return 0;
+}
+
+static void turnClockwise(void) { turnImage(ROTATE_CLOCKWISE); }
+static void turnAnticlockwise(void) { turnImage(ROTATE_ANTICLOCKWISE); }
+static void flipLeftRight(void) { turnImage(ROTATE_FLIP_LEFT_RIGHT); }
+static void flipTopBottom(void) { turnImage(ROTATE_FLIP_TOP_BOTTOM); }
+
 int
 main(argc, argv)
 int argc;
 char **argv;
 {
     char *progname;
-    AG_Window	*window;
     AG_Toolbar	*toolbar;
     AG_Menu	*menu;
     AG_MenuItem	*item;
@@ -93,6 +168,7 @@ char **argv;
 		    AG_GetError());
 	    exit(1);
     }
+    stamp("init");
 
     window = AG_WindowNew(0);
     if (!window) {
@@ -105,6 +181,10 @@ char **argv;
 
     /* Quit if they close the main window or press Ctrl-Q. */
     AG_BindGlobalKey(AG_KEY_Q, AG_KEYMOD_CTRL, AG_QuitGUI);
+    AG_BindGlobalKey(AG_KEY_R, AG_KEYMOD_NONE, turnClockwise);
+    AG_BindGlobalKey(AG_KEY_L, AG_KEYMOD_NONE, turnAnticlockwise);
+    AG_BindGlobalKey(AG_KEY_H, AG_KEYMOD_NONE, flipLeftRight);
+    AG_BindGlobalKey(AG_KEY_V, AG_KEYMOD_NONE, flipTopBottom);
     AG_SetEvent(window, "window-close", do_QuitGUI, "");
 
     /* Populate the window with a menu bar at the top and the image below */
@@ -128,24 +208,39 @@ char **argv;
     if (imageFilename == NULL) {
 	surface = AG_SurfaceEmpty();
     } else {
+	trace_begin("decode");
 	surface = AG_SurfaceFromFile(imageFilename);
+	trace_end("decode");
 	if (!surface) {
 	    fprintf(stderr, "Cannot make surface from file %s: %s.\n",
 		    imageFilename, AG_GetError());
 	    exit(1);
 	}
+	stamp("decode");
     }
 
-    pixmap = AG_PixmapFromSurface(
-	vbox, AG_PIXMAP_RESCALE|AG_PIXMAP_EXPAND, surface);
+    pixmap = scaledPixmapNew(vbox, AG_PIXMAP_EXPAND, surface);
     if (!pixmap) {
 	fprintf(stderr, "Cannot make pixmap from surface: %s.\n",
 		    AG_GetError());
 	exit(1);
     }
+    if (imageFilename != NULL)
+	scaledPixmapTurn(pixmap, exifthumb_orientation(imageFilename));
 
     AG_WindowShow(window);
 
+    if (getenv("IMAGE_SOAK") != NULL && imageFilename != NULL &&
+	atoi(getenv("IMAGE_SOAK")) > 0) {
+	soakNames = argv + 1;
+	soakFiles = argc - 1;
+	soakTotal = atoi(getenv("IMAGE_SOAK")) * soakFiles;
+	printf("opens\trss_kb\n0\t%ld\n", residentKB());
+	fflush(stdout);
+	AG_InitTimer(&soak, "soak", 0);
+	AG_AddTimer(window, &soak, SOAK_MS, soakNext, 0, NULL);
+    }
+
     AG_EventLoop();
 
     exit(0);
@@ -156,15 +251,28 @@ static void openFile(AG_Event *event)
 {
     char *filename = AG_STRING(1);	//== filetype->cfile
     AG_FileType *filetype = AG_PTR(2);
+
+    loadFile(filename);
+}
+
+/* Show a new file in place of the old one */
+static void
+loadFile(const char *filename)
+{
     AG_Surface *oldsurface, *newsurface;
 
+    trace_begin("decode");
     newsurface = AG_SurfaceFromFile(filename);
+    trace_end("decode");
     if (!newsurface) {
 	fprintf(stderr, "Cannot make surface from file %s: %s.\n",
 		filename, AG_GetError());
     } else {
-	AG_PixmapReplaceSurface(pixmap, pixmap->n, newsurface);
-	/* Freeing the old surface leads to a "double free" error. */
+	/* The pixmap only owns the scaled copy it displays and frees that
+	 * itself; the source surface is ours to free. */
+	oldsurface = scaledPixmapSetSource(pixmap, newsurface);
+	AG_SurfaceFree(oldsurface);
+	scaledPixmapTurn(pixmap, exifthumb_orientation(filename));
     }
 
 #ifdef WORKAROUND_BUG
@@ -11,6 +11,21 @@
  * if successful, resize the the window to fit the image at 1:1 zoom,
  * and "Quit".
  *
+ * If the argument is a directory, or one is chosen with "Folder", it shows
+ * the images in it as a grid of thumbnails instead and double-clicking one
+ * opens it. The gengrid only asks for the content of the items it's showing
+ * and thumbs.c makes the ones asked for first, so what's on the screen
+ * appears first however big the directory is.
+ *
+ * Once an image is open, Right, Page Down or space shows the next one in
+ * its directory and Left, Page Up or BackSpace the previous one, with the
+ * ones either side of it decoded ahead of time (see "Next and previous").
+ *
+ * JPEGs are turned the way their EXIF orientation says, and the r and l keys
+ * turn the image a quarter turn clockwise and anticlockwise and h and v flip
+ * it left to right and top to bottom. The pixels are turned once, the ones
+ * decoded ahead in their thread (see rotate.c), and Evas scales those.
+ *
  * Bugs:
  * - Instead of a "File" menu there are just two buttons "Open" and "Quit".
  * - If you Open a duff file, you get a black window instead of an error.
@@ -23,26 +38,65 @@
  */
 
 #include <Elementary.h>
+#include "stamp.h"
+#include "trace.h"
+#include "stats.h"
+#include "thumbs.h"
+#include "loadjpeg.h"
+#include "exifthumb.h"
+#include "rotate.h"
+#include "rotate-evas.h"
+#include <limits.h>
 
 /* Event handlers */
 static void keyDown(void *data, Evas *e, Evas_Object *obj, void *event_info);
 static void fileChosen(void *data, Evas_Object *obj, void *event_info);
+static void folderChosen(void *data, Evas_Object *obj, void *event_info);
+static void thumbOpened(void *data, Evas_Object *obj, void *event_info);
 static void quitGUI(void *data, Evas_Object *obj, void *event_info);
+static void imageResized(void *data, Evas *e, Evas_Object *obj, void *event_info);
+static Eina_Bool serviceStats(void *data, Ecore_Fd_Handler *handler);
 
 static    Evas_Object *window;
 static    Evas_Object *vbox;
 static    Evas_Object *image;
 
+/* Going through the images in a directory */
+static void openDirectory(const char *filename);
+static void step(int delta);
+static int prefetchDepth = 2;		/* How many each side to decode */
+static long prefetchMax = 256L << 20;	/* How many bytes they can take */
+
+/* The thumbnails, when showing them */
+static void showGrid(const char *dir);
+static    Evas_Object *grid = NULL;
+static    thumbs_t *thumbs = NULL;
+static    Elm_Object_Item **items;	/* The grid's items, by number */
+
 EAPI_MAIN int
 elm_main(int argc, char **argv)
 {
     Evas_Object *hbox;	/* The "menu toolbar" */
     Evas_Object *openButton;
+    Evas_Object *folderButton;
     Evas_Object *quitButton;
     Evas_Object *menu;
     char *filename = (argc > 1) ? argv[1] : NULL;
- 
+    char *dir = NULL;
+    char *env;
+
+    stamp("init");	/* ELM_MAIN() has initialised it before calling us */
     elm_policy_set(ELM_POLICY_QUIT, ELM_POLICY_QUIT_LAST_WINDOW_CLOSED);
+
+    /* Report the stats on SIGUSR1 or to the stats socket */
+    stats_init("image2-elm");
+    ecore_main_fd_handler_add(stats_fd(), ECORE_FD_READ, serviceStats,
+			      NULL, NULL, NULL);
+
+    if ((env = getenv("IMAGE_PREFETCH")) != NULL)
+	prefetchDepth = atoi(env);
+    if ((env = getenv("IMAGE_PREFETCH_MB")) != NULL)
+	prefetchMax = atol(env) << 20;
  
     window = elm_win_add(NULL, "image2-elm", ELM_WIN_BASIC);
     elm_win_title_set(window, "image2-elm");
@@ -68,6 +122,14 @@ elm_main(int argc, char **argv)
     elm_box_pack_end(hbox, openButton);
     evas_object_show(openButton);
 
+    folderButton = elm_fileselector_button_add(hbox);
+    elm_object_text_set(folderButton, "Folder");
+    elm_fileselector_button_inwin_mode_set(folderButton, EINA_FALSE);
+    elm_fileselector_folder_only_set(folderButton, EINA_TRUE);
+    evas_object_smart_callback_add(folderButton, "file,chosen", folderChosen, NULL);
+    elm_box_pack_end(hbox, folderButton);
+    evas_object_show(folderButton);
+
     quitButton = elm_button_add(hbox);
     elm_object_part_text_set(quitButton, NULL, "Quit");
     evas_object_smart_callback_add(quitButton, "pressed", quitGUI, NULL);
@@ -78,7 +140,19 @@ elm_main(int argc, char **argv)
     image = elm_image_add(vbox);
     elm_image_resizable_set(image, EINA_TRUE, EINA_TRUE);
     elm_image_aspect_fixed_set(image, EINA_FALSE);
-    if (filename) elm_image_file_set(image, filename, NULL);
+    if (filename && ecore_file_is_dir(filename)) {
+	dir = filename;
+	filename = NULL;
+    }
+    if (filename) {
+	trace_begin("decode");
+	elm_image_file_set(image, filename, NULL);
+	trace_end("decode");
+	stamp("decode");
+	evasImageTurn(elm_image_object_get(image),
+		      exifthumb_orientation(filename));
+	openDirectory(filename);
+    }
     {
         int w, h;
         elm_image_object_size_get(image, &w, &h);
@@ -86,6 +160,7 @@ elm_main(int argc, char **argv)
     }
     elm_box_pack_end(vbox, image);
     evas_object_show(image);
+    evas_object_event_callback_add(image, EVAS_CALLBACK_RESIZE, imageResized, NULL);
 
     evas_object_size_hint_align_set(hbox, EVAS_HINT_FILL, EVAS_HINT_FILL);
     evas_object_size_hint_weight_set(image, EVAS_HINT_EXPAND, EVAS_HINT_EXPAND);
@@ -99,6 +174,8 @@ elm_main(int argc, char **argv)
     evas_object_size_hint_weight_set(vbox, EVAS_HINT_EXPAND, EVAS_HINT_EXPAND);
     evas_object_size_hint_min_set(image, 1, 1);
 
+    if (dir) showGrid(dir);
+
     elm_run();
 
     return 0;
@@ -116,7 +193,15 @@ fileChosen(void *data, Evas_Object *obj, void *event_info)
 
     if (filename == NULL) return;  /* They cancelled instead of selecting */
 
+    if (grid != NULL) {
+	evas_object_del(grid);	/* and its "del" callback closes thumbs */
+	grid = NULL;
+	evas_object_show(image);
+    }
+    trace_begin("decode");
     elm_image_file_set(image, filename, NULL);
+    trace_end("decode");
+    evasImageTurn(elm_image_object_get(image), exifthumb_orientation(filename));
     /* Make the window resize to display the image at 1:1 zoom
      * and when the window has resized, remove the size limits. */
     evas_object_event_callback_add(image, EVAS_CALLBACK_RESIZE,
@@ -127,6 +212,7 @@ fileChosen(void *data, Evas_Object *obj, void *event_info)
 	evas_object_size_hint_min_set(image, w, h);
 	evas_object_size_hint_max_set(image, w, h);
     }
+    openDirectory(filename);
 }
 
 static void
@@ -140,17 +226,464 @@ unlimitImageSize(void *data, Evas_Object *obj, void *event_info)
 	(Evas_Object_Event_Cb) unlimitImageSize);
 }
 
-/* Quit on Control-Q */
+/*
+ * Next and previous.
+ *
+ * The JPEGs up to IMAGE_PREFETCH (default 2) either side of the one on the
+ * screen are decoded ahead in Ecore threads, nearest first, so that when you
+ * move to one its pixels are ready. Those are kept until the space they take
+ * is needed for ones nearer to where you are, up to IMAGE_PREFETCH_MB
+ * (default 256) megabytes in all. While one is decoding it's charged for
+ * the most it has at once, the RGB from libjpeg with the ARGB made from it
+ * or the ARGB with the turned copy, and only for the ARGB when it's done.
+ * A decode that is still going when you have moved further than that away
+ * is cancelled. Other kinds of image are loaded
+ * by Evas when you get to them, as with "Open".
+ */
+
+typedef struct {
+    int index;			/* In files[] */
+    char *path;
+    Ecore_Thread *thread;	/* NULL when it has finished */
+    unsigned int *argb;		/* Evas's pixel format, the right way up,
+				 * or NULL if it failed */
+    int width, height;
+    int orientation;		/* From its EXIF data */
+    long bytes;			/* What it takes of prefetchBytes */
+} job_t;
+
+static char *dirName = NULL;	/* The directory we're going through */
+static char **files;		/* The images in it, in name order */
+static job_t **jobs;		/* Their decodes, NULL where there's none */
+static int nfiles = 0;
+static int current = -1;	/* Which one is on the screen */
+static int waiting = -1;	/* Which one to show when its decode is done */
+static long prefetchBytes = 0;	/* What the jobs take, done or not */
+
+/* Is this one of ours, or one that was dropped while it was running? */
+static Eina_Bool
+isOurs(job_t *job)
+{
+    return job->index < nfiles && jobs[job->index] == job;
+}
+
+static void
+freeJob(job_t *job)
+{
+    prefetchBytes -= job->bytes;
+    stats_add(STAT_LIVE_BYTES, -job->bytes);
+    free(job->argb);
+    free(job->path);
+    free(job);
+}
+
+/* In an Ecore thread */
+static void
+decodeJob(void *data, Ecore_Thread *thread)
+{
+    job_t *job = data;
+    unsigned char *rgb;
+    unsigned int *turned;
+    int w, h, denom, i, orientation = job->orientation;
+
+    if (ecore_thread_check(thread)) return;
+    rgb = loadjpeg(job->path, INT_MAX, INT_MAX, &w, &h, &denom);
+    if (rgb == NULL) return;
+    if (!ecore_thread_check(thread) &&
+	(job->argb = malloc((size_t) w * h * 4)) != NULL) {
+	for (i = 0; i < w * h; i++)
+	    job->argb[i] = 0xff000000 | rgb[i * 3] << 16 |
+			   rgb[i * 3 + 1] << 8 | rgb[i * 3 + 2];
+	job->width = w;
+	job->height = h;
+    }
+    free(rgb);
+
+    /* Turn it here too rather than in the main loop when it's shown */
+    if (job->argb == NULL || orientation == 1 || ecore_thread_check(thread) ||
+	(turned = malloc((size_t) w * h * 4)) == NULL)
+	return;
+    if (ROTATE_SWAPS(orientation)) {
+	job->width = h;
+	job->height = w;
+    }
+    rotate_pixels((unsigned char *) job->argb, w, h, w * 4,
+		  (unsigned char *) turned, job->width * 4, 4, orientation);
+    free(job->argb);
+    job->argb = turned;
+}
+
+/* Show the image from its decoded pixels or from the file */
+static void
+showJob(job_t *job)
+{
+    Evas_Object *img = elm_image_object_get(image);
+
+    evas_object_image_file_set(img, NULL, NULL);
+    evas_object_image_alpha_set(img, EINA_FALSE);
+    evas_object_image_size_set(img, job->width, job->height);
+    evas_object_image_data_copy_set(img, job->argb);
+    evas_object_image_data_update_add(img, 0, 0, job->width, job->height);
+}
+
+static void
+showFile(const char *path)
+{
+    Evas_Object *img = elm_image_object_get(image);
+
+    trace_begin("decode");
+    evas_object_image_file_set(img, NULL, NULL);
+    evas_object_image_file_set(img, path, NULL);
+    trace_end("decode");
+    evasImageTurn(img, exifthumb_orientation(path));
+}
+
+/* Back in the main loop */
+static void
+jobDone(void *data, Ecore_Thread *thread)
+{
+    job_t *job = data;
+
+    if (!isOurs(job)) {
+	freeJob(job);
+	return;
+    }
+    job->thread = NULL;
+    {
+	/* Now it only has the ARGB, or nothing if it failed, in which case
+	 * we keep it to say not to try again but it takes no space. */
+	long bytes = job->argb ? (long) job->width * job->height * 4 : 0;
+
+	prefetchBytes -= job->bytes - bytes;
+	stats_add(STAT_LIVE_BYTES, bytes - job->bytes);
+	job->bytes = bytes;
+    }
+    if (job->index == waiting) {
+	waiting = -1;
+	if (job->argb) showJob(job);
+	else showFile(job->path);
+    }
+}
+
+static void
+jobCancelled(void *data, Ecore_Thread *thread)
+{
+    job_t *job = data;
+
+    if (isOurs(job)) jobs[job->index] = NULL;
+    freeJob(job);
+}
+
+/* Make room for "bytes" more by dropping the finished decodes furthest from
+ * the current image, but none nearer to it than "distance". */
+static Eina_Bool
+makeRoom(long bytes, int distance)
+{
+    while (prefetchBytes + bytes > prefetchMax) {
+	int i, far = -1;
+
+	for (i = 0; i < nfiles; i++) {
+	    if (jobs[i] != NULL && jobs[i]->thread == NULL &&
+		abs(i - current) > distance &&
+		(far < 0 || abs(i - current) > abs(far - current)))
+		far = i;
+	}
+	if (far < 0) return EINA_FALSE;
+	freeJob(jobs[far]);
+	jobs[far] = NULL;
+    }
+    return EINA_TRUE;
+}
+
+static void
+startJob(int i)
+{
+    job_t *job;
+    Ecore_Thread *thread;
+    int w, h, orientation;
+    long peak;
+
+    /* Only JPEGs. Evas loads the rest when we get to them. */
+    if (loadjpeg_size(files[i], &w, &h) < 0) return;
+    /* RGB and ARGB, then ARGB and the turned copy if it needs turning */
+    orientation = exifthumb_orientation(files[i]);
+    peak = (long) w * h * (orientation == 1 ? 3 + 4 : 4 + 4);
+    if (!makeRoom(peak, abs(i - current))) return;
+    job = calloc(1, sizeof(*job));
+    job->index = i;
+    job->path = strdup(files[i]);
+    job->orientation = orientation;
+    job->bytes = peak;
+    prefetchBytes += job->bytes;
+    stats_add(STAT_LIVE_BYTES, job->bytes);
+    jobs[i] = job;
+    /* If it can't start one, it has already called jobCancelled() */
+    if ((thread = ecore_thread_run(decodeJob, jobDone, jobCancelled,
+				   job)) != NULL)
+	job->thread = thread;
+}
+
+/* Cancel the decodes we've moved away from and start the ones we're near */
+static void
+prefetchAround(void)
+{
+    int i, d;
+
+    for (i = 0; i < nfiles; i++) {
+	job_t *job = jobs[i];
+
+	if (job != NULL && job->thread != NULL &&
+	    abs(i - current) > prefetchDepth) {
+	    jobs[i] = NULL;
+	    stats_add(STAT_PREFETCH_CANCELS, 1);
+	    ecore_thread_cancel(job->thread); /* and jobCancelled() frees it */
+	}
+    }
+    for (d = 1; d <= prefetchDepth; d++) {
+	if (current + d < nfiles && jobs[current + d] == NULL)
+	    startJob(current + d);
+	if (current - d >= 0 && jobs[current - d] == NULL)
+	    startJob(current - d);
+    }
+}
+
+static void
+closeDirectory(void)
+{
+    int i;
+
+    for (i = 0; i < nfiles; i++) {
+	job_t *job = jobs[i];
+
+	jobs[i] = NULL;
+	if (job != NULL && job->thread != NULL)
+	    ecore_thread_cancel(job->thread);	/* and jobCancelled() frees it */
+	else if (job != NULL)
+	    freeJob(job);
+	free(files[i]);
+    }
+    free(files);
+    free(jobs);
+    free(dirName);
+    dirName = NULL;
+    nfiles = 0;
+    current = waiting = -1;
+}
+
+static int
+byName(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* A file has been opened. Find it among the images in its directory. */
+static void
+openDirectory(const char *filename)
+{
+    char *dir = ecore_file_dir_get(filename);
+    const char *base = ecore_file_file_get(filename);
+    int i;
+
+    if (dirName == NULL || strcmp(dir, dirName) != 0) {
+	Eina_List *names = ecore_file_ls(dir);
+	char *name;
+
+	closeDirectory();
+	dirName = dir;
+	files = malloc(eina_list_count(names) * sizeof(*files));
+	EINA_LIST_FREE(names, name) {
+	    if (evas_object_image_extension_can_load_get(name)) {
+		files[nfiles] = malloc(strlen(dir) + strlen(name) + 2);
+		sprintf(files[nfiles++], "%s/%s", dir, name);
+	    }
+	    free(name);
+	}
+	qsort(files, nfiles, sizeof(*files), byName);
+	jobs = calloc(nfiles, sizeof(*jobs));
+    } else {
+	free(dir);
+    }
+
+    waiting = current = -1;
+    for (i = 0; i < nfiles; i++)
+	if (strcmp(ecore_file_file_get(files[i]), base) == 0) current = i;
+    if (current >= 0) prefetchAround();
+}
+
+/* Move to the next (1) or previous (-1) image */
+static void
+step(int delta)
+{
+    int i = current + delta;
+    job_t *job;
+
+    if (current < 0 || grid != NULL || i < 0 || i >= nfiles) return;
+    current = i;
+    waiting = -1;
+    job = jobs[i];
+    if (job != NULL && job->thread == NULL && job->argb != NULL) {
+	stats_add(STAT_PREFETCH_HITS, 1);
+	showJob(job);
+    } else {
+	stats_add(STAT_PREFETCH_MISSES, 1);
+	if (job != NULL && job->thread != NULL) waiting = i;
+	else showFile(files[i]);
+    }
+    prefetchAround();
+}
+
+static void
+folderChosen(void *data, Evas_Object *obj, void *event_info)
+{
+    const char *dir = event_info;
+
+    if (dir == NULL) return;  /* They cancelled instead of selecting */
+    showGrid(dir);
+}
+
+/* The thumbnails are ARGB evas images, each with a copy of the pixels */
+static Evas_Object *
+thumbContent(void *data, Evas_Object *obj, const char *part)
+{
+    int i = (int) (intptr_t) data;
+    const thumb_t *thumb;
+    Evas_Object *icon;
+    unsigned int *argb;
+    int n;
+
+    if (strcmp(part, "elm.swallow.icon") != 0 ||
+	(thumb = thumbs_get(thumbs, i)) == NULL)
+	return NULL;	/* It calls updateThumb() when it's ready */
+
+    icon = evas_object_image_filled_add(evas_object_evas_get(obj));
+    evas_object_image_alpha_set(icon, EINA_TRUE);
+    evas_object_image_size_set(icon, thumb->width, thumb->height);
+    argb = evas_object_image_data_get(icon, EINA_TRUE);
+    /* Evas wants them premultiplied */
+    for (n = 0; n < thumb->width * thumb->height; n++) {
+	const unsigned char *p = thumb->pixels + n * 4;
+	unsigned a = p[3];
+
+	argb[n] = a << 24 | (p[0] * a / 255) << 16 |
+		  (p[1] * a / 255) << 8 | (p[2] * a / 255);
+    }
+    evas_object_image_data_set(icon, argb);
+    evas_object_image_data_update_add(icon, 0, 0, thumb->width, thumb->height);
+    evas_object_size_hint_aspect_set(icon, EVAS_ASPECT_CONTROL_BOTH,
+				     thumb->width, thumb->height);
+    return icon;
+}
+
+/* In the main loop, when the i'th thumbnail is ready */
+static void
+updateThumb(void *data)
+{
+    int i = (int) (intptr_t) data;
+
+    if (grid != NULL && thumbs_count(thumbs) > i)
+	elm_gengrid_item_update(items[i]);
+}
+
+/* In one of thumbs.c's threads */
+static void
+thumbReady(void *arg, int i)
+{
+    ecore_main_loop_thread_safe_call_async(updateThumb, (void *) (intptr_t) i);
+}
+
+static void
+gridDeleted(void *data, Evas *e, Evas_Object *obj, void *event_info)
+{
+    thumbs_close(thumbs);
+    thumbs = NULL;
+    free(items);
+}
+
+/* Show the images in a directory as thumbnails in place of the image */
+static void
+showGrid(const char *dir)
+{
+    static Elm_Gengrid_Item_Class *itc = NULL;
+    thumbs_t *newThumbs;
+    int i;
+
+    if (itc == NULL) {
+	itc = elm_gengrid_item_class_new();
+	itc->item_style = "default";
+	itc->func.content_get = thumbContent;
+    }
+    /* Drop the old one first, so that its updates find no grid */
+    if (grid != NULL) {
+	evas_object_del(grid);
+	grid = NULL;
+    }
+    if ((newThumbs = thumbs_open(dir, thumbReady, NULL)) == NULL) return;
+    thumbs = newThumbs;
+    items = malloc(thumbs_count(thumbs) * sizeof(*items));
+
+    grid = elm_gengrid_add(vbox);
+    elm_gengrid_item_size_set(grid, THUMBS_SIZE + 8, THUMBS_SIZE + 8);
+    evas_object_size_hint_weight_set(grid, EVAS_HINT_EXPAND, EVAS_HINT_EXPAND);
+    evas_object_size_hint_align_set(grid, EVAS_HINT_FILL, EVAS_HINT_FILL);
+    evas_object_size_hint_min_set(grid, 6 * (THUMBS_SIZE + 8),
+				  4 * (THUMBS_SIZE + 8));
+    evas_object_smart_callback_add(grid, "clicked,double", thumbOpened, NULL);
+    evas_object_event_callback_add(grid, EVAS_CALLBACK_DEL, gridDeleted, NULL);
+    for (i = 0; i < thumbs_count(thumbs); i++)
+	items[i] = elm_gengrid_item_append(grid, itc, (void *) (intptr_t) i,
+					   NULL, NULL);
+    evas_object_hide(image);
+    elm_box_pack_end(vbox, grid);
+    evas_object_show(grid);
+    /* Then let them shrink it */
+    evas_object_size_hint_min_set(grid, 1, 1);
+}
+
+/* They double-clicked a thumbnail. Open it as if chosen with "Open". */
+static void
+thumbOpened(void *data, Evas_Object *obj, void *event_info)
+{
+    int i = (int) (intptr_t) elm_object_item_data_get(event_info);
+    char *filename = strdup(thumbs_path(thumbs, i));
+
+    fileChosen(NULL, obj, filename);	/* which deletes the grid */
+    free(filename);
+}
+
+/* Quit on Control-Q, go back and forth on the arrows and others and turn
+ * or flip the image on the keys that do that */
 static void
 keyDown(void *data, Evas *evas, Evas_Object *obj, void *event_info)
 {
     const Evas_Modifier *mods;
     Evas_Event_Key_Down *ev = event_info;
+    int key;
 
     mods = evas_key_modifier_get(evas);
     if (evas_key_modifier_is_set(mods, "Control") &&
 	strcmp(ev->key, "q") == 0) {
 	quitGUI(data, obj, event_info);
+    } else if (strcmp(ev->key, "Right") == 0 ||
+	       strcmp(ev->key, "Next") == 0 ||
+	       strcmp(ev->key, "space") == 0) {
+	step(1);
+    } else if (strcmp(ev->key, "Left") == 0 ||
+	       strcmp(ev->key, "Prior") == 0 ||
+	       strcmp(ev->key, "BackSpace") == 0) {
+	step(-1);
+    } else if (grid == NULL &&
+	       !evas_key_modifier_is_set(mods, "Control") &&
+	       !evas_key_modifier_is_set(mods, "Alt") &&
+	       ev->key[0] != '\0' && ev->key[1] == '\0' &&
+	       (key = rotate_key(ev->key[0])) != 0 &&
+	       evasImageTurn(elm_image_object_get(image), key) == 0 &&
+	       ROTATE_SWAPS(key)) {
+	int ww, wh, iw, ih;
+
+	/* Turn the window with it, keeping the buttons the height they are */
+	evas_object_geometry_get(window, NULL, NULL, &ww, &wh);
+	evas_object_geometry_get(image, NULL, NULL, &iw, &ih);
+	evas_object_resize(window, ww - iw + ih, wh - ih + iw);
     }
 }
 
@@ -159,3 +692,18 @@ quitGUI(void *data, Evas_Object *obj, void *event_info)
 {
     exit(0);  /* There must be a more gracious way... */
 }
+
+/* Count the resizes. Evas does the scaling itself when it renders. */
+static void
+imageResized(void *data, Evas *evas, Evas_Object *obj, void *einfo)
+{
+    stats_add(STAT_RESIZES, 1);
+}
+
+/* Print the stats or send them to whoever connected to the stats socket */
+static Eina_Bool
+serviceStats(void *data, Ecore_Fd_Handler *handler)
+{
+    stats_service();
+    return ECORE_CALLBACK_RENEW;
+}
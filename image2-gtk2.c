@@ -11,6 +11,21 @@
  * if successful, resize the the window to fit the image at 1:1 zoom,
  * and "Quit".
  *
+ * If the argument is a directory, or one is chosen with "File/Open Folder",
+ * it shows the images in it as a grid of thumbnails instead (see
+ * sheet-gtk2.c) and double-clicking one opens it.
+ *
+ * If an image has a preview in its EXIF data, that is shown scaled up while
+ * the image is read in another thread (see preview-gdk.c).
+ * With IMAGE_LINEAR=1 it's scaled in linear light (see bands-gdk.c).
+ * Photos are turned the way their EXIF orientation says, and the r and l
+ * keys turn the image a quarter turn clockwise and anticlockwise and h and v
+ * flip it left to right and top to bottom (see rotate.c).
+ * "File/Levels" or Control-L shows the levels window, whose black point,
+ * white point and gamma sliders, for all channels or for one, are applied as
+ * the image is scaled to the window, over the image's histogram (see
+ * levels-gtk.c).
+ *
  * Bugs:
  *    - You can enlarge the image window but cannot shrink it again.
  *
@@ -26,17 +41,41 @@
  * When an image file is read we try to resize the window so that the image is
  * displayed with one screen pixel per image pixel, though the window manager
  * may immediately resize the window to fit the screen.
+ *
+ * Turning the image turns sourcePixbuf, once, into a new pixbuf, so the next
+ * expose sees a new source and the ones after that scale from it as before.
  */
 
 #include <gtk/gtk.h>
+#include <gdk/gdkkeysyms.h>
 #include <stdlib.h>	/* for exit() */
+#include "stamp.h"
+#include "trace.h"
+#include "stats.h"
+#include "pixcache-gdk.h"
+#include "budget-gdk.h"
+#include "thumbs.h"
+#include "sheet-gtk2.h"
+#include "preview-gdk.h"
+#include "levels.h"
+#include "bands-gdk.h"
+#include "levels-gtk.h"
+#include "rotate.h"
 
 /* Event callbacks */
 static void openFile(GtkWidget *widget, gpointer data);
+static void openFolder(GtkWidget *widget, gpointer data);
+static void showLevels(GtkWidget *widget, gpointer data);
+static void openThumb(const char *path);
 static gboolean exposeImage(GtkWidget *widget, gpointer data);
+static gboolean keyPress(GtkWidget *widget, GdkEventKey *event, gpointer data);
+static gboolean serviceStats(GIOChannel *source, GIOCondition condition, gpointer data);
 
 /* Utility functions */
 static void show_error(char *message);
+static gboolean loadFile(const char *filename);
+static void showSheet(const char *dir);
+static void imageRead(GdkPixbuf *pixbuf, GError *error, gpointer data);
 
 /* openFile() needs both "window" to open the dialog and "image" to be able
  * to change the displayed image. We should put them both in a struct and pass
@@ -47,37 +86,86 @@ static void show_error(char *message);
 static GtkWidget *window;
 static GdkPixbuf *sourcePixbuf = NULL;	/* As read from a file */
 static GtkWidget *image;		/* As displayed on the screen */
+static GtkWidget *vbox;
+static GtkWidget *sheet = NULL;		/* The thumbnails, when showing them */
+static guint loads = 0;			/* Which imageRead() is the latest */
+static int turn = 1;			/* How the keys have turned this one */
+static gboolean levelsChanged = FALSE;	/* Scale it again through them */
+
+/* To force the window to resize to fit a new image at 1:1 zoom, we set the
+ * image widget's minimum size to the desired size then resize the window to
+ * 1x1. This flag remembers that we need to undo this trickery when the
+ * window-resizing events are over.
+ */
+static gboolean undoMinSize = 0;
 
 int
 main(int argc, char **argv)
 {
     /* UI components */
-    GtkWidget *vbox;
     GtkWidget *menubar;
     GtkWidget *fileMenu;
     GtkWidget *fileMi;
     GtkWidget *openMi;
+    GtkWidget *folderMi;
+    GtkWidget *levelsMi;
     GtkWidget *quitMi;
     GtkWidget *sep;
     GtkAccelGroup *accel_group;
+    GError *error = NULL;
+
+    if (!gtk_init_with_args(&argc, &argv, "[FILE|DIRECTORY]",
+			    budgetOptions, NULL,
+			    &error)) {
+	g_message("%s", error->message);
+	exit(1);
+    }
+    stamp("init");
 
-    gtk_init(&argc, &argv);
+    /* Report the stats on SIGUSR1 or to the stats socket */
+    stats_init("image2-gtk2");
+    g_io_add_watch(g_io_channel_unix_new(stats_fd()), G_IO_IN,
+		   serviceStats, NULL);
+
+    if (getenv("IMAGE_LINEAR") && atoi(getenv("IMAGE_LINEAR")))
+	bandsSetLinear(TRUE);
 
     /* I haven't figured out how to open the app without an initial image yet */
-    if (argc > 1) {
-	GError *error = NULL;
-
-	/* Make pixbuf, then make image from pixbuf because
-	 * gtk_image_new_from_file() doesn't flag errors */
-	sourcePixbuf = gdk_pixbuf_new_from_file(argv[1], &error);
-	if (sourcePixbuf == NULL) {
-	    g_message("%s", error->message);
-	    exit(1);
+    if (argc > 1 && !g_file_test(argv[1], G_FILE_TEST_IS_DIR)) {
+	gint width, height;	/* The size of the image */
+
+	/* Show the preview while the image is read, if it has one */
+	trace_begin("preview");
+	sourcePixbuf = previewPixbufNewFromFile(argv[1], budgetSourceBytes(),
+				&width, &height, imageRead,
+				GUINT_TO_POINTER(loads));
+	trace_end("preview");
+	if (sourcePixbuf != NULL) {
+	    budgetTrack(sourcePixbuf);
+	    stamp("preview");
+	} else {
+	    /* Make pixbuf, then make image from pixbuf because
+	     * gtk_image_new_from_file() doesn't flag errors */
+	    trace_begin("decode");
+	    sourcePixbuf = budgetTrack(orientedPixbufNewFromFile(argv[1],
+					    budgetSourceBytes(), &error));
+	    trace_end("decode");
+	    if (sourcePixbuf == NULL) {
+		g_message("%s", error->message);
+		exit(1);
+	    }
+	    stamp("decode");
+	    width = gdk_pixbuf_get_width(sourcePixbuf);
+	    height = gdk_pixbuf_get_height(sourcePixbuf);
 	}
-	/* To start, the displayed image is the same as the original. */
-	image = gtk_image_new_from_pixbuf(gdk_pixbuf_copy(sourcePixbuf));
+	/* To start, the displayed image is the original itself, or the
+	 * preview, which is smaller, so ask for the image's size until
+	 * the first expose has scaled it up to that. */
+	image = gtk_image_new_from_pixbuf(sourcePixbuf);
+	gtk_widget_set_size_request(image, width, height);
+	undoMinSize = 1;
     } else {
-	/* Starting with no image filename */
+	/* Starting with no image filename, or with the thumbnails */
 	image = gtk_image_new();
     }
 
@@ -100,14 +188,26 @@ main(int argc, char **argv)
 
     gtk_menu_item_set_submenu(GTK_MENU_ITEM(fileMi), fileMenu);
     openMi = gtk_image_menu_item_new_from_stock(GTK_STOCK_OPEN, accel_group);
+    folderMi = gtk_image_menu_item_new_with_mnemonic("Open _Folder...");
+    gtk_image_menu_item_set_image(GTK_IMAGE_MENU_ITEM(folderMi),
+	gtk_image_new_from_stock(GTK_STOCK_DIRECTORY, GTK_ICON_SIZE_MENU));
+    levelsMi = gtk_menu_item_new_with_mnemonic("_Levels...");
+    gtk_widget_add_accelerator(levelsMi, "activate", accel_group,
+			       GDK_l, GDK_CONTROL_MASK, GTK_ACCEL_VISIBLE);
     quitMi = gtk_image_menu_item_new_from_stock(GTK_STOCK_QUIT, accel_group);
     sep = gtk_separator_menu_item_new();
 
     gtk_menu_shell_append(GTK_MENU_SHELL(fileMenu), openMi);
+    gtk_menu_shell_append(GTK_MENU_SHELL(fileMenu), folderMi);
+    gtk_menu_shell_append(GTK_MENU_SHELL(fileMenu), levelsMi);
     gtk_menu_shell_append(GTK_MENU_SHELL(fileMenu), sep);
     gtk_menu_shell_append(GTK_MENU_SHELL(fileMenu), quitMi);
     g_signal_connect(G_OBJECT(openMi), "activate",
 		     G_CALLBACK(openFile), NULL);
+    g_signal_connect(G_OBJECT(folderMi), "activate",
+		     G_CALLBACK(openFolder), NULL);
+    g_signal_connect(G_OBJECT(levelsMi), "activate",
+		     G_CALLBACK(showLevels), NULL);
     g_signal_connect(G_OBJECT(quitMi), "activate",
 		     G_CALLBACK(gtk_main_quit), NULL);
     gtk_menu_shell_append(GTK_MENU_SHELL(menubar), fileMi);
@@ -115,10 +215,13 @@ main(int argc, char **argv)
     /* When the window is resized, scale the image to fit */
     g_signal_connect(image, "expose-event",
 		     G_CALLBACK(exposeImage), NULL);
+    /* Turn it with r, l, h and v */
+    g_signal_connect(window, "key-press-event", G_CALLBACK(keyPress), NULL);
 	
     gtk_box_pack_start(GTK_BOX(vbox), menubar, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(vbox), image, TRUE, TRUE, 0);
     gtk_widget_show_all(window);
+    if (argc > 1 && sourcePixbuf == NULL) showSheet(argv[1]);
 
     gtk_main();
 
@@ -127,13 +230,6 @@ main(int argc, char **argv)
 
 /* Callback functions */
 
-/* To force the window to resize to fit a new image at 1:1 zoom, we set the
- * image widget's minimum size to the desired size then resize the window to
- * 1x1. This flag remembers that we need to undo this trickery when the
- * window-resizing events are over.
- */
-static gboolean undoMinSize = 0;
-
 static void
 openFile(GtkWidget *widget, gpointer data)
 {
@@ -145,34 +241,112 @@ openFile(GtkWidget *widget, gpointer data)
 				      NULL);
     if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
 	char *filename;		/* File name from chooser */
-	GdkPixbuf *newPixbuf;	/* image read from file */
-	GError *error = NULL;
 
 	filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
-	newPixbuf = gdk_pixbuf_new_from_file(filename, &error);
-	if (newPixbuf == NULL) {
-	    show_error(error->message);
-	} else {
-	    GdkPixbuf *oldPixbuf = sourcePixbuf;
-	    sourcePixbuf = newPixbuf;
-	    if (oldPixbuf != NULL) g_object_unref(oldPixbuf);
-	    /* Resize the window to display the image at 1:1 zoom. */
-	    /* This sets the widget's minimum size and asks the window go
-	     * become tiny. Result: it shrinks to the minimum that fits the
-	     * widget and the menu.
-	     * To allow the image to be shrunk by the user, its minimum size
-	     * will be set back to 1x1 in the exposeEvent() routine. */
-	    gtk_widget_set_size_request(image,
-					gdk_pixbuf_get_width(sourcePixbuf),
-					gdk_pixbuf_get_height(sourcePixbuf));
-	    gtk_window_resize(GTK_WINDOW(window), 1, 1);
-	    undoMinSize = 1;
+	if (loadFile(filename) && sheet != NULL) {
+	    gtk_widget_destroy(sheet);
+	    sheet = NULL;
+	    gtk_widget_show(image);
 	}
 	g_free(filename);
     }
     gtk_widget_destroy (dialog);
 }
 
+static void
+openFolder(GtkWidget *widget, gpointer data)
+{
+    GtkWidget *dialog = gtk_file_chooser_dialog_new("Open Folder",
+				      GTK_WINDOW(window),
+				      GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
+				      GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+				      GTK_STOCK_OPEN, GTK_RESPONSE_ACCEPT,
+				      NULL);
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+	char *dir = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+
+	showSheet(dir);
+	g_free(dir);
+    }
+    gtk_widget_destroy (dialog);
+}
+
+/* The sheet goes once we're out of its button-press handler */
+static gboolean
+destroySheet(gpointer data)
+{
+    gtk_widget_destroy(GTK_WIDGET(data));
+    return FALSE;
+}
+
+/* They double-clicked a thumbnail */
+static void
+openThumb(const char *path)
+{
+    if (loadFile(path)) {
+	gtk_widget_hide(sheet);
+	g_idle_add(destroySheet, sheet);
+	sheet = NULL;
+	gtk_widget_show(image);
+    }
+}
+
+/* Turn or flip the image for the keys that do that, and the window with it */
+static gboolean
+keyPress(GtkWidget *widget, GdkEventKey *event, gpointer data)
+{
+    GdkPixbuf *turned;
+    int key;
+    gint ww, wh, iw = image->allocation.width, ih = image->allocation.height;
+
+    if (sourcePixbuf == NULL || sheet != NULL ||
+	(event->state & (GDK_CONTROL_MASK | GDK_MOD1_MASK)) ||
+	(key = rotate_key(event->keyval)) == 0)
+	return FALSE;
+
+    trace_begin("rotate");
+    turned = orientPixbuf(g_object_ref(sourcePixbuf), key);
+    trace_end("rotate");
+    if (turned == NULL) {
+	show_error("Not enough memory to turn the image");
+	return TRUE;
+    }
+    /* The new one is made first, so exposeImage() sees a new address */
+    g_object_unref(sourcePixbuf);	/* The image may still have it */
+    sourcePixbuf = budgetTrack(turned);
+    turn = rotate_then(turn, key);
+    if (ROTATE_SWAPS(key)) {
+	/* The menu bar stays as wide and as high as it was */
+	gtk_window_get_size(GTK_WINDOW(window), &ww, &wh);
+	gtk_window_resize(GTK_WINDOW(window), ww - iw + ih, wh - ih + iw);
+    }
+    gtk_widget_queue_draw(image);
+    return TRUE;
+}
+
+/* A levels slider has moved. Scale it again through the new tables. */
+static void
+levelsMoved(gpointer data)
+{
+    levelsChanged = TRUE;
+    gtk_widget_queue_draw(image);
+}
+
+/* Service routine for the "File-Levels" menu item */
+static void
+showLevels(GtkWidget *widget, gpointer data)
+{
+    levelsToggle(GTK_WINDOW(window), sourcePixbuf, levelsMoved, NULL);
+}
+
+/* Print the stats or send them to whoever connected to the stats socket */
+static gboolean
+serviceStats(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    stats_service();
+    return TRUE;
+}
+
 /* If the window has been resized, resize the image to it.
  * Similarly if the image itself has changed.
  * The image-changing code ensures that the pixbuf containing a new image
@@ -198,28 +372,162 @@ exposeImage(GtkWidget *widget, gpointer data)
     /* Recreate displayed image if source file has changed
      * or image size has changed.  */
     if (imagePixbuf == NULL ||  /* Because we started with no filename */
-	sourcePixbuf != oldPixbuf ||
+	sourcePixbuf != oldPixbuf || levelsChanged ||
 	(widget->allocation.width != gdk_pixbuf_get_width(imagePixbuf) ||
          widget->allocation.height != gdk_pixbuf_get_height(imagePixbuf))) {
+	long long start = stats_now();
+	GdkPixbuf *scaled;
 
-	gtk_image_set_from_pixbuf(
-	    GTK_IMAGE(widget),
-	    gdk_pixbuf_scale_simple(sourcePixbuf,
-				    widget->allocation.width,
-				    widget->allocation.height,
-				    GDK_INTERP_BILINEAR)
-	);
-	/* Free the old one */
-        if (imagePixbuf != NULL) g_object_unref(imagePixbuf);
-
+	if (sourcePixbuf == oldPixbuf && !levelsChanged)
+	    stats_add(STAT_RESIZES, 1);
 	oldPixbuf = sourcePixbuf;
+	levelsChanged = FALSE;
+
+	/* At the original size, show the original, unless it has to go
+	 * through the levels */
+	if (widget->allocation.width == gdk_pixbuf_get_width(sourcePixbuf) &&
+	    widget->allocation.height == gdk_pixbuf_get_height(sourcePixbuf) &&
+	    !bandsLevelled()) {
+	    stats_add(STAT_CACHE_HITS, 1);
+	    gtk_image_set_from_pixbuf(GTK_IMAGE(widget), sourcePixbuf);
+	    stamp("present");	/* GTK draws it when we return */
+	    return FALSE;
+	}
+
+	stats_add(STAT_CACHE_MISSES, 1);
+	trace_scale(gdk_pixbuf_get_width(sourcePixbuf),
+		    gdk_pixbuf_get_height(sourcePixbuf),
+		    widget->allocation.width, widget->allocation.height,
+		    "bilinear");
+	/* On all cores, into the on-screen one if it's still the right
+	 * size, which it is when the image has changed but not the window */
+	scaled = bandsPixbufScale(sourcePixbuf, imagePixbuf,
+				  widget->allocation.width,
+				  widget->allocation.height,
+				  GDK_INTERP_BILINEAR);
+	if (scaled != imagePixbuf) budgetTrack(scaled);
+	trace_end("scale");
+	stats_scaled(start, (long) widget->allocation.width *
+			    widget->allocation.height *
+			    gdk_pixbuf_get_n_channels(sourcePixbuf));
+	/* The image drops the old one, freeing it unless it's the source */
+	gtk_image_set_from_pixbuf(GTK_IMAGE(widget), scaled);
+	if (scaled != NULL) g_object_unref(scaled);
+
+	stamp("scale");
+    } else {
+	stats_add(STAT_CACHE_HITS, 1);
     }
+    stamp("present");	/* GTK draws it when we return */
 
     return FALSE;
 }
 
 /* Utility functions */
 
+/* Read an image file into sourcePixbuf and resize the window to show it at
+ * 1:1 zoom. Says why not and returns FALSE if it can't be read. */
+static gboolean
+loadFile(const char *filename)
+{
+    GdkPixbuf *newPixbuf;	/* image read from file */
+    GdkPixbuf *oldPixbuf = sourcePixbuf;
+    GError *error = NULL;
+    gint width, height;		/* The size of the image */
+
+    /* Any image still being read is no longer wanted */
+    loads++;
+    turn = 1;
+
+    /* Show the preview while the image is read, if it has one */
+    trace_begin("preview");
+    newPixbuf = previewPixbufNewFromFile(filename, budgetSourceBytes(),
+				&width, &height, imageRead,
+				GUINT_TO_POINTER(loads));
+    trace_end("preview");
+    if (newPixbuf != NULL) {
+	budgetTrack(newPixbuf);
+	stamp("preview");
+    } else {
+	trace_begin("decode");
+	newPixbuf = budgetTrack(orientedPixbufNewFromFile(filename,
+					budgetSourceBytes(), &error));
+	trace_end("decode");
+	if (newPixbuf == NULL) {
+	    show_error(error->message);
+	    g_error_free(error);
+	    return FALSE;
+	}
+	stamp("decode");
+	width = gdk_pixbuf_get_width(newPixbuf);
+	height = gdk_pixbuf_get_height(newPixbuf);
+    }
+    sourcePixbuf = newPixbuf;
+    if (oldPixbuf != NULL) g_object_unref(oldPixbuf);
+    levelsSetSource(sourcePixbuf);
+    /* Resize the window to display the image at 1:1 zoom. */
+    /* This sets the widget's minimum size and asks the window go
+     * become tiny. Result: it shrinks to the minimum that fits the
+     * widget and the menu.
+     * To allow the image to be shrunk by the user, its minimum size
+     * will be set back to 1x1 in the exposeEvent() routine. */
+    gtk_widget_set_size_request(image, width, height);
+    gtk_window_resize(GTK_WINDOW(window), 1, 1);
+    undoMinSize = 1;
+    return TRUE;
+}
+
+/* An image has been read in the background. If it's the one we're showing
+ * the preview of, show it instead. The new pixbuf is made before the old one
+ * is freed, so exposeImage() sees a different address and rescales. */
+static void
+imageRead(GdkPixbuf *pixbuf, GError *error, gpointer data)
+{
+    GdkPixbuf *oldPixbuf = sourcePixbuf;
+
+    if (GPOINTER_TO_UINT(data) != loads) {
+	if (pixbuf != NULL) g_object_unref(pixbuf);
+	return;
+    }
+    if (pixbuf == NULL) {
+	show_error(error->message);
+	return;
+    }
+    stamp("decode");
+    /* Turned the way they've turned the preview */
+    if ((pixbuf = orientPixbuf(pixbuf, turn)) == NULL) {
+	show_error("Not enough memory to turn the image");
+	return;
+    }
+    sourcePixbuf = budgetTrack(pixbuf);
+    g_object_unref(oldPixbuf);		/* The image may still have it */
+    levelsSetSource(sourcePixbuf);
+    gtk_widget_queue_draw(image);
+}
+
+/* Show the images in a directory as thumbnails in place of the image */
+static void
+showSheet(const char *dir)
+{
+    GtkWidget *newSheet = sheetNew(dir, openThumb);
+
+    if (newSheet == NULL) {
+	char *message = g_strdup_printf("Can't read %s", dir);
+
+	show_error(message);
+	g_free(message);
+	return;
+    }
+    if (sheet != NULL) gtk_widget_destroy(sheet);
+    sheet = newSheet;
+    gtk_widget_hide(image);
+    gtk_box_pack_start(GTK_BOX(vbox), sheet, TRUE, TRUE, 0);
+    gtk_widget_show_all(sheet);
+    /* Room for six by four of them to start with */
+    gtk_window_resize(GTK_WINDOW(window), 6 * SHEET_CELL + 20,
+		      4 * SHEET_CELL + 30);
+}
+
 static void
 show_error(char *message)
 {
@@ -0,0 +1,205 @@
+/*
+ * imgclient.c: Get decoded images from imgserver.
+ *
+ * If $IMAGE_SERVER names the socket of a running imgserver, we ask it for
+ * the image and it sends us a file descriptor for a sealed memfd with the
+ * pixels in it, which we map read-only. Every viewer that asks for the same
+ * file at the same size gets the same memfd, so the image is decoded once and
+ * there is one copy of the pixels however many of them there are.
+ * We keep one connection to the server and the server keeps the image for as
+ * long as anyone has it; closing the connection drops everything we got.
+ * The viewers ask from their decode threads as well as the main one, so each
+ * request and its reply are sent and read with the connection locked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "imgclient.h"
+
+static int conn = -1;		/* Our connection to the server */
+static int failed = 0;		/* Connecting failed, so don't try again */
+static pthread_mutex_t connLock = PTHREAD_MUTEX_INITIALIZER; /* For both */
+
+/* Connect to the server if we haven't already. Returns 0 or -1.
+ * This and the rest that use "conn" are called with connLock held. */
+static int
+connectServer(void)
+{
+    const char *path = getenv("IMAGE_SERVER");
+    struct sockaddr_un addr;
+
+    if (conn >= 0) return 0;
+    if (failed || path == NULL || *path == '\0' ||
+	strlen(path) >= sizeof(addr.sun_path)) {
+	failed = 1;
+	return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn < 0 ||
+	connect(conn, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+	fprintf(stderr, "Can't connect to the image server %s: %s\n",
+		path, strerror(errno));
+	if (conn >= 0) close(conn);
+	conn = -1;
+	failed = 1;
+	return -1;
+    }
+    return 0;
+}
+
+static void
+disconnect(void)
+{
+    close(conn);
+    conn = -1;
+    failed = 1;
+}
+
+/* If the server has gone, this fails instead of killing us with SIGPIPE */
+static int
+sendAll(int fd, const char *buf, size_t n)
+{
+    while (n > 0) {
+	ssize_t done = send(fd, buf, n, MSG_NOSIGNAL);
+
+	if (done < 0 && errno == EINTR) continue;
+	if (done <= 0) return -1;
+	buf += done;
+	n -= done;
+    }
+    return 0;
+}
+
+/* Read a reply and the descriptor that comes with it, if any */
+static int
+readReply(imgserver_reply_t *reply, int *fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    size_t got = 0;
+
+    *fd = -1;
+    while (got < sizeof(*reply)) {
+	ssize_t n;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = (char *) reply + got;
+	iov.iov_len = sizeof(*reply) - got;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	if (n < 0 && errno == EINTR) continue;
+	if (n <= 0) return -1;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	    if (cmsg->cmsg_level == SOL_SOCKET &&
+		cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+	got += n;
+    }
+    return 0;
+}
+
+/* Tell the server we've finished with an image it gave us */
+static void
+drop(unsigned id)
+{
+    char request[32];
+
+    sprintf(request, "DROP %u\n", id);
+    pthread_mutex_lock(&connLock);
+    if (conn >= 0 && sendAll(conn, request, strlen(request)) < 0)
+	disconnect();
+    pthread_mutex_unlock(&connLock);
+}
+
+imgclient_t *
+imgclient_get(const char *filename, int minw, int minh)
+{
+    char path[PATH_MAX], request[IMGSERVER_MAXLINE];
+    imgserver_reply_t reply;
+    imgclient_t *img;
+    int fd, n;
+
+    /* The server's current directory isn't ours */
+    if (realpath(filename, path) == NULL || strchr(path, '\n')) return NULL;
+    n = snprintf(request, sizeof(request), "GET %d %d %s\n", minw, minh, path);
+    if (n >= (int) sizeof(request)) return NULL;
+
+    pthread_mutex_lock(&connLock);
+    if (connectServer() < 0) {
+	pthread_mutex_unlock(&connLock);
+	return NULL;
+    }
+    if (sendAll(conn, request, n) < 0 || readReply(&reply, &fd) < 0) {
+	fputs("Lost the image server\n", stderr);
+	disconnect();
+	pthread_mutex_unlock(&connLock);
+	return NULL;
+    }
+    pthread_mutex_unlock(&connLock);
+    if (reply.status != 0) {
+	if (fd >= 0) close(fd);
+	return NULL;
+    }
+
+    /* From here on the server is holding the image for us, so if we can't
+     * use it we have to say so or it keeps it as long as we're connected. */
+    if (fd < 0) {
+	drop(reply.id);
+	return NULL;
+    }
+    if ((img = malloc(sizeof(*img))) == NULL) {
+	close(fd);
+	drop(reply.id);
+	return NULL;
+    }
+    img->mapLen = reply.size;
+    img->map = mmap(NULL, img->mapLen, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (img->map == MAP_FAILED) {
+	free(img);
+	drop(reply.id);
+	return NULL;
+    }
+    img->pixels = img->map;
+    img->width = reply.width;
+    img->height = reply.height;
+    img->stride = reply.stride;
+    img->bpp = reply.bpp;
+    img->rmask = reply.rmask;
+    img->gmask = reply.gmask;
+    img->bmask = reply.bmask;
+    img->denom = reply.denom;
+    img->id = reply.id;
+    return img;
+}
+
+void
+imgclient_release(imgclient_t *img)
+{
+    if (img == NULL) return;
+    munmap(img->map, img->mapLen);
+    drop(img->id);
+    free(img);
+}
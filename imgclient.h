@@ -0,0 +1,46 @@
+/*
+ * imgclient.h: Interface to imgclient.c, which gets decoded images from
+ * imgserver so that viewers showing the same file share one copy of it.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    unsigned char *pixels;	/* Mapped read-only from the server's memfd */
+    int width, height, stride;	/* stride is in bytes */
+    int bpp;			/* Bytes per pixel: 1 (gray levels) or 3 */
+    uint32_t rmask, gmask, bmask; /* Where the channels are in a pixel
+				 * read as a native-endian word, as SDL says */
+    int denom;			/* How much it was reduced by */
+    uint32_t id;		/* The server's name for our hold on it */
+    void *map;			/* The mapping, for imgclient_release() */
+    size_t mapLen;
+} imgclient_t;
+
+/* Get a JPEG decoded at the smallest of 1/1, 1/2, 1/4 or 1/8 scale that is
+ * at least minw x minh, as loadjpeg() would. Returns NULL if $IMAGE_SERVER
+ * isn't set, the server isn't there or it can't decode the file. */
+extern imgclient_t *imgclient_get(const char *filename, int minw, int minh);
+extern void imgclient_release(imgclient_t *img);
+
+/*
+ * The protocol between them, on a Unix stream socket.
+ * Requests are lines of text:
+ *	GET minw minh pathname	Get an image. The reply is a reply_t and,
+ *				if its status is 0, a memfd with the pixels.
+ *	DROP id			Let go of an image from GET. No reply.
+ *	STATS			A line of text saying how the server is doing.
+ * Closing the connection drops everything it got.
+ */
+
+#define IMGSERVER_MAXLINE 4200	/* Longest request line, with PATH_MAX */
+
+typedef struct {
+    int32_t status;		/* 0 or an errno value */
+    uint32_t id;
+    uint32_t width, height, stride, bpp;
+    uint32_t rmask, gmask, bmask;
+    uint32_t denom;
+    uint64_t size;		/* of the memfd */
+} imgserver_reply_t;
@@ -0,0 +1,513 @@
+/*
+ * imgserver.c: Decode each image once for all the viewers that show it.
+ *
+ * Usage: imgserver [-l] [-m megabytes] [socket]
+ *
+ * It listens on the Unix socket named on the command line or in
+ * $IMAGE_SERVER and, when a viewer run with the same $IMAGE_SERVER asks for
+ * a JPEG (see imgclient.c), decodes it at the size the viewer asks for,
+ * as loadjpeg() would, into a memfd that it seals against writing and
+ * sends to the viewer over the socket. The next viewer to ask for the same
+ * file at the same size gets the same memfd, so there is one copy of the
+ * pixels, in the page cache, whoever has them mapped.
+ *
+ * With -l it decodes each JPEG at full size and makes the 1/2, 1/4 and 1/8
+ * size ones from that with our scaler (see scale.c), so any size a viewer
+ * asks for is ready, for one decode.
+ *
+ * Each image counts the viewers that have it. When the images come to more
+ * than -m megabytes (default 256), the least recently asked-for ones that
+ * nobody has are let go; ones somebody has are kept so that whoever asks
+ * next gets the same copy. If a file changes, the next viewer to ask for it
+ * gets it decoded again.
+ *
+ * It is single-threaded and decodes while the others wait, which is what
+ * makes sure a file that several viewers ask for at once is decoded once.
+ */
+
+#define _GNU_SOURCE	/* for memfd_create() and F_ADD_SEALS */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "imgclient.h"
+#include "loadjpeg.h"
+#include "scale.h"
+
+#define MAXCLIENTS 64
+#define DEFAULT_MB 256
+
+/* A decoded image */
+typedef struct entry {
+    struct entry *next;
+    char *path;
+    dev_t dev;			/* Which file it is, and which version */
+    ino_t ino;
+    off_t fileSize;
+    struct timespec mtime;
+    int fd;			/* The sealed memfd with the pixels */
+    imgserver_reply_t info;	/* What to tell the viewers about it */
+    int refs;			/* How many viewers have it */
+    unsigned long used;		/* When it was last asked for */
+    int stale;			/* The file has changed since */
+} entry_t;
+
+/* A viewer's hold on an image */
+typedef struct {
+    entry_t *entry;
+    uint32_t id;
+} hold_t;
+
+typedef struct {
+    int fd;			/* Its connection, or -1 if this slot is free */
+    char buf[IMGSERVER_MAXLINE];
+    size_t len;			/* How much of a request is in buf */
+    hold_t *holds;
+    int nholds, maxholds;
+} client_t;
+
+static entry_t *entries = NULL;
+static client_t clients[MAXCLIENTS];
+static int levels = 0;		/* -l: make all sizes from a full-size decode */
+static long long limit;		/* -m in bytes */
+static long long bytes = 0;	/* in all the entries */
+static unsigned long tick = 0;	/* Counts requests, for entry_t.used */
+static uint32_t nextId = 1;
+static long decodes = 0, gets = 0, hits = 0;
+static const char *socketPath;
+static volatile sig_atomic_t quit = 0;
+
+static void
+onSignal(int sig)
+{
+    quit = 1;
+}
+
+/*
+ * The images
+ */
+
+static void
+freeEntry(entry_t *e)
+{
+    entry_t **p;
+
+    for (p = &entries; *p; p = &(*p)->next)
+	if (*p == e) {
+	    *p = e->next;
+	    break;
+	}
+    close(e->fd);
+    bytes -= e->info.size;
+    free(e->path);
+    free(e);
+}
+
+/* Let go of images that nobody has until we're within the limit */
+static void
+evict(void)
+{
+    entry_t *e, *oldest;
+
+    while (bytes > limit) {
+	oldest = NULL;
+	for (e = entries; e; e = e->next)
+	    if (e->refs == 0 && (oldest == NULL || e->used < oldest->used))
+		oldest = e;
+	if (oldest == NULL) break;
+	freeEntry(oldest);
+    }
+}
+
+static entry_t *
+findEntry(const char *path, const struct stat *st, int denom)
+{
+    entry_t *e, *next;
+
+    for (e = entries; e; e = next) {
+	next = e->next;
+	if (e->stale || strcmp(e->path, path) != 0) continue;
+	if (e->dev != st->st_dev || e->ino != st->st_ino ||
+	    e->fileSize != st->st_size ||
+	    e->mtime.tv_sec != st->st_mtim.tv_sec ||
+	    e->mtime.tv_nsec != st->st_mtim.tv_nsec) {
+	    /* It's changed. Whoever has the old one can go on using it. */
+	    if (e->refs == 0) freeEntry(e);
+	    else e->stale = 1;
+	    continue;
+	}
+	if ((int) e->info.denom == denom) return e;
+    }
+    return NULL;
+}
+
+/* Put w x h pixels of bpp bytes in a new entry. Returns it or NULL. */
+static entry_t *
+makeEntry(const char *path, const struct stat *st, const unsigned char *pixels,
+	  int w, int h, int bpp, int denom)
+{
+    entry_t *e;
+    unsigned char *map;
+    size_t size = (size_t) w * bpp * h;
+
+    if ((e = calloc(1, sizeof(*e))) == NULL) return NULL;
+    if ((e->path = strdup(path)) == NULL) {
+	free(e);
+	return NULL;
+    }
+    e->fd = memfd_create("image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (e->fd < 0 || ftruncate(e->fd, size) < 0) goto fail;
+    map = mmap(NULL, size, PROT_WRITE, MAP_SHARED, e->fd, 0);
+    if (map == MAP_FAILED) goto fail;
+    memcpy(map, pixels, size);
+    munmap(map, size);
+    /* Nobody can change it now, us included */
+    if (fcntl(e->fd, F_ADD_SEALS,
+	      F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+	goto fail;
+
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->fileSize = st->st_size;
+    e->mtime = st->st_mtim;
+    e->info.width = w;
+    e->info.height = h;
+    e->info.stride = w * bpp;
+    e->info.bpp = bpp;
+    if (bpp == 3) {
+	/* R, G and B bytes, as loadjpeg() gives them */
+	static const union { uint16_t s; unsigned char c[2]; } one = { 1 };
+
+	e->info.rmask = one.c[0] ? 0x0000FF : 0xFF0000;
+	e->info.gmask = 0x00FF00;
+	e->info.bmask = one.c[0] ? 0xFF0000 : 0x0000FF;
+    }
+    e->info.denom = denom;
+    e->info.size = size;
+    e->used = tick;
+    e->next = entries;
+    entries = e;
+    bytes += size;
+    return e;
+
+fail:
+    if (e->fd >= 0) close(e->fd);
+    free(e->path);
+    free(e);
+    return NULL;
+}
+
+/* Decode a file at 1/denom size and make an entry of it, and with -l make
+ * the smaller sizes from it too. Returns the entry for denom or NULL. */
+static entry_t *
+decode(const char *path, const struct stat *st, int iw, int ih, int denom)
+{
+    unsigned char *pixels, *half;
+    entry_t *e, *wanted;
+    int w, h, d, bpp, full = levels ? 1 : denom;
+
+    /* Ask for exactly the size that 1/full gives */
+    pixels = loadjpeg_native(path, (iw + full - 1) / full,
+			     (ih + full - 1) / full, &w, &h, &d, &bpp);
+    if (pixels == NULL) return NULL;
+    decodes++;
+    if ((e = findEntry(path, st, d)) == NULL)
+	e = makeEntry(path, st, pixels, w, h, bpp, d);
+    wanted = e;
+
+    if (levels) {
+	/* Each size is half the last, as libjpeg would make it */
+	for (d = 2; e != NULL && d <= 8; d *= 2) {
+	    int hw = (w + 1) / 2, hh = (h + 1) / 2;
+
+	    if ((half = malloc((size_t) hw * bpp * hh)) == NULL ||
+		scale_pixels(pixels, w, h, w * bpp, half, hw, hh, hw * bpp,
+			     bpp) < 0) {
+		free(half);
+		break;
+	    }
+	    free(pixels);
+	    pixels = half;
+	    w = hw;
+	    h = hh;
+	    if ((e = findEntry(path, st, d)) == NULL)
+		e = makeEntry(path, st, pixels, w, h, bpp, d);
+	    if (d == denom) wanted = e;
+	}
+    }
+    free(pixels);
+    return wanted;
+}
+
+/*
+ * The viewers
+ */
+
+static int
+sendReply(int fd, imgserver_reply_t *reply, int memfd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = reply;
+    iov.iov_len = sizeof(*reply);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (memfd >= 0) {
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    }
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t) sizeof(*reply) ? 0 : -1;
+}
+
+/* A viewer has let go of an image */
+static void
+unhold(entry_t *e)
+{
+    /* Nobody will ask for an old version of a file again */
+    if (--e->refs == 0 && e->stale) freeEntry(e);
+}
+
+static void
+dropClient(client_t *c)
+{
+    int i;
+
+    for (i = 0; i < c->nholds; i++)
+	unhold(c->holds[i].entry);
+    free(c->holds);
+    close(c->fd);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+    evict();
+}
+
+/* GET minw minh path. Returns 0, or -1 to drop the client. */
+static int
+get(client_t *c, int minw, int minh, const char *path)
+{
+    imgserver_reply_t reply;
+    struct stat st;
+    entry_t *e = NULL;
+    int iw, ih, d;
+
+    gets++;
+    tick++;
+    memset(&reply, 0, sizeof(reply));
+    if (stat(path, &st) < 0) {
+	reply.status = errno;
+    } else if (loadjpeg_size(path, &iw, &ih) != 0) {
+	reply.status = EINVAL;
+    } else {
+	/* What loadjpeg() would reduce it by */
+	for (d = 8; d > 1; d /= 2)
+	    if ((iw + d - 1) / d >= minw && (ih + d - 1) / d >= minh) break;
+	if ((e = findEntry(path, &st, d)) != NULL) hits++;
+	else e = decode(path, &st, iw, ih, d);
+	if (e == NULL) reply.status = EIO;
+    }
+
+    if (e != NULL) {
+	if (c->nholds == c->maxholds) {
+	    int n = c->maxholds ? c->maxholds * 2 : 4;
+	    hold_t *holds = realloc(c->holds, n * sizeof(*holds));
+
+	    if (holds == NULL) return -1;
+	    c->holds = holds;
+	    c->maxholds = n;
+	}
+	reply = e->info;
+	reply.id = nextId++;
+	c->holds[c->nholds].entry = e;
+	c->holds[c->nholds].id = reply.id;
+	c->nholds++;
+	e->refs++;
+	e->used = tick;
+    }
+    if (sendReply(c->fd, &reply, e ? e->fd : -1) < 0) return -1;
+    evict();
+    return 0;
+}
+
+static void
+drop(client_t *c, uint32_t id)
+{
+    int i;
+
+    for (i = 0; i < c->nholds; i++)
+	if (c->holds[i].id == id) {
+	    unhold(c->holds[i].entry);
+	    c->holds[i] = c->holds[--c->nholds];
+	    evict();
+	    return;
+	}
+}
+
+static int
+stats(client_t *c)
+{
+    char line[256];
+    entry_t *e;
+    int n = 0, held = 0, nclients = 0, i;
+
+    for (e = entries; e; e = e->next) {
+	n++;
+	if (e->refs) held++;
+    }
+    for (i = 0; i < MAXCLIENTS; i++)
+	if (clients[i].fd >= 0) nclients++;
+    snprintf(line, sizeof(line), "clients %d images %d held %d bytes %lld "
+	     "gets %ld hits %ld decodes %ld\n",
+	     nclients, n, held, bytes, gets, hits, decodes);
+    return send(c->fd, line, strlen(line), MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+/* Do the complete requests in a client's buffer. Returns 0 or -1 to drop it. */
+static int
+serve(client_t *c)
+{
+    char *line, *nl, path[IMGSERVER_MAXLINE];
+    int minw, minh;
+    unsigned id;
+
+    line = c->buf;
+    while ((nl = memchr(line, '\n', c->buf + c->len - line)) != NULL) {
+	*nl = '\0';
+	if (sscanf(line, "GET %d %d %[^\n]", &minw, &minh, path) == 3) {
+	    if (get(c, minw, minh, path) < 0) return -1;
+	} else if (sscanf(line, "DROP %u", &id) == 1) {
+	    drop(c, id);
+	} else if (strcmp(line, "STATS") == 0) {
+	    if (stats(c) < 0) return -1;
+	} else {
+	    return -1;
+	}
+	line = nl + 1;
+    }
+    c->len -= line - c->buf;
+    memmove(c->buf, line, c->len);
+    /* A request that won't fit isn't one of ours */
+    return c->len == sizeof(c->buf) ? -1 : 0;
+}
+
+static void
+usage(void)
+{
+    fputs("Usage: imgserver [-l] [-m megabytes] [socket]\n", stderr);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    int listener, opt, i;
+    long mb = DEFAULT_MB;
+
+    while ((opt = getopt(argc, argv, "lm:")) != -1) {
+	switch (opt) {
+	case 'l': levels = 1; break;
+	case 'm': mb = atol(optarg); break;
+	default: usage();
+	}
+    }
+    socketPath = (optind < argc) ? argv[optind] : getenv("IMAGE_SERVER");
+    if (socketPath == NULL || *socketPath == '\0') usage();
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+	fprintf(stderr, "imgserver: %s is too long for a socket name\n",
+		socketPath);
+	exit(1);
+    }
+    limit = (long long) mb * 1024 * 1024;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketPath);
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(socketPath);
+    umask(077);		/* Only we can connect */
+    if (listener < 0 ||
+	bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	listen(listener, 16) < 0) {
+	fprintf(stderr, "imgserver: %s: %s\n", socketPath, strerror(errno));
+	exit(1);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (i = 0; i < MAXCLIENTS; i++) clients[i].fd = -1;
+
+    while (!quit) {
+	struct pollfd pfd[MAXCLIENTS + 1];
+	int slot[MAXCLIENTS + 1], n = 1;
+
+	pfd[0].fd = listener;
+	pfd[0].events = POLLIN;
+	for (i = 0; i < MAXCLIENTS; i++)
+	    if (clients[i].fd >= 0) {
+		pfd[n].fd = clients[i].fd;
+		pfd[n].events = POLLIN;
+		slot[n++] = i;
+	    }
+	if (poll(pfd, n, -1) < 0) continue;	/* EINTR, to quit */
+
+	for (i = 1; i < n; i++) {
+	    client_t *c = &clients[slot[i]];
+	    ssize_t got;
+
+	    if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+	    got = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+	    if (got < 0 && errno == EINTR) continue;
+	    if (got <= 0) {
+		dropClient(c);
+		continue;
+	    }
+	    c->len += got;
+	    if (serve(c) < 0) dropClient(c);
+	}
+
+	if (pfd[0].revents & POLLIN) {
+	    int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+
+	    if (fd >= 0) {
+		for (i = 0; i < MAXCLIENTS && clients[i].fd >= 0; i++)
+		    ;
+		if (i == MAXCLIENTS) {
+		    close(fd);	/* They do without */
+		} else {
+		    memset(&clients[i], 0, sizeof(clients[i]));
+		    clients[i].fd = fd;
+		}
+	    }
+	}
+    }
+
+    unlink(socketPath);
+    return 0;
+}
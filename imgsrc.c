@@ -0,0 +1,730 @@
+/*
+ * imgsrc.c: Read a region of an image at a level of detail without having
+ * the whole image in memory.
+ *
+ * The decoders hand us the pixels a few rows at a time, in bands, and we add
+ * each one into a box filter that averages all the source pixels that land
+ * in each output pixel, writing out each row of the output as soon as the
+ * last source row that lands in it has gone by. So we only keep a band and
+ * a few output rows' worth of sums, and how much memory it takes depends on
+ * how big the output is, not on how big the image is.
+ *
+ * JPEGs have four levels of detail, because libjpeg can decode at 1/2, 1/4
+ * and 1/8 size. If the level we want is small enough to fit in memory anyway,
+ * we decode it with loadjpeg() so that files with restart markers get
+ * decoded on all cores. If not, we stream it a scanline at a time.
+ * Progressive JPEGs are the exception: libjpeg has to hold all their
+ * coefficients, whatever we do.
+ * TIFFs are read tile by tile, or strip by strip if the strips are a few
+ * rows, or else a row at a time, so a TIFF that is one big strip, as most
+ * are, isn't all in memory at once. If the file has
+ * reduced-resolution copies of the image, as pyramidal TIFFs do in SubIFDs
+ * or in later directories, those are its levels of detail.
+ * PNGs are read a row at a time, except interlaced ones, which we refuse
+ * because the first row isn't finished until the last pass.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include <png.h>
+#include <tiffio.h>
+
+#include "imgsrc.h"
+#include "loadjpeg.h"
+#include "scale.h"
+
+#define MAXLEVELS 32
+#define STRIP_ROWS 64	/* Read TIFF strips of more rows a row at a time */
+
+enum { JPEG, PNG, TIFF_ };
+
+struct imgsrc {
+    int type;
+    char *filename;
+    int64_t width, height;	/* of the full-resolution image */
+    int nlevels;
+    struct {
+	int64_t w, h;
+	uint64_t dir;		/* TIFF directory offset of this level */
+    } levels[MAXLEVELS];	/* Biggest first. levels[0] is full size. */
+    TIFF *tif;
+};
+
+/*
+ * The box filter
+ */
+
+typedef struct {
+    int64_t x0, y0, w, h;	/* The region, in pixels of this level */
+    int rw, rh;			/* The size of the output */
+    unsigned char *out;		/* which is rw x rh x 3 bytes, */
+    int pitch;			/* with rows this far apart */
+    int *colOut;		/* Which output column each column goes in */
+    int *colCount;		/* How many columns go in each output column */
+    uint64_t *acc;		/* The sums for output rows accBase onwards */
+    int accBase, accRows;
+} reducer_t;
+
+/* Which output row does row y of the source go in? */
+static int
+outRow(reducer_t *r, int64_t y)
+{
+    return (y - r->y0) * r->rh / r->h;
+}
+
+/* Which is the first source row that goes in output row oy? */
+static int64_t
+firstRow(reducer_t *r, int oy)
+{
+    return r->y0 + ((int64_t) oy * r->h + r->rh - 1) / r->rh;
+}
+
+static int
+reducerInit(reducer_t *r, int64_t x0, int64_t y0, int64_t w, int64_t h,
+	    unsigned char *out, int rw, int rh, int pitch)
+{
+    int64_t i;
+
+    r->x0 = x0; r->y0 = y0; r->w = w; r->h = h;
+    r->out = out; r->rw = rw; r->rh = rh; r->pitch = pitch;
+    r->colOut = malloc(w * sizeof(*r->colOut));
+    r->colCount = calloc(rw, sizeof(*r->colCount));
+    r->acc = NULL;
+    r->accBase = r->accRows = 0;
+    if (r->colOut == NULL || r->colCount == NULL) {
+	free(r->colOut);
+	free(r->colCount);
+	return -1;
+    }
+    for (i = 0; i < w; i++) {
+	r->colOut[i] = i * rw / w;
+	r->colCount[r->colOut[i]]++;
+    }
+    return 0;
+}
+
+/* Write out the output rows before row "upto" and shift the rest down */
+static void
+flushRows(reducer_t *r, int upto)
+{
+    size_t rowSize = (size_t) r->rw * 3;
+    int oy, ox, c, done;
+
+    if (upto > r->rh) upto = r->rh;
+    for (oy = r->accBase; oy < upto; oy++) {
+	int rows = firstRow(r, oy + 1) - firstRow(r, oy);
+	unsigned char *o = r->out + (size_t) oy * r->pitch;
+	uint64_t *a;
+
+	/* Rows the decoder never got to are black */
+	if (r->acc == NULL || oy - r->accBase >= r->accRows) {
+	    memset(o, 0, rowSize);
+	    continue;
+	}
+	a = r->acc + (oy - r->accBase) * rowSize;
+	for (ox = 0; ox < r->rw; ox++) {
+	    uint64_t n = (uint64_t) r->colCount[ox] * rows;
+
+	    for (c = 0; c < 3; c++)
+		*o++ = (*a++ + n / 2) / n;
+	}
+    }
+    done = upto - r->accBase;
+    if (done <= 0) return;
+    if (done < r->accRows) {
+	memmove(r->acc, r->acc + done * rowSize,
+		(r->accRows - done) * rowSize * sizeof(*r->acc));
+	memset(r->acc + (r->accRows - done) * rowSize, 0,
+	       done * rowSize * sizeof(*r->acc));
+    } else if (r->acc) {
+	memset(r->acc, 0, r->accRows * rowSize * sizeof(*r->acc));
+    }
+    r->accBase = upto;
+}
+
+/* Rows y0 to y1-1 are coming next. Returns 0 or -1 if out of memory. */
+static int
+reducerBand(reducer_t *r, int64_t y0, int64_t y1)
+{
+    size_t rowSize = (size_t) r->rw * 3;
+    int need;
+
+    flushRows(r, outRow(r, y0));
+    need = outRow(r, y1 - 1) - r->accBase + 1;
+    if (need > r->accRows) {
+	uint64_t *more = realloc(r->acc, need * rowSize * sizeof(*more));
+
+	if (more == NULL) return -1;
+	memset(more + r->accRows * rowSize, 0,
+	       (need - r->accRows) * rowSize * sizeof(*more));
+	r->acc = more;
+	r->accRows = need;
+    }
+    return 0;
+}
+
+/* Add n RGB pixels from x,y in the current band */
+static void
+reducerAdd(reducer_t *r, int64_t x, int64_t y, int64_t n,
+	   const unsigned char *rgb)
+{
+    uint64_t *row;
+    int64_t i;
+
+    if (y < r->y0 || y >= r->y0 + r->h) return;
+    row = r->acc + (size_t) (outRow(r, y) - r->accBase) * r->rw * 3;
+    for (i = 0; i < n; i++, rgb += 3) {
+	int64_t col = x + i - r->x0;
+	uint64_t *a;
+
+	if (col < 0 || col >= r->w) continue;
+	a = row + r->colOut[col] * 3;
+	a[0] += rgb[0]; a[1] += rgb[1]; a[2] += rgb[2];
+    }
+}
+
+static void
+reducerFinish(reducer_t *r)
+{
+    flushRows(r, r->rh);
+    free(r->acc);
+    free(r->colOut);
+    free(r->colCount);
+}
+
+/*
+ * JPEG
+ */
+
+struct error_mgr {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+};
+
+static void
+errorExit(j_common_ptr cinfo)
+{
+    longjmp(((struct error_mgr *) cinfo->err)->jmp, 1);
+}
+
+static void
+outputMessage(j_common_ptr cinfo)
+{
+}
+
+static int
+readJpeg(imgsrc_t *src, int level, int64_t x, int64_t y, int64_t w, int64_t h,
+	 reducer_t *r)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct error_mgr jerr;
+    unsigned char * volatile row = NULL;
+    FILE *fp;
+    int64_t ly;
+
+    /* If it's small enough, decode it all at once, maybe on all cores */
+    if (src->levels[level].w * src->levels[level].h <=
+	4 * (int64_t) r->rw * r->rh) {
+	unsigned char *pixels;
+	int pw, ph, denom;
+
+	pixels = loadjpeg(src->filename, src->levels[level].w,
+			  src->levels[level].h, &pw, &ph, &denom);
+	if (pixels != NULL && denom == 1 << level) {
+	    for (ly = y; ly < y + h && ly < ph; ly++) {
+		if (reducerBand(r, ly, ly + 1) < 0) {
+		    free(pixels);
+		    return -1;
+		}
+		reducerAdd(r, x, ly, w, pixels + (ly * pw + x) * 3);
+	    }
+	    free(pixels);
+	    return 0;
+	}
+	free(pixels);
+    }
+
+    if ((fp = fopen(src->filename, "rb")) == NULL) return -1;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = errorExit;
+    jerr.pub.output_message = outputMessage;
+    jpeg_create_decompress(&cinfo);
+    if (setjmp(jerr.jmp)) {
+	jpeg_destroy_decompress(&cinfo);
+	fclose(fp);
+	free(row);
+	return -1;
+    }
+    jpeg_stdio_src(&cinfo, fp);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = (cinfo.jpeg_color_space == JCS_GRAYSCALE)
+			    ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 1 << level;
+    jpeg_start_decompress(&cinfo);
+
+    if ((row = malloc((size_t) cinfo.output_width * 3)) == NULL)
+	longjmp(jerr.jmp, 1);
+    while (cinfo.output_scanline < y + h &&
+	   cinfo.output_scanline < cinfo.output_height) {
+	JSAMPROW rowp = row;
+
+	ly = cinfo.output_scanline;
+	jpeg_read_scanlines(&cinfo, &rowp, 1);
+	if (ly < y) continue;
+	if (cinfo.out_color_space == JCS_GRAYSCALE) {
+	    int i;
+
+	    for (i = cinfo.output_width - 1; i >= 0; i--)
+		row[i * 3] = row[i * 3 + 1] = row[i * 3 + 2] = row[i];
+	}
+	if (reducerBand(r, ly, ly + 1) < 0) longjmp(jerr.jmp, 1);
+	reducerAdd(r, x, ly, w, row + x * 3);
+    }
+
+    /* We may have stopped before the end, so don't finish it */
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    free(row);
+    return 0;
+}
+
+/*
+ * PNG
+ */
+
+static int
+readPng(imgsrc_t *src, int64_t x, int64_t y, int64_t w, int64_t h,
+	reducer_t *r)
+{
+    png_structp png;
+    png_infop info;
+    unsigned char * volatile row = NULL;
+    FILE *fp;
+    int64_t ly;
+
+    if ((fp = fopen(src->filename, "rb")) == NULL) return -1;
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info = png ? png_create_info_struct(png) : NULL;
+    if (info == NULL || setjmp(png_jmpbuf(png))) {
+	png_destroy_read_struct(&png, &info, NULL);
+	fclose(fp);
+	free(row);
+	return -1;
+    }
+    png_init_io(png, fp);
+    png_read_info(png, info);
+
+    /* Make it 8-bit RGB whatever it is */
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_strip_alpha(png);
+    png_set_gray_to_rgb(png);
+    png_read_update_info(png, info);
+
+    if ((row = malloc(png_get_rowbytes(png, info))) == NULL)
+	png_error(png, "Out of memory");
+    for (ly = 0; ly < y + h && ly < src->height; ly++) {
+	png_read_row(png, row, NULL);
+	if (ly < y) continue;
+	if (reducerBand(r, ly, ly + 1) < 0) png_error(png, "Out of memory");
+	reducerAdd(r, x, ly, w, row + x * 3);
+    }
+
+    png_destroy_read_struct(&png, &info, NULL);
+    fclose(fp);
+    free(row);
+    return 0;
+}
+
+/*
+ * TIFF
+ */
+
+/* Convert n of TIFFReadRGBA*'s ABGR pixels to RGB */
+static void
+abgrToRgb(const uint32_t *p, int64_t n, unsigned char *rgb)
+{
+    for (; n > 0; n--, p++) {
+	*rgb++ = TIFFGetR(*p);
+	*rgb++ = TIFFGetG(*p);
+	*rgb++ = TIFFGetB(*p);
+    }
+}
+
+/* What we need to know to convert a TIFF's scanlines to RGB ourselves */
+typedef struct {
+    uint16_t bits, spp, photometric;
+    uint16_t *map[3];		/* The colormap, for palette images */
+} tiffFormat_t;
+
+/* Can we read the directory we're in a scanline at a time? Returns 0 if so
+ * or -1 if it's a kind only TIFFReadRGBA*() understands. */
+static int
+tiffFormat(TIFF *tif, tiffFormat_t *f)
+{
+    uint16_t planar, compression;
+
+    TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &f->bits);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &f->spp);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+    if (planar != PLANARCONFIG_CONTIG ||
+	!TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &f->photometric))
+	return -1;
+    if (f->photometric == PHOTOMETRIC_YCBCR &&
+	compression == COMPRESSION_JPEG) {
+	/* libjpeg can give us RGB */
+	TIFFSetField(tif, TIFFTAG_JPEGCOLORMODE, JPEGCOLORMODE_RGB);
+	f->photometric = PHOTOMETRIC_RGB;
+    }
+    switch (f->photometric) {
+    case PHOTOMETRIC_MINISBLACK:
+    case PHOTOMETRIC_MINISWHITE:
+	return (f->bits == 8 || f->bits == 16) && f->spp >= 1 ? 0 : -1;
+    case PHOTOMETRIC_RGB:
+	return (f->bits == 8 || f->bits == 16) && f->spp >= 3 ? 0 : -1;
+    case PHOTOMETRIC_PALETTE:
+	return f->bits == 8 && f->spp == 1 &&
+	       TIFFGetField(tif, TIFFTAG_COLORMAP,
+			    &f->map[0], &f->map[1], &f->map[2]) ? 0 : -1;
+    }
+    return -1;
+}
+
+/* Convert n pixels of a scanline from x on to RGB */
+static void
+scanlineToRgb(const tiffFormat_t *f, const unsigned char *line, int64_t x,
+	      int64_t n, unsigned char *rgb)
+{
+    const unsigned char *p = line + x * (f->bits / 8) * f->spp;
+    const uint16_t *p16 = (const uint16_t *) line + x * f->spp;
+    int c;
+
+    for (; n > 0; n--, p += f->spp, p16 += f->spp) {
+	switch (f->photometric) {
+	case PHOTOMETRIC_MINISBLACK:
+	case PHOTOMETRIC_MINISWHITE:
+	    c = f->bits == 16 ? p16[0] >> 8 : p[0];
+	    if (f->photometric == PHOTOMETRIC_MINISWHITE) c = 255 - c;
+	    *rgb++ = c; *rgb++ = c; *rgb++ = c;
+	    break;
+	case PHOTOMETRIC_RGB:
+	    for (c = 0; c < 3; c++)
+		*rgb++ = f->bits == 16 ? p16[c] >> 8 : p[c];
+	    break;
+	default:	/* PHOTOMETRIC_PALETTE */
+	    for (c = 0; c < 3; c++)
+		*rgb++ = f->map[c][p[0]] >> 8;
+	    break;
+	}
+    }
+}
+
+static int
+readTiff(imgsrc_t *src, int level, int64_t x, int64_t y, int64_t w, int64_t h,
+	 reducer_t *r)
+{
+    TIFF *tif = src->tif;
+    int64_t lw = src->levels[level].w, lh = src->levels[level].h;
+    uint32_t *buf = NULL;
+    unsigned char *line = NULL;
+    unsigned char *rgb = NULL;
+    tiffFormat_t format;
+    int ok = 0;
+
+    if (!TIFFSetSubDirectory(tif, src->levels[level].dir)) return -1;
+
+    if (TIFFIsTiled(tif)) {
+	uint32_t tw, th;
+	int64_t tx, ty, ly;
+
+	if (!TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tw) ||
+	    !TIFFGetField(tif, TIFFTAG_TILELENGTH, &th))
+	    return -1;
+	buf = _TIFFmalloc((tmsize_t) tw * th * sizeof(*buf));
+	rgb = malloc((size_t) tw * 3);
+	if (buf == NULL || rgb == NULL) goto out;
+
+	/* A row of tiles at a time. Their pixels are bottom row first. */
+	for (ty = y - y % th; ty < y + h; ty += th) {
+	    int64_t y0 = ty > y ? ty : y;
+	    int64_t y1 = ty + th < y + h ? ty + th : y + h;
+
+	    if (reducerBand(r, y0, y1) < 0) goto out;
+	    for (tx = x - x % tw; tx < x + w; tx += tw) {
+		int64_t n = tx + tw <= lw ? tw : lw - tx;
+
+		if (!TIFFReadRGBATile(tif, tx, ty, buf)) goto out;
+		for (ly = y0; ly < y1; ly++) {
+		    abgrToRgb(buf + (th - 1 - (ly - ty)) * tw, n, rgb);
+		    reducerAdd(r, tx, ly, n, rgb);
+		}
+	    }
+	}
+    } else {
+	uint32_t rps;
+	int64_t sy, ly;
+
+	TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rps);
+	if (rps > lh) rps = lh;
+
+	/* Big strips a row at a time, if we know how to convert them.
+	 * Planar, CMYK, Lab and the like still take a strip at a time. */
+	if (rps > STRIP_ROWS && tiffFormat(tif, &format) == 0) {
+	    line = _TIFFmalloc(TIFFScanlineSize(tif));
+	    rgb = malloc((size_t) w * 3);
+	    if (line == NULL || rgb == NULL) goto out;
+	    for (ly = y; ly < y + h; ly++) {
+		if (reducerBand(r, ly, ly + 1) < 0 ||
+		    TIFFReadScanline(tif, line, ly, 0) < 0)
+		    goto out;
+		scanlineToRgb(&format, line, x, w, rgb);
+		reducerAdd(r, x, ly, w, rgb);
+	    }
+	    ok = 1;
+	    goto out;
+	}
+
+	buf = _TIFFmalloc((tmsize_t) lw * rps * sizeof(*buf));
+	rgb = malloc((size_t) w * 3);
+	if (buf == NULL || rgb == NULL) goto out;
+
+	/* A strip at a time, bottom row first. The last may be short. */
+	for (sy = y - y % rps; sy < y + h; sy += rps) {
+	    int64_t rows = sy + rps <= lh ? rps : lh - sy;
+	    int64_t y0 = sy > y ? sy : y;
+	    int64_t y1 = sy + rows < y + h ? sy + rows : y + h;
+
+	    if (reducerBand(r, y0, y1) < 0 ||
+		!TIFFReadRGBAStrip(tif, sy, buf))
+		goto out;
+	    for (ly = y0; ly < y1; ly++) {
+		abgrToRgb(buf + (rows - 1 - (ly - sy)) * lw + x, w, rgb);
+		reducerAdd(r, x, ly, w, rgb);
+	    }
+	}
+    }
+    ok = 1;
+
+out:
+    if (buf) _TIFFfree(buf);
+    if (line) _TIFFfree(line);
+    free(rgb);
+    return ok ? 0 : -1;
+}
+
+/* Add the TIFF directory we're in as a level if it's a smaller copy */
+static void
+addTiffLevel(imgsrc_t *src)
+{
+    uint32_t w, h;
+    int i;
+
+    if (src->nlevels == MAXLEVELS ||
+	!TIFFGetField(src->tif, TIFFTAG_IMAGEWIDTH, &w) ||
+	!TIFFGetField(src->tif, TIFFTAG_IMAGELENGTH, &h) ||
+	w == 0 || h == 0 || w >= src->width)
+	return;
+    /* Same shape, give or take rounding */
+    if (llabs((int64_t) w * src->height - (int64_t) h * src->width) >
+	src->width + src->height)
+	return;
+
+    /* Keep them biggest first */
+    for (i = src->nlevels; i > 1 && src->levels[i - 1].w < w; i--)
+	src->levels[i] = src->levels[i - 1];
+    src->levels[i].w = w;
+    src->levels[i].h = h;
+    src->levels[i].dir = TIFFCurrentDirOffset(src->tif);
+    src->nlevels++;
+}
+
+static int
+openTiff(imgsrc_t *src)
+{
+    uint32_t w, h;
+    uint16_t nsub = 0;
+    uint32_t subfiletype;
+    uint64_t *subs, *offsets = NULL;
+    int i;
+
+    TIFFSetWarningHandler(NULL);
+    if ((src->tif = TIFFOpen(src->filename, "r")) == NULL) return -1;
+    if (!TIFFGetField(src->tif, TIFFTAG_IMAGEWIDTH, &w) ||
+	!TIFFGetField(src->tif, TIFFTAG_IMAGELENGTH, &h)) {
+	TIFFClose(src->tif);
+	return -1;
+    }
+    src->width = w;
+    src->height = h;
+    src->levels[0].w = w;
+    src->levels[0].h = h;
+    src->levels[0].dir = TIFFCurrentDirOffset(src->tif);
+    src->nlevels = 1;
+
+    /* Reduced-resolution levels in SubIFDs of the first directory... */
+    if (TIFFGetField(src->tif, TIFFTAG_SUBIFD, &nsub, &subs) && nsub > 0 &&
+	(offsets = malloc(nsub * sizeof(*offsets))) != NULL) {
+	/* The array goes away when we change directory */
+	memcpy(offsets, subs, nsub * sizeof(*offsets));
+	for (i = 0; i < nsub; i++)
+	    if (TIFFSetSubDirectory(src->tif, offsets[i]))
+		addTiffLevel(src);
+	free(offsets);
+    }
+
+    /* ...or in the directories that follow it */
+    TIFFSetSubDirectory(src->tif, src->levels[0].dir);
+    while (TIFFReadDirectory(src->tif))
+	if (TIFFGetField(src->tif, TIFFTAG_SUBFILETYPE, &subfiletype) &&
+	    (subfiletype & FILETYPE_REDUCEDIMAGE))
+	    addTiffLevel(src);
+
+    return 0;
+}
+
+/*
+ * The interface
+ */
+
+imgsrc_t *
+imgsrc_open(const char *filename)
+{
+    imgsrc_t *src;
+    unsigned char magic[29];
+    size_t got;
+    FILE *fp;
+
+    if ((fp = fopen(filename, "rb")) == NULL) return NULL;
+    got = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+
+    if ((src = calloc(1, sizeof(*src))) == NULL) return NULL;
+    if ((src->filename = strdup(filename)) == NULL) {
+	free(src);
+	return NULL;
+    }
+
+    if (got >= 2 && magic[0] == 0xFF && magic[1] == 0xD8) {
+	int w, h, i;
+
+	src->type = JPEG;
+	if (loadjpeg_size(filename, &w, &h) < 0) goto fail;
+	src->width = w;
+	src->height = h;
+	for (i = 0; i < 4; i++) {
+	    src->levels[i].w = (w + (1 << i) - 1) >> i;
+	    src->levels[i].h = (h + (1 << i) - 1) >> i;
+	}
+	src->nlevels = 4;
+    } else if (got == sizeof(magic) && memcmp(magic, "\211PNG", 4) == 0) {
+	/* The IHDR chunk is always first */
+	src->type = PNG;
+	src->width = (uint32_t) magic[16] << 24 | magic[17] << 16 |
+		     magic[18] << 8 | magic[19];
+	src->height = (uint32_t) magic[20] << 24 | magic[21] << 16 |
+		      magic[22] << 8 | magic[23];
+	if (magic[28] != 0) goto fail;		/* Interlaced */
+	src->levels[0].w = src->width;
+	src->levels[0].h = src->height;
+	src->nlevels = 1;
+    } else if (got >= 4 && (memcmp(magic, "II", 2) == 0 ||
+			    memcmp(magic, "MM", 2) == 0)) {
+	src->type = TIFF_;
+	if (openTiff(src) < 0) goto fail;
+    } else {
+	goto fail;
+    }
+    if (src->width <= 0 || src->height <= 0) {
+	imgsrc_close(src);
+	return NULL;
+    }
+    return src;
+
+fail:
+    free(src->filename);
+    free(src);
+    return NULL;
+}
+
+void
+imgsrc_close(imgsrc_t *src)
+{
+    if (src->tif) TIFFClose(src->tif);
+    free(src->filename);
+    free(src);
+}
+
+int64_t
+imgsrc_width(imgsrc_t *src)
+{
+    return src->width;
+}
+
+int64_t
+imgsrc_height(imgsrc_t *src)
+{
+    return src->height;
+}
+
+int
+imgsrc_read(imgsrc_t *src, int64_t x, int64_t y, int64_t w, int64_t h,
+	    unsigned char *dst, int dw, int dh, int pitch)
+{
+    int64_t lx, ly, lw, lh;	/* The region in the level we read from */
+    int level, rw, rh, ret;
+    unsigned char *out;
+    reducer_t r;
+
+    /* Clip the region to the image */
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > src->width) w = src->width - x;
+    if (y + h > src->height) h = src->height - y;
+    if (w <= 0 || h <= 0 || dw <= 0 || dh <= 0) return -1;
+
+    /* Use the smallest level that still has dw x dh pixels in the region */
+    for (level = src->nlevels - 1; level > 0; level--)
+	if (w * src->levels[level].w / src->width >= dw &&
+	    h * src->levels[level].h / src->height >= dh)
+	    break;
+    lx = x * src->levels[level].w / src->width;
+    ly = y * src->levels[level].h / src->height;
+    lw = (x + w) * src->levels[level].w / src->width - lx;
+    lh = (y + h) * src->levels[level].h / src->height - ly;
+    if (lw < 1) lw = 1;
+    if (lh < 1) lh = 1;
+
+    /* The box filter can only reduce, so enlarge with scale_pixels after */
+    rw = lw < dw ? lw : dw;
+    rh = lh < dh ? lh : dh;
+    if (rw == dw && rh == dh) {
+	out = dst;
+    } else if ((out = malloc((size_t) rw * rh * 3)) == NULL) {
+	return -1;
+    }
+    if (reducerInit(&r, lx, ly, lw, lh, out, rw, rh,
+		    out == dst ? pitch : rw * 3) < 0) {
+	if (out != dst) free(out);
+	return -1;
+    }
+
+    switch (src->type) {
+    case JPEG:	ret = readJpeg(src, level, lx, ly, lw, lh, &r);	break;
+    case PNG:	ret = readPng(src, lx, ly, lw, lh, &r);		break;
+    default:	ret = readTiff(src, level, lx, ly, lw, lh, &r);	break;
+    }
+    reducerFinish(&r);
+
+    if (out != dst) {
+	if (ret == 0 &&
+	    scale_pixels(out, rw, rh, rw * 3, dst, dw, dh, pitch, 3) < 0)
+	    ret = -1;
+	free(out);
+    }
+    return ret;
+}
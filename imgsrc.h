@@ -0,0 +1,30 @@
+/*
+ * imgsrc.h: Interface to imgsrc.c, which reads regions of images that may be
+ * too big to decode into memory, scaled to the size you want them.
+ *
+ * Sizes and coordinates are in pixels of the full-resolution image and are
+ * 64-bit because gigapixel images don't fit in an int once you multiply
+ * two of them together.
+ */
+
+#include <stdint.h>
+
+typedef struct imgsrc imgsrc_t;
+
+/* Open an image file. Returns NULL if it isn't in a format we can read
+ * piece by piece: tiled or stripped TIFF (with reduced-resolution levels
+ * if it has them), non-interlaced PNG and JPEG. */
+extern imgsrc_t *imgsrc_open(const char *filename);
+extern void imgsrc_close(imgsrc_t *src);
+
+extern int64_t imgsrc_width(imgsrc_t *src);
+extern int64_t imgsrc_height(imgsrc_t *src);
+
+/* Read the region x,y,w,h of the image scaled to dw x dh into dst,
+ * which has rows of 3-byte RGB pixels "pitch" bytes apart.
+ * It uses the smallest level of detail that has at least dw x dh pixels
+ * in that region, and only keeps a few rows of it in memory at a time.
+ * Returns 0 on success or -1 on failure. */
+extern int imgsrc_read(imgsrc_t *src, int64_t x, int64_t y,
+		       int64_t w, int64_t h,
+		       unsigned char *dst, int dw, int dh, int pitch);
@@ -0,0 +1,283 @@
+/*
+ * levels-gtk.c: A window of sliders for the black point, white point and
+ * gamma of the image, for all channels or one of red, green and blue, over
+ * the image's histogram as they make it, for the GTK2 and GTK3 viewers.
+ *
+ * The sliders only make new tables (see levels.c) and ask the viewer to
+ * scale the image again, which looks it up in them as it goes (see
+ * bands-gdk.c), so dragging one costs a frame of resizing. The histogram is
+ * counted from the source image on all cores when it's shown or the image
+ * changes and moved through the tables to draw it, which costs nothing.
+ *
+ * The gamma slider goes from 0.1 to 10 logarithmically, so 1 is in the
+ * middle.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <gtk/gtk.h>
+
+#include "levels.h"
+#include "levels-gtk.h"
+#include "bands-gdk.h"
+#include "trace.h"
+
+#define HIST_W	256
+#define HIST_H	100
+
+static GtkWidget *window = NULL;
+static GtkWidget *area;			/* The histogram */
+static GtkWidget *blackScale, *whiteScale, *gammaScale;
+static int channel = -1;		/* Which the sliders set, -1 for all */
+static levels_t levels;
+static unsigned long sourceHist[3][256];/* Of R, G and B in the source */
+static gboolean counted = FALSE;	/* Is that of anything? */
+static void (*changed)(gpointer data);
+static gpointer changedData;
+
+void
+levelsSetSource(GdkPixbuf *pixbuf)
+{
+    unsigned long hist[4][256];
+    int b;
+
+    if (window == NULL || !gtk_widget_get_visible(window)) return;
+    counted = FALSE;
+    if (pixbuf != NULL && gdk_pixbuf_get_bits_per_sample(pixbuf) == 8) {
+	trace_begin("histogram");
+	levels_histogram(gdk_pixbuf_get_pixels(pixbuf),
+			 gdk_pixbuf_get_width(pixbuf),
+			 gdk_pixbuf_get_height(pixbuf),
+			 gdk_pixbuf_get_rowstride(pixbuf),
+			 gdk_pixbuf_get_n_channels(pixbuf), hist);
+	trace_end("histogram");
+	for (b = 0; b < 3; b++)
+	    memcpy(sourceHist[b], hist[b], sizeof(sourceHist[b]));
+	counted = TRUE;
+    }
+    gtk_widget_queue_draw(area);
+}
+
+/* Draw the histogram after the tables, red, green and blue added together
+ * so where they're the same it's white. The ends are left out of the scale,
+ * as clipping piles everything up there. */
+static void
+drawHistogram(GtkWidget *widget, cairo_t *cr)
+{
+    static const int order[3] = { 0, 1, 2 };
+    unsigned char lut[3][256];
+    unsigned long hist[3][256];
+    unsigned long max = 1;
+    GtkAllocation a;
+    int b, v;
+
+    gtk_widget_get_allocation(widget, &a);
+    cairo_set_source_rgb(cr, 0, 0, 0);
+    cairo_paint(cr);
+    if (!counted) return;
+
+    levels_tables(&levels, order, 3, lut);
+    levels_remap(sourceHist, 3, lut, hist);
+    for (b = 0; b < 3; b++)
+	for (v = 1; v < 255; v++)
+	    if (hist[b][v] > max) max = hist[b][v];
+
+    cairo_set_operator(cr, CAIRO_OPERATOR_ADD);
+    cairo_set_line_width(cr, (double) a.width / 256);
+    for (b = 0; b < 3; b++) {
+	cairo_set_source_rgb(cr, b == 0, b == 1, b == 2);
+	for (v = 0; v < 256; v++) {
+	    double x = (v + 0.5) * a.width / 256;
+	    double y = MIN(1.0, (double) hist[b][v] / max) * a.height;
+
+	    cairo_move_to(cr, x, a.height);
+	    cairo_line_to(cr, x, a.height - y);
+	}
+	cairo_stroke(cr);
+    }
+}
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+static gboolean
+draw(GtkWidget *widget, cairo_t *cr, gpointer data)
+{
+    drawHistogram(widget, cr);
+    return TRUE;
+}
+#else
+static gboolean
+expose(GtkWidget *widget, GdkEventExpose *event, gpointer data)
+{
+    cairo_t *cr = gdk_cairo_create(widget->window);
+
+    drawHistogram(widget, cr);
+    cairo_destroy(cr);
+    return TRUE;
+}
+#endif
+
+/* Set the sliders from the channel they're for without it counting as
+ * moving them */
+static void sliderMoved(GtkRange *range, gpointer data);
+
+static void
+showChannel(void)
+{
+    int c = channel < 0 ? 0 : channel;
+
+    g_signal_handlers_block_by_func(blackScale, sliderMoved, NULL);
+    g_signal_handlers_block_by_func(whiteScale, sliderMoved, NULL);
+    g_signal_handlers_block_by_func(gammaScale, sliderMoved, NULL);
+    gtk_range_set_value(GTK_RANGE(blackScale), levels.black[c]);
+    gtk_range_set_value(GTK_RANGE(whiteScale), levels.white[c]);
+    gtk_range_set_value(GTK_RANGE(gammaScale), log10(levels.gamma[c]));
+    g_signal_handlers_unblock_by_func(blackScale, sliderMoved, NULL);
+    g_signal_handlers_unblock_by_func(whiteScale, sliderMoved, NULL);
+    g_signal_handlers_unblock_by_func(gammaScale, sliderMoved, NULL);
+}
+
+static void
+levelsChanged(void)
+{
+    bandsSetLevels(&levels);
+    gtk_widget_queue_draw(area);
+    changed(changedData);
+}
+
+static void
+sliderMoved(GtkRange *range, gpointer data)
+{
+    int black = gtk_range_get_value(GTK_RANGE(blackScale));
+    int white = gtk_range_get_value(GTK_RANGE(whiteScale));
+    double gamma = pow(10, gtk_range_get_value(GTK_RANGE(gammaScale)));
+    int c;
+
+    /* Keep the white point above the black one */
+    if (white <= black) {
+	if (GTK_WIDGET(range) == blackScale) white = black + 1;
+	else black = white - 1;
+	if (white > 255) white = 255, black = 254;
+	if (black < 0) black = 0, white = 1;
+	g_signal_handlers_block_by_func(blackScale, sliderMoved, NULL);
+	g_signal_handlers_block_by_func(whiteScale, sliderMoved, NULL);
+	gtk_range_set_value(GTK_RANGE(blackScale), black);
+	gtk_range_set_value(GTK_RANGE(whiteScale), white);
+	g_signal_handlers_unblock_by_func(blackScale, sliderMoved, NULL);
+	g_signal_handlers_unblock_by_func(whiteScale, sliderMoved, NULL);
+    }
+    for (c = 0; c < 3; c++) {
+	if (channel >= 0 && c != channel) continue;
+	levels.black[c] = black;
+	levels.white[c] = white;
+	levels.gamma[c] = gamma;
+    }
+    levelsChanged();
+}
+
+static void
+channelChosen(GtkComboBox *combo, gpointer data)
+{
+    channel = gtk_combo_box_get_active(combo) - 1;
+    showChannel();
+}
+
+static void
+resetLevels(GtkButton *button, gpointer data)
+{
+    levels_reset(&levels);
+    showChannel();
+    levelsChanged();
+}
+
+static gchar *
+formatGamma(GtkScale *scale, gdouble value, gpointer data)
+{
+    return g_strdup_printf("%.2f", pow(10, value));
+}
+
+/* A slider with a label on the left */
+static GtkWidget *
+addSlider(GtkWidget *table, int row, const char *name,
+	  double min, double max, double step)
+{
+    GtkWidget *label = gtk_label_new(name);
+    GtkWidget *scale = gtk_hscale_new_with_range(min, max, step);
+
+    gtk_misc_set_alignment(GTK_MISC(label), 0, 0.5);
+    gtk_table_attach(GTK_TABLE(table), label, 0, 1, row, row + 1,
+		     GTK_FILL, 0, 4, 0);
+    gtk_table_attach(GTK_TABLE(table), scale, 1, 2, row, row + 1,
+		     GTK_EXPAND | GTK_FILL, 0, 4, 0);
+    gtk_scale_set_value_pos(GTK_SCALE(scale), GTK_POS_RIGHT);
+    g_signal_connect(scale, "value-changed", G_CALLBACK(sliderMoved), NULL);
+    return scale;
+}
+
+static void
+makeWindow(GtkWindow *parent)
+{
+    GtkWidget *vbox, *hbox, *table, *combo, *reset;
+
+    levels_reset(&levels);
+    window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(window), "Levels");
+    gtk_window_set_transient_for(GTK_WINDOW(window), parent);
+    gtk_window_set_destroy_with_parent(GTK_WINDOW(window), TRUE);
+    /* Closing it only hides it, keeping the settings */
+    g_signal_connect(window, "delete-event",
+		     G_CALLBACK(gtk_widget_hide_on_delete), NULL);
+
+    vbox = gtk_vbox_new(FALSE, 4);
+    gtk_container_set_border_width(GTK_CONTAINER(vbox), 4);
+    gtk_container_add(GTK_CONTAINER(window), vbox);
+
+    area = gtk_drawing_area_new();
+    gtk_widget_set_size_request(area, HIST_W, HIST_H);
+#if GTK_CHECK_VERSION(3, 0, 0)
+    g_signal_connect(area, "draw", G_CALLBACK(draw), NULL);
+#else
+    g_signal_connect(area, "expose-event", G_CALLBACK(expose), NULL);
+#endif
+    gtk_box_pack_start(GTK_BOX(vbox), area, TRUE, TRUE, 0);
+
+    table = gtk_table_new(3, 2, FALSE);
+    blackScale = addSlider(table, 0, "Black", 0, 255, 1);
+    whiteScale = addSlider(table, 1, "White", 0, 255, 1);
+    gammaScale = addSlider(table, 2, "Gamma", -1, 1, 0.01);
+    gtk_scale_set_digits(GTK_SCALE(blackScale), 0);
+    gtk_scale_set_digits(GTK_SCALE(whiteScale), 0);
+    g_signal_connect(gammaScale, "format-value", G_CALLBACK(formatGamma),
+		     NULL);
+    gtk_box_pack_start(GTK_BOX(vbox), table, FALSE, FALSE, 0);
+
+    hbox = gtk_hbox_new(FALSE, 4);
+    combo = gtk_combo_box_text_new();
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), "All");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), "Red");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), "Green");
+    gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(combo), "Blue");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(combo), 0);
+    g_signal_connect(combo, "changed", G_CALLBACK(channelChosen), NULL);
+    gtk_box_pack_start(GTK_BOX(hbox), combo, FALSE, FALSE, 0);
+    reset = gtk_button_new_with_mnemonic("_Reset");
+    g_signal_connect(reset, "clicked", G_CALLBACK(resetLevels), NULL);
+    gtk_box_pack_end(GTK_BOX(hbox), reset, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
+
+    showChannel();
+}
+
+void
+levelsToggle(GtkWindow *parent, GdkPixbuf *pixbuf,
+	     void (*changedFn)(gpointer data), gpointer data)
+{
+    changed = changedFn;
+    changedData = data;
+    if (window == NULL) makeWindow(parent);
+    if (gtk_widget_get_visible(window)) {
+	gtk_widget_hide(window);
+	return;
+    }
+    gtk_widget_show_all(window);
+    levelsSetSource(pixbuf);
+}
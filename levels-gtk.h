@@ -0,0 +1,14 @@
+/*
+ * levels-gtk.h: Interface to levels-gtk.c, the GTK viewers' window of
+ * black point, white point and gamma sliders and the histogram.
+ */
+
+/* Show the levels window over "parent", counting the histogram of "pixbuf",
+ * or hide it if it's showing. Whenever a slider moves, bandsSetLevels() is
+ * called with the new settings (see bands-gdk.h), then changed(data) so that
+ * the image can be scaled again. */
+extern void levelsToggle(GtkWindow *parent, GdkPixbuf *pixbuf,
+			 void (*changed)(gpointer data), gpointer data);
+
+/* Count the histogram of a new source image, if the window is showing */
+extern void levelsSetSource(GdkPixbuf *pixbuf);
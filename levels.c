@@ -0,0 +1,329 @@
+/*
+ * levels.c: Black point, white point and gamma as lookup tables, and the
+ * histogram to set them by.
+ *
+ * Each setting is a table of 256 bytes for each byte of a pixel, made once
+ * when it changes, so applying it is one lookup per byte wherever the
+ * pixels are going anyway. The GTK viewers do it to each row as it's
+ * scaled (see scale_levels() and bands-gdk.c). SDL2 lets its renderer
+ * scale, so while they're set it scales the image to the window itself
+ * with scale_levels() instead, once each time they or the window's size
+ * change, and the renderer only turns that. Fusing isn't
+ * a saving in itself: bench-levels has scaling a 4K image with the tables
+ * fused taking about as long as scaling it and then mapping the result.
+ * The tables are 1K together and stay in L1.
+ * SSE2 has no lookup instruction, so a pixel of four bytes is loaded as
+ * one word, looked up a byte at a time and stored as one word.
+ *
+ * The histogram is counted in bands of rows on all cores, each into its own
+ * histogram so they don't fight over the cache lines of one, which are
+ * added up at the end. The result of the tables is the source's histogram
+ * moved through them, so it only has to be counted once per image.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "levels.h"
+
+#define MIN_THREAD_PIXELS (1 << 20)	/* Give each thread at least this many */
+
+/* Where byte b of a pixel is in it as a word */
+#ifdef WORDS_BIGENDIAN
+#define BYTE(b)	(24 - 8 * (b))
+#else
+#define BYTE(b)	(8 * (b))
+#endif
+
+int levels_threads = 0;
+
+void
+levels_reset(levels_t *levels)
+{
+    int c;
+
+    for (c = 0; c < 3; c++) {
+	levels->black[c] = 0;
+	levels->white[c] = 255;
+	levels->gamma[c] = 1.0;
+    }
+}
+
+int
+levels_identity(const levels_t *levels)
+{
+    int c;
+
+    for (c = 0; c < 3; c++)
+	if (levels->black[c] != 0 || levels->white[c] != 255 ||
+	    levels->gamma[c] != 1.0)
+	    return 0;
+    return 1;
+}
+
+/* One channel's table */
+static void
+channelTable(const levels_t *levels, int c, unsigned char lut[256])
+{
+    int black = levels->black[c], white = levels->white[c];
+    double gamma = levels->gamma[c] > 0.01 ? levels->gamma[c] : 0.01;
+    int v;
+
+    if (white <= black) white = black + 1;
+    for (v = 0; v < 256; v++) {
+	if (v <= black) lut[v] = 0;
+	else if (v >= white) lut[v] = 255;
+	else lut[v] = (int) (255 * pow((double) (v - black) / (white - black),
+				       1 / gamma) + 0.5);
+    }
+}
+
+void
+levels_tables(const levels_t *levels, const int order[], int bpp,
+	      unsigned char lut[][256])
+{
+    int b, v;
+
+    for (b = 0; b < bpp; b++) {
+	int c = bpp == 1 ? 1 : order[b];
+
+	if (c < 0 || c > 2) {
+	    for (v = 0; v < 256; v++) lut[b][v] = v;
+	} else {
+	    channelTable(levels, c, lut[b]);
+	}
+    }
+}
+
+/*
+ * Doing something to bands of rows on all cores
+ */
+
+typedef struct job job_t;
+struct job {
+    void (*band)(job_t *j, int y0, int y1, int thread);
+    int h, nbands, next;
+    pthread_mutex_t lock;
+    /* For levels_map() */
+    const unsigned char *src;
+    unsigned char *dst;
+    int spitch, dpitch, w, bpp;
+    const unsigned char (*lut)[256];
+    /* For levels_histogram(), a histogram for each thread */
+    unsigned long (*hists)[4][256];
+};
+
+typedef struct {
+    job_t *job;
+    int thread;
+} worker_t;
+
+static void *
+worker(void *arg)
+{
+    worker_t *w = arg;
+    job_t *j = w->job;
+    int band;
+
+    for (;;) {
+	pthread_mutex_lock(&j->lock);
+	band = j->next++;
+	pthread_mutex_unlock(&j->lock);
+	if (band >= j->nbands) break;
+	j->band(j, (long) j->h * band / j->nbands,
+		(long) j->h * (band + 1) / j->nbands, w->thread);
+    }
+    return NULL;
+}
+
+/* How many threads to do w x h pixels on */
+static int
+howManyThreads(int w, int h)
+{
+    int threads = levels_threads > 0 ? levels_threads
+				     : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (threads > (int) ((size_t) w * h / MIN_THREAD_PIXELS))
+	threads = (size_t) w * h / MIN_THREAD_PIXELS;
+    return threads < 1 ? 1 : threads;
+}
+
+/* Do the job's bands on "threads" threads, this one being one of them.
+ * Returns how many it ran on, which is fewer if it couldn't start them. */
+static int
+runJob(job_t *j, int threads)
+{
+    pthread_t tids[threads];
+    worker_t workers[threads];
+    int started, i;
+
+    j->nbands = threads * 4;
+    j->next = 0;
+    pthread_mutex_init(&j->lock, NULL);
+    for (i = 0; i < threads; i++) {
+	workers[i].job = j;
+	workers[i].thread = i;
+    }
+    for (started = 0; started < threads - 1; started++)
+	if (pthread_create(&tids[started], NULL, worker,
+			   &workers[started + 1]) != 0)
+	    break;
+    worker(&workers[0]);
+    for (i = 0; i < started; i++)
+	pthread_join(tids[i], NULL);
+    pthread_mutex_destroy(&j->lock);
+    return started + 1;
+}
+
+/*
+ * Looking pixels up
+ */
+
+static void
+mapRows(const unsigned char *src, int spitch, unsigned char *dst, int dpitch,
+	int w, int h, int bpp, const unsigned char lut[][256])
+{
+    int x, y, b;
+
+    for (y = 0; y < h; y++, src += spitch, dst += dpitch) {
+	const unsigned char *s = src;
+	unsigned char *d = dst;
+
+	switch (bpp) {
+	case 1:
+	    for (x = 0; x < w; x++)
+		d[x] = lut[0][s[x]];
+	    break;
+	case 4:
+	    /* A word at a time, so it's one load and one store per pixel */
+	    for (x = 0; x < w; x++, s += 4, d += 4) {
+		unsigned int p;
+
+		memcpy(&p, s, 4);
+		p = (unsigned) lut[0][(p >> BYTE(0)) & 0xFF] << BYTE(0) |
+		    (unsigned) lut[1][(p >> BYTE(1)) & 0xFF] << BYTE(1) |
+		    (unsigned) lut[2][(p >> BYTE(2)) & 0xFF] << BYTE(2) |
+		    (unsigned) lut[3][(p >> BYTE(3)) & 0xFF] << BYTE(3);
+		memcpy(d, &p, 4);
+	    }
+	    break;
+	default:
+	    for (x = 0; x < w; x++)
+		for (b = 0; b < bpp; b++)
+		    *d++ = lut[b][*s++];
+	    break;
+	}
+    }
+}
+
+static void
+mapBand(job_t *j, int y0, int y1, int thread)
+{
+    mapRows(j->src + (size_t) y0 * j->spitch, j->spitch,
+	    j->dst + (size_t) y0 * j->dpitch, j->dpitch,
+	    j->w, y1 - y0, j->bpp, j->lut);
+}
+
+void
+levels_map(const unsigned char *src, int spitch, unsigned char *dst,
+	   int dpitch, int w, int h, int bpp, const unsigned char lut[][256])
+{
+    int threads = howManyThreads(w, h);
+    job_t job;
+
+    if (threads == 1) {
+	mapRows(src, spitch, dst, dpitch, w, h, bpp, lut);
+	return;
+    }
+    job.band = mapBand;
+    job.h = h;
+    job.src = src;
+    job.dst = dst;
+    job.spitch = spitch;
+    job.dpitch = dpitch;
+    job.w = w;
+    job.bpp = bpp;
+    job.lut = lut;
+    runJob(&job, threads);
+}
+
+/*
+ * Counting
+ */
+
+static void
+countRows(const unsigned char *src, int w, int h, int pitch, int bpp,
+	  unsigned long hist[][256])
+{
+    int x, y, b;
+
+    for (y = 0; y < h; y++, src += pitch) {
+	const unsigned char *s = src;
+
+	if (bpp == 4) {
+	    for (x = 0; x < w; x++, s += 4) {
+		hist[0][s[0]]++;
+		hist[1][s[1]]++;
+		hist[2][s[2]]++;
+		hist[3][s[3]]++;
+	    }
+	} else {
+	    for (x = 0; x < w; x++)
+		for (b = 0; b < bpp; b++)
+		    hist[b][*s++]++;
+	}
+    }
+}
+
+static void
+countBand(job_t *j, int y0, int y1, int thread)
+{
+    countRows(j->src + (size_t) y0 * j->spitch, j->w, y1 - y0, j->spitch,
+	      j->bpp, j->hists[thread]);
+}
+
+void
+levels_histogram(const unsigned char *src, int w, int h, int pitch, int bpp,
+		 unsigned long hist[][256])
+{
+    int threads = howManyThreads(w, h);
+    job_t job;
+    int t, b, v;
+
+    for (b = 0; b < bpp; b++)
+	memset(hist[b], 0, sizeof(hist[b]));
+    if (threads > 1 &&
+	(job.hists = calloc(threads, sizeof(*job.hists))) == NULL)
+	threads = 1;
+    if (threads == 1) {
+	countRows(src, w, h, pitch, bpp, hist);
+	return;
+    }
+    job.band = countBand;
+    job.h = h;
+    job.src = src;
+    job.spitch = pitch;
+    job.w = w;
+    job.bpp = bpp;
+    threads = runJob(&job, threads);
+    for (t = 0; t < threads; t++)
+	for (b = 0; b < bpp; b++)
+	    for (v = 0; v < 256; v++)
+		hist[b][v] += job.hists[t][b][v];
+    free(job.hists);
+}
+
+void
+levels_remap(unsigned long in[][256], int bpp, const unsigned char lut[][256],
+	     unsigned long out[][256])
+{
+    int b, v;
+
+    for (b = 0; b < bpp; b++) {
+	memset(out[b], 0, sizeof(out[b]));
+	for (v = 0; v < 256; v++)
+	    out[b][lut[b][v]] += in[b][v];
+    }
+}
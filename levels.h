@@ -0,0 +1,54 @@
+/*
+ * levels.h: Interface to levels.c, which makes the lookup tables for the
+ * viewers' black point, white point and gamma controls, applies them and
+ * counts the histogram they're set from.
+ */
+
+/* The settings for red, green and blue */
+typedef struct {
+    int black[3];		/* The value that becomes 0 */
+    int white[3];		/* and the one that becomes 255 */
+    double gamma[3];		/* Above 1 brightens the middle, below darkens */
+} levels_t;
+
+/* How many threads to count and look up big images on. 0, the default,
+ * means one per core. */
+extern int levels_threads;
+
+/* Set them to leave the image as it is */
+extern void levels_reset(levels_t *levels);
+
+/* Whether they leave the image as it is */
+extern int levels_identity(const levels_t *levels);
+
+/*
+ * Make the tables for pixels of "bpp" bytes, 1 to 4, in lut[byte][value].
+ * order[byte] says which channel each byte is: 0 red, 1 green, 2 blue or
+ * -1 for one that's left alone, like alpha. A gray byte takes green's.
+ */
+extern void levels_tables(const levels_t *levels, const int order[],
+			  int bpp, unsigned char lut[][256]);
+
+/*
+ * Look each byte of the "w" x "h" pixels at "src", "spitch" bytes per row,
+ * up in its table, into "dst" with "dpitch" bytes per row, which can be
+ * the same as "src".
+ */
+extern void levels_map(const unsigned char *src, int spitch,
+		       unsigned char *dst, int dpitch, int w, int h, int bpp,
+		       const unsigned char lut[][256]);
+
+/*
+ * Count how many of each value each byte of the pixels has, into
+ * hist[byte][value], on all cores.
+ */
+extern void levels_histogram(const unsigned char *src, int w, int h,
+			     int pitch, int bpp, unsigned long hist[][256]);
+
+/*
+ * What a histogram will be after the tables: out[byte][lut[byte][v]] gets
+ * in[byte][v]. Cheaper than counting the result, and the same.
+ */
+extern void levels_remap(unsigned long in[][256], int bpp,
+			 const unsigned char lut[][256],
+			 unsigned long out[][256]);
@@ -0,0 +1,539 @@
+/*
+ * loadjpeg.c: Read a JPEG file at a reduced resolution.
+ *
+ * libjpeg can decode at 1/2, 1/4 or 1/8 size by doing a smaller inverse DCT
+ * on each block, which takes much less time and memory than decoding at
+ * full size and then throwing most of the pixels away when we scale it down
+ * to fit the window. A 50-megapixel photo in a 1920x1080 window is decoded
+ * at 1/4 size, one sixteenth of the pixels.
+ *
+ * Big JPEGs with restart markers are decoded on several cores at once.
+ * A restart marker resets the DC predictors, so the data between two of them
+ * can be decoded on its own. If the restart interval is a whole number of
+ * rows of MCUs, we split the file into bands at restart markers and make
+ * each band into a little JPEG file of its own, with the original headers
+ * but with its height in the SOF marker and its restart markers renumbered
+ * from RST0. Each thread takes a band, decodes it with its own libjpeg and
+ * writes the pixels straight into its rows of the output buffer.
+ * Files without restart markers, progressive ones and any that confuse us
+ * are decoded on one core as usual.
+ * Smooth upsampling of subsampled chroma makes each row from the chroma
+ * rows above and below it too, so each band also decodes the restart
+ * interval either side of it, when there is one, and throws those rows away.
+ * The rows at the joins then come out exactly as they do on one core, for a
+ * band or two's worth more decoding in all.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <jpeglib.h>
+
+#include "loadjpeg.h"
+
+/* libjpeg's default error handler calls exit(), so we jump back instead */
+struct error_mgr {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+};
+
+static void
+errorExit(j_common_ptr cinfo)
+{
+    longjmp(((struct error_mgr *) cinfo->err)->jmp, 1);
+}
+
+/* Don't moan about slightly broken files on stderr */
+static void
+outputMessage(j_common_ptr cinfo)
+{
+}
+
+/* Open the file and read its header. Returns the FILE or NULL */
+static FILE *
+openJpeg(const char *filename, struct jpeg_decompress_struct *cinfo,
+	 struct error_mgr *jerr)
+{
+    FILE *fp;
+    int c1, c2;
+
+    if ((fp = fopen(filename, "rb")) == NULL) return NULL;
+
+    /* Don't give libjpeg other formats, which it would complain about */
+    c1 = getc(fp); c2 = getc(fp);
+    if (c1 != 0xFF || c2 != 0xD8) {
+	fclose(fp);
+	return NULL;
+    }
+    rewind(fp);
+
+    cinfo->err = jpeg_std_error(&jerr->pub);
+    jerr->pub.error_exit = errorExit;
+    jerr->pub.output_message = outputMessage;
+    jpeg_create_decompress(cinfo);
+    jpeg_stdio_src(cinfo, fp);
+
+    return fp;
+}
+
+int
+loadjpeg_size(const char *filename, int *w, int *h)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct error_mgr jerr;
+    FILE *fp;
+
+    if ((fp = openJpeg(filename, &cinfo, &jerr)) == NULL) return -1;
+    if (setjmp(jerr.jmp)) {
+	jpeg_destroy_decompress(&cinfo);
+	fclose(fp);
+	return -1;
+    }
+    jpeg_read_header(&cinfo, TRUE);
+    *w = cinfo.image_width;
+    *h = cinfo.image_height;
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+
+    return 0;
+}
+
+int loadjpeg_threads = 0;
+
+/* Choose the output color space. Returns -1 if it's one we don't handle. */
+static int
+setColorSpace(struct jpeg_decompress_struct *cinfo)
+{
+    /* We do RGB from YCbCr or RGB, and grayscale, which we expand below.
+     * Leave CMYK and the like to the toolkit's loader. */
+    switch (cinfo->jpeg_color_space) {
+    case JCS_GRAYSCALE:
+	cinfo->out_color_space = JCS_GRAYSCALE;
+	return 0;
+    case JCS_YCbCr:
+    case JCS_RGB:
+	cinfo->out_color_space = JCS_RGB;
+	return 0;
+    default:
+	return -1;
+    }
+}
+
+/* Decode the rows into "pixels", whose rows are "stride" bytes apart,
+ * as gray levels if bpp is 1, or expanded to RGB if it's 3. The first
+ * "skip" rows are decoded into "scratch" and thrown away, and it stops
+ * after "rows" more. */
+static void
+readRows(struct jpeg_decompress_struct *cinfo, unsigned char *pixels,
+	 size_t stride, int bpp, int skip, int rows, unsigned char *scratch)
+{
+    while (cinfo->output_scanline < cinfo->output_height &&
+	   (int) cinfo->output_scanline < skip + rows) {
+	int y = (int) cinfo->output_scanline - skip;
+	JSAMPROW row = y >= 0 ? pixels + y * stride : scratch;
+
+	jpeg_read_scanlines(cinfo, &row, 1);
+	if (cinfo->out_color_space == JCS_GRAYSCALE && bpp == 3) {
+	    /* Spread it out from the left half, right to left */
+	    int x;
+
+	    for (x = cinfo->output_width - 1; x >= 0; x--)
+		row[x * 3] = row[x * 3 + 1] = row[x * 3 + 2] = row[x];
+	}
+    }
+}
+
+/*
+ * Multi-threaded decoding
+ */
+
+/* One band of the image, as a JPEG file of its own */
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    int row;		/* Where its first row goes in the output */
+    int skip;		/* How many rows above that it decodes for context */
+    int rows;		/* and how many it gives */
+} band_t;
+
+/* What the threads share */
+typedef struct {
+    band_t *bands;
+    int nbands;
+    int next;		/* The next band that needs decoding */
+    J_COLOR_SPACE colorSpace;
+    unsigned int denom;
+    unsigned char *pixels;
+    int width, height;	/* of the output */
+    int bpp;		/* Bytes per pixel of the output */
+    int failed;
+} job_t;
+
+/* Where the entropy-coded data between two restart markers is in the file */
+typedef struct {
+    size_t start, end;
+} interval_t;
+
+static int
+getMarkerLength(const unsigned char *file, size_t len, size_t pos)
+{
+    return (pos + 4 <= len) ? (file[pos + 2] << 8) | file[pos + 3] : -1;
+}
+
+/* Split the file into bands. cinfo has read its header.
+ * Returns the bands and sets *nbands, or returns NULL if we can't. */
+static band_t *
+makeBands(const unsigned char *file, size_t len,
+	  struct jpeg_decompress_struct *cinfo, int wanted, int *nbands)
+{
+    size_t pos, sof = 0, headerLen = 0;
+    interval_t *intervals = NULL;
+    int nintervals = 0, maxIntervals = 0;
+    int mcuWidth, mcuHeight, mcusPerRow, mcuRows, rowsPerInterval;
+    int context;	/* Intervals to decode either side of each band */
+    int outputHeight;
+    band_t *bands;
+    int b;
+
+    /* Only one component, or all of them interleaved in the one scan */
+    if (cinfo->num_components == 1) {
+	mcuWidth = mcuHeight = DCTSIZE;
+    } else if (cinfo->comps_in_scan == cinfo->num_components) {
+	mcuWidth = cinfo->max_h_samp_factor * DCTSIZE;
+	mcuHeight = cinfo->max_v_samp_factor * DCTSIZE;
+    } else {
+	return NULL;
+    }
+    mcusPerRow = (cinfo->image_width + mcuWidth - 1) / mcuWidth;
+    mcuRows = (cinfo->image_height + mcuHeight - 1) / mcuHeight;
+    if (cinfo->restart_interval % mcusPerRow != 0) return NULL;
+    rowsPerInterval = cinfo->restart_interval / mcusPerRow;
+    context = cinfo->num_components > 1 && cinfo->max_v_samp_factor > 1 &&
+	      cinfo->do_fancy_upsampling;
+    outputHeight = (cinfo->image_height + cinfo->scale_denom - 1) /
+		   cinfo->scale_denom;
+
+    /* Find the SOF marker and the end of the SOS marker */
+    for (pos = 2; pos + 1 < len; ) {
+	int marker, mlen;
+
+	if (file[pos] != 0xFF) return NULL;
+	if ((marker = file[pos + 1]) == 0xFF) { pos++; continue; }
+	if ((mlen = getMarkerLength(file, len, pos)) < 2) return NULL;
+	if (marker == 0xC0 || marker == 0xC1) {
+	    sof = pos;
+	} else if (marker >= 0xC2 && marker <= 0xCF &&
+		   marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+	    return NULL;	/* Progressive, lossless or arithmetic */
+	}
+	pos += 2 + mlen;
+	if (marker == 0xDA) {
+	    headerLen = pos;
+	    break;
+	}
+    }
+    if (sof == 0 || headerLen == 0 || headerLen > len) return NULL;
+
+    /* Find the restart markers in the entropy-coded data */
+    for (pos = headerLen; ; ) {
+	size_t start = pos;
+	int marker = -1;
+
+	while (pos + 1 < len) {
+	    if (file[pos] == 0xFF && file[pos + 1] != 0x00 &&
+		file[pos + 1] != 0xFF) {
+		marker = file[pos + 1];
+		break;
+	    }
+	    pos++;
+	}
+	if (marker != 0xD9 && (marker < 0xD0 || marker > 0xD7)) {
+	    free(intervals);	/* Truncated, or a DNL or another scan */
+	    return NULL;
+	}
+	if (nintervals == maxIntervals) {
+	    interval_t *more;
+
+	    maxIntervals = maxIntervals ? maxIntervals * 2 : 256;
+	    if ((more = realloc(intervals, maxIntervals * sizeof(*more)))
+		== NULL) {
+		free(intervals);
+		return NULL;
+	    }
+	    intervals = more;
+	}
+	intervals[nintervals].start = start;
+	intervals[nintervals].end = pos;
+	nintervals++;
+	pos += 2;
+	if (marker == 0xD9) break;
+    }
+    if (nintervals != (mcuRows + rowsPerInterval - 1) / rowsPerInterval ||
+	nintervals < 2) {
+	free(intervals);
+	return NULL;
+    }
+
+    if (wanted > nintervals) wanted = nintervals;
+    if ((bands = calloc(wanted, sizeof(*bands))) == NULL) {
+	free(intervals);
+	return NULL;
+    }
+    for (b = 0; b < wanted; b++) {
+	int first = b * nintervals / wanted;
+	int last = (b + 1) * nintervals / wanted;	/* One past the end */
+	/* With the context either side */
+	int from = first - context >= 0 ? first - context : 0;
+	int to = last + context <= nintervals ? last + context : nintervals;
+	int top = from * rowsPerInterval * mcuHeight;	/* in pixels */
+	int height = (to - from) * rowsPerInterval * mcuHeight;
+	unsigned char *p;
+	size_t size = headerLen + 2;
+	int i;
+
+	if (top + height > (int) cinfo->image_height)
+	    height = cinfo->image_height - top;
+	for (i = from; i < to; i++)
+	    size += intervals[i].end - intervals[i].start + 2;
+
+	if ((p = bands[b].data = malloc(size)) == NULL) {
+	    while (b-- > 0) free(bands[b].data);
+	    free(bands);
+	    free(intervals);
+	    return NULL;
+	}
+	memcpy(p, file, headerLen);
+	p[sof + 5] = height >> 8;
+	p[sof + 6] = height & 0xFF;
+	p += headerLen;
+	for (i = from; i < to; i++) {
+	    if (i > from) {
+		*p++ = 0xFF;
+		*p++ = 0xD0 + ((i - from - 1) & 7);
+	    }
+	    memcpy(p, file + intervals[i].start,
+		   intervals[i].end - intervals[i].start);
+	    p += intervals[i].end - intervals[i].start;
+	}
+	*p++ = 0xFF;
+	*p++ = 0xD9;
+	bands[b].len = p - bands[b].data;
+	/* The bands' tops are multiples of 8 so these are exact */
+	bands[b].row = first * rowsPerInterval * mcuHeight /
+		       cinfo->scale_denom;
+	bands[b].skip = (first - from) * rowsPerInterval * mcuHeight /
+			cinfo->scale_denom;
+    }
+    for (b = 0; b < wanted; b++)
+	bands[b].rows = (b + 1 < wanted ? bands[b + 1].row : outputHeight) -
+			bands[b].row;
+    free(intervals);
+
+    *nbands = wanted;
+    return bands;
+}
+
+/* Decode one band into its rows of the output. Returns 0 or -1 */
+static int
+decodeBand(job_t *job, band_t *band)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct error_mgr jerr;
+    size_t stride = (size_t) job->width * job->bpp;
+    unsigned char * volatile scratch = NULL;	/* For the context rows */
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = errorExit;
+    jerr.pub.output_message = outputMessage;
+    jpeg_create_decompress(&cinfo);
+    if (setjmp(jerr.jmp)) {
+	jpeg_destroy_decompress(&cinfo);
+	free(scratch);
+	return -1;
+    }
+    jpeg_mem_src(&cinfo, band->data, band->len);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = job->colorSpace;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = job->denom;
+    jpeg_start_decompress(&cinfo);
+    if ((int) cinfo.output_width != job->width ||
+	band->skip + band->rows > (int) cinfo.output_height ||
+	band->row + band->rows > job->height ||
+	(scratch = malloc(stride)) == NULL)
+	longjmp(jerr.jmp, 1);
+    readRows(&cinfo, job->pixels + band->row * stride, stride, job->bpp,
+	     band->skip, band->rows, scratch);
+    /* It stops before the context below, so don't finish, just drop it */
+    jpeg_destroy_decompress(&cinfo);
+    free(scratch);
+
+    return 0;
+}
+
+static void *
+worker(void *arg)
+{
+    job_t *job = arg;
+    int b;
+
+    while ((b = __sync_fetch_and_add(&job->next, 1)) < job->nbands)
+	if (decodeBand(job, &job->bands[b]) < 0)
+	    job->failed = 1;
+
+    return NULL;
+}
+
+/* Decode the file on "threads" cores. cinfo has read its header and had its
+ * output color space and scale set. Returns the pixels or NULL if it can't. */
+static unsigned char *
+decodeParallel(FILE *fp, struct jpeg_decompress_struct *cinfo, int threads,
+	       int bpp)
+{
+    unsigned char *file;
+    long len;
+    job_t job;
+    pthread_t *tids;
+    int i, started;
+
+    /* Read the whole file */
+    if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) <= 0) return NULL;
+    if ((file = malloc(len)) == NULL) return NULL;
+    rewind(fp);
+    if (fread(file, 1, len, fp) != (size_t) len) {
+	free(file);
+	return NULL;
+    }
+
+    job.bands = makeBands(file, len, cinfo, threads * 4, &job.nbands);
+    free(file);
+    if (job.bands == NULL) return NULL;
+
+    jpeg_calc_output_dimensions(cinfo);
+    job.next = 0;
+    job.colorSpace = cinfo->out_color_space;
+    job.denom = cinfo->scale_denom;
+    job.width = cinfo->output_width;
+    job.height = cinfo->output_height;
+    job.bpp = bpp;
+    job.failed = 0;
+    job.pixels = malloc((size_t) job.width * bpp * job.height);
+    tids = malloc(threads * sizeof(*tids));
+
+    if (job.pixels != NULL && tids != NULL) {
+	/* This thread decodes too */
+	for (started = 0; started < threads - 1; started++)
+	    if (pthread_create(&tids[started], NULL, worker, &job) != 0)
+		break;
+	worker(&job);
+	for (i = 0; i < started; i++)
+	    pthread_join(tids[i], NULL);
+    } else {
+	job.failed = 1;
+    }
+
+    for (i = 0; i < job.nbands; i++) free(job.bands[i].data);
+    free(job.bands);
+    free(tids);
+    if (job.failed) {
+	free(job.pixels);
+	return NULL;
+    }
+    return job.pixels;
+}
+
+/* Decode it on "threads" threads, or as loadjpeg_threads says if that's 0,
+ * leaving gray as gray if "keepGray" is set */
+static unsigned char *
+decode(const char *filename, int minw, int minh, int *w, int *h, int *denom,
+       int *bpp, int keepGray, int threads)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct error_mgr jerr;
+    FILE *fp;
+    unsigned char * volatile pixels = NULL;
+    size_t stride;
+
+    if ((fp = openJpeg(filename, &cinfo, &jerr)) == NULL) return NULL;
+    if (setjmp(jerr.jmp)) {
+	jpeg_destroy_decompress(&cinfo);
+	fclose(fp);
+	free(pixels);
+	return NULL;
+    }
+    jpeg_read_header(&cinfo, TRUE);
+    if (setColorSpace(&cinfo) < 0) longjmp(jerr.jmp, 1);
+    *bpp = (cinfo.out_color_space == JCS_GRAYSCALE && keepGray) ? 1 : 3;
+
+    /* Find the smallest size that's still at least minw x minh */
+    cinfo.scale_num = 1;
+    for (cinfo.scale_denom = 8; cinfo.scale_denom > 1; cinfo.scale_denom /= 2)
+	if ((cinfo.image_width + cinfo.scale_denom - 1) / cinfo.scale_denom
+		>= (unsigned) minw &&
+	    (cinfo.image_height + cinfo.scale_denom - 1) / cinfo.scale_denom
+		>= (unsigned) minh)
+	    break;
+
+    /* If it has restart markers, try doing it on all cores */
+    if (threads <= 0)
+	threads = loadjpeg_threads > 0 ? loadjpeg_threads
+				       : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > 1 && cinfo.restart_interval > 0 && !cinfo.progressive_mode) {
+	/* That reads the file, so put it back where libjpeg had got to */
+	long readPos = ftell(fp);
+
+	if ((pixels = decodeParallel(fp, &cinfo, threads, *bpp)) != NULL) {
+	    *w = cinfo.output_width;
+	    *h = cinfo.output_height;
+	    *denom = cinfo.scale_denom;
+	    jpeg_destroy_decompress(&cinfo);
+	    fclose(fp);
+	    return pixels;
+	}
+	fseek(fp, readPos, SEEK_SET);
+    }
+
+    jpeg_start_decompress(&cinfo);
+
+    stride = (size_t) cinfo.output_width * *bpp;
+    if ((pixels = malloc(stride * cinfo.output_height)) == NULL)
+	longjmp(jerr.jmp, 1);
+    readRows(&cinfo, pixels, stride, *bpp, 0, cinfo.output_height, NULL);
+
+    *w = cinfo.output_width;
+    *h = cinfo.output_height;
+    *denom = cinfo.scale_denom;
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+
+    return pixels;
+}
+
+unsigned char *
+loadjpeg(const char *filename, int minw, int minh, int *w, int *h, int *denom)
+{
+    int bpp;
+
+    return decode(filename, minw, minh, w, h, denom, &bpp, 0, 0);
+}
+
+unsigned char *
+loadjpeg_with_threads(const char *filename, int minw, int minh,
+		      int *w, int *h, int *denom, int threads)
+{
+    int bpp;
+
+    return decode(filename, minw, minh, w, h, denom, &bpp, 0, threads);
+}
+
+unsigned char *
+loadjpeg_native(const char *filename, int minw, int minh,
+		int *w, int *h, int *denom, int *bpp)
+{
+    return decode(filename, minw, minh, w, h, denom, bpp, 1, 0);
+}
@@ -0,0 +1,31 @@
+/*
+ * loadjpeg.h: Interface to loadjpeg.c, which reads JPEG files at reduced
+ * resolution when we don't need all of their pixels.
+ */
+
+/* How many threads to decode JPEGs with restart markers on.
+ * 0, the default, means one per core. */
+extern int loadjpeg_threads;
+
+/* Get the size of the image in a JPEG file without decoding it.
+ * Returns 0 on success or -1 if it isn't a JPEG file we can read. */
+extern int loadjpeg_size(const char *filename, int *w, int *h);
+
+/* Decode a JPEG file at the smallest of 1/1, 1/2, 1/4 or 1/8 scale that is
+ * at least minw x minh, or at full size if that is smaller.
+ * Returns a malloc()ed buffer of *w x *h pixels of 3 bytes, R, G and B,
+ * with no gaps between the rows, and sets *denom to the denominator used.
+ * Returns NULL if it isn't a JPEG file we can read. */
+extern unsigned char *loadjpeg(const char *filename, int minw, int minh,
+			       int *w, int *h, int *denom);
+
+/* The same on at most "threads" threads, whatever loadjpeg_threads says,
+ * for callers that are already running one decode per core. */
+extern unsigned char *loadjpeg_with_threads(const char *filename,
+					    int minw, int minh, int *w, int *h,
+					    int *denom, int threads);
+
+/* The same as loadjpeg(), except that grayscale JPEGs are left as 1 byte per pixel.
+ * Sets *bpp to 1 for those or 3 for RGB ones. */
+extern unsigned char *loadjpeg_native(const char *filename, int minw, int minh,
+				      int *w, int *h, int *denom, int *bpp);
@@ -0,0 +1,100 @@
+/*
+ * pixcache-gdk.c: gdk_pixbuf_new_from_file() through the pixel cache.
+ *
+ * On a hit, the pixbuf's pixels are the cache entry's, mapped straight
+ * from the file, and the mapping goes away when the pixbuf does.
+ * On a miss, the image is decoded as usual and the result put in the cache
+ * for next time.
+ * Images read at a reduced size to fit a memory budget are cached by size.
+ * If $IMAGE_SERVER is set, full-size JPEGs come from imgserver first, which
+ * decodes each one once for all the viewers showing it (see imgclient.c),
+ * and the pixbuf's pixels are its shared memory.
+ */
+
+#include <stdio.h>
+#include <limits.h>
+#include <math.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "pixcache.h"
+#include "pixcache-gdk.h"
+#include "imgclient.h"
+
+static void
+releasePixels(guchar *pixels, gpointer data)
+{
+    pixcache_release(data);
+}
+
+static void
+releaseServed(guchar *pixels, gpointer data)
+{
+    imgclient_release(data);
+}
+
+GdkPixbuf *
+cachedPixbufNewFromFile(const char *filename, gsize maxBytes, GError **error)
+{
+    pixcache_t *pc;
+    imgclient_t *served;
+    GdkPixbuf *pixbuf;
+    char variant[32] = "gdk";
+    gint w, h;
+
+    /* Will it fit? If not, what size will? */
+    if (maxBytes > 0 && gdk_pixbuf_get_file_info(filename, &w, &h) != NULL &&
+	(guint64) w * h * 4 > maxBytes) {
+	double shrink = sqrt((double) maxBytes / ((double) w * h * 4));
+
+	w = MAX(1, w * shrink);
+	h = MAX(1, h * shrink);
+	sprintf(variant, "gdk/%dx%d", w, h);
+    } else {
+	w = h = 0;
+    }
+
+    /* Another viewer may have had the server decode it already.
+     * Gray ones would need converting, so we decode those ourselves. */
+    if (w == 0 &&
+	(served = imgclient_get(filename, INT_MAX, INT_MAX)) != NULL) {
+	if (served->bpp == 3) {
+	    pixbuf = gdk_pixbuf_new_from_data(served->pixels,
+					      GDK_COLORSPACE_RGB, FALSE, 8,
+					      served->width, served->height,
+					      served->stride,
+					      releaseServed, served);
+	    if (pixbuf != NULL) return pixbuf;
+	}
+	imgclient_release(served);
+    }
+
+    pc = pixcache_get(filename, variant);
+    if (pc != NULL) {
+	if (pc->bpp == 3 || pc->bpp == 4) {
+	    pixbuf = gdk_pixbuf_new_from_data(pc->pixels, GDK_COLORSPACE_RGB,
+					      pc->bpp == 4, 8,
+					      pc->width, pc->height, pc->stride,
+					      releasePixels, pc);
+	    if (pixbuf != NULL) return pixbuf;
+	}
+	pixcache_release(pc);
+    }
+
+    if (w > 0)
+	pixbuf = gdk_pixbuf_new_from_file_at_scale(filename, w, h, FALSE, error);
+    else
+	pixbuf = gdk_pixbuf_new_from_file(filename, error);
+    if (pixbuf != NULL &&
+	gdk_pixbuf_get_colorspace(pixbuf) == GDK_COLORSPACE_RGB &&
+	gdk_pixbuf_get_bits_per_sample(pixbuf) == 8) {
+	int bpp = gdk_pixbuf_get_n_channels(pixbuf);
+
+	/* The masks say where R, G, B and A are in a little-endian word */
+	pixcache_put(filename, variant, gdk_pixbuf_get_pixels(pixbuf),
+		     gdk_pixbuf_get_width(pixbuf),
+		     gdk_pixbuf_get_height(pixbuf),
+		     gdk_pixbuf_get_rowstride(pixbuf), bpp,
+		     0xff, 0xff00, 0xff0000, bpp == 4 ? 0xff000000 : 0);
+    }
+    return pixbuf;
+}
@@ -0,0 +1,10 @@
+/*
+ * pixcache-gdk.h: Interface to pixcache-gdk.c, which gives GTK viewers
+ * their decoded images from the pixel cache when it has them.
+ */
+
+/* Like gdk_pixbuf_new_from_file() but, if maxBytes isn't 0 and the image
+ * would take more than that at 4 bytes per pixel, it is read at a reduced
+ * size that fits, keeping its aspect ratio. */
+extern GdkPixbuf *cachedPixbufNewFromFile(const char *filename,
+					  gsize maxBytes, GError **error);
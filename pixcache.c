@@ -0,0 +1,381 @@
+/*
+ * pixcache.c: A cache of decoded images on disk, so that opening the same
+ * file again just maps the pixels into memory instead of decoding it.
+ *
+ * Each entry is one file in $XDG_CACHE_HOME/image (or ~/.cache/image)
+ * named after a hash of the image's full pathname and the variant.
+ * It starts with a header giving the image's size, mtime and a hash of its
+ * contents, which must all still match for the entry to be used, then the
+ * key it was made for, then the pixels, 64-byte aligned, in whatever layout
+ * the viewer gave us so that it can use them where they are.
+ *
+ * Entries are written to a temporary file and renamed into place, so
+ * nobody ever sees half a file. Using an entry touches its mtime, and after
+ * writing one, the oldest are deleted until the cache is under its size limit,
+ * $IMAGE_CACHE_MB megabytes (default 512). IMAGE_CACHE_MB=0 turns it off.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pixcache.h"
+
+#define MAGIC "imgpix1"
+#define DEFAULT_MB 512
+#define ALIGN 64
+
+typedef struct {
+    char magic[8];
+    uint64_t fileSize;		/* of the image file */
+    int64_t mtimeSec, mtimeNsec;
+    uint64_t contentHash;
+    uint32_t width, height, stride, bpp;
+    uint32_t rmask, gmask, bmask, amask;
+    uint32_t keyLen;		/* Length of the key that follows, with NUL */
+    uint32_t dataOffset;	/* Where the pixels start in the entry */
+} header_t;
+
+/* The hash of the last image file we looked at, so that a miss followed by
+ * a put of the same file only reads it once. The viewers' decode threads
+ * use the cache too, so it's only looked at or changed with "lastLock". */
+static struct {
+    char path[PATH_MAX];
+    struct stat st;
+    uint64_t hash;
+} last;
+static pthread_mutex_t lastLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The cache size limit in bytes, 0 if the cache is off */
+static long long
+limit(void)
+{
+    const char *mb = getenv("IMAGE_CACHE_MB");
+
+    return (mb ? atoll(mb) : DEFAULT_MB) * 1024 * 1024;
+}
+
+/* Put the cache directory's name in dir, making it if necessary.
+ * Returns 0 or -1 if there isn't one. */
+static int
+cacheDir(char *dir)
+{
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (xdg && *xdg) {
+	snprintf(dir, PATH_MAX, "%s", xdg);
+    } else if (home && *home) {
+	snprintf(dir, PATH_MAX, "%s/.cache", home);
+    } else {
+	return -1;
+    }
+    mkdir(dir, 0700);
+    strncat(dir, "/image", PATH_MAX - strlen(dir) - 1);
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) return -1;
+    return 0;
+}
+
+/* FNV-1a, for the entry's name */
+static uint64_t
+hashString(uint64_t h, const char *s)
+{
+    do {
+	h = (h ^ (unsigned char) *s) * 0x100000001b3ULL;
+    } while (*s++);
+    return h;
+}
+
+/* A quick hash of the image file's contents, eight bytes at a time.
+ * It isn't cryptographic; it's there to notice files that have been
+ * rewritten without changing their size or mtime. */
+static int
+hashFile(const char *path, const struct stat *st, uint64_t *hashp)
+{
+    const unsigned char *p;
+    uint64_t h = 0xcbf29ce484222325ULL ^ st->st_size, w;
+    size_t i, n = st->st_size;
+    int fd, known;
+
+    pthread_mutex_lock(&lastLock);
+    known = last.path[0] && strcmp(last.path, path) == 0 &&
+	    last.st.st_size == st->st_size &&
+	    last.st.st_mtim.tv_sec == st->st_mtim.tv_sec &&
+	    last.st.st_mtim.tv_nsec == st->st_mtim.tv_nsec &&
+	    last.st.st_ino == st->st_ino;
+    if (known) *hashp = last.hash;
+    pthread_mutex_unlock(&lastLock);
+    if (known) return 0;
+
+    if (n > 0) {
+	if ((fd = open(path, O_RDONLY)) < 0) return -1;
+	p = mmap(NULL, n, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return -1;
+	madvise((void *) p, n, MADV_SEQUENTIAL);
+	for (i = 0; i + 8 <= n; i += 8) {
+	    memcpy(&w, p + i, 8);
+	    h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+	    h ^= h >> 29;
+	}
+	for (; i < n; i++)
+	    h = (h ^ p[i]) * 0x100000001b3ULL;
+	munmap((void *) p, n);
+    }
+
+    pthread_mutex_lock(&lastLock);
+    snprintf(last.path, sizeof(last.path), "%s", path);
+    last.st = *st;
+    last.hash = h;
+    pthread_mutex_unlock(&lastLock);
+    *hashp = h;
+    return 0;
+}
+
+/* How many bytes of pixels there are. The last row may not be padded
+ * out to the stride, as in a GdkPixbuf. */
+static uint64_t
+dataSize(uint64_t width, uint64_t height, uint64_t stride, uint64_t bpp)
+{
+    return stride * (height - 1) + width * bpp;
+}
+
+/* Work out the image's full pathname and its cache entry's name.
+ * Returns 0, or -1 if there's no cache or no image. */
+static int
+entryName(const char *filename, const char *variant,
+	  char *path, struct stat *st, char *entry)
+{
+    char dir[PATH_MAX];
+
+    if (limit() <= 0) return -1;
+    if (realpath(filename, path) == NULL || stat(path, st) != 0 ||
+	!S_ISREG(st->st_mode) || cacheDir(dir) != 0)
+	return -1;
+    snprintf(entry, PATH_MAX, "%s/%016llx.pix", dir, (unsigned long long)
+	     hashString(hashString(0xcbf29ce484222325ULL, path), variant));
+    return 0;
+}
+
+pixcache_t *
+pixcache_get(const char *filename, const char *variant)
+{
+    char path[PATH_MAX], entry[PATH_MAX];
+    struct stat st, est;
+    const header_t *hdr;
+    const char *key;
+    pixcache_t *pc;
+    uint64_t hash;
+    void *map;
+    int fd;
+
+    if (entryName(filename, variant, path, &st, entry) != 0) return NULL;
+    if ((fd = open(entry, O_RDONLY)) < 0) return NULL;
+    if (fstat(fd, &est) != 0 || est.st_size < (off_t) sizeof(header_t)) {
+	close(fd);
+	return NULL;
+    }
+    /* Private and writable so that callers that modify the pixels in place
+     * get their own copy of the pages they touch, not a SIGSEGV. */
+    map = mmap(NULL, est.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+	close(fd);
+	return NULL;
+    }
+    hdr = map;
+    key = (const char *) (hdr + 1);
+
+    if (memcmp(hdr->magic, MAGIC, sizeof(hdr->magic)) != 0 ||
+	hdr->keyLen == 0 || sizeof(header_t) + hdr->keyLen > hdr->dataOffset ||
+	hdr->height == 0 || hdr->dataOffset + dataSize(hdr->width,
+	    hdr->height, hdr->stride, hdr->bpp) > (uint64_t) est.st_size ||
+	key[hdr->keyLen - 1] != '\0' ||
+	strcmp(key, path) != 0 ||
+	strcmp(key + strlen(key) + 1, variant) != 0) {
+	/* Someone else's, by a hash collision, or corrupt */
+	goto miss;
+    }
+    if (hdr->fileSize != (uint64_t) st.st_size ||
+	hdr->mtimeSec != st.st_mtim.tv_sec ||
+	hdr->mtimeNsec != st.st_mtim.tv_nsec ||
+	hashFile(path, &st, &hash) != 0 || hdr->contentHash != hash) {
+	/* The image has changed since it was cached */
+	unlink(entry);
+	goto miss;
+    }
+
+    if ((pc = malloc(sizeof(*pc))) == NULL) goto miss;
+    pc->pixels = (unsigned char *) map + hdr->dataOffset;
+    pc->width = hdr->width;
+    pc->height = hdr->height;
+    pc->stride = hdr->stride;
+    pc->bpp = hdr->bpp;
+    pc->rmask = hdr->rmask;
+    pc->gmask = hdr->gmask;
+    pc->bmask = hdr->bmask;
+    pc->amask = hdr->amask;
+    pc->map = map;
+    pc->mapLen = est.st_size;
+
+    /* Touch it so that it's the last to be evicted */
+    futimens(fd, NULL);
+    close(fd);
+    return pc;
+
+miss:
+    munmap(map, est.st_size);
+    close(fd);
+    return NULL;
+}
+
+void
+pixcache_release(pixcache_t *pc)
+{
+    if (pc == NULL) return;
+    munmap(pc->map, pc->mapLen);
+    free(pc);
+}
+
+/* Write all of a buffer, or fail */
+static int
+writeAll(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    ssize_t done;
+
+    while (n > 0) {
+	if ((done = write(fd, p, n)) < 0) {
+	    if (errno == EINTR) continue;
+	    return -1;
+	}
+	p += done;
+	n -= done;
+    }
+    return 0;
+}
+
+typedef struct {
+    char name[NAME_MAX + 1];
+    off_t size;
+    struct timespec mtime;
+} file_t;
+
+static int
+olderFirst(const void *a, const void *b)
+{
+    const struct timespec *ta = &((const file_t *) a)->mtime;
+    const struct timespec *tb = &((const file_t *) b)->mtime;
+
+    if (ta->tv_sec != tb->tv_sec) return ta->tv_sec < tb->tv_sec ? -1 : 1;
+    if (ta->tv_nsec != tb->tv_nsec) return ta->tv_nsec < tb->tv_nsec ? -1 : 1;
+    return 0;
+}
+
+/* Delete the least recently used entries until the cache fits in its limit.
+ * Temporary files left by writers that died count too, and being old,
+ * they go first. */
+static void
+evict(const char *dir)
+{
+    long long total = 0, max = limit();
+    file_t *files = NULL, *more;
+    int nfiles = 0, allocated = 0, i;
+    char path[PATH_MAX + NAME_MAX + 2];
+    struct dirent *de;
+    struct stat st;
+    DIR *d;
+
+    if ((d = opendir(dir)) == NULL) return;
+    while ((de = readdir(d)) != NULL) {
+	if (de->d_name[0] == '.') continue;
+	if (fstatat(dirfd(d), de->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode))
+	    continue;
+	if (nfiles == allocated) {
+	    allocated = allocated ? allocated * 2 : 64;
+	    if ((more = realloc(files, allocated * sizeof(*files))) == NULL)
+		break;
+	    files = more;
+	}
+	snprintf(files[nfiles].name, sizeof(files[nfiles].name), "%s",
+		 de->d_name);
+	files[nfiles].size = st.st_blocks * 512;
+	files[nfiles].mtime = st.st_mtim;
+	total += files[nfiles].size;
+	nfiles++;
+    }
+    closedir(d);
+
+    if (total > max) {
+	qsort(files, nfiles, sizeof(*files), olderFirst);
+	for (i = 0; i < nfiles && total > max; i++) {
+	    snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+	    if (unlink(path) == 0) total -= files[i].size;
+	}
+    }
+    free(files);
+}
+
+int
+pixcache_put(const char *filename, const char *variant,
+	     const unsigned char *pixels, int width, int height,
+	     int stride, int bpp, uint32_t rmask, uint32_t gmask,
+	     uint32_t bmask, uint32_t amask)
+{
+    char path[PATH_MAX], entry[PATH_MAX], tmp[PATH_MAX + 8];
+    static const char zeroes[ALIGN];
+    size_t keyLen, pad;
+    struct stat st;
+    header_t hdr;
+    uint64_t hash;
+    int fd, bad;
+
+    if (entryName(filename, variant, path, &st, entry) != 0) return -1;
+    /* Don't bother with ones that would push everything else out */
+    if (width <= 0 || height <= 0 ||
+	dataSize(width, height, stride, bpp) > (uint64_t) limit() / 2)
+	return -1;
+    if (hashFile(path, &st, &hash) != 0) return -1;
+
+    keyLen = strlen(path) + 1 + strlen(variant) + 1;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MAGIC, sizeof(hdr.magic));
+    hdr.fileSize = st.st_size;
+    hdr.mtimeSec = st.st_mtim.tv_sec;
+    hdr.mtimeNsec = st.st_mtim.tv_nsec;
+    hdr.contentHash = hash;
+    hdr.width = width;
+    hdr.height = height;
+    hdr.stride = stride;
+    hdr.bpp = bpp;
+    hdr.rmask = rmask;
+    hdr.gmask = gmask;
+    hdr.bmask = bmask;
+    hdr.amask = amask;
+    hdr.keyLen = keyLen;
+    hdr.dataOffset = (sizeof(hdr) + keyLen + ALIGN - 1) / ALIGN * ALIGN;
+    pad = hdr.dataOffset - sizeof(hdr) - keyLen;
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", entry);
+    if ((fd = mkstemp(tmp)) < 0) return -1;
+    bad = writeAll(fd, &hdr, sizeof(hdr)) != 0 ||
+	  writeAll(fd, path, strlen(path) + 1) != 0 ||
+	  writeAll(fd, variant, strlen(variant) + 1) != 0 ||
+	  writeAll(fd, zeroes, pad) != 0 ||
+	  writeAll(fd, pixels, dataSize(width, height, stride, bpp)) != 0;
+    if (close(fd) != 0 || bad || rename(tmp, entry) != 0) {
+	unlink(tmp);
+	return -1;
+    }
+
+    *strrchr(entry, '/') = '\0';
+    evict(entry);
+    return 0;
+}
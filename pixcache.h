@@ -0,0 +1,30 @@
+/*
+ * pixcache.h: Interface to pixcache.c, which keeps decoded images on disk
+ * so that opening the same file again doesn't need to decode it.
+ *
+ * "variant" distinguishes different decodings of the same file, for example
+ * a toolkit's own pixel format or a reduced size.
+ */
+
+#include <stdint.h>
+
+typedef struct {
+    unsigned char *pixels;	/* Mapped from the cache file */
+    int width, height, stride;	/* stride is in bytes */
+    int bpp;			/* Bytes per pixel */
+    uint32_t rmask, gmask, bmask, amask; /* Where the channels are in a pixel
+				 * read as a little- or big-endian word */
+    void *map;			/* The mapping, for pixcache_release() */
+    size_t mapLen;
+} pixcache_t;
+
+/* Returns the cached pixels, or NULL if they aren't in the cache.
+ * The pixels are copy-on-write so you can scribble on them. */
+extern pixcache_t *pixcache_get(const char *filename, const char *variant);
+extern void pixcache_release(pixcache_t *pc);
+
+/* Put some pixels in the cache. Returns 0 or -1 if it couldn't. */
+extern int pixcache_put(const char *filename, const char *variant,
+			const unsigned char *pixels, int width, int height,
+			int stride, int bpp, uint32_t rmask, uint32_t gmask,
+			uint32_t bmask, uint32_t amask);
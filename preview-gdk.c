@@ -0,0 +1,136 @@
+/*
+ * preview-gdk.c: Show the preview from a JPEG's EXIF data while the image
+ * is read in another thread, for the GTK viewers.
+ *
+ * A camera's 24-megapixel JPEG takes a second or so to decode, while the
+ * 160x120 preview in its EXIF data takes a millisecond (see exifthumb.c).
+ * The viewer shows that, scaled up to the size the image will be, and a
+ * thread reads the image as the viewer would have. When it's done, an idle
+ * callback hands it to the viewer, which shows it in place of the preview.
+ *
+ * Both are turned the way the EXIF orientation says, the preview when it
+ * is decoded and the image in the thread that reads it, in one pass with
+ * rotate.c, which GdkPixbuf's own rotate then flip would take two.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "exifthumb.h"
+#include "rotate.h"
+#include "pixcache-gdk.h"
+#include "preview-gdk.h"
+
+typedef struct {
+    char *filename;
+    gsize maxBytes;
+    GdkPixbuf *pixbuf;		/* What was read */
+    GError *error;		/* or why not */
+    void (*done)(GdkPixbuf *pixbuf, GError *error, gpointer data);
+    gpointer data;
+} preview_t;
+
+GdkPixbuf *
+orientPixbuf(GdkPixbuf *pixbuf, int orientation)
+{
+    GdkPixbuf *turned;
+    int w, h;
+
+    if (pixbuf == NULL || orientation == 1) return pixbuf;
+    w = gdk_pixbuf_get_width(pixbuf);
+    h = gdk_pixbuf_get_height(pixbuf);
+    turned = gdk_pixbuf_new(GDK_COLORSPACE_RGB,
+			    gdk_pixbuf_get_has_alpha(pixbuf), 8,
+			    ROTATE_SWAPS(orientation) ? h : w,
+			    ROTATE_SWAPS(orientation) ? w : h);
+    if (turned != NULL)
+	rotate_pixels(gdk_pixbuf_get_pixels(pixbuf), w, h,
+		      gdk_pixbuf_get_rowstride(pixbuf),
+		      gdk_pixbuf_get_pixels(turned),
+		      gdk_pixbuf_get_rowstride(turned),
+		      gdk_pixbuf_get_n_channels(pixbuf), orientation);
+    g_object_unref(pixbuf);
+    return turned;
+}
+
+GdkPixbuf *
+orientedPixbufNewFromFile(const char *filename, gsize maxBytes,
+			  GError **error)
+{
+    return orientPixbuf(cachedPixbufNewFromFile(filename, maxBytes, error),
+			exifthumb_orientation(filename));
+}
+
+/* In the main loop */
+static gboolean
+imageRead(gpointer data)
+{
+    preview_t *p = data;
+
+    p->done(p->pixbuf, p->error, p->data);
+    if (p->error != NULL) g_error_free(p->error);
+    g_free(p->filename);
+    g_free(p);
+    return FALSE;
+}
+
+/* In its own thread */
+static gpointer
+readImage(gpointer data)
+{
+    preview_t *p = data;
+
+    p->pixbuf = orientedPixbufNewFromFile(p->filename, p->maxBytes,
+					  &p->error);
+    g_idle_add(imageRead, p);
+    return NULL;
+}
+
+static void
+freePixels(guchar *pixels, gpointer data)
+{
+    free(pixels);
+}
+
+GdkPixbuf *
+previewPixbufNewFromFile(const char *filename, gsize maxBytes,
+	gint *width, gint *height,
+	void (*done)(GdkPixbuf *pixbuf, GError *error, gpointer data),
+	gpointer data)
+{
+    unsigned char *pixels;
+    int tw, th, orientation;
+    GdkPixbuf *preview;
+    preview_t *p;
+    gint w, h;
+
+    if (gdk_pixbuf_get_file_info(filename, &w, &h) == NULL ||
+	(pixels = exifthumb_load(filename, &tw, &th, &orientation)) == NULL)
+	return NULL;
+    preview = gdk_pixbuf_new_from_data(pixels, GDK_COLORSPACE_RGB, FALSE, 8,
+				       tw, th, tw * 3, freePixels, NULL);
+    if (preview == NULL) {
+	free(pixels);
+	return NULL;
+    }
+
+    /* The size cachedPixbufNewFromFile() will read it at */
+    if (maxBytes > 0 && (guint64) w * h * 4 > maxBytes) {
+	double shrink = sqrt((double) maxBytes / ((double) w * h * 4));
+
+	w = MAX(1, w * shrink);
+	h = MAX(1, h * shrink);
+    }
+    *width = orientation >= 5 ? h : w;
+    *height = orientation >= 5 ? w : h;
+
+    p = g_new0(preview_t, 1);
+    p->filename = g_strdup(filename);
+    p->maxBytes = maxBytes;
+    p->done = done;
+    p->data = data;
+    g_thread_unref(g_thread_new("decode", readImage, p));
+
+    return preview;
+}
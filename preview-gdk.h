@@ -0,0 +1,26 @@
+/*
+ * preview-gdk.h: Interface to preview-gdk.c, which gives the GTK viewers
+ * the preview from a JPEG's EXIF data to show while they read the image
+ * in another thread, and turns images the way their EXIF data says.
+ */
+
+/* Turn a pixbuf the way an EXIF orientation says (see rotate.h). Takes the
+ * reference it's given and returns one to the result, or NULL if there
+ * isn't the memory. */
+extern GdkPixbuf *orientPixbuf(GdkPixbuf *pixbuf, int orientation);
+
+/* Like cachedPixbufNewFromFile() but turned the right way up */
+extern GdkPixbuf *orientedPixbufNewFromFile(const char *filename,
+					    gsize maxBytes, GError **error);
+
+/* If the file has a preview in its EXIF data, start reading the image in
+ * another thread with orientedPixbufNewFromFile() and return the preview,
+ * the right way up, setting *width and *height to the size the image will
+ * be. When it has been read, done(pixbuf, error, data) is called from the
+ * main loop with the pixbuf, or NULL and why not. The error is freed when
+ * done() returns.
+ * If there's no preview, it returns NULL and doesn't read anything. */
+extern GdkPixbuf *previewPixbufNewFromFile(const char *filename,
+	gsize maxBytes, gint *width, gint *height,
+	void (*done)(GdkPixbuf *pixbuf, GError *error, gpointer data),
+	gpointer data);
@@ -0,0 +1,364 @@
+/*
+ * rawimg.c: Use the pixels of uncompressed image files where they are.
+ *
+ * PPM, PGM, PAM, uncompressed BMP and TGA already have their pixels laid out
+ * in the file in a way that SDL can use, so we map the file into memory
+ * and say where they are, what order the channels are in and what the
+ * pitch is. Opening a huge file only reads its header; the pixels are
+ * paged in when someone looks at them.
+ *
+ * The ones with more than 8 bits per channel (16-bit PNM and farbfeld)
+ * or with gray and alpha are converted to 8-bit RGB(A) in memory instead.
+ * PBM bitmaps stay as bits, for callers that can scale them as they are.
+ */
+
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rawimg.h"
+
+static unsigned
+le16(const unsigned char *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t
+le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint32_t
+be32(const unsigned char *p)
+{
+    return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* The mask for byte n of a pixel of bpp bytes read as a native word */
+static uint32_t
+byteMask(int n, int bpp)
+{
+    static const union { uint16_t s; unsigned char c[2]; } one = { 1 };
+
+    return 0xffU << 8 * (one.c[0] ? n : bpp - 1 - n);
+}
+
+/* Say which bytes of a pixel R, G, B and A are in. a < 0 means no alpha. */
+static void
+setOrder(rawimg_t *img, int r, int g, int b, int a)
+{
+    img->rmask = byteMask(r, img->bpp);
+    img->gmask = byteMask(g, img->bpp);
+    img->bmask = byteMask(b, img->bpp);
+    img->amask = a >= 0 ? byteMask(a, img->bpp) : 0;
+}
+
+/* Make 8-bit pixels from ones with "channels" samples of "bytes" bytes,
+ * big-endian, from 0 to maxval, rows packed. Gray+alpha becomes RGBA.
+ * Returns 0 or -1 if there isn't the memory. */
+static int
+convert(rawimg_t *img, const unsigned char *src, int channels, int bytes,
+	unsigned maxval)
+{
+    size_t n = (size_t) img->width * img->height, i;
+    unsigned char *dst, *d;
+    unsigned v[4];
+    int c;
+
+    img->bpp = (channels == 2) ? 4 : channels;
+    if (img->width > INT_MAX / img->bpp) return -1;
+    img->pitch = img->width * img->bpp;
+    if ((dst = malloc((size_t) img->pitch * img->height)) == NULL)
+	return -1;
+    for (i = 0, d = dst; i < n; i++) {
+	for (c = 0; c < channels; c++) {
+	    v[c] = (bytes == 2) ? src[0] << 8 | src[1] : src[0];
+	    if (v[c] > maxval) v[c] = maxval;
+	    v[c] = (v[c] * 255 + maxval / 2) / maxval;
+	    src += bytes;
+	}
+	if (channels == 2) {
+	    *d++ = v[0]; *d++ = v[0]; *d++ = v[0]; *d++ = v[1];
+	} else {
+	    for (c = 0; c < channels; c++) *d++ = v[c];
+	}
+    }
+    munmap(img->map, img->mapLen);
+    img->map = NULL;
+    img->pixels = dst;
+    return 0;
+}
+
+/* Read a number from a PNM header, skipping white space and comments */
+static long
+pnmNumber(const unsigned char **pp, const unsigned char *end)
+{
+    const unsigned char *p = *pp;
+    long n = 0;
+
+    for (;;) {
+	while (p < end && strchr(" \t\r\n", *p)) p++;
+	if (p < end && *p == '#') {
+	    while (p < end && *p != '\n') p++;
+	} else break;
+    }
+    if (p == end || *p < '0' || *p > '9') return -1;
+    while (p < end && *p >= '0' && *p <= '9' && n < 1000000000)
+	n = n * 10 + *p++ - '0';
+    *pp = p;
+    return n;
+}
+
+/* P5 and P6. Returns the pixels and sets the rest, or NULL. */
+static const unsigned char *
+pnmHeader(rawimg_t *img, const unsigned char *p, const unsigned char *end,
+	  int *channels, long *maxval)
+{
+    *channels = (p[1] == '5') ? 1 : 3;
+    p += 2;
+    img->width = pnmNumber(&p, end);
+    img->height = pnmNumber(&p, end);
+    *maxval = pnmNumber(&p, end);
+    /* A single white space character, then the pixels */
+    if (p == end || !strchr(" \t\r\n", *p)) return NULL;
+    return p + 1;
+}
+
+/* P7. Returns the pixels and sets the rest, or NULL. */
+static const unsigned char *
+pamHeader(rawimg_t *img, const unsigned char *p, const unsigned char *end,
+	  int *channels, long *maxval)
+{
+    char line[80];
+    int len;
+
+    img->width = img->height = *channels = *maxval = -1;
+    for (p += 3; p < end; p += len + 1) {
+	for (len = 0; p + len < end && p[len] != '\n'; len++)
+	    ;
+	if (p + len == end || len >= (int) sizeof(line)) return NULL;
+	memcpy(line, p, len);
+	line[len] = '\0';
+	if (strncmp(line, "WIDTH ", 6) == 0) img->width = atoi(line + 6);
+	else if (strncmp(line, "HEIGHT ", 7) == 0) img->height = atoi(line + 7);
+	else if (strncmp(line, "DEPTH ", 6) == 0) *channels = atoi(line + 6);
+	else if (strncmp(line, "MAXVAL ", 7) == 0) *maxval = atoi(line + 7);
+	else if (strcmp(line, "ENDHDR") == 0) return p + len + 1;
+	/* Ignore TUPLTYPE and comments: DEPTH says it all. */
+    }
+    return NULL;
+}
+
+/* P4, whose rows are whole bytes of bits */
+static int
+openPbm(rawimg_t *img, const unsigned char *p, const unsigned char *end)
+{
+    p += 2;
+    img->width = pnmNumber(&p, end);
+    img->height = pnmNumber(&p, end);
+    if (img->width <= 0 || img->height <= 0 ||
+	p == end || !strchr(" \t\r\n", *p))
+	return -1;
+    p++;
+    img->mono = 1;
+    img->pitch = (img->width + 7) / 8;
+    if ((uint64_t) img->pitch * img->height > (uint64_t) (end - p))
+	return -1;
+    img->pixels = (unsigned char *) p;
+    return 0;
+}
+
+static int
+openPnm(rawimg_t *img, const unsigned char *p, const unsigned char *end)
+{
+    const unsigned char *data;
+    int channels, bytes;
+    long maxval;
+
+    data = (p[1] == '7') ? pamHeader(img, p, end, &channels, &maxval)
+			 : pnmHeader(img, p, end, &channels, &maxval);
+    if (data == NULL || img->width <= 0 || img->height <= 0 ||
+	channels < 1 || channels > 4 || maxval < 1 || maxval > 65535 ||
+	img->width > INT_MAX / 8)
+	return -1;
+    bytes = maxval > 255 ? 2 : 1;
+    if ((uint64_t) img->width * img->height * channels * bytes >
+	(uint64_t) (end - data))
+	return -1;
+
+    img->gray = (channels == 1);
+    if (maxval != 255 || channels == 2) {
+	if (convert(img, data, channels, bytes, maxval) < 0) return -1;
+    } else {
+	img->pixels = (unsigned char *) data;
+	img->bpp = channels;
+	img->pitch = img->width * channels;
+    }
+    if (!img->gray) setOrder(img, 0, 1, 2, img->bpp == 4 ? 3 : -1);
+    return 0;
+}
+
+/* Which byte of a 32-bit little-endian pixel an 8-bit-aligned mask selects,
+ * or -1 if it doesn't. */
+static int
+maskByte(uint32_t mask)
+{
+    int n;
+
+    for (n = 0; n < 4; n++)
+	if (mask == 0xffU << 8 * n) return n;
+    return -1;
+}
+
+static int
+openBmp(rawimg_t *img, const unsigned char *p, const unsigned char *end)
+{
+    size_t size = end - p;
+    uint32_t offset, hdrSize, compression, amask;
+    int32_t height;
+    int bits, r = 2, g = 1, b = 0, a = -1;
+
+    if (size < 54) return -1;
+    offset = le32(p + 10);
+    hdrSize = le32(p + 14);
+    img->width = (int32_t) le32(p + 18);
+    height = (int32_t) le32(p + 22);
+    bits = le16(p + 28);
+    compression = le32(p + 30);
+    if (hdrSize < 40 || img->width <= 0 || img->width > INT_MAX / 4 ||
+	height == 0 || height == INT32_MIN || le16(p + 26) != 1)
+	return -1;
+
+    if (compression == 0 && (bits == 24 || bits == 32)) {
+	/* BGR or BGRX */
+    } else if (compression == 3 && bits == 32 && size >= 14 + 40 + 12) {
+	/* The masks follow the header, or are in it if it's a V4 or V5 */
+	r = maskByte(le32(p + 54));
+	g = maskByte(le32(p + 58));
+	b = maskByte(le32(p + 62));
+	if (hdrSize >= 56 && size >= 70 && (amask = le32(p + 66)) != 0 &&
+	    (a = maskByte(amask)) < 0)
+	    return -1;
+	if (r < 0 || g < 0 || b < 0) return -1;
+    } else {
+	return -1;
+    }
+
+    img->bottomUp = (height > 0);
+    img->height = height > 0 ? height : -height;
+    img->bpp = bits / 8;
+    img->pitch = ((size_t) img->width * bits + 31) / 32 * 4;
+    if (offset > size ||
+	(uint64_t) img->pitch * img->height > size - offset)
+	return -1;
+    img->pixels = (unsigned char *) p + offset;
+    setOrder(img, r, g, b, a);
+    return 0;
+}
+
+/* TGA has no magic number, so only try files called .tga */
+static int
+openTga(rawimg_t *img, const unsigned char *p, const unsigned char *end)
+{
+    size_t size = end - p, offset;
+    int type, bits;
+
+    if (size < 18) return -1;
+    type = p[2];
+    bits = p[16];
+    if (p[1] > 1 || (p[17] & 0x10) ||		/* Right-to-left */
+	!((type == 2 && (bits == 24 || bits == 32)) ||
+	  (type == 3 && bits == 8)))
+	return -1;
+    offset = 18 + p[0];
+    if (p[1]) offset += le16(p + 5) * ((p[7] + 7) / 8);
+    img->width = le16(p + 12);
+    img->height = le16(p + 14);
+    img->bpp = bits / 8;
+    img->pitch = img->width * img->bpp;
+    img->bottomUp = !(p[17] & 0x20);
+    img->gray = (type == 3);
+    if (img->width == 0 || img->height == 0 || offset > size ||
+	(uint64_t) img->pitch * img->height > size - offset)
+	return -1;
+    img->pixels = (unsigned char *) p + offset;
+    if (!img->gray)
+	setOrder(img, 2, 1, 0, (bits == 32 && (p[17] & 0x0f)) ? 3 : -1);
+    return 0;
+}
+
+static int
+openFarbfeld(rawimg_t *img, const unsigned char *p, const unsigned char *end)
+{
+    if (end - p < 16) return -1;
+    img->width = be32(p + 8);
+    img->height = be32(p + 12);
+    if (img->width <= 0 || img->height <= 0 ||
+	(uint64_t) img->width * img->height * 8 > (uint64_t) (end - p - 16))
+	return -1;
+    if (convert(img, p + 16, 4, 2, 65535) < 0) return -1;
+    setOrder(img, 0, 1, 2, 3);
+    return 0;
+}
+
+rawimg_t *
+rawimg_open(const char *filename)
+{
+    rawimg_t *img;
+    const unsigned char *p, *end;
+    const char *dot = strrchr(filename, '.');
+    struct stat st;
+    int fd, ok;
+
+    if ((fd = open(filename, O_RDONLY)) < 0) return NULL;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 16 ||
+	(img = calloc(1, sizeof(*img))) == NULL) {
+	close(fd);
+	return NULL;
+    }
+    img->mapLen = st.st_size;
+    img->map = mmap(NULL, img->mapLen, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (img->map == MAP_FAILED) {
+	free(img);
+	return NULL;
+    }
+    p = img->map;
+    end = p + img->mapLen;
+
+    if (p[0] == 'P' && p[1] == '4')
+	ok = openPbm(img, p, end);
+    else if (p[0] == 'P' && (p[1] == '5' || p[1] == '6' ||
+			(p[1] == '7' && p[2] == '\n')))
+	ok = openPnm(img, p, end);
+    else if (p[0] == 'B' && p[1] == 'M')
+	ok = openBmp(img, p, end);
+    else if (memcmp(p, "farbfeld", 8) == 0)
+	ok = openFarbfeld(img, p, end);
+    else if (dot && strcasecmp(dot, ".tga") == 0)
+	ok = openTga(img, p, end);
+    else
+	ok = -1;
+
+    if (ok < 0) {
+	rawimg_close(img);
+	return NULL;
+    }
+    return img;
+}
+
+void
+rawimg_close(rawimg_t *img)
+{
+    if (img == NULL) return;
+    if (img->map != NULL) munmap(img->map, img->mapLen);
+    else free(img->pixels);
+    free(img);
+}
@@ -0,0 +1,28 @@
+/*
+ * rawimg.h: Interface to rawimg.c, which maps uncompressed image files
+ * into memory and tells you where the pixels are, instead of reading them.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    unsigned char *pixels;	/* The first row in the file */
+    int width, height, pitch;	/* pitch is in bytes */
+    int bpp;			/* Bytes per pixel: 1, 3 or 4, or 0 if mono */
+    uint32_t rmask, gmask, bmask, amask; /* Where the channels are in a pixel
+				 * read as a native-endian word, as SDL says */
+    int gray;			/* 1-byte pixels are gray levels, 0 to 255 */
+    int mono;			/* A bitmap, leftmost pixel in the top bit,
+				 * 1 for black */
+    int bottomUp;		/* The first row is the bottom one */
+    void *map;			/* What to unmap, or NULL if we converted */
+    size_t mapLen;
+} rawimg_t;
+
+/* Open a binary PBM, PPM, PGM or PAM, an uncompressed 24- or 32-bit BMP,
+ * an uncompressed true-color or gray TGA or a farbfeld file.
+ * The pixels are the ones in the file unless they need converting to
+ * 8 bits per channel. Returns NULL if it isn't one of those. */
+extern rawimg_t *rawimg_open(const char *filename);
+extern void rawimg_close(rawimg_t *img);
@@ -0,0 +1,47 @@
+/*
+ * rotate-evas.c: Turn the pixels of an Evas image object with rotate.c.
+ *
+ * Evas scales the image itself whenever it renders, so once its pixels have
+ * been turned it goes on scaling the turned ones and nothing has to be done
+ * per frame. Its pixels are always 32-bit ARGB, whatever the file was.
+ */
+
+#include <stdlib.h>
+#include <Evas.h>
+
+#include "rotate.h"
+#include "rotate-evas.h"
+#include "trace.h"
+
+int
+evasImageTurn(Evas_Object *img, int orientation)
+{
+    int w, h, stride;
+    int dw, dh;
+    void *src;
+    unsigned char *dst;
+
+    if (orientation == 1) return 0;
+    evas_object_image_size_get(img, &w, &h);
+    stride = evas_object_image_stride_get(img);
+    dw = ROTATE_SWAPS(orientation) ? h : w;
+    dh = ROTATE_SWAPS(orientation) ? w : h;
+    if (w <= 0 || h <= 0 ||
+	(dst = malloc((size_t) dw * dh * 4)) == NULL)
+	return -1;
+    if ((src = evas_object_image_data_get(img, EINA_FALSE)) == NULL) {
+	free(dst);
+	return -1;
+    }
+    trace_begin("rotate");
+    rotate_pixels(src, w, h, stride, dst, dw * 4, 4, orientation);
+    trace_end("rotate");
+    /* Give the pixels back before changing the size, which drops them */
+    evas_object_image_data_set(img, src);
+
+    evas_object_image_size_set(img, dw, dh);
+    evas_object_image_data_copy_set(img, dst);
+    evas_object_image_data_update_add(img, 0, 0, dw, dh);
+    free(dst);
+    return 0;
+}
@@ -0,0 +1,8 @@
+/*
+ * rotate-evas.h: Interface to rotate-evas.c, which turns the pixels of an
+ * Evas image object for the EFL viewers' rotate and flip keys.
+ */
+
+/* Turn the image in "img" the way an EXIF orientation says (see rotate.h).
+ * Returns 0, or -1 if it has no pixels or there isn't the memory. */
+extern int evasImageTurn(Evas_Object *img, int orientation);
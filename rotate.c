@@ -0,0 +1,317 @@
+/*
+ * rotate.c: Turn and flip images by multiples of 90 degrees.
+ *
+ * Flips and the half turn take each source row to a destination row,
+ * forwards or backwards, so they're a row at a time. Quarter turns and the
+ * diagonal flips take each source row to a column of the destination, and
+ * doing a whole row at a time would touch a different cache line and,
+ * on a big image, a different page for every pixel, so they're done in
+ * tiles of TILE x TILE pixels, whose source and destination rows both
+ * stay in the cache while the tile is done.
+ *
+ * With SSE2, a tile of 4-byte pixels is done as 4 x 4 blocks: four source
+ * rows of four pixels are loaded into four registers, transposed in them
+ * with unpacks so each holds a column, reversed with a shuffle if the
+ * destination goes backwards, and stored as four destination rows.
+ * Other sizes of pixel are copied one at a time, but still in tiles.
+ *
+ * It's limited by memory more than by instructions, so a big image is split
+ * into bands of source rows, done on as many cores as there are, which keeps
+ * more cache misses going at once.
+ *
+ * Every orientation is a transpose or not followed by a left-to-right flip
+ * or not and a top-to-bottom one or not, so each is where a source pixel
+ * goes: a starting point and how far it moves in the destination for each
+ * step along a source row and for each step down the source.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rotate.h"
+
+/* NO_SIMD makes it use plain C everywhere, to compare them */
+#if defined(__SSE2__) && !defined(NO_SIMD)
+# define USE_SSE2
+# include <emmintrin.h>
+#endif
+
+#define TILE	64	/* Pixels square. A 4-byte tile and its result are 32K */
+#define MIN_THREAD_PIXELS (1 << 20)	/* Give each thread at least this many */
+
+int rotate_threads = 0;
+
+/* Each orientation as transpose, flip left to right, flip top to bottom */
+static const struct { char t, fx, fy; } parts[9] = {
+    { 0, 0, 0 },
+    { 0, 0, 0 }, { 0, 1, 0 }, { 0, 1, 1 }, { 0, 0, 1 },
+    { 1, 0, 0 }, { 1, 1, 0 }, { 1, 1, 1 }, { 1, 0, 1 },
+};
+
+int
+rotate_then(int first, int then)
+{
+    int t, fx, fy, o;
+
+    if (first < 1 || first > 8) first = 1;
+    if (then < 1 || then > 8) then = 1;
+    /* A transpose after the flips swaps which way they went */
+    t = parts[first].t ^ parts[then].t;
+    fx = parts[then].fx ^ (parts[then].t ? parts[first].fy : parts[first].fx);
+    fy = parts[then].fy ^ (parts[then].t ? parts[first].fx : parts[first].fy);
+    for (o = 1; o < 8; o++)
+	if (parts[o].t == t && parts[o].fx == fx && parts[o].fy == fy) break;
+    return o;
+}
+
+int
+rotate_key(int c)
+{
+    switch (c) {
+    case 'r': case 'R': return ROTATE_CLOCKWISE;
+    case 'l': case 'L': return ROTATE_ANTICLOCKWISE;
+    case 'h': case 'H': return ROTATE_FLIP_LEFT_RIGHT;
+    case 'v': case 'V': return ROTATE_FLIP_TOP_BOTTOM;
+    default: return 0;
+    }
+}
+
+static void
+copyPixel(unsigned char *d, const unsigned char *s, int bpp)
+{
+    switch (bpp) {
+    case 4: memcpy(d, s, 4); break;
+    case 3: d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; break;
+    case 2: memcpy(d, s, 2); break;
+    default: *d = *s; break;
+    }
+}
+
+/* A source row that stays a row, backwards. "d" is where its first pixel
+ * goes, at the end of the destination row. */
+static void
+reverseRow(const unsigned char *s, unsigned char *d, int w, int bpp)
+{
+    int x = 0;
+
+#ifdef USE_SSE2
+    if (bpp == 4) {
+	/* Four pixels at a time, their order reversed in the register */
+	for (; x + 4 <= w; x += 4, s += 16, d -= 16)
+	    _mm_storeu_si128((__m128i *) (d - 12), _mm_shuffle_epi32(
+			     _mm_loadu_si128((const __m128i *) s), 0x1B));
+    }
+#endif
+    for (; x < w; x++, s += bpp, d -= bpp)
+	copyPixel(d, s, bpp);
+}
+
+/* Transpose the pixels of the source from x0 to x1 and y0 to y1 one at a
+ * time: xstep is a destination row and ystep is one pixel, forwards or
+ * backwards. Each source column is done in the order that fills its
+ * destination row forwards, which the write buffers like best, and the loop
+ * is repeated for each size of pixel so its copy is a load and a store. */
+#define COPY_AREA(bpp) \
+    for (x = x0; x < x1; x++) { \
+	const unsigned char *s = src + (size_t) first * spitch + \
+				 (size_t) x * bpp; \
+	unsigned char *d = base + x * xstep + first * ystep; \
+ \
+	for (y = y0; y < y1; y++, s += sstep, d += bpp) \
+	    copyPixel(d, s, bpp); \
+    }
+
+static void
+copyArea(const unsigned char *src, int spitch, unsigned char *base,
+	 long xstep, long ystep, int bpp, int x0, int y0, int x1, int y1)
+{
+    int first = ystep > 0 ? y0 : y1 - 1;	/* The source row to start at */
+    long sstep = ystep > 0 ? spitch : -spitch;
+    int x, y;
+
+    switch (bpp) {
+    case 4: COPY_AREA(4); break;
+    case 3: COPY_AREA(3); break;
+    case 2: COPY_AREA(2); break;
+    default: COPY_AREA(1); break;
+    }
+}
+
+#ifdef USE_SSE2
+/* The same for 4-byte pixels four by four, where x0 to x1 and y0 to y1 are
+ * multiples of four. */
+static void
+transposeArea(const unsigned char *src, int spitch, unsigned char *base,
+	      long xstep, long ystep, int x0, int y0, int x1, int y1)
+{
+    int x, y;
+    /* Where the lowest-addressed pixel of a destination row of four goes */
+    long back = ystep < 0 ? -12 : 0;
+
+    for (x = x0; x < x1; x += 4) {
+	const unsigned char *s = src + (size_t) y0 * spitch + (size_t) x * 4;
+	unsigned char *d = base + x * xstep + y0 * ystep + back;
+
+	for (y = y0; y < y1; y += 4, s += 4 * spitch, d += 4 * ystep) {
+	    __m128i r0 = _mm_loadu_si128((const __m128i *) s);
+	    __m128i r1 = _mm_loadu_si128((const __m128i *) (s + spitch));
+	    __m128i r2 = _mm_loadu_si128((const __m128i *) (s + 2 * spitch));
+	    __m128i r3 = _mm_loadu_si128((const __m128i *) (s + 3 * spitch));
+	    /* a0 b0 a1 b1, c0 d0 c1 d1, a2 b2 a3 b3, c2 d2 c3 d3 */
+	    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+	    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+	    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+	    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+	    /* a0 b0 c0 d0 and so on: column i of the block in register i */
+	    r0 = _mm_unpacklo_epi64(t0, t1);
+	    r1 = _mm_unpackhi_epi64(t0, t1);
+	    r2 = _mm_unpacklo_epi64(t2, t3);
+	    r3 = _mm_unpackhi_epi64(t2, t3);
+	    if (ystep < 0) {
+		r0 = _mm_shuffle_epi32(r0, 0x1B);
+		r1 = _mm_shuffle_epi32(r1, 0x1B);
+		r2 = _mm_shuffle_epi32(r2, 0x1B);
+		r3 = _mm_shuffle_epi32(r3, 0x1B);
+	    }
+	    _mm_storeu_si128((__m128i *) d, r0);
+	    _mm_storeu_si128((__m128i *) (d + xstep), r1);
+	    _mm_storeu_si128((__m128i *) (d + 2 * xstep), r2);
+	    _mm_storeu_si128((__m128i *) (d + 3 * xstep), r3);
+	}
+    }
+}
+#endif
+
+/* What the threads share: a band of source rows each */
+typedef struct {
+    const unsigned char *src;
+    int w, h, spitch, bpp;
+    int transpose;
+    unsigned char *base;	/* Where the top left source pixel goes */
+    long xstep, ystep;		/* How far a step in x and y moves from there */
+    int nbands;
+    int next;			/* The next band to do */
+    pthread_mutex_t lock;
+} job_t;
+
+static void
+doBand(job_t *j, int y0, int y1)
+{
+    int x, y;
+
+    if (!j->transpose) {
+	for (y = y0; y < y1; y++) {
+	    const unsigned char *s = j->src + (size_t) y * j->spitch;
+	    unsigned char *d = j->base + y * j->ystep;
+
+	    if (j->xstep > 0) memcpy(d, s, (size_t) j->w * j->bpp);
+	    else reverseRow(s, d, j->w, j->bpp);
+	}
+	return;
+    }
+
+    for (y = y0; y < y1; y += TILE) {
+	int ty1 = y + TILE < y1 ? y + TILE : y1;
+
+	for (x = 0; x < j->w; x += TILE) {
+	    int tx1 = x + TILE < j->w ? x + TILE : j->w;
+#ifdef USE_SSE2
+	    if (j->bpp == 4) {
+		/* Blocks of four, then what's left down the right and along
+		 * the bottom of the tile a pixel at a time. */
+		int x4 = x + ((tx1 - x) & ~3), y4 = y + ((ty1 - y) & ~3);
+
+		transposeArea(j->src, j->spitch, j->base, j->xstep, j->ystep,
+			      x, y, x4, y4);
+		copyArea(j->src, j->spitch, j->base, j->xstep, j->ystep, 4,
+			 x4, y, tx1, y4);
+		copyArea(j->src, j->spitch, j->base, j->xstep, j->ystep, 4,
+			 x, y4, tx1, ty1);
+		continue;
+	    }
+#endif
+	    copyArea(j->src, j->spitch, j->base, j->xstep, j->ystep, j->bpp,
+		     x, y, tx1, ty1);
+	}
+    }
+}
+
+/* Take bands until there are none left. The bands are a whole number of
+ * tiles high, so two threads seldom write to the same cache line. */
+static void *
+worker(void *arg)
+{
+    job_t *j = arg;
+    int band, rows = (j->h + j->nbands - 1) / j->nbands;
+
+    rows = (rows + TILE - 1) / TILE * TILE;
+    for (;;) {
+	pthread_mutex_lock(&j->lock);
+	band = j->next++;
+	pthread_mutex_unlock(&j->lock);
+	if (band * rows >= j->h) break;
+	doBand(j, band * rows, band * rows + rows < j->h ? band * rows + rows
+							 : j->h);
+    }
+    return NULL;
+}
+
+void
+rotate_pixels(const unsigned char *src, int w, int h, int spitch,
+	      unsigned char *dst, int dpitch, int bpp, int orientation)
+{
+    int dw, dh;			/* The size of the destination */
+    job_t job;
+    pthread_t *tids = NULL;
+    int threads, started, i;
+
+    if (orientation < 1 || orientation > 8) orientation = 1;
+    dw = parts[orientation].t ? h : w;
+    dh = parts[orientation].t ? w : h;
+    job.src = src;
+    job.w = w;
+    job.h = h;
+    job.spitch = spitch;
+    job.bpp = bpp;
+    job.transpose = parts[orientation].t;
+    if (job.transpose) {
+	job.xstep = dpitch;
+	job.ystep = bpp;
+    } else {
+	job.xstep = bpp;
+	job.ystep = dpitch;
+    }
+    job.base = dst;
+    if (parts[orientation].fx) {
+	job.base += (size_t) (dw - 1) * bpp;
+	if (job.transpose) job.ystep = -job.ystep;
+	else job.xstep = -job.xstep;
+    }
+    if (parts[orientation].fy) {
+	job.base += (size_t) (dh - 1) * dpitch;
+	if (job.transpose) job.xstep = -job.xstep;
+	else job.ystep = -job.ystep;
+    }
+
+    /* Threads only pay for themselves on big images */
+    threads = rotate_threads > 0 ? rotate_threads
+				 : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > (int) ((size_t) w * h / MIN_THREAD_PIXELS))
+	threads = (size_t) w * h / MIN_THREAD_PIXELS;
+    if (threads < 1) threads = 1;
+    if (threads > 1 && (tids = malloc(threads * sizeof(*tids))) == NULL)
+	threads = 1;
+    job.nbands = threads * 4;
+    job.next = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    /* This thread does bands too */
+    for (started = 0; started < threads - 1; started++)
+	if (pthread_create(&tids[started], NULL, worker, &job) != 0) break;
+    worker(&job);
+    for (i = 0; i < started; i++)
+	pthread_join(tids[i], NULL);
+    pthread_mutex_destroy(&job.lock);
+    free(tids);
+}
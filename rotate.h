@@ -0,0 +1,36 @@
+/*
+ * rotate.h: Interface to rotate.c, which turns and flips images the ways
+ * that EXIF orientations say, for the viewers' rotate and flip keys.
+ */
+
+/* Orientations are numbered as in EXIF (see exifthumb.h), 1 being as it is.
+ * These are what the keys do to whatever way up the image is already. */
+#define ROTATE_CLOCKWISE	6	/* r */
+#define ROTATE_ANTICLOCKWISE	8	/* l */
+#define ROTATE_FLIP_LEFT_RIGHT	2	/* h */
+#define ROTATE_FLIP_TOP_BOTTOM	4	/* v */
+
+/* Which of those a key does, from the character on it, or 0 if none.
+ * Upper and lower case do the same, as the toolkits differ in which they
+ * say when shift isn't held. */
+extern int rotate_key(int c);
+
+/* How many threads to turn big images on. 0, the default, means one per core. */
+extern int rotate_threads;
+
+/* Whether an orientation makes the width the height and the height the width */
+#define ROTATE_SWAPS(orientation) ((orientation) >= 5)
+
+/*
+ * Turn the image at "src", "w" x "h" pixels with "spitch" bytes per row,
+ * the way "orientation" says, into the one at "dst" with "dpitch" bytes per
+ * row, which is "h" x "w" pixels if ROTATE_SWAPS(orientation) and "w" x "h"
+ * if not. Pixels are "bpp" bytes, 1 to 4. The two mustn't overlap.
+ */
+extern void rotate_pixels(const unsigned char *src, int w, int h, int spitch,
+			  unsigned char *dst, int dpitch, int bpp,
+			  int orientation);
+
+/* The orientation that does what orientation "first" does followed by what
+ * "then" does, so the keys can add up to one turn of the original. */
+extern int rotate_then(int first, int then);
@@ -0,0 +1,202 @@
+/*
+ * scale-agar.c: An AG_Pixmap that scales its image to fit using scale.c.
+ *
+ * AG_PIXMAP_RESCALE scales to the nearest pixel, which makes the image
+ * shimmer as the window is resized. Instead, we keep the original surface
+ * to one side and, when the pixmap is allocated a new size, we scale it once
+ * to that size with an area-averaging filter and give the result to the
+ * pixmap, which then just blits it 1:1 until the size changes again.
+ *
+ * To find out when the size changes, the pixmap gets a copy of the
+ * AG_Pixmap class with our own size_request, size_allocate and draw
+ * operations, which call the real ones.
+ *
+ * scaledPixmapTurn() turns the source image once, into a copy that the
+ * pixmap keeps as it keeps a converted one, and the frames are scaled from
+ * that until it's turned again.
+ */
+
+#include <agar/core.h>
+#include <agar/gui.h>
+
+#include "scale.h"
+#include "scale-agar.h"
+#include "rotate.h"
+#include "stamp.h"
+#include "trace.h"
+
+/* What we hang off the pixmap, as its "scaled-pixmap" pointer variable */
+typedef struct {
+    AG_Surface *original;	/* The caller's source surface */
+    AG_Surface *source;		/* The same, in a format we can scale and
+				 * turned the way it has been turned */
+    int w, h;			/* Size of the scaled copy, or 0x0 if none */
+} ScaledPixmap;
+
+static AG_WidgetClass scaledPixmapClass;
+
+static void rescale(AG_Pixmap *pixmap, int w, int h);
+
+/* Ask for enough room to show the source image 1:1, as AG_Pixmap does */
+static void
+sizeRequest(void *obj, AG_SizeReq *r)
+{
+    ScaledPixmap *sp = AG_GetPointer(obj, "scaled-pixmap");
+
+    r->w = sp->source->w;
+    r->h = sp->source->h;
+}
+
+/* Draw it as AG_Pixmap does. Only here to know when the frames are. */
+static void
+draw(void *obj)
+{
+    trace_begin("present");
+    agPixmapClass.draw(obj);
+    trace_end("present");
+    stamp("present");
+}
+
+/* When it's given a new size, make a new scaled copy. */
+static int
+sizeAllocate(void *obj, const AG_SizeAlloc *a)
+{
+    if (agPixmapClass.size_allocate != NULL &&
+	agPixmapClass.size_allocate(obj, a) == -1)
+	return -1;
+    rescale(obj, a->w, a->h);
+    return 0;
+}
+
+AG_Pixmap *
+scaledPixmapNew(void *parent, Uint flags, AG_Surface *source)
+{
+    AG_Pixmap *pixmap;
+    ScaledPixmap *sp;
+
+    if (scaledPixmapClass.size_allocate == NULL) {
+	scaledPixmapClass = agPixmapClass;
+	scaledPixmapClass.size_request = sizeRequest;
+	scaledPixmapClass.size_allocate = sizeAllocate;
+	scaledPixmapClass.draw = draw;
+    }
+
+    pixmap = AG_PixmapNew(parent, flags & ~AG_PIXMAP_RESCALE,
+			  source->w, source->h);
+    if (pixmap == NULL) return NULL;
+    if ((sp = AG_TryMalloc(sizeof(*sp))) == NULL) {
+	AG_ObjectDetach(pixmap);
+	AG_ObjectDestroy(pixmap);
+	return NULL;
+    }
+    sp->original = sp->source = NULL;
+    sp->w = sp->h = 0;
+    AG_SetPointer(pixmap, "scaled-pixmap", sp);
+    AGOBJECT(pixmap)->cls = (AG_ObjectClass *)&scaledPixmapClass;
+
+    scaledPixmapSetSource(pixmap, source);
+
+    return pixmap;
+}
+
+AG_Surface *
+scaledPixmapSetSource(AG_Pixmap *pixmap, AG_Surface *source)
+{
+    ScaledPixmap *sp = AG_GetPointer(pixmap, "scaled-pixmap");
+    AG_Surface *old = sp->original;
+
+    if (sp->source != sp->original) AG_SurfaceFree(sp->source);
+
+    /* scale_pixels() needs whole bytes per channel, so convert anything
+     * with a palette or packed into 16 bits to the standard format. */
+    sp->original = sp->source = source;
+    if (source->format->palette != NULL ||
+	source->format->BytesPerPixel < 3) {
+	AG_Surface *converted = AG_SurfaceConvert(source, agSurfaceFmt);
+	if (converted == NULL) {
+	    fprintf(stderr, "Cannot convert surface: %s.\n", AG_GetError());
+	} else {
+	    sp->source = converted;
+	}
+    }
+
+    /* Force a rescale even if the size is the same */
+    sp->w = sp->h = 0;
+    if (WIDTH(pixmap) > 0 && HEIGHT(pixmap) > 0)
+	rescale(pixmap, WIDTH(pixmap), HEIGHT(pixmap));
+    AG_Redraw(pixmap);
+
+    return old;
+}
+
+int
+scaledPixmapTurn(AG_Pixmap *pixmap, int orientation)
+{
+    ScaledPixmap *sp = AG_GetPointer(pixmap, "scaled-pixmap");
+    AG_Surface *source = sp->source;
+    AG_Surface *turned;
+    int w = ROTATE_SWAPS(orientation) ? source->h : source->w;
+    int h = ROTATE_SWAPS(orientation) ? source->w : source->h;
+
+    if (orientation == 1 || source->w == 0 || source->h == 0) return 0;
+    turned = AG_SurfaceNew(AG_SURFACE_PACKED, w, h, source->format, 0);
+    if (turned == NULL) {
+	fprintf(stderr, "Cannot make %dx%d surface: %s.\n",
+		w, h, AG_GetError());
+	return -1;
+    }
+    trace_begin("rotate");
+    rotate_pixels(source->pixels, source->w, source->h, source->pitch,
+		  turned->pixels, turned->pitch,
+		  source->format->BytesPerPixel, orientation);
+    trace_end("rotate");
+    if (sp->source != sp->original) AG_SurfaceFree(sp->source);
+    sp->source = turned;
+
+    /* Ask for the new shape and force a rescale even if it's the same */
+    sp->w = sp->h = 0;
+    AG_WidgetUpdate(pixmap);
+    if (WIDTH(pixmap) > 0 && HEIGHT(pixmap) > 0)
+	rescale(pixmap, WIDTH(pixmap), HEIGHT(pixmap));
+    AG_Redraw(pixmap);
+    return 0;
+}
+
+/* Scale the source image to w x h if we haven't already done so. */
+static void
+rescale(AG_Pixmap *pixmap, int w, int h)
+{
+    ScaledPixmap *sp = AG_GetPointer(pixmap, "scaled-pixmap");
+    AG_Surface *source = sp->source;
+    AG_Surface *scaled;
+
+    if (w <= 0 || h <= 0 || source->w == 0 || source->h == 0 ||
+	(w == sp->w && h == sp->h))
+	return;
+
+    scaled = AG_SurfaceNew(AG_SURFACE_PACKED, w, h, source->format, 0);
+    if (scaled == NULL) {
+	fprintf(stderr, "Cannot make %dx%d surface: %s.\n",
+		w, h, AG_GetError());
+	return;
+    }
+    trace_scale(source->w, source->h, w, h, "area");
+    if (scale_pixels(source->pixels, source->w, source->h, source->pitch,
+		     scaled->pixels, w, h, scaled->pitch,
+		     source->format->BytesPerPixel) == -1) {
+	trace_end("scale");
+	fprintf(stderr, "Out of memory scaling image to %dx%d.\n", w, h);
+	AG_SurfaceFree(scaled);
+	return;
+    }
+    trace_end("scale");
+    stamp("scale");
+
+    /* The pixmap owns the scaled copy and frees the previous one. */
+    if (pixmap->n < 0)
+	pixmap->n = AG_WidgetMapSurface(pixmap, scaled);
+    else
+	AG_WidgetReplaceSurface(pixmap, pixmap->n, scaled);
+    sp->w = w;
+    sp->h = h;
+}
@@ -0,0 +1,19 @@
+/*
+ * scale-agar.h: Interface to scale-agar.c, an AG_Pixmap that scales its
+ * image to fit with a better scaler than AG_PIXMAP_RESCALE.
+ */
+
+/* Make a pixmap widget displaying "source" scaled to the widget's size.
+ * "flags" are AG_Pixmap flags except for AG_PIXMAP_RESCALE, which is implied.
+ * The pixmap keeps a pointer to the source surface, which must not be freed
+ * while it is displayed. */
+extern AG_Pixmap *scaledPixmapNew(void *parent, Uint flags, AG_Surface *source);
+
+/* Change the image displayed by a scaled pixmap.
+ * Returns the previous source surface, which belongs to the caller again. */
+extern AG_Surface *scaledPixmapSetSource(AG_Pixmap *pixmap, AG_Surface *source);
+
+/* Turn the image displayed by a scaled pixmap the way an EXIF orientation
+ * says (see rotate.h). The pixmap keeps the turned copy, so the caller's
+ * source surface isn't touched. Returns 0, or -1 if there isn't the memory. */
+extern int scaledPixmapTurn(AG_Pixmap *pixmap, int orientation);
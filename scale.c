@@ -0,0 +1,995 @@
+/*
+ * scale.c: Image scaler for the toolkits that don't have a good one.
+ *
+ * When reducing, each screen pixel is the average of the area of the source
+ * image that it covers, so the image doesn't shimmer as the window is resized.
+ * When enlarging, it interpolates bilinearly between the four nearest pixels.
+ * It's the same result as GTK's GDK_INTERP_BILINEAR.
+ *
+ * Pixels are "bpp" bytes, each an 8-bit channel, and every channel is scaled
+ * separately so it doesn't matter what order R, G, B and A come in.
+ *
+ * The scaling is done in two passes, first horizontally from each source row
+ * into a temporary image, then vertically from that to the destination.
+ * The weights are calculated once per call in fixed-point.
+ *
+ * 16-bit pixels are unpacked to 8-bit channels a row at a time, scaled like
+ * 32-bit ones and packed into 16 bits again, rounded or with ordered dither.
+ *
+ * With SSE2, the 3- and 4-byte horizontal pass and all vertical passes
+ * multiply and add pairs of pixels' channels in one instruction, and 16-bit
+ * pixels are unpacked and packed eight at a time with the same rounding as
+ * the tables.
+ *
+ * Gray and palette images and bitmaps needn't be expanded to RGB to be
+ * scaled: scale_lut() and scale_bits() expand each source row through a
+ * lookup table just before it is scaled, so only one row of it ever exists,
+ * and gray scaled to gray is just scale_pixels() with one byte per pixel.
+ *
+ * The channels are sRGB-encoded, not proportional to the light, so averaging
+ * them makes fine detail and high-contrast edges darker than they should be:
+ * black and white lines come out as 128, not 188. When the caller asks for
+ * linear light, which only the viewers do for what they show, each source
+ * row is looked up in a table of 15-bit linear values, scaled as those and
+ * the results are looked up in a 4096-entry inverse table indexed by their
+ * top 12 bits, which is close enough between the dark codes' steps of 10
+ * that every code comes back as itself.
+ *
+ * scale_band() makes only some of the destination's rows, from only the
+ * source rows they need, so that a viewer can scale bands of one image on
+ * several threads at once and get the same result as in one go.
+ *
+ * scale_levels() looks each destination row up in a table per channel as
+ * it's made, while it's still in the cache, instead of going over the
+ * result again for the viewers' black point, white point and gamma (see
+ * levels.c), though on one core that comes out no faster.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "scale.h"
+
+/* NO_SIMD makes it use plain C everywhere, to compare them */
+#if defined(__SSE2__) && !defined(NO_SIMD)
+# define USE_SSE2
+# include <emmintrin.h>
+#endif
+
+#define WBITS	14		/* Fixed-point weights are fractions of WONE */
+#define WONE	(1 << WBITS)
+
+/* Linear light is 0 to LMAX, which times WONE still fits in an int and,
+ * for SSE2, in a signed 16-bit one. */
+#define LBITS	15
+#define LMAX	((1 << LBITS) - 1)
+#define LSHIFT	3		/* fromLinear[] is indexed by linear >> LSHIFT */
+
+static unsigned short toLinear[256];
+static unsigned char fromLinear[(LMAX >> LSHIFT) + 1];
+static pthread_once_t linearOnce = PTHREAD_ONCE_INIT;	/* Made them yet? */
+
+/* Which source pixels contribute to a destination pixel and how much. */
+typedef struct {
+    int first;		/* The first source pixel that contributes */
+    int n;		/* How many source pixels contribute */
+    int *weight;	/* n weights that add up to WONE */
+} contrib_t;
+
+/* Make the table of contributions for scaling "from" pixels to "to" pixels.
+ * The weights live in the same malloc()ed block, so free() frees the lot. */
+static contrib_t *
+make_contribs(int from, int to)
+{
+    contrib_t *c;
+    int *w;
+    int maxn;	/* Maximum number of source pixels per destination pixel */
+    int i;
+
+    maxn = (to < from) ? from / to + 2 : 2;
+    c = malloc(to * sizeof(*c) + (size_t)to * maxn * sizeof(int));
+    if (c == NULL) return NULL;
+    w = (int *)(c + to);
+
+    for (i = 0; i < to; i++, w += maxn) {
+	int j, sum, biggest;
+
+	c[i].weight = w;
+	if (to < from) {
+	    /* Average the source pixels covered by this destination pixel,
+	     * weighting the ones at the ends by how much of them is covered.
+	     * Each weight is the difference between where its pixel's ends
+	     * round to, so they never go negative when we make them add up
+	     * below, however many of them there are. */
+	    double start = (double) i * from / to;
+	    double end = (double) (i + 1) * from / to;
+	    double scale = (double) WONE * to / from;
+
+	    c[i].first = (int) start;
+	    c[i].n = 0;
+	    for (j = c[i].first; j < end && j < from; j++) {
+		double lo = (j < start) ? start : j;
+		double hi = (j + 1 > end) ? end : j + 1;
+
+		w[c[i].n++] = (int) ((hi - start) * scale + 0.5)
+			    - (int) ((lo - start) * scale + 0.5);
+	    }
+	} else {
+	    /* Bilinear interpolation between the two nearest source pixels */
+	    double x = (i + 0.5) * from / to - 0.5;
+
+	    if (x < 0) x = 0;
+	    j = (int) x;
+	    if (j >= from - 1) {
+		c[i].first = from - 1;
+		c[i].n = 1;
+		w[0] = WONE;
+	    } else {
+		c[i].first = j;
+		c[i].n = 2;
+		w[1] = (int) ((x - j) * WONE + 0.5);
+		w[0] = WONE - w[1];
+	    }
+	}
+
+	/* Make the weights add up to exactly WONE so that a flat area of
+	 * color stays exactly the same color. */
+	sum = 0; biggest = 0;
+	for (j = 0; j < c[i].n; j++) {
+	    sum += w[j];
+	    if (w[j] > w[biggest]) biggest = j;
+	}
+	w[biggest] += WONE - sum;
+    }
+
+    return c;
+}
+
+/* Where a scaler gets its source rows from: row y, "bpp" bytes per pixel.
+ * "buf" has room for one row if it needs to make it. */
+typedef const unsigned char *(*getrow_t)(const void *arg, int y,
+					 unsigned char *buf);
+
+/* Where it puts destination rows that aren't "bpp" bytes per pixel:
+ * "row" is row y of dw pixels of "bpp" bytes, to go at "drow". */
+typedef void (*putrow_t)(const void *arg, int y, const unsigned char *row,
+			 unsigned char *drow);
+
+/* Scale one row horizontally, from srow to the dw pixels at trow */
+static void
+hrow(const unsigned char *srow, unsigned char *trow, const contrib_t *cx,
+     int dw, int bpp)
+{
+    int x, k, b;
+
+    if (bpp == 1) {
+	/* Gray levels and palette indices: one channel, no inner loop */
+	for (x = 0; x < dw; x++) {
+	    const unsigned char *p = srow + cx[x].first;
+	    const int *w = cx[x].weight;
+	    int sum = WONE / 2;
+
+	    for (k = 0; k < cx[x].n; k++)
+		sum += p[k] * w[k];
+	    *trow++ = sum >> WBITS;
+	}
+	return;
+    }
+    for (x = 0; x < dw; x++) {
+	const unsigned char *p = srow + cx[x].first * bpp;
+	const int *w = cx[x].weight;
+
+	for (b = 0; b < bpp; b++) {
+	    int sum = WONE / 2;	/* for rounding */
+
+	    for (k = 0; k < cx[x].n; k++)
+		sum += p[k * bpp + b] * w[k];
+	    *trow++ = sum >> WBITS;
+	}
+    }
+}
+
+/* Scale columns x0 to rowlen-1 of one row vertically, from tmp to drow.
+ * "acc" has room for a row of accumulators. */
+static void
+vrow(const unsigned char *tmp, int rowlen, const contrib_t *cy,
+     unsigned char *drow, int *acc, int x0)
+{
+    int x, k;
+
+    for (x = x0; x < rowlen; x++) acc[x] = WONE / 2;
+    for (k = 0; k < cy->n; k++) {
+	const unsigned char *trow = tmp + (size_t)(cy->first + k) * rowlen;
+	int w = cy->weight[k];
+
+	for (x = x0; x < rowlen; x++)
+	    acc[x] += trow[x] * w;
+    }
+    for (x = x0; x < rowlen; x++)
+	drow[x] = acc[x] >> WBITS;
+}
+
+#ifdef USE_SSE2
+/*
+ * The same with SSE2, for 3- and 4-byte pixels. The weights fit in 16 bits,
+ * so pmaddwd can multiply the channels of two source pixels by their weights
+ * and add the pairs in one go, leaving the four channels' sums in 32 bits.
+ * The arithmetic is the same as above, so the results are identical.
+ */
+
+/* A 3- or 4-byte pixel in the bottom of a register. The fourth byte of
+ * a 3-byte one is rubbish unless it's at the end of the row, which we don't
+ * read past. */
+static __m128i
+loadPixel(const unsigned char *p, int bpp, const unsigned char *end)
+{
+    int v;
+
+    if (bpp == 4 || p + 4 <= end) memcpy(&v, p, 4);
+    else v = p[0] | p[1] << 8 | p[2] << 16;
+    return _mm_cvtsi32_si128(v);
+}
+
+static void
+hrowSSE2(const unsigned char *srow, unsigned char *trow, const contrib_t *cx,
+	 int sw, int dw, int bpp)
+{
+    const unsigned char *end = srow + sw * bpp;
+    const __m128i zero = _mm_setzero_si128();
+    int x, k, v;
+
+    for (x = 0; x < dw; x++, trow += bpp) {
+	const unsigned char *p = srow + cx[x].first * bpp;
+	const int *w = cx[x].weight;
+	int n = cx[x].n;
+	__m128i sum = _mm_set1_epi32(WONE / 2);
+
+	for (k = 0; k + 1 < n; k += 2) {
+	    __m128i a = _mm_unpacklo_epi8(loadPixel(p + k * bpp, bpp, end),
+					  zero);
+	    __m128i b = _mm_unpacklo_epi8(loadPixel(p + (k + 1) * bpp, bpp,
+						    end), zero);
+
+	    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(a, b),
+				_mm_set1_epi32(w[k + 1] << 16 |
+					       (w[k] & 0xFFFF))));
+	}
+	if (k < n) {
+	    __m128i a = _mm_unpacklo_epi8(loadPixel(p + k * bpp, bpp, end),
+					  zero);
+
+	    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero),
+						    _mm_set1_epi32(w[k])));
+	}
+	sum = _mm_srai_epi32(sum, WBITS);
+	sum = _mm_packs_epi32(sum, sum);
+	v = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+	memcpy(trow, &v, bpp);
+    }
+}
+
+/* Vertically, sixteen bytes at a time, any number of bytes per pixel */
+static void
+vrowSSE2(const unsigned char *tmp, int rowlen, const contrib_t *cy,
+	 unsigned char *drow, int *acc)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi32(WONE / 2);
+    const int *w = cy->weight;
+    int n = cy->n;
+    int x, k;
+
+    for (x = 0; x + 16 <= rowlen; x += 16) {
+	const unsigned char *t = tmp + (size_t)cy->first * rowlen + x;
+	__m128i s0 = half, s1 = half, s2 = half, s3 = half;
+
+	for (k = 0; k < n; k += 2, t += 2 * rowlen) {
+	    __m128i a = _mm_loadu_si128((const __m128i *) t);
+	    __m128i b = (k + 1 < n) ? _mm_loadu_si128((const __m128i *)
+						      (t + rowlen))
+				    : zero;
+	    __m128i ww = _mm_set1_epi32((k + 1 < n ? w[k + 1] << 16 : 0) |
+					(w[k] & 0xFFFF));
+	    __m128i lo = _mm_unpacklo_epi8(a, b);	/* a0 b0 a1 b1... */
+	    __m128i hi = _mm_unpackhi_epi8(a, b);
+
+	    s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero),
+						  ww));
+	    s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero),
+						  ww));
+	    s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero),
+						  ww));
+	    s3 = _mm_add_epi32(s3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero),
+						  ww));
+	}
+	s0 = _mm_packs_epi32(_mm_srai_epi32(s0, WBITS),
+			     _mm_srai_epi32(s1, WBITS));
+	s2 = _mm_packs_epi32(_mm_srai_epi32(s2, WBITS),
+			     _mm_srai_epi32(s3, WBITS));
+	_mm_storeu_si128((__m128i *) (drow + x), _mm_packus_epi16(s0, s2));
+    }
+    /* and the odd bytes at the end */
+    vrow(tmp, rowlen, cy, drow, acc, x);
+}
+#endif
+
+/* Scale one row of linear light horizontally, as hrow() does bytes */
+static void
+hrowLinear(const unsigned short *lrow, unsigned short *trow,
+	   const contrib_t *cx, int dw, int bpp)
+{
+    int x, k, b;
+
+    for (x = 0; x < dw; x++) {
+	const unsigned short *p = lrow + cx[x].first * bpp;
+	const int *w = cx[x].weight;
+
+	for (b = 0; b < bpp; b++) {
+	    int sum = WONE / 2;
+
+	    for (k = 0; k < cx[x].n; k++)
+		sum += p[k * bpp + b] * w[k];
+	    *trow++ = sum >> WBITS;
+	}
+    }
+}
+
+/* and vertically, from x0 on, back to sRGB bytes. rows[k] is the row that
+ * cy->weight[k] is for. */
+static void
+vrowLinear(const unsigned short **rows, int rowlen, const contrib_t *cy,
+	   unsigned char *drow, int *acc, int x0)
+{
+    int x, k;
+
+    for (x = x0; x < rowlen; x++) acc[x] = WONE / 2;
+    for (k = 0; k < cy->n; k++) {
+	const unsigned short *trow = rows[k];
+	int w = cy->weight[k];
+
+	for (x = x0; x < rowlen; x++)
+	    acc[x] += trow[x] * w;
+    }
+    for (x = x0; x < rowlen; x++)
+	drow[x] = fromLinear[acc[x] >> (WBITS + LSHIFT)];
+}
+
+#ifdef USE_SSE2
+/* The same with SSE2. Linear values are 16-bit already, so a pixel is one
+ * 64-bit load, and pmaddwd does two pixels' channels as for bytes. */
+static void
+hrowLinearSSE2(const unsigned short *lrow, unsigned short *trow,
+	       const contrib_t *cx, int dw, int bpp)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int x, k;
+
+    for (x = 0; x < dw; x++, trow += bpp) {
+	/* A 3-channel pixel's load takes in the next one's first channel,
+	 * which is why the row has a spare one on the end. */
+	const unsigned short *p = lrow + cx[x].first * bpp;
+	const int *w = cx[x].weight;
+	int n = cx[x].n;
+	__m128i sum = _mm_set1_epi32(WONE / 2);
+	unsigned short v[8];
+
+	for (k = 0; k + 1 < n; k += 2) {
+	    __m128i a = _mm_loadl_epi64((const __m128i *) (p + k * bpp));
+	    __m128i b = _mm_loadl_epi64((const __m128i *) (p + (k + 1) * bpp));
+
+	    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(a, b),
+				_mm_set1_epi32(w[k + 1] << 16 |
+					       (w[k] & 0xFFFF))));
+	}
+	if (k < n) {
+	    __m128i a = _mm_loadl_epi64((const __m128i *) (p + k * bpp));
+
+	    sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero),
+						    _mm_set1_epi32(w[k])));
+	}
+	sum = _mm_srai_epi32(sum, WBITS);
+	_mm_storeu_si128((__m128i *) v, _mm_packs_epi32(sum, sum));
+	memcpy(trow, v, bpp * sizeof(*trow));
+    }
+}
+
+/* Vertically, eight channels at a time */
+static void
+vrowLinearSSE2(const unsigned short **rows, int rowlen, const contrib_t *cy,
+	       unsigned char *drow, int *acc)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi32(WONE / 2);
+    const int *w = cy->weight;
+    int n = cy->n;
+    int x, k, i;
+
+    for (x = 0; x + 8 <= rowlen; x += 8) {
+	__m128i s0 = half, s1 = half;
+	unsigned short index[8];
+
+	for (k = 0; k < n; k += 2) {
+	    __m128i a = _mm_loadu_si128((const __m128i *) (rows[k] + x));
+	    __m128i b = (k + 1 < n) ? _mm_loadu_si128((const __m128i *)
+						      (rows[k + 1] + x))
+				    : zero;
+	    __m128i ww = _mm_set1_epi32((k + 1 < n ? w[k + 1] << 16 : 0) |
+					(w[k] & 0xFFFF));
+
+	    s0 = _mm_add_epi32(s0, _mm_madd_epi16(_mm_unpacklo_epi16(a, b),
+						  ww));
+	    s1 = _mm_add_epi32(s1, _mm_madd_epi16(_mm_unpackhi_epi16(a, b),
+						  ww));
+	}
+	_mm_storeu_si128((__m128i *) index,
+			 _mm_packs_epi32(_mm_srai_epi32(s0, WBITS + LSHIFT),
+					 _mm_srai_epi32(s1, WBITS + LSHIFT)));
+	for (i = 0; i < 8; i++)
+	    drow[x + i] = fromLinear[index[i]];
+    }
+    /* and the odd channels at the end */
+    vrowLinear(rows, rowlen, cy, drow, acc, x);
+}
+#endif
+
+/*
+ * scale_rows() in linear light. The 16-bit rows would make tmp twice the
+ * size, so instead each source row is scaled horizontally only when the
+ * destination row that needs it first comes along, into a ring of as many
+ * rows as one destination row can need, which stays in the cache.
+ */
+static int
+scale_rows_linear(getrow_t getrow, putrow_t putrow, const void *arg,
+		  int sw, int sh, int srowlen,
+		  unsigned char *dst, int dw, int dh, int dpitch, int bpp,
+		  int y0, int y1)
+{
+    contrib_t *cx = NULL, *cy = NULL;
+    unsigned short *ring = NULL;/* Source rows scaled horizontally */
+    const unsigned short **rows = NULL;	/* The ones a destination row needs */
+    unsigned short *lrow = NULL;/* One source row in linear light */
+    unsigned char *buf = NULL;	/* One source row, if getrow() makes them */
+    unsigned char *out = NULL;	/* One destination row, for putrow() */
+    int *acc = NULL;		/* Accumulators for one destination row */
+    int rowlen = dw * bpp;	/* Values in a row of the ring */
+    int ringRows = (dh < sh) ? sh / dh + 2 : 2;	/* as make_contribs() */
+    int next;			/* The next source row to scale into it */
+    int x, y, k;
+    int result = -1;
+
+    if ((cx = make_contribs(sw, dw)) == NULL ||
+	(cy = make_contribs(sh, dh)) == NULL ||
+	(ring = malloc((size_t)rowlen * ringRows * sizeof(*ring))) == NULL ||
+	(rows = malloc(ringRows * sizeof(*rows))) == NULL ||
+	(lrow = malloc(((size_t)sw * bpp + 1) * sizeof(*lrow))) == NULL ||
+	(buf = malloc(srowlen)) == NULL ||
+	(out = malloc(rowlen)) == NULL ||
+	(acc = malloc(rowlen * sizeof(*acc))) == NULL)
+	goto out;
+    lrow[sw * bpp] = 0;
+
+    for (next = cy[y0].first, y = y0; y < y1; y++) {
+	unsigned char *drow = dst + (size_t)y * dpitch;
+	unsigned char *row = putrow ? out : drow;
+
+	/* Horizontally, through toLinear[], the source rows it needs */
+	for (; next < cy[y].first + cy[y].n; next++) {
+	    const unsigned char *srow = getrow(arg, next, buf);
+	    unsigned short *trow = ring + (size_t)(next % ringRows) * rowlen;
+
+	    for (x = 0; x < sw * bpp; x++)
+		lrow[x] = toLinear[srow[x]];
+#ifdef USE_SSE2
+	    if (bpp == 3 || bpp == 4) {
+		hrowLinearSSE2(lrow, trow, cx, dw, bpp);
+		continue;
+	    }
+#endif
+	    hrowLinear(lrow, trow, cx, dw, bpp);
+	}
+
+	/* then vertically, through fromLinear[] */
+	for (k = 0; k < cy[y].n; k++)
+	    rows[k] = ring + (size_t)((cy[y].first + k) % ringRows) * rowlen;
+#ifdef USE_SSE2
+	vrowLinearSSE2(rows, rowlen, &cy[y], row, acc);
+#else
+	vrowLinear(rows, rowlen, &cy[y], row, acc, 0);
+#endif
+	if (putrow) putrow(arg, y, out, drow);
+    }
+    result = 0;
+
+out:
+    free(acc);
+    free(out);
+    free(buf);
+    free(lrow);
+    free(rows);
+    free(ring);
+    free(cy);
+    free(cx);
+    return result;
+}
+
+/* An sRGB-encoded value from 0 to 1 as linear light */
+static double
+decode(double e)
+{
+    double y, y2, r = 1.0;
+    int i;
+
+    if (e <= 0.04045) return e / 12.92;
+    /* ((e + 0.055) / 1.055) to the 2.4 is y squared times the fifth root
+     * of y squared, which Newton's method finds without needing libm. */
+    y = (e + 0.055) / 1.055;
+    y2 = y * y;
+    for (i = 0; i < 20; i++) {
+	double r4 = r * r * r * r;
+
+	r -= (r4 * r - y2) / (5 * r4);
+    }
+    return y2 * r;
+}
+
+/* Make toLinear[] and fromLinear[], once, whichever thread gets there first */
+static void
+makeLinear(void)
+{
+    int code, i;
+
+    for (code = 0; code < 256; code++)
+	toLinear[code] = (int) (decode(code / 255.0) * LMAX + 0.5);
+    /* Each step of the inverse goes to the code whose range its middle is
+     * in, going by where halfway between codes is in linear light. */
+    code = 0;
+    for (i = 0; i <= LMAX >> LSHIFT; i++) {
+	double mid = ((i << LSHIFT) + (1 << LSHIFT) / 2) / (double) LMAX;
+
+	while (code < 255 && decode((code + 0.5) / 255.0) <= mid) code++;
+	fromLinear[i] = code;
+    }
+    /* and every code comes back as itself, so a flat area of color stays
+     * exactly the same color */
+    for (code = 0; code < 256; code++)
+	fromLinear[toLinear[code] >> LSHIFT] = code;
+}
+
+/* Scale sw x sh pixels, which getrow() fetches a row at a time, to rows
+ * y0 to y1 - 1 of the dw x dh pixels at dst, through putrow() if it isn't
+ * NULL, and in linear light if "linear" is set. */
+static int
+scale_rows(getrow_t getrow, putrow_t putrow, const void *arg,
+	   int sw, int sh, int srowlen,
+	   unsigned char *dst, int dw, int dh, int dpitch, int bpp,
+	   int y0, int y1, int linear)
+{
+    contrib_t *cx = NULL, *cy = NULL;
+    unsigned char *tmp = NULL;	/* Source rows scaled horizontally */
+    unsigned char *buf = NULL;	/* One source row, if getrow() makes them */
+    unsigned char *out = NULL;	/* One destination row, for putrow() */
+    int *acc = NULL;		/* Accumulators for one destination row */
+    int rowlen = dw * bpp;	/* Bytes in a row of tmp */
+    int from, to;		/* The source rows that band needs */
+    int y;
+    int result = -1;
+
+    if (y0 >= y1) return 0;
+    if (linear) {
+	pthread_once(&linearOnce, makeLinear);
+	return scale_rows_linear(getrow, putrow, arg, sw, sh, srowlen,
+				 dst, dw, dh, dpitch, bpp, y0, y1);
+    }
+
+    if ((cx = make_contribs(sw, dw)) == NULL ||
+	(cy = make_contribs(sh, dh)) == NULL)
+	goto out;
+    from = cy[y0].first;
+    for (to = from, y = y0; y < y1; y++)
+	if (cy[y].first + cy[y].n > to) to = cy[y].first + cy[y].n;
+    /* so tmp only has those, and row "from" is its first */
+    for (y = y0; y < y1; y++) cy[y].first -= from;
+    if ((tmp = malloc((size_t)rowlen * (to - from))) == NULL ||
+	(buf = malloc(srowlen)) == NULL ||
+	(out = malloc(rowlen)) == NULL ||
+	(acc = malloc(rowlen * sizeof(*acc))) == NULL)
+	goto out;
+
+    /* Horizontal pass, from src to tmp */
+    for (y = from; y < to; y++) {
+	const unsigned char *srow = getrow(arg, y, buf);
+	unsigned char *trow = tmp + (size_t)(y - from) * rowlen;
+
+#ifdef USE_SSE2
+	if (bpp == 3 || bpp == 4) {
+	    hrowSSE2(srow, trow, cx, sw, dw, bpp);
+	    continue;
+	}
+#endif
+	hrow(srow, trow, cx, dw, bpp);
+    }
+
+    /* Vertical pass, from tmp to dst, a whole row at a time */
+    for (y = y0; y < y1; y++) {
+	unsigned char *drow = dst + (size_t)y * dpitch;
+	unsigned char *row = putrow ? out : drow;
+
+#ifdef USE_SSE2
+	vrowSSE2(tmp, rowlen, &cy[y], row, acc);
+#else
+	vrow(tmp, rowlen, &cy[y], row, acc, 0);
+#endif
+	if (putrow) putrow(arg, y, out, drow);
+    }
+    result = 0;
+
+out:
+    free(acc);
+    free(out);
+    free(buf);
+    free(tmp);
+    free(cy);
+    free(cx);
+    return result;
+}
+
+/* The order of the dither's thresholds */
+static const unsigned char bayer[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+/* Where red, green or blue is in a 16-bit pixel */
+typedef struct {
+    int shift, bits;
+    unsigned char expand[256];	/* Its values as 8-bit ones */
+    unsigned char pack[16][256];/* 8-bit values as its, for each place in
+				 * the dither matrix */
+    /* For SSE2: expand[v] is (v * 255 + max / 2) * mul >> (16 + mulShift),
+     * or mul is 0 if no 16-bit multiplier gives exactly that, and thresh[]
+     * is what pack[] adds before dividing by 255, for eight pixels of each
+     * row of the dither matrix. */
+    unsigned mul;
+    int mulShift;
+    unsigned short thresh[4][8];
+} field_t;
+
+/* The source image and how to read it */
+typedef struct {
+    const unsigned char *src;
+    int sw, spitch;
+    const unsigned char *lut;	/* For scale_lut() and scale_bits() */
+    int bpp;
+    field_t field[3];		/* For scale_pixels16() */
+    int dw;
+    const unsigned char (*levels)[256];	/* For scale_levels() */
+} source_t;
+
+/* Rows of ordinary pixels are used where they are */
+static const unsigned char *
+pixelRow(const void *arg, int y, unsigned char *buf)
+{
+    const source_t *s = arg;
+
+    return s->src + (size_t)y * s->spitch;
+}
+
+int
+scale_pixels(const unsigned char *src, int sw, int sh, int spitch,
+	     unsigned char *dst, int dw, int dh, int dpitch,
+	     int bpp)
+{
+    source_t s = { src, sw, spitch, NULL, bpp };
+
+    return scale_rows(pixelRow, NULL, &s, sw, sh, 1, dst, dw, dh, dpitch,
+		      bpp, 0, dh, 0);
+}
+
+/* Destination rows are looked up in the tables on their way out */
+static void
+levelsPut(const void *arg, int y, const unsigned char *row,
+	  unsigned char *drow)
+{
+    const source_t *s = arg;
+    const unsigned char (*lut)[256] = s->levels;
+    int x, b;
+
+    if (s->bpp == 4) {
+	for (x = 0; x < s->dw; x++, row += 4, drow += 4) {
+	    drow[0] = lut[0][row[0]];
+	    drow[1] = lut[1][row[1]];
+	    drow[2] = lut[2][row[2]];
+	    drow[3] = lut[3][row[3]];
+	}
+	return;
+    }
+    for (x = 0; x < s->dw; x++)
+	for (b = 0; b < s->bpp; b++)
+	    *drow++ = lut[b][*row++];
+}
+
+int
+scale_levels(const unsigned char *src, int sw, int sh, int spitch,
+	     unsigned char *dst, int dw, int dh, int dpitch,
+	     int bpp, const unsigned char levels[][256])
+{
+    return scale_band(src, sw, sh, spitch, dst, dw, dh, dpitch, bpp, levels,
+		      0, dh, 0);
+}
+
+int
+scale_band(const unsigned char *src, int sw, int sh, int spitch,
+	   unsigned char *dst, int dw, int dh, int dpitch,
+	   int bpp, const unsigned char levels[][256],
+	   int y0, int y1, int linear)
+{
+    source_t s = { src, sw, spitch, NULL, bpp };
+
+    s.dw = dw;
+    s.levels = levels;
+    return scale_rows(pixelRow, levels ? levelsPut : NULL, &s, sw, sh, 1,
+		      dst, dw, dh, dpitch, bpp, y0, y1, linear);
+}
+
+/* Rows of 8-bit indices are looked up in the table as they're needed */
+static const unsigned char *
+lutRow(const void *arg, int y, unsigned char *buf)
+{
+    const source_t *s = arg;
+    const unsigned char *p = s->src + (size_t)y * s->spitch;
+    unsigned char *b = buf;
+    int x, c;
+
+    switch (s->bpp) {
+    case 1:
+	for (x = 0; x < s->sw; x++)
+	    *b++ = s->lut[*p++];
+	break;
+    case 4:
+	/* A constant size lets the compiler do it as one word */
+	for (x = 0; x < s->sw; x++, b += 4)
+	    memcpy(b, s->lut + *p++ * 4, 4);
+	break;
+    default:
+	for (x = 0; x < s->sw; x++, p++)
+	    for (c = 0; c < s->bpp; c++)
+		*b++ = s->lut[*p * s->bpp + c];
+	break;
+    }
+    return buf;
+}
+
+int
+scale_lut(const unsigned char *src, int sw, int sh, int spitch,
+	  unsigned char *dst, int dw, int dh, int dpitch,
+	  const unsigned char *lut, int bpp, int linear)
+{
+    source_t s = { src, sw, spitch, lut, bpp };
+
+    return scale_rows(lutRow, NULL, &s, sw, sh, sw * bpp, dst, dw, dh, dpitch,
+		      bpp, 0, dh, linear);
+}
+
+/* Rows of bits are spread out into bytes, eight at a time, with a table of
+ * the eight levels that each byte of bits becomes */
+static const unsigned char *
+bitRow(const void *arg, int y, unsigned char *buf)
+{
+    const source_t *s = arg;
+    const unsigned char *p = s->src + (size_t)y * s->spitch;
+    unsigned char *b = buf;
+    int x;
+
+    for (x = 0; x + 8 <= s->sw; x += 8, b += 8)
+	memcpy(b, s->lut + *p++ * 8, 8);
+    if (x < s->sw)
+	memcpy(b, s->lut + *p * 8, s->sw - x);
+    return buf;
+}
+
+int
+scale_bits(const unsigned char *src, int sw, int sh, int spitch,
+	   unsigned char *dst, int dw, int dh, int dpitch,
+	   const unsigned char levels[2], int linear)
+{
+    unsigned char bytes[256 * 8];
+    source_t s = { src, sw, spitch, bytes, 1 };
+    int v, i;
+
+    for (v = 0; v < 256; v++)
+	for (i = 0; i < 8; i++)
+	    bytes[v * 8 + i] = levels[(v >> (7 - i)) & 1];
+
+    return scale_rows(bitRow, NULL, &s, sw, sh, sw, dst, dw, dh, dpitch, 1,
+		      0, dh, linear);
+}
+
+#ifdef USE_SSE2
+/* Unpack as many whole groups of eight 16-bit pixels as there are in a row,
+ * and say how many pixels that was. Each field is shifted down, masked and
+ * expanded with a multiply, then the three are interleaved as R, G, B, 0. */
+static int
+rgb16RowSSE2(const source_t *s, const unsigned char *p, unsigned char *b)
+{
+    const field_t *f = s->field;
+    __m128i c[3];
+    int x, i;
+
+    if (f[0].mul == 0 || f[1].mul == 0 || f[2].mul == 0) return 0;
+    for (x = 0; x + 8 <= s->sw; x += 8, p += 16, b += 32) {
+	__m128i v = _mm_loadu_si128((const __m128i *) p), rg;
+
+	for (i = 0; i < 3; i++) {
+	    int max = (1 << f[i].bits) - 1;
+	    __m128i n = _mm_and_si128(_mm_srl_epi16(v,
+					_mm_cvtsi32_si128(f[i].shift)),
+				      _mm_set1_epi16(max));
+
+	    n = _mm_add_epi16(_mm_mullo_epi16(n, _mm_set1_epi16(255)),
+			      _mm_set1_epi16(max / 2));
+	    c[i] = _mm_srl_epi16(_mm_mulhi_epu16(n,
+					_mm_set1_epi16((short) f[i].mul)),
+				 _mm_cvtsi32_si128(f[i].mulShift));
+	}
+	rg = _mm_or_si128(c[0], _mm_slli_epi16(c[1], 8));
+	_mm_storeu_si128((__m128i *) b, _mm_unpacklo_epi16(rg, c[2]));
+	_mm_storeu_si128((__m128i *) (b + 16), _mm_unpackhi_epi16(rg, c[2]));
+    }
+    return x;
+}
+
+/* Pack eight pixels at a time, likewise. n / 255 is n * 0x8081 >> 23 for
+ * any 16-bit n, and n is at most 255 * 255 + 254. */
+static int
+rgb16PutSSE2(const source_t *s, int y, const unsigned char *row,
+	     unsigned char *drow)
+{
+    const field_t *f = s->field;
+    const __m128i ff = _mm_set1_epi32(0xFF);
+    __m128i c[3];
+    int x, i;
+
+    for (x = 0; x + 8 <= s->dw; x += 8, row += 32, drow += 16) {
+	__m128i a = _mm_loadu_si128((const __m128i *) row);
+	__m128i b = _mm_loadu_si128((const __m128i *) (row + 16));
+	__m128i v = _mm_setzero_si128();
+
+	c[0] = _mm_packs_epi32(_mm_and_si128(a, ff), _mm_and_si128(b, ff));
+	c[1] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), ff),
+			       _mm_and_si128(_mm_srli_epi32(b, 8), ff));
+	c[2] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 16), ff),
+			       _mm_and_si128(_mm_srli_epi32(b, 16), ff));
+	for (i = 0; i < 3; i++) {
+	    __m128i n = _mm_add_epi16(
+		_mm_mullo_epi16(c[i], _mm_set1_epi16((1 << f[i].bits) - 1)),
+		_mm_loadu_si128((const __m128i *) f[i].thresh[y & 3]));
+
+	    n = _mm_srli_epi16(_mm_mulhi_epu16(n, _mm_set1_epi16((short) 0x8081)),
+			       7);
+	    v = _mm_or_si128(v, _mm_sll_epi16(n, _mm_cvtsi32_si128(f[i].shift)));
+	}
+	_mm_storeu_si128((__m128i *) drow, v);
+    }
+    return x;
+}
+#endif
+
+/* 16-bit rows are unpacked to 4-byte pixels of 8-bit R, G, B and 0, so that
+ * they go the same way as 32-bit ones */
+static const unsigned char *
+rgb16Row(const void *arg, int y, unsigned char *buf)
+{
+    const source_t *s = arg;
+    const unsigned char *p = s->src + (size_t)y * s->spitch;
+    unsigned char *b = buf;
+    unsigned short v;
+    int x = 0, c;
+
+#ifdef USE_SSE2
+    x = rgb16RowSSE2(s, p, b);
+    p += x * 2;
+    b += x * 4;
+#endif
+    for (; x < s->sw; x++, p += 2) {
+	memcpy(&v, p, 2);
+	for (c = 0; c < 3; c++) {
+	    const field_t *f = &s->field[c];
+
+	    *b++ = f->expand[(v >> f->shift) & ((1 << f->bits) - 1)];
+	}
+	*b++ = 0;
+    }
+    return buf;
+}
+
+/* and packed again afterwards, rounded to each channel's bits or dithered
+ * with a 4x4 Bayer matrix */
+static void
+rgb16Put(const void *arg, int y, const unsigned char *row,
+	 unsigned char *drow)
+{
+    const source_t *s = arg;
+    const field_t *r = &s->field[0], *g = &s->field[1], *b = &s->field[2];
+    unsigned short v;
+    int x = 0, d;
+
+#ifdef USE_SSE2
+    x = rgb16PutSSE2(s, y, row, drow);
+    row += x * 4;
+    drow += x * 2;
+#endif
+    for (; x < s->dw; x++, row += 4, drow += 2) {
+	d = bayer[y & 3][x & 3];
+	v = r->pack[d][row[0]] << r->shift | g->pack[d][row[1]] << g->shift |
+	    b->pack[d][row[2]] << b->shift;
+	memcpy(drow, &v, 2);
+    }
+}
+
+/* Say where a mask's bits are and make its tables. The dither's thresholds
+ * stop short of 0 and 255 by the most that expanding a channel rounds by,
+ * so an area of one 16-bit color stays exactly that color.
+ * Returns -1 if they aren't 1 to 8 bits in a row. */
+static int
+setField(field_t *f, unsigned mask, int dither)
+{
+    int i, d, max, margin, t[16];
+
+    if (mask == 0) return -1;
+    for (f->shift = 0; !(mask & 1); f->shift++) mask >>= 1;
+    for (f->bits = 0; mask & 1; f->bits++) mask >>= 1;
+    if (mask != 0 || f->bits > 8) return -1;
+    max = (1 << f->bits) - 1;
+    margin = (max + 1) / 2;
+    for (i = 0; i <= max; i++)
+	f->expand[i] = (i * 255 + max / 2) / max;
+    for (d = 0; d < 16; d++) {
+	t[d] = dither ? margin + d * (254 - 2 * margin) / 15
+		      : 127;	/* Half of 255, to round */
+
+	for (i = 0; i < 256; i++)
+	    f->pack[d][i] = (i * max + t[d]) / 255;
+    }
+
+    /* Find the smallest shift whose multiplier expands every value right */
+    f->mul = 0;
+    for (f->mulShift = 0; f->mulShift < 16; f->mulShift++) {
+	unsigned long m = ((1UL << (16 + f->mulShift)) + max - 1) / max;
+
+	if (m > 0xFFFF) break;
+	for (i = 0; i <= max; i++)
+	    if (((i * 255 + max / 2) * m >> (16 + f->mulShift)) != f->expand[i])
+		break;
+	if (i > max) {
+	    f->mul = m;
+	    break;
+	}
+    }
+    for (d = 0; d < 4; d++)
+	for (i = 0; i < 8; i++)
+	    f->thresh[d][i] = t[bayer[d][i & 3]];
+    return 0;
+}
+
+int
+scale_pixels16(const unsigned char *src, int sw, int sh, int spitch,
+	       unsigned char *dst, int dw, int dh, int dpitch,
+	       unsigned rmask, unsigned gmask, unsigned bmask, int dither,
+	       int linear)
+{
+    source_t s;
+
+    s.src = src;
+    s.sw = sw;
+    s.spitch = spitch;
+    s.dw = dw;
+    if (setField(&s.field[0], rmask, dither) < 0 ||
+	setField(&s.field[1], gmask, dither) < 0 ||
+	setField(&s.field[2], bmask, dither) < 0)
+	return -1;
+
+    return scale_rows(rgb16Row, rgb16Put, &s, sw, sh, sw * 4,
+		      dst, dw, dh, dpitch, 4, 0, dh, linear);
+}
@@ -0,0 +1,71 @@
+/*
+ * scale.h: Interface to scale.c, the image scaler used by those toolkits
+ * that don't have a good one of their own.
+ */
+
+/*
+ * Scale the image at "src", "sw" x "sh" pixels with "spitch" bytes per row,
+ * into the one at "dst", "dw" x "dh" pixels with "dpitch" bytes per row.
+ * Each pixel is "bpp" bytes of 8-bit channels.
+ *
+ * Returns 0 on success or -1 if it ran out of memory.
+ */
+extern int scale_pixels(const unsigned char *src, int sw, int sh, int spitch,
+			unsigned char *dst, int dw, int dh, int dpitch,
+			int bpp);
+
+/*
+ * The same, with byte b of each destination pixel looked up in levels[b]
+ * as its row is made, for brightness and contrast controls (see levels.h),
+ * or just scale_pixels() if "levels" is NULL.
+ */
+extern int scale_levels(const unsigned char *src, int sw, int sh, int spitch,
+			unsigned char *dst, int dw, int dh, int dpitch,
+			int bpp, const unsigned char levels[][256]);
+
+/*
+ * The same as scale_levels(), but only making destination rows y0 to y1 - 1,
+ * which are still at their places below "dst", so that bands of one image
+ * can be scaled on different threads at once. If "linear" is set, it's
+ * scaled in linear light, which keeps the brightness of fine detail, like
+ * black and white lines, which average to the same light as gray 188, not
+ * 128. That is for what the viewers show; thumbnails and the like are
+ * scaled in the sRGB values themselves, as everything else here does.
+ */
+extern int scale_band(const unsigned char *src, int sw, int sh, int spitch,
+		      unsigned char *dst, int dw, int dh, int dpitch,
+		      int bpp, const unsigned char levels[][256],
+		      int y0, int y1, int linear);
+
+/*
+ * The same for 16-bit native-endian pixels whose red, green and blue are in
+ * the bits of rmask, gmask and bmask, like 0xF800, 0x07E0 and 0x001F for
+ * 565. The channels are scaled as 8-bit ones and rounded to their bits again
+ * or, if "dither" is set, dithered to them with a 4x4 ordered dither, in
+ * linear light if "linear" is set (see scale_band()).
+ * Returns -1 if a mask isn't 1 to 8 bits in a row, too.
+ */
+extern int scale_pixels16(const unsigned char *src, int sw, int sh, int spitch,
+			  unsigned char *dst, int dw, int dh, int dpitch,
+			  unsigned rmask, unsigned gmask, unsigned bmask,
+			  int dither, int linear);
+
+/*
+ * The same for an image of 8-bit values, each of which becomes the "bpp"
+ * bytes at lut[value * bpp] in the destination. With a palette as the
+ * table, that scales a palette image to RGB. With one channel of the
+ * palette and bpp 1, it makes one plane of a planar RGB image.
+ * It's in linear light if "linear" is set (see scale_band()).
+ */
+extern int scale_lut(const unsigned char *src, int sw, int sh, int spitch,
+		     unsigned char *dst, int dw, int dh, int dpitch,
+		     const unsigned char *lut, int bpp, int linear);
+
+/*
+ * The same for a bitmap, most significant bit first, into 8-bit gray levels:
+ * 0 bits count as levels[0] and 1 bits as levels[1], in linear light if
+ * "linear" is set.
+ */
+extern int scale_bits(const unsigned char *src, int sw, int sh, int spitch,
+		      unsigned char *dst, int dw, int dh, int dpitch,
+		      const unsigned char levels[2], int linear);
@@ -0,0 +1,209 @@
+/*
+ * sheet-gtk2.c: A contact sheet: the images in a directory as a grid of
+ * thumbnails, for image2-gtk2.
+ *
+ * It's a drawing area and a scrollbar in an hbox. The scrollbar's adjustment
+ * is in pixels from the top of the whole sheet and the expose handler only
+ * draws the rows that are on the screen, asking thumbs.c for just those
+ * thumbnails, so a directory of ten thousand images costs no more to scroll
+ * through than one of ten. A thumbnail that isn't ready yet is drawn as an
+ * empty frame and, because it was asked for, is made before the rest.
+ *
+ * thumbs.c says when one is ready from one of its threads, so that just
+ * queues an idle callback to redraw the sheet from GTK's, and only if there
+ * isn't one queued already, so that a burst of them from the cache is drawn
+ * once, not once each.
+ */
+
+#include <gtk/gtk.h>
+
+#include "thumbs.h"
+#include "sheet-gtk2.h"
+
+typedef struct {
+    thumbs_t *thumbs;
+    int n;			/* How many images there are */
+    GtkWidget *area;
+    GtkAdjustment *adj;
+    GdkPixbuf **pixbufs;	/* Wrapped round the thumbnails once ready */
+    void (*open)(const char *path);
+    gint redrawQueued;		/* Is there a redraw() idle callback pending? */
+} sheet_t;
+
+/* How many cells fit across the area */
+static int
+columns(sheet_t *s)
+{
+    return MAX(1, s->area->allocation.width / SHEET_CELL);
+}
+
+/* In GTK's thread */
+static gboolean
+redraw(gpointer data)
+{
+    sheet_t *s = data;
+
+    g_atomic_int_set(&s->redrawQueued, 0);
+    gtk_widget_queue_draw(s->area);
+    return FALSE;
+}
+
+/* In one of thumbs.c's */
+static void
+ready(void *arg, int i)
+{
+    sheet_t *s = arg;
+
+    if (g_atomic_int_compare_and_exchange(&s->redrawQueued, 0, 1))
+	g_idle_add(redraw, s);
+}
+
+/* Make the scrollbar fit the number of rows at the area's new size */
+static void
+areaResized(GtkWidget *widget, GtkAllocation *allocation, gpointer data)
+{
+    sheet_t *s = data;
+    int rows = (s->n + columns(s) - 1) / columns(s);
+
+    s->adj->lower = 0;
+    s->adj->upper = rows * SHEET_CELL;
+    s->adj->page_size = allocation->height;
+    s->adj->step_increment = SHEET_CELL / 2;
+    s->adj->page_increment = MAX(SHEET_CELL, allocation->height - SHEET_CELL);
+    gtk_adjustment_changed(s->adj);
+    /* Keep the bottom row at the bottom when the sheet grows */
+    if (s->adj->value > s->adj->upper - s->adj->page_size)
+	gtk_adjustment_set_value(s->adj,
+				 MAX(0, s->adj->upper - s->adj->page_size));
+}
+
+static void
+scrolled(GtkAdjustment *adj, gpointer data)
+{
+    sheet_t *s = data;
+
+    gtk_widget_queue_draw(s->area);
+}
+
+static gboolean
+wheel(GtkWidget *widget, GdkEventScroll *event, gpointer data)
+{
+    sheet_t *s = data;
+    double value = s->adj->value;
+
+    if (event->direction == GDK_SCROLL_UP) value -= s->adj->step_increment;
+    else if (event->direction == GDK_SCROLL_DOWN)
+	value += s->adj->step_increment;
+    else return FALSE;
+    gtk_adjustment_set_value(s->adj,
+	CLAMP(value, s->adj->lower, s->adj->upper - s->adj->page_size));
+    return TRUE;
+}
+
+static gboolean
+exposeSheet(GtkWidget *widget, GdkEventExpose *event, gpointer data)
+{
+    sheet_t *s = data;
+    int n = s->n, cols = columns(s);
+    int top = (int) s->adj->value;
+    int row, col;
+    /* Only the rows in the part that needs drawing */
+    int firstRow = (top + event->area.y) / SHEET_CELL;
+    int lastRow = (top + event->area.y + event->area.height - 1) / SHEET_CELL;
+
+    for (row = firstRow; row <= lastRow; row++) {
+	for (col = 0; col < cols; col++) {
+	    int i = row * cols + col;
+	    int x = col * SHEET_CELL, y = row * SHEET_CELL - top;
+	    const thumb_t *thumb;
+
+	    if (i >= n) return FALSE;
+	    if (s->pixbufs[i] == NULL && (thumb = thumbs_get(s->thumbs, i))) {
+		/* The pixels stay put till thumbs_close() */
+		s->pixbufs[i] = gdk_pixbuf_new_from_data(thumb->pixels,
+				    GDK_COLORSPACE_RGB, TRUE, 8,
+				    thumb->width, thumb->height,
+				    thumb->width * 4, NULL, NULL);
+	    }
+	    if (s->pixbufs[i] != NULL) {
+		int w = gdk_pixbuf_get_width(s->pixbufs[i]);
+		int h = gdk_pixbuf_get_height(s->pixbufs[i]);
+
+		gdk_draw_pixbuf(widget->window, NULL, s->pixbufs[i], 0, 0,
+				x + (SHEET_CELL - w) / 2,
+				y + (SHEET_CELL - h) / 2, w, h,
+				GDK_RGB_DITHER_NONE, 0, 0);
+	    } else if (!thumbs_failed(s->thumbs, i)) {
+		gdk_draw_rectangle(widget->window,
+				   widget->style->mid_gc[GTK_STATE_NORMAL],
+				   FALSE, x + 4, y + 4,
+				   THUMBS_SIZE - 1, THUMBS_SIZE - 1);
+	    }
+	}
+    }
+    return FALSE;
+}
+
+static gboolean
+buttonPressed(GtkWidget *widget, GdkEventButton *event, gpointer data)
+{
+    sheet_t *s = data;
+    int col = (int) event->x / SHEET_CELL;
+    int i = ((int) (event->y + s->adj->value) / SHEET_CELL) * columns(s) + col;
+
+    if (event->type != GDK_2BUTTON_PRESS || event->button != 1 ||
+	col >= columns(s) || i >= s->n)
+	return FALSE;
+    s->open(thumbs_path(s->thumbs, i));
+    return TRUE;
+}
+
+static void
+destroySheet(GtkWidget *widget, gpointer data)
+{
+    sheet_t *s = data;
+    int i;
+
+    /* No more ready() calls after this, but there may be a redraw() */
+    thumbs_close(s->thumbs);
+    g_idle_remove_by_data(s);
+    for (i = 0; i < s->n; i++)
+	if (s->pixbufs[i] != NULL) g_object_unref(s->pixbufs[i]);
+    g_free(s->pixbufs);
+    g_free(s);
+}
+
+GtkWidget *
+sheetNew(const char *dir, void (*open)(const char *path))
+{
+    sheet_t *s = g_new0(sheet_t, 1);
+    GtkWidget *hbox;
+
+    /* ready() can be called before thumbs_open() returns, but redraw()
+     * can't be until we're back in the main loop. */
+    if ((s->thumbs = thumbs_open(dir, ready, s)) == NULL) {
+	g_free(s);
+	return NULL;
+    }
+    s->open = open;
+    s->n = thumbs_count(s->thumbs);
+    s->area = gtk_drawing_area_new();
+    s->pixbufs = g_new0(GdkPixbuf *, s->n);
+    s->adj = GTK_ADJUSTMENT(gtk_adjustment_new(0, 0, 1, 1, 1, 1));
+
+    gtk_widget_add_events(s->area, GDK_BUTTON_PRESS_MASK | GDK_SCROLL_MASK);
+    g_signal_connect(s->area, "expose-event", G_CALLBACK(exposeSheet), s);
+    g_signal_connect(s->area, "size-allocate", G_CALLBACK(areaResized), s);
+    g_signal_connect(s->area, "button-press-event",
+		     G_CALLBACK(buttonPressed), s);
+    g_signal_connect(s->area, "scroll-event", G_CALLBACK(wheel), s);
+    g_signal_connect(s->adj, "value-changed", G_CALLBACK(scrolled), s);
+
+    hbox = gtk_hbox_new(FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(hbox), s->area, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(hbox), gtk_vscrollbar_new(s->adj),
+		       FALSE, FALSE, 0);
+    g_signal_connect(hbox, "destroy", G_CALLBACK(destroySheet), s);
+
+    return hbox;
+}
@@ -0,0 +1,11 @@
+/*
+ * sheet-gtk2.h: Interface to sheet-gtk2.c, a GTK2 widget that shows the
+ * images in a directory as a scrolling grid of thumbnails.
+ */
+
+/* A widget showing the thumbnails of the images in dir, or NULL if it can't
+ * be read. Double-clicking one calls open(path) with its file name. */
+extern GtkWidget *sheetNew(const char *dir, void (*open)(const char *path));
+
+/* The size of a cell in the grid, to size a window to a number of them */
+#define SHEET_CELL (THUMBS_SIZE + 8)
@@ -0,0 +1,40 @@
+/*
+ * stamp.h: Timestamps of a viewer's progress from exec to its first frame.
+ *
+ * If the environment variable IMAGE_STAMPS is set, stamp("decode") prints
+ *	stamp decode <microseconds since the epoch>
+ * on stderr the first time it is called with that name, and does nothing
+ * the following times. bench-firstpixel uses these to split the time to
+ * the first correct frame into toolkit init, decode, first scale and first
+ * present. Without IMAGE_STAMPS it does nothing.
+ *
+ * It's all in this header so that the C++ viewers can use it too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define MAXSTAMPS 8	/* How many different names we remember */
+
+static void
+stamp(const char *what)
+{
+    static int enabled = -1;
+    static const char *done[MAXSTAMPS];
+    static int ndone = 0;
+    struct timeval tv;
+    int i;
+
+    if (enabled < 0) enabled = (getenv("IMAGE_STAMPS") != NULL);
+    if (!enabled) return;
+
+    for (i = 0; i < ndone; i++)
+	if (strcmp(done[i], what) == 0) return;
+    if (ndone < MAXSTAMPS) done[ndone++] = what;
+
+    gettimeofday(&tv, NULL);
+    fprintf(stderr, "stamp %s %ld%06ld\n",
+	    what, (long) tv.tv_sec, (long) tv.tv_usec);
+}
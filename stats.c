@@ -0,0 +1,246 @@
+/*
+ * stats.c: Counters and scaling-time histogram for the viewers, reported
+ * on stderr at SIGUSR1 or to whoever connects to a Unix socket.
+ *
+ * The signal handler just writes a byte down a pipe, and the listening
+ * socket and the pipe are both in an epoll set whose file descriptor the
+ * viewer watches in its main loop, so all the work is done there.
+ *
+ * The histogram is like an HDR histogram: 16 buckets for each power of two,
+ * so the percentiles are accurate to within about 6% from a microsecond to
+ * days, in a few hundred counters.
+ *
+ * The counters are bumped from the decoding and scaling threads too, so
+ * they are only ever changed with atomic adds, and the peak and maximum
+ * with compare-and-swap. Relaxed ordering is enough: nothing else is
+ * published through them and a report can be a count or two behind.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stats.h"
+
+#define SUBBITS	4			/* 16 buckets per power of two */
+#define SUBBUCKETS (1 << SUBBITS)
+#define NBUCKETS ((64 - SUBBITS + 1) * SUBBUCKETS)
+
+static const char *names[NSTATS] = {
+    "resizes", "resizes_coalesced", "scales", "pixel_bytes",
+    "cache_hits", "cache_misses", "pixel_bytes_live", "pixel_bytes_peak",
+    "prefetch_hits", "prefetch_misses", "prefetch_cancels"
+};
+
+static const char *prog = "";
+static long counters[NSTATS];
+static long histogram[NBUCKETS];	/* of scaling times in microseconds */
+static long long maxLatency;
+
+static int epfd = -1;			/* What the main loop watches */
+static int sigpipe[2] = { -1, -1 };	/* The signal handler writes to [1] */
+static int listener = -1;		/* The Unix socket, if any */
+
+long long
+stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Raise *max to v if it's less */
+static void
+raiseLong(long *max, long v)
+{
+    long old = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+    while (v > old &&
+	   !__atomic_compare_exchange_n(max, &old, v, 1, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+	;
+}
+
+void
+stats_add(int counter, long n)
+{
+    long now = __atomic_add_fetch(&counters[counter], n, __ATOMIC_RELAXED);
+
+    if (counter == STAT_LIVE_BYTES) raiseLong(&counters[STAT_PEAK_BYTES], now);
+}
+
+/* Which bucket does a value go in? Values below SUBBUCKETS have one each,
+ * then each power of two is divided into SUBBUCKETS. */
+static int
+bucket(unsigned long long v)
+{
+    int e = 0;
+
+    while ((v >> e) >= 2 * SUBBUCKETS) e++;
+    return (v < SUBBUCKETS) ? (int) v
+			    : (e + 1) * SUBBUCKETS + (int) (v >> e) - SUBBUCKETS;
+}
+
+/* The largest value that goes in bucket b */
+static unsigned long long
+bucketMax(int b)
+{
+    int e;
+
+    if (b < 2 * SUBBUCKETS) return b;
+    e = b / SUBBUCKETS - 1;
+    return ((unsigned long long) (b % SUBBUCKETS + SUBBUCKETS + 1) << e) - 1;
+}
+
+void
+stats_scaled(long long start, long bytes)
+{
+    long long usecs = stats_now() - start;
+    long long old = __atomic_load_n(&maxLatency, __ATOMIC_RELAXED);
+
+    if (usecs < 0) usecs = 0;
+    __atomic_fetch_add(&counters[STAT_SCALES], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counters[STAT_PIXEL_BYTES], bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram[bucket(usecs)], 1, __ATOMIC_RELAXED);
+    while (usecs > old &&
+	   !__atomic_compare_exchange_n(&maxLatency, &old, usecs, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+/* The value below which "percent" percent of the scaling times fall */
+static unsigned long long
+percentile(double percent)
+{
+    long total = 0, sum = 0;
+    long counts[NBUCKETS];
+    int b;
+
+    for (b = 0; b < NBUCKETS; b++)
+	total += counts[b] = __atomic_load_n(&histogram[b], __ATOMIC_RELAXED);
+    if (total == 0) return 0;
+    for (b = 0; b < NBUCKETS; b++) {
+	sum += counts[b];
+	if (sum >= total * percent / 100) break;
+    }
+    return bucketMax(b);
+}
+
+/* Write the report to file descriptor fd */
+static void
+report(int fd)
+{
+    char buf[1024];
+    int len, i;
+
+    len = snprintf(buf, sizeof(buf), "%s stats:\n", prog);
+    for (i = 0; i < NSTATS; i++)
+	len += snprintf(buf + len, sizeof(buf) - len, "%s %ld\n",
+			names[i], __atomic_load_n(&counters[i],
+						  __ATOMIC_RELAXED));
+    len += snprintf(buf + len, sizeof(buf) - len,
+		    "scale_us p50 %llu p99 %llu max %lld\n",
+		    percentile(50), percentile(99),
+		    __atomic_load_n(&maxLatency, __ATOMIC_RELAXED));
+
+    /* Don't let a client that doesn't read hang the viewer */
+    if (send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 &&
+	errno == ENOTSOCK)
+	if (write(fd, buf, len) < 0) { /* Nowhere to complain to */ }
+}
+
+static void
+sigusr1(int sig)
+{
+    int saved = errno;
+
+    if (write(sigpipe[1], "", 1) < 0) { /* Pipe full: one's pending */ }
+    errno = saved;
+}
+
+static void
+watch(int fd)
+{
+    struct epoll_event ev;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void
+stats_init(const char *progname)
+{
+    char *path = getenv("IMAGE_STATS_SOCKET");
+
+    prog = progname;
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+	pipe(sigpipe) < 0) {
+	perror("Cannot set up stats");
+	return;
+    }
+    watch(sigpipe[0]);
+    fcntl(sigpipe[1], F_SETFL, fcntl(sigpipe[1], F_GETFL) | O_NONBLOCK);
+    signal(SIGUSR1, sigusr1);
+
+    if (path != NULL && *path != '\0') {
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	unlink(path);
+	if ((listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+	    bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	    listen(listener, 4) < 0) {
+	    perror(path);
+	    if (listener >= 0) close(listener);
+	    listener = -1;
+	} else {
+	    watch(listener);
+	}
+    }
+}
+
+int
+stats_fd(void)
+{
+    return epfd;
+}
+
+/* Called from the main loop when stats_fd() is readable */
+void
+stats_service(void)
+{
+    struct epoll_event ev[2];
+    int n, i;
+
+    n = epoll_wait(epfd, ev, 2, 0);
+    for (i = 0; i < n; i++) {
+	if (ev[i].data.fd == sigpipe[0]) {
+	    char buf[64];
+
+	    while (read(sigpipe[0], buf, sizeof(buf)) > 0)
+		;
+	    report(2);
+	} else if (ev[i].data.fd == listener) {
+	    int client;
+
+	    while ((client = accept(listener, NULL, NULL)) >= 0) {
+		report(client);
+		close(client);
+	    }
+	}
+    }
+}
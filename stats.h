@@ -0,0 +1,41 @@
+/*
+ * stats.h: Interface to stats.c, which keeps counters and a histogram of
+ * scaling times in the viewers and reports them while they are running.
+ *
+ * Send the process SIGUSR1 to have them printed on stderr or, if
+ * IMAGE_STATS_SOCKET is set to a filename, connect to that Unix socket
+ * to read them, e.g. with "socat - UNIX-CONNECT:filename".
+ *
+ * The reporting is done in the toolkit's main loop: after stats_init(), the
+ * viewer watches stats_fd() with its toolkit's file descriptor watcher and
+ * calls stats_service() when it becomes readable.
+ */
+
+/* The counters */
+enum {
+    STAT_RESIZES,	/* Resize events received */
+    STAT_COALESCED,	/* Resize events skipped because a newer one was queued */
+    STAT_SCALES,	/* Scalings performed */
+    STAT_PIXEL_BYTES,	/* Bytes allocated for pixel buffers */
+    STAT_CACHE_HITS,	/* Times an already-scaled image could be reused */
+    STAT_CACHE_MISSES,	/* Times it had to be scaled again */
+    STAT_LIVE_BYTES,	/* Bytes in pixel buffers that exist now */
+    STAT_PEAK_BYTES,	/* The most there have been, kept by stats_add() */
+    STAT_PREFETCH_HITS,	/* Images that were already decoded when shown */
+    STAT_PREFETCH_MISSES, /* and ones that weren't */
+    STAT_PREFETCH_CANCELS, /* Decodes dropped because they moved away */
+    NSTATS
+};
+
+extern void stats_init(const char *progname);
+extern int stats_fd(void);
+extern void stats_service(void);
+
+extern void stats_add(int counter, long n);
+
+/* Microseconds since some time in the past */
+extern long long stats_now(void);
+
+/* Record a scaling that started at time "start" (from stats_now()),
+ * which produced a new pixel buffer of "bytes" bytes. */
+extern void stats_scaled(long long start, long bytes);
@@ -0,0 +1,741 @@
+/*
+ * thumbs.c: Make thumbnails of a directory of images on a pool of threads.
+ *
+ * The thumbnails are kept as the freedesktop.org Thumbnail Managing Standard
+ * says, so that we use the ones that file managers have made and they use
+ * ours: a PNG of at most 128x128 pixels in $XDG_CACHE_HOME/thumbnails/normal
+ * (or ~/.cache/thumbnails/normal) named after the MD5 of the image's URI,
+ * with the URI and the image's mtime in its Thumb::URI and Thumb::MTime,
+ * which must match for it to be used. Images we can't read get an empty
+ * one in thumbnails/fail/image-thumbs so that we don't try again.
+ *
+ * JPEGs are decoded at 1/2, 1/4 or 1/8 size if that's still bigger than a
+ * thumbnail (see loadjpeg.c), uncompressed files are scaled from where they
+ * are mapped (see rawimg.c) and PNGs are read with libpng.
+ *
+ * Each thread has a deque of images to do. It takes work from the front of
+ * its own and, when that's empty, steals from the back of the others'.
+ * All the images start off at the backs. When the viewer asks for one that
+ * isn't ready, because it's on the screen, it goes on the front of a deque,
+ * so that the ones on the screen are made first, most recently asked for
+ * first, and asking never waits for anything to be made.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <png.h>
+#include <glib.h>
+
+#include "thumbs.h"
+#include "loadjpeg.h"
+#include "rawimg.h"
+#include "scale.h"
+
+int thumbs_threads = 0;
+
+/* What's happening to an image */
+enum { QUEUED, URGENT, MAKING, DONE, FAILED };
+
+typedef struct {
+    char *path;
+    int state;			/* Read and written atomically */
+    thumb_t thumb;
+} item_t;
+
+/* A thread's work, a ring of item numbers */
+typedef struct {
+    pthread_mutex_t lock;
+    int *ring;
+    int size, head, count;	/* head is the front */
+} deque_t;
+
+struct thumbs {
+    item_t *items;
+    int nitems;
+    void (*ready)(void *arg, int i);
+    void *arg;
+    char dir[PATH_MAX];		/* The thumbnail cache */
+    int nthreads;		/* How many are running */
+    pthread_t *threads;
+    deque_t *deques;		/* One per thread */
+    int ndeques;
+    pthread_mutex_t sleepLock;	/* Guards queued and closing, which the
+				 * workers also check without it */
+    pthread_cond_t wake;
+    int queued;			/* Item numbers in all the deques */
+    int closing;
+    int nextDeque;		/* Where the next urgent one goes */
+};
+
+/* The file's URI, escaped as g_filename_to_uri() does, so that our names
+ * for thumbnails are the same as GNOME's. */
+static void
+fileUri(const char *path, char *uri)
+{
+    static const char safe[] = "-_.!~*'()/:@&=+$,";
+
+    strcpy(uri, "file://");
+    uri += strlen(uri);
+    for (; *path; path++) {
+	unsigned char c = *path;
+
+	if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+	    (c >= '0' && c <= '9') || strchr(safe, c)) {
+	    *uri++ = c;
+	} else {
+	    sprintf(uri, "%%%02X", c);
+	    uri += 3;
+	}
+    }
+    *uri = '\0';
+}
+
+/*
+ * PNG files
+ */
+
+/* Files that aren't PNGs are no surprise, so say nothing about them */
+static void
+pngError(png_structp png, png_const_charp message)
+{
+    png_longjmp(png, 1);
+}
+
+static void
+pngWarning(png_structp png, png_const_charp message)
+{
+}
+
+/* Read a PNG as RGBA and, if uri and mtime aren't NULL, its Thumb::URI and
+ * Thumb::MTime into them, with room for PATH_MAX * 3 + 8 and 32 bytes.
+ * Returns a malloc()ed buffer of *w x *h pixels or NULL. */
+static unsigned char *
+readPng(const char *path, int *w, int *h, char *uri, char *mtime)
+{
+    FILE *fp;
+    png_structp png;
+    png_infop info;
+    unsigned char *volatile pixels = NULL;
+    png_bytep *volatile rows = NULL;
+    png_textp text;
+    int ntext, y, i;
+
+    if ((fp = fopen(path, "rb")) == NULL) return NULL;
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL,
+				 pngError, pngWarning);
+    info = png ? png_create_info_struct(png) : NULL;
+    if (info == NULL || setjmp(png_jmpbuf(png))) {
+	png_destroy_read_struct(&png, &info, NULL);
+	free(pixels);
+	free(rows);
+	fclose(fp);
+	return NULL;
+    }
+    png_init_io(png, fp);
+    png_read_info(png, info);
+    /* Whatever it is, make it 8-bit RGBA */
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_gray_to_rgb(png);
+    png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
+    png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+    *w = png_get_image_width(png, info);
+    *h = png_get_image_height(png, info);
+    if ((pixels = malloc((size_t) *w * 4 * *h)) == NULL ||
+	(rows = malloc(*h * sizeof(*rows))) == NULL)
+	png_error(png, "Out of memory");
+    for (y = 0; y < *h; y++) rows[y] = pixels + (size_t) y * *w * 4;
+    png_read_image(png, rows);
+    png_read_end(png, info);
+
+    if (uri) *uri = '\0';
+    if (mtime) *mtime = '\0';
+    if (png_get_text(png, info, &text, &ntext) > 0) {
+	for (i = 0; i < ntext; i++) {
+	    if (uri && strcmp(text[i].key, "Thumb::URI") == 0)
+		snprintf(uri, PATH_MAX * 3 + 8, "%s", text[i].text);
+	    if (mtime && strcmp(text[i].key, "Thumb::MTime") == 0)
+		snprintf(mtime, 32, "%s", text[i].text);
+	}
+    }
+    png_destroy_read_struct(&png, &info, NULL);
+    free(rows);
+    fclose(fp);
+    return pixels;
+}
+
+/* Write a thumbnail with the keys the spec asks for, to a temporary file
+ * that is renamed into place so that nobody sees half of one. */
+static void
+writePng(const char *path, const unsigned char *pixels, int w, int h,
+	 const char *uri, const struct stat *st, int iw, int ih)
+{
+    char temp[PATH_MAX + 72], mtime[32], size[32], width[16], height[16];
+    png_structp png;
+    png_infop info;
+    png_text text[6];
+    FILE *volatile fp = NULL;
+    int fd, y, ntext = 0;
+
+    if (snprintf(temp, sizeof(temp), "%s.XXXXXX", path) >= (int) sizeof(temp))
+	return;
+    /* mkstemp() makes it readable by us alone, as the spec says */
+    if ((fd = mkstemp(temp)) < 0) return;
+    if ((fp = fdopen(fd, "wb")) == NULL) {
+	close(fd);
+	unlink(temp);
+	return;
+    }
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    info = png ? png_create_info_struct(png) : NULL;
+    if (info == NULL || setjmp(png_jmpbuf(png))) {
+	png_destroy_write_struct(&png, &info);
+	fclose(fp);
+	unlink(temp);
+	return;
+    }
+    png_init_io(png, fp);
+    png_set_IHDR(png, info, w, h, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+		 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+		 PNG_FILTER_TYPE_DEFAULT);
+
+    sprintf(mtime, "%lld", (long long) st->st_mtime);
+    sprintf(size, "%lld", (long long) st->st_size);
+    sprintf(width, "%d", iw);
+    sprintf(height, "%d", ih);
+#define TEXT(k, v) \
+    (text[ntext].compression = PNG_TEXT_COMPRESSION_NONE, \
+     text[ntext].key = (char *) (k), text[ntext].text = (char *) (v), ntext++)
+    TEXT("Thumb::URI", uri);
+    TEXT("Thumb::MTime", mtime);
+    TEXT("Thumb::Size", size);
+    if (iw > 0) {
+	TEXT("Thumb::Image::Width", width);
+	TEXT("Thumb::Image::Height", height);
+    }
+    TEXT("Software", "image-thumbs");
+#undef TEXT
+    png_set_text(png, info, text, ntext);
+    png_write_info(png, info);
+    for (y = 0; y < h; y++)
+	png_write_row(png, (png_bytep) pixels + (size_t) y * w * 4);
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+    if (fclose(fp) != 0 || rename(temp, path) < 0) unlink(temp);
+}
+
+/*
+ * Making thumbnails
+ */
+
+/* The size to make a thumbnail of a w x h image: no more than THUMBS_SIZE
+ * either way, keeping its shape, and no bigger than it is. */
+static void
+thumbSize(int w, int h, int *tw, int *th)
+{
+    if (w <= THUMBS_SIZE && h <= THUMBS_SIZE) {
+	*tw = w;
+	*th = h;
+    } else if (w >= h) {
+	*tw = THUMBS_SIZE;
+	*th = ((long) h * THUMBS_SIZE + w / 2) / w;
+    } else {
+	*th = THUMBS_SIZE;
+	*tw = ((long) w * THUMBS_SIZE + h / 2) / h;
+    }
+    if (*tw < 1) *tw = 1;
+    if (*th < 1) *th = 1;
+}
+
+/* Which byte of a native-endian pixel of n bytes a channel's mask is in */
+static int
+maskByte(uint32_t mask, int n)
+{
+    static const union { uint16_t s; unsigned char c[2]; } one = { 1 };
+    int shift = 0;
+
+    while (shift < 24 && !(mask >> shift & 1)) shift += 8;
+    return one.c[0] ? shift / 8 : n - 1 - shift / 8;
+}
+
+/* Scale w x h pixels of bpp bytes, with R, G and B in bytes r, g and b of
+ * each and A in byte a or none if a is negative, to a thumbnail.
+ * Returns a malloc()ed RGBA buffer or NULL. */
+static unsigned char *
+scaleThumb(const unsigned char *src, int w, int h, int pitch, int bpp,
+	   int r, int g, int b, int a, int tw, int th)
+{
+    unsigned char *scaled, *rgba;
+    int i;
+
+    scaled = malloc((size_t) tw * bpp * th);
+    rgba = malloc((size_t) tw * 4 * th);
+    if (scaled == NULL || rgba == NULL ||
+	scale_pixels(src, w, h, pitch, scaled, tw, th, tw * bpp, bpp) < 0) {
+	free(scaled);
+	free(rgba);
+	return NULL;
+    }
+    for (i = 0; i < tw * th; i++) {
+	const unsigned char *s = scaled + i * bpp;
+
+	rgba[i * 4] = s[r];
+	rgba[i * 4 + 1] = s[g];
+	rgba[i * 4 + 2] = s[b];
+	rgba[i * 4 + 3] = a >= 0 ? s[a] : 255;
+    }
+    free(scaled);
+    return rgba;
+}
+
+/* Turn a thumbnail upside down */
+static void
+flipRows(unsigned char *pixels, int w, int h)
+{
+    unsigned char row[THUMBS_SIZE * 4];
+    int y;
+
+    for (y = 0; y < h / 2; y++) {
+	unsigned char *top = pixels + (size_t) y * w * 4;
+	unsigned char *bottom = pixels + (size_t) (h - 1 - y) * w * 4;
+
+	memcpy(row, top, w * 4);
+	memcpy(top, bottom, w * 4);
+	memcpy(bottom, row, w * 4);
+    }
+}
+
+/* Make a thumbnail of an image file. Sets *iw and *ih to the image's size.
+ * Returns a malloc()ed RGBA buffer of *tw x *th pixels or NULL. */
+static unsigned char *
+makeThumb(const char *path, int *iw, int *ih, int *tw, int *th)
+{
+    unsigned char *pixels, *thumb;
+    rawimg_t *raw;
+    int w, h, d;
+
+    /* A JPEG at the smallest size that is still bigger than a thumbnail */
+    if (loadjpeg_size(path, iw, ih) == 0) {
+	thumbSize(*iw, *ih, tw, th);
+	/* Our threads are all the cores, so each decodes on its own */
+	pixels = loadjpeg_with_threads(path, *tw, *th, &w, &h, &d, 1);
+	if (pixels == NULL) return NULL;
+	thumb = scaleThumb(pixels, w, h, w * 3, 3, 0, 1, 2, -1, *tw, *th);
+	free(pixels);
+	return thumb;
+    }
+
+    if ((raw = rawimg_open(path)) != NULL) {
+	*iw = raw->width;
+	*ih = raw->height;
+	thumbSize(*iw, *ih, tw, th);
+	if (raw->mono) {
+	    /* Bits to gray levels to gray RGBA */
+	    static const unsigned char levels[2] = { 255, 0 };
+	    unsigned char *gray = malloc((size_t) *tw * *th);
+
+	    thumb = NULL;
+	    if (gray && scale_bits(raw->pixels, raw->width, raw->height,
+				   raw->pitch, gray, *tw, *th, *tw,
+				   levels, 0) == 0)
+		thumb = scaleThumb(gray, *tw, *th, *tw, 1, 0, 0, 0, -1,
+				   *tw, *th);
+	    free(gray);
+	} else if (raw->gray) {
+	    thumb = scaleThumb(raw->pixels, raw->width, raw->height,
+			       raw->pitch, 1, 0, 0, 0, -1, *tw, *th);
+	} else {
+	    thumb = scaleThumb(raw->pixels, raw->width, raw->height,
+			       raw->pitch, raw->bpp,
+			       maskByte(raw->rmask, raw->bpp),
+			       maskByte(raw->gmask, raw->bpp),
+			       maskByte(raw->bmask, raw->bpp),
+			       raw->amask ? maskByte(raw->amask, raw->bpp) : -1,
+			       *tw, *th);
+	}
+	if (thumb && raw->bottomUp) flipRows(thumb, *tw, *th);
+	rawimg_close(raw);
+	return thumb;
+    }
+
+    if ((pixels = readPng(path, iw, ih, NULL, NULL)) != NULL) {
+	thumbSize(*iw, *ih, tw, th);
+	thumb = scaleThumb(pixels, *iw, *ih, *iw * 4, 4, 0, 1, 2, 3, *tw, *th);
+	free(pixels);
+	return thumb;
+    }
+    return NULL;
+}
+
+/* Get a thumbnail from the cache or make one and put it there */
+static void
+doItem(thumbs_t *t, item_t *it)
+{
+    char uri[PATH_MAX * 3 + 8], thumbUri[PATH_MAX * 3 + 8];
+    char *md5, name[PATH_MAX + 64], mtime[32], thumbMtime[32];
+    unsigned char *pixels = NULL;
+    struct stat st;
+    int w, h, iw = 0, ih = 0;
+
+    if (stat(it->path, &st) == 0) {
+	fileUri(it->path, uri);
+	md5 = g_compute_checksum_for_string(G_CHECKSUM_MD5, uri, -1);
+	sprintf(mtime, "%lld", (long long) st.st_mtime);
+
+	/* Made already, by us or a file manager? */
+	snprintf(name, sizeof(name), "%s/normal/%s.png", t->dir, md5);
+	pixels = readPng(name, &w, &h, thumbUri, thumbMtime);
+	if (pixels != NULL && (strcmp(thumbUri, uri) != 0 ||
+			       strcmp(thumbMtime, mtime) != 0 ||
+			       w > THUMBS_SIZE || h > THUMBS_SIZE)) {
+	    free(pixels);
+	    pixels = NULL;
+	}
+
+	if (pixels == NULL) {
+	    /* Did we fail to make one already? */
+	    char failName[PATH_MAX + 64];
+	    unsigned char *failed;
+
+	    snprintf(failName, sizeof(failName), "%s/fail/image-thumbs/%s.png",
+		     t->dir, md5);
+	    failed = readPng(failName, &w, &h, thumbUri, thumbMtime);
+	    free(failed);
+	    if (failed == NULL || strcmp(thumbUri, uri) != 0 ||
+		strcmp(thumbMtime, mtime) != 0) {
+		pixels = makeThumb(it->path, &iw, &ih, &w, &h);
+		if (pixels != NULL) {
+		    writePng(name, pixels, w, h, uri, &st, iw, ih);
+		} else {
+		    static const unsigned char empty[4] = { 0, 0, 0, 0 };
+
+		    writePng(failName, empty, 1, 1, uri, &st, 0, 0);
+		}
+	    }
+	}
+	g_free(md5);
+    }
+
+    if (pixels != NULL) {
+	it->thumb.pixels = pixels;
+	it->thumb.width = w;
+	it->thumb.height = h;
+	/* The thumbnail is there before anyone sees that it's done */
+	__atomic_store_n(&it->state, DONE, __ATOMIC_RELEASE);
+    } else {
+	__atomic_store_n(&it->state, FAILED, __ATOMIC_RELEASE);
+    }
+    if (t->ready) t->ready(t->arg, it - t->items);
+}
+
+/*
+ * The threads
+ */
+
+/* Put an item number on the front or the back of a deque.
+ * Returns -1 if there's no room for it. */
+static int
+push(thumbs_t *t, int d, int i, int front)
+{
+    deque_t *q = &t->deques[d];
+    int stored = 0;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count < q->size) {
+	if (front) {
+	    q->head = (q->head + q->size - 1) % q->size;
+	    q->ring[q->head] = i;
+	} else {
+	    q->ring[(q->head + q->count) % q->size] = i;
+	}
+	q->count++;
+	stored = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    if (!stored) return -1;
+
+    pthread_mutex_lock(&t->sleepLock);
+    t->queued++;
+    pthread_cond_signal(&t->wake);
+    pthread_mutex_unlock(&t->sleepLock);
+    return 0;
+}
+
+/* Take an item number from the front or the back of a deque, or -1 */
+static int
+pop(thumbs_t *t, int d, int front)
+{
+    deque_t *q = &t->deques[d];
+    int i = -1;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->count > 0) {
+	if (front) {
+	    i = q->ring[q->head];
+	    q->head = (q->head + 1) % q->size;
+	} else {
+	    i = q->ring[(q->head + q->count - 1) % q->size];
+	}
+	q->count--;
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    if (i >= 0) {
+	pthread_mutex_lock(&t->sleepLock);
+	t->queued--;
+	pthread_mutex_unlock(&t->sleepLock);
+    }
+    return i;
+}
+
+typedef struct {
+    thumbs_t *t;
+    int self;
+} worker_t;
+
+static void *
+worker(void *arg)
+{
+    thumbs_t *t = ((worker_t *) arg)->t;
+    int self = ((worker_t *) arg)->self;
+
+    free(arg);
+    for (;;) {
+	int i, d;
+
+	/* Once they're closing, finish what's being made and no more */
+	if (__atomic_load_n(&t->closing, __ATOMIC_ACQUIRE)) return NULL;
+	i = pop(t, self, 1);
+
+	/* Nothing of our own to do? Take some of someone else's. */
+	for (d = 1; i < 0 && d < t->ndeques; d++)
+	    i = pop(t, (self + d) % t->ndeques, 0);
+
+	if (i >= 0) {
+	    item_t *it = &t->items[i];
+	    int state = __atomic_load_n(&it->state, __ATOMIC_ACQUIRE);
+
+	    /* An urgent one is in two deques; the second time, it's done */
+	    if ((state == QUEUED || state == URGENT) &&
+		__atomic_compare_exchange_n(&it->state, &state, MAKING, 0,
+					    __ATOMIC_ACQ_REL,
+					    __ATOMIC_ACQUIRE))
+		doItem(t, it);
+	    continue;
+	}
+
+	pthread_mutex_lock(&t->sleepLock);
+	while (t->queued == 0 && !t->closing)
+	    pthread_cond_wait(&t->wake, &t->sleepLock);
+	if (t->closing) {
+	    pthread_mutex_unlock(&t->sleepLock);
+	    return NULL;
+	}
+	pthread_mutex_unlock(&t->sleepLock);
+    }
+}
+
+/*
+ * The interface
+ */
+
+static int
+isImage(const char *name)
+{
+    static const char *exts[] = {
+	"jpg", "jpeg", "png", "ppm", "pgm", "pbm", "pam", "pnm",
+	"bmp", "tga", "ff", NULL
+    };
+    const char *dot = strrchr(name, '.');
+    int i;
+
+    if (dot == NULL || name[0] == '.') return 0;
+    for (i = 0; exts[i]; i++)
+	if (strcasecmp(dot + 1, exts[i]) == 0) return 1;
+    return 0;
+}
+
+static int
+byPath(const void *a, const void *b)
+{
+    return strcmp(((const item_t *) a)->path, ((const item_t *) b)->path);
+}
+
+/* Make the cache directories, as the spec says, only for us */
+static int
+makeDirs(char *dir)
+{
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char sub[PATH_MAX];
+
+    if (xdg && *xdg) {
+	snprintf(dir, PATH_MAX, "%s", xdg);
+    } else if (home && *home) {
+	snprintf(dir, PATH_MAX, "%s/.cache", home);
+    } else {
+	return -1;
+    }
+    mkdir(dir, 0700);
+    strncat(dir, "/thumbnails", PATH_MAX - strlen(dir) - 1);
+    mkdir(dir, 0700);
+    snprintf(sub, sizeof(sub), "%s/normal", dir);
+    mkdir(sub, 0700);
+    snprintf(sub, sizeof(sub), "%s/fail", dir);
+    mkdir(sub, 0700);
+    snprintf(sub, sizeof(sub), "%s/fail/image-thumbs", dir);
+    mkdir(sub, 0700);
+    return 0;
+}
+
+thumbs_t *
+thumbs_open(const char *dir, void (*ready)(void *arg, int i), void *arg)
+{
+    thumbs_t *t;
+    DIR *dp;
+    struct dirent *de;
+    char full[PATH_MAX];
+    int i, maxitems = 0;
+
+    if (realpath(dir, full) == NULL || (dp = opendir(full)) == NULL)
+	return NULL;
+    if ((t = calloc(1, sizeof(*t))) == NULL) {
+	closedir(dp);
+	return NULL;
+    }
+    while ((de = readdir(dp)) != NULL) {
+	if (!isImage(de->d_name)) continue;
+	if (t->nitems == maxitems) {
+	    int n = maxitems ? maxitems * 2 : 256;
+	    item_t *items = realloc(t->items, n * sizeof(*items));
+
+	    if (items == NULL) break;
+	    t->items = items;
+	    maxitems = n;
+	}
+	memset(&t->items[t->nitems], 0, sizeof(item_t));
+	t->items[t->nitems].path = malloc(strlen(full) + strlen(de->d_name) + 2);
+	if (t->items[t->nitems].path == NULL) break;
+	sprintf(t->items[t->nitems].path, "%s/%s", full, de->d_name);
+	t->nitems++;
+    }
+    closedir(dp);
+    qsort(t->items, t->nitems, sizeof(item_t), byPath);
+
+    t->ready = ready;
+    t->arg = arg;
+    if (makeDirs(t->dir) < 0) snprintf(t->dir, sizeof(t->dir), "/nonexistent");
+
+    t->ndeques = thumbs_threads > 0 ? thumbs_threads
+				     : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (t->ndeques < 1) t->ndeques = 1;
+    t->threads = calloc(t->ndeques, sizeof(pthread_t));
+    t->deques = calloc(t->ndeques, sizeof(deque_t));
+    pthread_mutex_init(&t->sleepLock, NULL);
+    pthread_cond_init(&t->wake, NULL);
+    for (i = 0; t->deques && i < t->ndeques; i++) {
+	pthread_mutex_init(&t->deques[i].lock, NULL);
+	/* Room for each item twice: once queued and once urgent */
+	t->deques[i].size = 2 * t->nitems + 1;
+	t->deques[i].ring = malloc(t->deques[i].size * sizeof(int));
+	if (t->deques[i].ring == NULL) t->deques[i].size = 0;
+    }
+    if (t->threads == NULL || t->deques == NULL) {
+	thumbs_close(t);
+	return NULL;
+    }
+
+    /* Deal them out in runs, so each thread starts on the next ones down */
+    for (i = 0; i < t->nitems; i++)
+	if (push(t, (long) i * t->ndeques / t->nitems, i, 0) < 0)
+	    t->items[i].state = FAILED;	/* Its deque has no ring */
+
+    for (i = 0; i < t->ndeques; i++) {
+	worker_t *w = malloc(sizeof(*w));
+
+	if (w == NULL) break;
+	w->t = t;
+	w->self = i;
+	if (pthread_create(&t->threads[i], NULL, worker, w) != 0) {
+	    free(w);
+	    break;
+	}
+    }
+    t->nthreads = i;
+    if (t->nthreads == 0) {
+	thumbs_close(t);
+	return NULL;
+    }
+    return t;
+}
+
+int
+thumbs_count(thumbs_t *t)
+{
+    return t->nitems;
+}
+
+const char *
+thumbs_path(thumbs_t *t, int i)
+{
+    return t->items[i].path;
+}
+
+const thumb_t *
+thumbs_get(thumbs_t *t, int i)
+{
+    item_t *it = &t->items[i];
+    int state = __atomic_load_n(&it->state, __ATOMIC_ACQUIRE);
+
+    if (state == DONE) return &it->thumb;
+    /* Put it at the front of the queue, once */
+    if (state == QUEUED &&
+	__atomic_compare_exchange_n(&it->state, &state, URGENT, 0,
+				    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+	/* If there's no room, it's still queued where it was */
+	if (push(t, t->nextDeque, i, 1) < 0)
+	    __atomic_store_n(&it->state, QUEUED, __ATOMIC_RELEASE);
+	t->nextDeque = (t->nextDeque + 1) % t->ndeques;
+    }
+    return NULL;
+}
+
+int
+thumbs_failed(thumbs_t *t, int i)
+{
+    return __atomic_load_n(&t->items[i].state, __ATOMIC_ACQUIRE) == FAILED;
+}
+
+void
+thumbs_close(thumbs_t *t)
+{
+    int i;
+
+    pthread_mutex_lock(&t->sleepLock);
+    __atomic_store_n(&t->closing, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&t->wake);
+    pthread_mutex_unlock(&t->sleepLock);
+    for (i = 0; i < t->nthreads; i++)
+	pthread_join(t->threads[i], NULL);
+
+    for (i = 0; t->deques && i < t->ndeques; i++)
+	free(t->deques[i].ring);
+    for (i = 0; i < t->nitems; i++) {
+	free(t->items[i].path);
+	free((void *) t->items[i].thumb.pixels);
+    }
+    free(t->items);
+    free(t->deques);
+    free(t->threads);
+    free(t);
+}
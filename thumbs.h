@@ -0,0 +1,36 @@
+/*
+ * thumbs.h: Interface to thumbs.c, which makes thumbnails of the images in
+ * a directory on a pool of threads, keeping them in the freedesktop.org
+ * thumbnail cache.
+ */
+
+typedef struct thumbs thumbs_t;
+
+typedef struct {
+    const unsigned char *pixels;	/* R, G, B and A bytes, no gaps */
+    int width, height;		/* No more than THUMBS_SIZE */
+} thumb_t;
+
+#define THUMBS_SIZE 128		/* The spec's "normal" size */
+
+/* How many threads to make them on. 0, the default, means one per core. */
+extern int thumbs_threads;
+
+/* Start making thumbnails of the images in a directory, in name order.
+ * ready(arg, i) is called from one of the threads when the i'th is ready
+ * or has failed. Returns NULL if the directory can't be read. */
+extern thumbs_t *thumbs_open(const char *dir,
+			     void (*ready)(void *arg, int i), void *arg);
+
+extern int thumbs_count(thumbs_t *t);
+extern const char *thumbs_path(thumbs_t *t, int i);
+
+/* The i'th thumbnail, or NULL if it isn't ready, in which case it's made
+ * next unless something has been asked for since. It never waits. */
+extern const thumb_t *thumbs_get(thumbs_t *t, int i);
+
+/* Couldn't we make the i'th one? */
+extern int thumbs_failed(thumbs_t *t, int i);
+
+/* Stop the threads and free everything */
+extern void thumbs_close(thumbs_t *t);
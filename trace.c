@@ -0,0 +1,142 @@
+/*
+ * trace.c: Record the decode, scale and present times in the viewers and
+ * write them as a Chrome trace_event JSON file at exit.
+ *
+ * Each thread gets its own ring buffer of events so that recording an
+ * event doesn't need a lock: only that thread writes to it. The rings are
+ * chained into a list with an atomic compare-and-swap when a thread records
+ * its first event, and at exit we write out all the rings. If a ring fills
+ * up, its oldest events are overwritten.
+ *
+ * Threads still recording events at exit may lose their last few.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define RINGSIZE 65536	/* Events per thread */
+
+typedef struct {
+    const char *name;
+    char phase;			/* 'B' for begin or 'E' for end */
+    long long ts;		/* Microseconds */
+    int sw, sh, dw, dh;		/* For scalings, or 0 */
+    const char *filter;		/* For scalings, or NULL */
+} event_t;
+
+typedef struct ring {
+    struct ring *next;		/* Chain of all threads' rings */
+    int tid;
+    unsigned long n;		/* How many events have been recorded */
+    event_t events[RINGSIZE];
+} ring_t;
+
+int trace_on = 0;
+
+static const char *filename;	/* Where to write the trace */
+static ring_t *rings = NULL;	/* All threads' rings */
+static __thread ring_t *myRing = NULL;
+
+static void trace_write(void);
+
+/* See if tracing is wanted before main() runs. */
+static void __attribute__((constructor))
+trace_init(void)
+{
+    if ((filename = getenv("IMAGE_TRACE")) != NULL && *filename != '\0') {
+	trace_on = 1;
+	atexit(trace_write);
+    }
+}
+
+/* Get the next event slot in this thread's ring, making it if necessary */
+static event_t *
+nextEvent(void)
+{
+    struct timespec now;
+    event_t *e;
+
+    if (myRing == NULL) {
+	if ((myRing = calloc(1, sizeof(*myRing))) == NULL) return NULL;
+	myRing->tid = syscall(SYS_gettid);
+	do
+	    myRing->next = rings;
+	while (!__sync_bool_compare_and_swap(&rings, myRing->next, myRing));
+    }
+
+    e = &myRing->events[myRing->n % RINGSIZE];
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    e->ts = now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+    e->sw = e->sh = e->dw = e->dh = 0;
+    e->filter = NULL;
+
+    return e;
+}
+
+void
+trace_event(char phase, const char *name)
+{
+    event_t *e = nextEvent();
+
+    if (e == NULL) return;
+    e->name = name;
+    e->phase = phase;
+    myRing->n++;
+}
+
+void
+trace_scale_event(int sw, int sh, int dw, int dh, const char *filter)
+{
+    event_t *e = nextEvent();
+
+    if (e == NULL) return;
+    e->name = "scale";
+    e->phase = 'B';
+    e->sw = sw; e->sh = sh;
+    e->dw = dw; e->dh = dh;
+    e->filter = filter;
+    myRing->n++;
+}
+
+/* Write all the events in Chrome's trace_event JSON format */
+static void
+trace_write(void)
+{
+    FILE *fp;
+    ring_t *r;
+    int pid = getpid();
+    int first = 1;
+
+    trace_on = 0;
+    if ((fp = fopen(filename, "w")) == NULL) {
+	perror(filename);
+	return;
+    }
+
+    fputs("{\"traceEvents\":[\n", fp);
+    for (r = rings; r != NULL; r = r->next) {
+	unsigned long n = r->n;
+	unsigned long i = (n > RINGSIZE) ? n - RINGSIZE : 0;
+
+	for (; i < n; i++) {
+	    event_t *e = &r->events[i % RINGSIZE];
+
+	    fprintf(fp, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld,"
+			"\"pid\":%d,\"tid\":%d",
+		    first ? "" : ",\n", e->name, e->phase, e->ts, pid, r->tid);
+	    if (e->filter != NULL)
+		fprintf(fp, ",\"args\":{\"src\":\"%dx%d\",\"dst\":\"%dx%d\","
+			    "\"filter\":\"%s\"}",
+			e->sw, e->sh, e->dw, e->dh, e->filter);
+	    fputc('}', fp);
+	    first = 0;
+	}
+    }
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", fp);
+    fclose(fp);
+}
@@ -0,0 +1,24 @@
+/*
+ * trace.h: Interface to trace.c, which records where the time goes in the
+ * viewers and writes it as a Chrome trace that chrome://tracing can show.
+ *
+ * Set IMAGE_TRACE=file.json in the environment to turn it on.
+ * When it's off, each of these costs a test of trace_on.
+ *
+ * The names must be string constants because only the pointer is kept.
+ */
+
+extern int trace_on;	/* Set at startup if IMAGE_TRACE is set */
+
+/* Start and end of something, like "decode" or "present" */
+#define trace_begin(name) do { if (trace_on) trace_event('B', name); } while (0)
+#define trace_end(name)	  do { if (trace_on) trace_event('E', name); } while (0)
+
+/* Start of a scaling from sw x sh to dw x dh with the named filter.
+ * End it with trace_end("scale"). */
+#define trace_scale(sw, sh, dw, dh, filter) \
+    do { if (trace_on) trace_scale_event(sw, sh, dw, dh, filter); } while (0)
+
+extern void trace_event(char phase, const char *name);
+extern void trace_scale_event(int sw, int sh, int dw, int dh,
+			      const char *filter);